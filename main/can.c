@@ -16,6 +16,7 @@
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 #include "esp_system.h"
 #include "esp_err.h"
@@ -29,13 +30,20 @@
 
 #include "ts_client.h"
 #include "ts_cbor.h"
+#include "web_events.h"
+#include "emoncms.h"
 #include "cJSON.h"
 static const char *TAG = "can";
 
-bool update_bms_received = false;
-bool update_mppt_received = false;
+// number of publication messages received per device
+static uint32_t bms_pub_count;
+static uint32_t mppt_pub_count;
 
 xQueueHandle receive_queue;
+
+/* only one ISO-TP request at a time, as the link and receive queue are shared */
+static SemaphoreHandle_t isotp_lock;
+#define ISOTP_LOCK_TIMEOUT_MS 1000
 #define RECV_QUEUE_SIZE 1
 #define ISOTP_BUFSIZE 1000
 
@@ -48,9 +56,23 @@ static uint8_t isotp_send_buf[ISOTP_BUFSIZE];
 
 uint32_t can_addr_client = 0xF1;     // this device
 
+static CanStats can_stats;
+
 // buffer for JSON string generated from received data objects via CAN
 static char json_buf[500];
 
+// separate buffer for live event stream, only used in CAN receive task
+static char events_json_buf[500];
+
+// minimum interval between two snapshots of the same device sent to the event stream
+#define EVENTS_SNAPSHOT_INTERVAL_MS 1000
+
+#define RX_TASK_PRIO 9
+
+/* set while the receive task is running, cleared by the task before it exits */
+static volatile TaskHandle_t rx_task;
+static volatile bool rx_stop;
+
 static const twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS();
 static const twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
 static const twai_general_config_t g_config =
@@ -183,6 +205,98 @@ static int generate_json_string(char *buf, size_t len, DataObject *objs, size_t
     return pos;
 }
 
+static uint32_t raw_uint32(const uint8_t *data)
+{
+    return ((uint32_t) data[0] << 24) + (data[1] << 16) + (data[2] << 8) + data[3];
+}
+
+bool can_data_object_value(const DataObject *obj, double *value)
+{
+    union float2bytes { float f; char b[4]; } f2b;     // for conversion of float to single bytes
+
+    switch (obj->raw_data[0]) {
+        case CAN_TS_T_TRUE:
+        case CAN_TS_T_FALSE:
+            *value = (obj->raw_data[0] == CAN_TS_T_TRUE) ? 1 : 0;
+            return true;
+        case CAN_TS_T_POS_INT32:
+            *value = raw_uint32(&obj->raw_data[1]);
+            return true;
+        case CAN_TS_T_NEG_INT32:
+            *value = -(double)raw_uint32(&obj->raw_data[1]) - 1;
+            return true;
+        case CAN_TS_T_FLOAT32:
+            f2b.b[3] = obj->raw_data[1];
+            f2b.b[2] = obj->raw_data[2];
+            f2b.b[1] = obj->raw_data[3];
+            f2b.b[0] = obj->raw_data[4];
+            *value = f2b.f;
+            return true;
+        case CAN_TS_T_DECFRAC:
+            // same limitation as in generate_json_string: only int32 with exponent -3
+            if (obj->raw_data[2] != 0x22) {
+                return false;
+            }
+            if (obj->raw_data[3] == 0x1a) {
+                *value = raw_uint32(&obj->raw_data[4]) / 1000.0;
+                return true;
+            }
+            else if (obj->raw_data[3] == 0x3a) {
+                *value = -(raw_uint32(&obj->raw_data[4]) + 1.0) / 1000.0;
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+DataObject *can_get_data_objects(uint8_t device_addr, size_t *num_objs)
+{
+    if (device_addr == 0) {
+        *num_objs = sizeof(data_obj_bms) / sizeof(DataObject);
+        return data_obj_bms;
+    }
+    else if (device_addr == 10) {
+        *num_objs = sizeof(data_obj_mppt) / sizeof(DataObject);
+        return data_obj_mppt;
+    }
+    *num_objs = 0;
+    return NULL;
+}
+
+int can_get_data_json(uint8_t device_addr, char *buf, size_t size, uint32_t *pub_count)
+{
+    size_t num_objs;
+    DataObject *objs = can_get_data_objects(device_addr, &num_objs);
+    if (objs == NULL) {
+        return 0;
+    }
+    *pub_count = (device_addr == 0) ? bms_pub_count : mppt_pub_count;
+
+    int len = generate_json_string(buf, size - 1, objs, num_objs);
+    if (len <= 1 || len >= size - 1) {
+        // no data objects received yet or buffer too small
+        return 0;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+void can_get_stats(CanStats *stats)
+{
+    *stats = can_stats;
+    stats->rx_queue_waiting = receive_queue != NULL ? uxQueueMessagesWaiting(receive_queue) : 0;
+
+    twai_status_info_t status;
+    if (twai_get_status_info(&status) == ESP_OK) {
+        stats->rx_missed = status.rx_missed_count;
+        stats->bus_errors = status.bus_error_count;
+        stats->tx_error_counter = status.tx_error_counter;
+        stats->rx_error_counter = status.rx_error_counter;
+    }
+}
+
 char *get_mppt_json_data()
 {
     generate_json_string(json_buf, sizeof(json_buf),
@@ -197,9 +311,31 @@ char *get_bms_json_data()
     return json_buf;
 }
 
-void can_setup()
+static void publish_events_snapshot(uint8_t device_addr, DataObject *objs, size_t num_objs,
+    TickType_t *last_snapshot)
 {
+    if (web_events_num_clients() == 0 ||
+        xTaskGetTickCount() - *last_snapshot < pdMS_TO_TICKS(EVENTS_SNAPSHOT_INTERVAL_MS))
+    {
+        return;
+    }
+    *last_snapshot = xTaskGetTickCount();
 
+    int len = generate_json_string(events_json_buf, sizeof(events_json_buf) - 1, objs, num_objs);
+    if (len <= 1 || len >= sizeof(events_json_buf) - 1) {
+        // no data objects received yet or buffer too small
+        return;
+    }
+    events_json_buf[len] = '\0';
+
+    // address 0 is also used for the gateway itself, so only look up other devices
+    TSDevice *device = device_addr > 0 ? ts_get_can_device(device_addr) : NULL;
+    web_events_publish_data(device != NULL ? device->ts_device_id : NULL, device_addr, "can",
+        events_json_buf);
+}
+
+static bool driver_start()
+{
 #ifdef GPIO_CAN_STB
     // switch CAN transceiver on (STB = low)
     gpio_pad_select_gpio(CONFIG_GPIO_CAN_STB);
@@ -209,22 +345,31 @@ void can_setup()
 
     if (twai_driver_install(&g_config, &t_config, &f_config) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to install CAN driver");
-        return;
+        return false;
     }
 
     if (twai_start() != ESP_OK) {
         ESP_LOGE(TAG, "Failed to start CAN driver");
-        return;
+        twai_driver_uninstall();
+        return false;
     }
 
-    receive_queue = xQueueCreate(RECV_QUEUE_SIZE, sizeof(RecvMsg));
-    if (!receive_queue) {
-        ESP_LOGE(TAG, "Failed to create receiving queue");
-        return;
+    // queue and lock are kept if the interface is stopped
+    if (receive_queue == NULL) {
+        receive_queue = xQueueCreate(RECV_QUEUE_SIZE, sizeof(RecvMsg));
+        if (!receive_queue) {
+            ESP_LOGE(TAG, "Failed to create receiving queue");
+            return false;
+        }
     }
+
+    if (isotp_lock == NULL) {
+        isotp_lock = xSemaphoreCreateMutex();
+    }
+    return true;
 }
 
-void can_receive_task(void *arg)
+static void can_receive_task(void *arg)
 {
     twai_message_t message;
     unsigned int device_addr;
@@ -232,9 +377,12 @@ void can_receive_task(void *arg)
 
     uint8_t payload[1000];
     int ret;
-    while (1) {
+    TickType_t bms_snapshot_ticks = 0;
+    TickType_t mppt_snapshot_ticks = 0;
+    while (!rx_stop) {
         ret = twai_receive(&message, pdMS_TO_TICKS(100));
         if (ret == ESP_OK) {
+            can_stats.rx_frames++;
             device_addr = message.identifier & 0x000000FF;
             ESP_LOGD(TAG, "Received CAN msg from %.2x", device_addr);
 
@@ -284,7 +432,10 @@ void can_receive_task(void *arg)
                             data_obj_bms[i].len = message.data_length_code;
                         }
                     }
-                    update_bms_received = true;
+                    emoncms_notify(EMONCMS_DATA_BMS);
+                    bms_pub_count++;
+                    publish_events_snapshot(device_addr, data_obj_bms,
+                        sizeof(data_obj_bms) / sizeof(DataObject), &bms_snapshot_ticks);
                 }
                 else if (device_addr == 10) {
                     for (int i = 0; i < sizeof(data_obj_mppt) / sizeof(DataObject); i++) {
@@ -294,7 +445,10 @@ void can_receive_task(void *arg)
                             data_obj_mppt[i].len = message.data_length_code;
                         }
                     }
-                    update_mppt_received = true;
+                    emoncms_notify(EMONCMS_DATA_MPPT);
+                    mppt_pub_count++;
+                    publish_events_snapshot(device_addr, data_obj_mppt,
+                        sizeof(data_obj_mppt) / sizeof(DataObject), &mppt_snapshot_ticks);
                 }
                 ESP_LOGD(TAG, "Received pub-msg on CAN:");
                 ESP_LOG_BUFFER_HEX_LEVEL(TAG, message.data, message.data_length_code, ESP_LOG_DEBUG);
@@ -308,11 +462,61 @@ void can_receive_task(void *arg)
             ESP_LOGE(TAG, "Driver in invalid state");
         }
     }
+    rx_task = NULL;
+    vTaskDelete(NULL);
+}
+
+void can_start()
+{
+    if (rx_task != NULL || !driver_start()) {
+        return;
+    }
+    rx_stop = false;
+    xTaskCreatePinnedToCore(can_receive_task, "CAN_rx", 4096, NULL, RX_TASK_PRIO,
+        (TaskHandle_t *) &rx_task, 1);
+    ESP_LOGI(TAG, "CAN interface started");
+}
+
+void can_stop()
+{
+    if (rx_task == NULL) {
+        return;
+    }
+    // wait for a running ISO-TP request, the driver must not be removed in between
+    xSemaphoreTake(isotp_lock, portMAX_DELAY);
+    rx_stop = true;
+    while (rx_task != NULL) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    twai_stop();
+    twai_driver_uninstall();
+
+#ifdef GPIO_CAN_STB
+    // switch CAN transceiver to standby
+    gpio_set_level(CONFIG_GPIO_CAN_STB, 1);
+#endif
+
+    xSemaphoreGive(isotp_lock);
+    ESP_LOGI(TAG, "CAN interface stopped");
 }
 
 char *ts_can_send(uint8_t *req, uint32_t query_size, uint8_t can_address, uint32_t *block_len)
 {
     RecvMsg msg;
+    char *resp = NULL;
+
+    if (isotp_lock == NULL ||
+        xSemaphoreTake(isotp_lock, pdMS_TO_TICKS(ISOTP_LOCK_TIMEOUT_MS)) != pdTRUE)
+    {
+        ESP_LOGE(TAG, "Could not take semaphore isotp_lock");
+        return NULL;
+    }
+    if (rx_task == NULL) {
+        // interface stopped
+        xSemaphoreGive(isotp_lock);
+        return NULL;
+    }
+
     // empty queue before request, don't block if empty and dismiss data if present
     if (xQueueReceive(receive_queue, &msg, 50)) {
         if (msg.data != NULL) {
@@ -326,12 +530,17 @@ char *ts_can_send(uint8_t *req, uint32_t query_size, uint8_t can_address, uint32
 
     int ret = isotp_send(&isotp_link, req, query_size);
     ESP_LOGI(TAG, "ISOTP Send %s", ret == ESP_OK ? "OK" : "FAILED");
+    can_stats.isotp_requests++;
     if (xQueueReceive(receive_queue, &msg, pdMS_TO_TICKS(500))) {
         *block_len = msg.len;
-        return (char *) msg.data;
+        resp = (char *) msg.data;
+    }
+    else {
+        can_stats.isotp_timeouts++;
     }
 
-    return NULL;
+    xSemaphoreGive(isotp_lock);
+    return resp;
 }
 
 int ts_can_scan_device_info(TSDevice *device)
@@ -364,6 +573,8 @@ int ts_can_scan_device_info(TSDevice *device)
 
         device->build_query = ts_build_query_serial;
         device->send = ts_can_send;
+        // ISO-TP needs the entire request in the send buffer
+        device->max_query_size = ISOTP_BUFSIZE;
         device->ts_resp_data = ts_serial_resp_data;
         device->ts_resp_status = ts_serial_resp_status;
         return ESP_OK;
@@ -5,6 +5,7 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "ts_client.h"
 
@@ -22,14 +23,25 @@ typedef struct {
 #define CAN_TS_T_FLOAT32 30
 #define CAN_TS_T_DECFRAC 36
 
-extern bool update_bms_received;
-extern bool update_mppt_received;
-
 typedef struct {
     uint8_t * data;
     int len;
 } RecvMsg;
 
+/**
+ * Counters of the CAN interface
+ */
+typedef struct {
+    uint32_t rx_frames;         // all received frames
+    uint32_t isotp_requests;
+    uint32_t isotp_timeouts;    // requests without response
+    uint32_t rx_queue_waiting;  // ISO-TP responses not yet processed
+    uint32_t rx_missed;         // frames lost by the driver because of full RX queue
+    uint32_t bus_errors;
+    uint32_t tx_error_counter;
+    uint32_t rx_error_counter;
+} CanStats;
+
 /**
  * Sends a query to a given address. If a string is used, the termination bit must be substracted
  * from the query length before invoking this method.
@@ -47,20 +59,60 @@ char *ts_can_send(uint8_t *req, uint32_t query_size, uint8_t can_address, uint32
 int ts_can_scan_device_info(TSDevice *device);
 
 /**
- * Initiate the CAN interface.
+ * Initiate the CAN interface and start the thread listening to it
+ *
+ * Does nothing if the interface is already running.
  */
-void can_setup();
+void can_start();
 
 /**
- * Thread listening to CAN interface, needs to be spawned from main.
+ * Stop the thread listening to the CAN interface and remove the driver, e.g. if CAN was
+ * deactivated in the configuration
+ *
+ * Waits for a running request. Requests to CAN devices fail while the interface is stopped.
  */
-void can_receive_task(void *arg);
+void can_stop();
 
 /**
  * Thread performing regular requests to other devices using ISO-TP
  */
 void isotp_task(void *arg);
 
+/**
+ * Get counters of the CAN interface (does not cause any bus traffic)
+ */
+void can_get_stats(CanStats *stats);
+
+/**
+ * Get table with the latest data objects published by a device on the CAN bus
+ *
+ * \param device_addr CAN address of the device
+ * \param num_objs Pointer to store the number of data objects in the table
+ *
+ * \returns Pointer to the table or NULL if no table exists for this device
+ */
+DataObject *can_get_data_objects(uint8_t device_addr, size_t *num_objs);
+
+/**
+ * Convert the latest data objects published by a device on the CAN bus into a JSON object
+ *
+ * \param device_addr CAN address of the device
+ * \param buf Buffer for the zero-terminated JSON string
+ * \param size Size of the buffer
+ * \param pub_count Pointer to store the number of publication messages received from the device
+ *
+ * \returns Length of the JSON string or 0 if no data objects were received yet, no table exists
+ *          for this device or the buffer is too small
+ */
+int can_get_data_json(uint8_t device_addr, char *buf, size_t size, uint32_t *pub_count);
+
+/**
+ * Convert the raw data of a data object into a number
+ *
+ * \returns true if the data object was received and has a numeric value
+ */
+bool can_data_object_value(const DataObject *obj, double *value);
+
 /**
  * Get data from MPPT connected via CAN bus and convert it to JSON
  *
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "config_store.h"
+
+#include <string.h>
+
+void config_store_init(ConfigStore *store, const ConfigStoreIO *io, const char *const *keys,
+    uint32_t num_keys, uint32_t delay_ms, char *buf, size_t size)
+{
+    memset(store, 0, sizeof(*store));
+    store->io = *io;
+    store->keys = keys;
+    store->num_keys = num_keys < CONFIG_STORE_KEYS_MAX ? num_keys : CONFIG_STORE_KEYS_MAX;
+    store->delay_ms = delay_ms;
+    store->buf = buf;
+    store->size = size;
+}
+
+int config_store_request(ConfigStore *store, const char *key, uint32_t now_ms)
+{
+    for (uint32_t i = 0; i < store->num_keys; i++) {
+        if (strcmp(store->keys[i], key) == 0) {
+            if (store->pending == 0) {
+                // further requests within the delay are written together with this one
+                store->due_ms = now_ms + store->delay_ms;
+            }
+            store->pending |= 1U << i;
+            store->stats.requests++;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int32_t config_store_due(const ConfigStore *store, uint32_t now_ms)
+{
+    if (store->pending == 0) {
+        return -1;
+    }
+    int32_t remaining = (int32_t) (store->due_ms - now_ms);
+    return remaining > 0 ? remaining : 0;
+}
+
+/* writes the data of one key if it differs from the stored data */
+static int save_key(ConfigStore *store, const char *key)
+{
+    size_t half = store->size / 2;
+    char *current = store->buf;
+    char *stored = store->buf + half;
+
+    int len = store->io.render(store->io.ctx, key, current, half);
+    if (len < 0) {
+        return -1;
+    }
+    int stored_len = store->io.read(store->io.ctx, key, stored, half);
+    if (stored_len == len && memcmp(current, stored, len) == 0) {
+        store->stats.unchanged++;
+        return 0;
+    }
+    if (store->io.write(store->io.ctx, key, current, len) < 0) {
+        return -1;
+    }
+    store->stats.writes++;
+    return 1;
+}
+
+int config_store_flush(ConfigStore *store, uint32_t now_ms, bool force)
+{
+    if (store->pending == 0 || (!force && config_store_due(store, now_ms) > 0)) {
+        return 0;
+    }
+
+    int written = 0;
+    bool failed = false;
+    for (uint32_t i = 0; i < store->num_keys; i++) {
+        if ((store->pending & (1U << i)) == 0) {
+            continue;
+        }
+        int ret = save_key(store, store->keys[i]);
+        if (ret < 0) {
+            store->stats.errors++;
+            failed = true;
+            continue;
+        }
+        store->pending &= ~(1U << i);
+        written += ret;
+    }
+
+    if (failed) {
+        store->due_ms = now_ms + store->delay_ms;
+        return -1;
+    }
+    return written;
+}
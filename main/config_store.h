@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef CONFIG_STORE_H_
+#define CONFIG_STORE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONFIG_STORE_KEYS_MAX 32
+
+/**
+ * Access to the configuration data and the non-volatile storage (e.g. NVS blobs)
+ *
+ * Functions return the length of the data or -1 in case of error. read also returns -1 if
+ * nothing was stored for the key yet. write must store the data persistently before returning.
+ */
+typedef struct {
+    int (*render)(void *ctx, const char *key, char *buf, size_t size);  // current data
+    int (*read)(void *ctx, const char *key, char *buf, size_t size);
+    int (*write)(void *ctx, const char *key, const char *buf, size_t len);
+    void *ctx;
+} ConfigStoreIO;
+
+/**
+ * Counters to monitor the wear of the flash
+ */
+typedef struct {
+    uint32_t requests;      // save requests, e.g. each time a configuration node is changed
+    uint32_t writes;        // data written to the storage
+    uint32_t unchanged;     // writes skipped, as the stored data was identical
+    uint32_t errors;
+} ConfigStoreStats;
+
+/**
+ * Persistence of configuration data with one entry per key
+ *
+ * Save requests only mark the key as pending. All requests within the delay after the first
+ * one are written together, and only if the data differs from the stored data.
+ */
+typedef struct {
+    ConfigStoreIO io;
+    const char *const *keys;
+    uint32_t num_keys;
+    uint32_t delay_ms;
+    uint32_t pending;       // bit mask of keys to be written
+    uint32_t due_ms;        // time when pending keys are written
+    char *buf;              // current and stored data are compared in two halves
+    size_t size;
+    ConfigStoreStats stats;
+} ConfigStore;
+
+/**
+ * Initialize the store
+ *
+ * \param keys Keys of the configuration data, must stay valid
+ * \param buf Buffer for comparing the data, twice the maximum size of the data of one key
+ */
+void config_store_init(ConfigStore *store, const ConfigStoreIO *io, const char *const *keys,
+    uint32_t num_keys, uint32_t delay_ms, char *buf, size_t size);
+
+/**
+ * Request to save the data of a key, it is written with the next due config_store_flush
+ *
+ * \returns 0 on success or -1 if the key is unknown
+ */
+int config_store_request(ConfigStore *store, const char *key, uint32_t now_ms);
+
+/**
+ * Time until pending data has to be written
+ *
+ * \returns Milliseconds until config_store_flush is due (0 if already due) or -1 if nothing
+ *          is pending
+ */
+int32_t config_store_due(const ConfigStore *store, uint32_t now_ms);
+
+/**
+ * Write the data of pending keys if the delay has passed or if forced (e.g. before a reset)
+ *
+ * Keys which could not be written stay pending and are retried after the delay.
+ *
+ * \returns Number of keys written or -1 in case of error
+ */
+int config_store_flush(ConfigStore *store, uint32_t now_ms, bool force);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONFIG_STORE_H_ */
@@ -6,6 +6,11 @@
 
 #ifndef UNIT_TEST
 #include "data_nodes.h"
+#include "http_stats.h"
+#include "pub_batch.h"
+#include "services.h"
+#include "config_store.h"
+#include "sys_stats.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "../lib/thingset/src/thingset.h"
@@ -13,10 +18,34 @@
 #include "nvs.h"
 #include "esp_err.h"
 #include "string.h"
+#include <stdio.h>
+#include <sys/param.h>
 #include "esp_timer.h"
 #include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 // assumption that config data is smaller than 1024 bytes
-#define BUFFER_SIZE 1024;
+#define BUFFER_SIZE 1024
+
+// changes of the configuration within this time are written to NVS together
+#define SAVE_DELAY_MS 2000
+
+// number of blobs written since the NVS partition was erased
+#define NVS_KEY_WRITES "writes"
+
+// interval of updates of the runtime statistics in output/sys
+#define SYS_STATS_INTERVAL_MS 5000
+
+// saving and sampling is done with lower priority than the services and the history
+#define DATA_NODES_TASK_PRIO 2
+
+// notification bits of data_nodes_task
+#define EVENT_SAVE          (1UL << 0)
+#define EVENT_SYS_STATS     (1UL << 1)
+
+// initial size of responses to requests from other tasks, written directly into the result
+#define RESP_BUFFER_SIZE 1024
 
 static const char *TAG = "config_nodes";
 
@@ -24,6 +53,24 @@ EmoncmsConfig emon_config;
 MqttConfig mqtt_config;
 GeneralConfig general_config;
 
+// updated by the web server after each request
+HttpStatsSummary http_summary;
+PubStats mqtt_stats;
+
+// updated by app_main and the startup tasks
+BootTimes boot_times;
+
+// updated periodically, as values are read from the variables by GET requests
+SysStats sys_stats;
+static esp_timer_handle_t sys_stats_timer;
+
+/* configuration nodes are written to NVS only if changed, see config_nodes_save */
+static ConfigStore config_store;
+static char config_store_buf[2 * BUFFER_SIZE];
+static esp_timer_handle_t save_timer;
+static nvs_handle_t nvs;
+static uint32_t nvs_writes;
+
 char device_id[9];
 const char manufacturer[] = "Libre Solar";
 char firmware_version[32];
@@ -85,6 +132,9 @@ static DataNode data_nodes[] = {
     TS_NODE_STRING(0x3F, "Port", emon_config.port, STRING_LEN,
         ID_CONF_EMONCMS, TS_ANY_R | TS_ANY_W, PUB_NVM),
 
+    TS_NODE_UINT32(0x51, "Interval_s", &(emon_config.interval),
+        ID_CONF_EMONCMS, TS_ANY_R | TS_ANY_W, PUB_NVM),
+
     TS_NODE_PATH(ID_CONF_MQTT, DATA_NODE_MQTT, ID_CONF, &save_mqtt),
 
     TS_NODE_BOOL(0x41, "Activate", &(mqtt_config.active),
@@ -108,6 +158,159 @@ static DataNode data_nodes[] = {
     TS_NODE_UINT32(0x47, "PubInterval", &(mqtt_config.pub_interval),
         ID_CONF_MQTT, TS_ANY_R | TS_ANY_W, PUB_NVM),
 
+    TS_NODE_FLOAT(0x48, "DeadbandAbs", &(mqtt_config.deadband_abs), 3,
+        ID_CONF_MQTT, TS_ANY_R | TS_ANY_W, PUB_NVM),
+
+    TS_NODE_FLOAT(0x49, "DeadbandRel_pct", &(mqtt_config.deadband_rel), 1,
+        ID_CONF_MQTT, TS_ANY_R | TS_ANY_W, PUB_NVM),
+
+    TS_NODE_STRING(0x4A, "Deadbands", mqtt_config.deadbands, STRING_LEN,
+        ID_CONF_MQTT, TS_ANY_R | TS_ANY_W, PUB_NVM),
+
+    TS_NODE_UINT32(0x4B, "FullRefresh", &(mqtt_config.full_refresh),
+        ID_CONF_MQTT, TS_ANY_R | TS_ANY_W, PUB_NVM),
+
+    TS_NODE_BOOL(0x4C, "CborPayload", &(mqtt_config.cbor_payload),
+        ID_CONF_MQTT, TS_ANY_R | TS_ANY_W, PUB_NVM),
+
+    TS_NODE_BOOL(0x4D, "NumericIDs", &(mqtt_config.cbor_ids),
+        ID_CONF_MQTT, TS_ANY_R | TS_ANY_W, PUB_NVM),
+
+    TS_NODE_UINT32(0x4E, "QoS", &(mqtt_config.qos),
+        ID_CONF_MQTT, TS_ANY_R | TS_ANY_W, PUB_NVM),
+
+    TS_NODE_UINT32(0x4F, "BatchSize", &(mqtt_config.batch_size),
+        ID_CONF_MQTT, TS_ANY_R | TS_ANY_W, PUB_NVM),
+
+    TS_NODE_UINT32(0x50, "BatchDelay_s", &(mqtt_config.batch_delay),
+        ID_CONF_MQTT, TS_ANY_R | TS_ANY_W, PUB_NVM),
+
+    TS_NODE_PATH(ID_OUTPUT, "output", 0, NULL),
+
+    TS_NODE_PATH(ID_OUTPUT_HTTP, "http", ID_OUTPUT, NULL),
+
+    TS_NODE_UINT32(0x72, "Requests", &(http_summary.requests),
+        ID_OUTPUT_HTTP, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x73, "Errors", &(http_summary.errors),
+        ID_OUTPUT_HTTP, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x74, "BytesOut", &(http_summary.bytes_out),
+        ID_OUTPUT_HTTP, TS_ANY_R, 0),
+
+    TS_NODE_FLOAT(0x75, "RecvAvg_ms", &(http_summary.recv_avg_ms), 1,
+        ID_OUTPUT_HTTP, TS_ANY_R, 0),
+
+    TS_NODE_FLOAT(0x76, "BusAvg_ms", &(http_summary.bus_avg_ms), 1,
+        ID_OUTPUT_HTTP, TS_ANY_R, 0),
+
+    TS_NODE_FLOAT(0x77, "SendAvg_ms", &(http_summary.send_avg_ms), 1,
+        ID_OUTPUT_HTTP, TS_ANY_R, 0),
+
+    TS_NODE_FLOAT(0x78, "BusMax_ms", &(http_summary.bus_max_ms), 1,
+        ID_OUTPUT_HTTP, TS_ANY_R, 0),
+
+    TS_NODE_FLOAT(0x79, "SerialBusAvg_ms", &(http_summary.serial_bus_avg_ms), 1,
+        ID_OUTPUT_HTTP, TS_ANY_R, 0),
+
+    TS_NODE_FLOAT(0x7A, "CanBusAvg_ms", &(http_summary.can_bus_avg_ms), 1,
+        ID_OUTPUT_HTTP, TS_ANY_R, 0),
+
+    TS_NODE_FLOAT(0x7B, "SpiffsBusAvg_ms", &(http_summary.spiffs_bus_avg_ms), 1,
+        ID_OUTPUT_HTTP, TS_ANY_R, 0),
+
+    TS_NODE_PATH(ID_OUTPUT_MQTT, "mqtt", ID_OUTPUT, NULL),
+
+    TS_NODE_UINT32(0x81, "Published", &(mqtt_stats.published),
+        ID_OUTPUT_MQTT, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x82, "Acked", &(mqtt_stats.acked),
+        ID_OUTPUT_MQTT, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x83, "Expired", &(mqtt_stats.expired),
+        ID_OUTPUT_MQTT, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x84, "InFlight", &(mqtt_stats.inflight),
+        ID_OUTPUT_MQTT, TS_ANY_R, 0),
+
+    TS_NODE_FLOAT(0x85, "AckRate_pct", &(mqtt_stats.ack_rate_pct), 1,
+        ID_OUTPUT_MQTT, TS_ANY_R, 0),
+
+    TS_NODE_FLOAT(0x86, "LatencyAvg_ms", &(mqtt_stats.latency_avg_ms), 1,
+        ID_OUTPUT_MQTT, TS_ANY_R, 0),
+
+    TS_NODE_FLOAT(0x87, "LatencyMax_ms", &(mqtt_stats.latency_max_ms), 1,
+        ID_OUTPUT_MQTT, TS_ANY_R, 0),
+
+    TS_NODE_PATH(ID_OUTPUT_SYS, "sys", ID_OUTPUT, NULL),
+
+    TS_NODE_UINT32(0x89, "Uptime_s", &(sys_stats.uptime_s),
+        ID_OUTPUT_SYS, TS_ANY_R, 0),
+
+    TS_NODE_STRING(0x8A, "ResetReason", sys_stats.reset_reason, sizeof(sys_stats.reset_reason),
+        ID_OUTPUT_SYS, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x8B, "HeapFree_B", &(sys_stats.heap_free),
+        ID_OUTPUT_SYS, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x8C, "HeapMinFree_B", &(sys_stats.heap_min_free),
+        ID_OUTPUT_SYS, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x8D, "HeapLargestBlock_B", &(sys_stats.heap_largest_block),
+        ID_OUTPUT_SYS, TS_ANY_R, 0),
+
+    TS_NODE_INT32(0x8E, "WifiRssi_dBm", &(sys_stats.wifi_rssi),
+        ID_OUTPUT_SYS, TS_ANY_R, 0),
+
+    TS_NODE_STRING(0x8F, "TaskStackFree_B", sys_stats.task_stack_free,
+        sizeof(sys_stats.task_stack_free), ID_OUTPUT_SYS, TS_ANY_R, 0),
+
+    TS_NODE_STRING(0x96, "TaskCpu_pct", sys_stats.task_cpu, sizeof(sys_stats.task_cpu),
+        ID_OUTPUT_SYS, TS_ANY_R, 0),
+
+    TS_NODE_STRING(0x97, "Queues", sys_stats.queues, sizeof(sys_stats.queues),
+        ID_OUTPUT_SYS, TS_ANY_R, 0),
+
+    TS_NODE_PATH(ID_OUTPUT_NVS, "nvs", ID_OUTPUT, NULL),
+
+    TS_NODE_UINT32(0x91, "SaveRequests", &(config_store.stats.requests),
+        ID_OUTPUT_NVS, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x92, "Writes", &(config_store.stats.writes),
+        ID_OUTPUT_NVS, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x93, "WritesTotal", &nvs_writes,
+        ID_OUTPUT_NVS, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x94, "Unchanged", &(config_store.stats.unchanged),
+        ID_OUTPUT_NVS, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x95, "Errors", &(config_store.stats.errors),
+        ID_OUTPUT_NVS, TS_ANY_R, 0),
+
+    TS_NODE_PATH(ID_OUTPUT_BOOT, "boot", ID_OUTPUT, NULL),
+
+    TS_NODE_UINT32(0x99, "Config_ms", &(boot_times.config),
+        ID_OUTPUT_BOOT, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x9A, "Filesystem_ms", &(boot_times.fs),
+        ID_OUTPUT_BOOT, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x9B, "Interfaces_ms", &(boot_times.interfaces),
+        ID_OUTPUT_BOOT, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x9C, "WebServer_ms", &(boot_times.web_server),
+        ID_OUTPUT_BOOT, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x9D, "Wifi_ms", &(boot_times.wifi),
+        ID_OUTPUT_BOOT, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x9E, "Discovery_ms", &(boot_times.discovery),
+        ID_OUTPUT_BOOT, TS_ANY_R, 0),
+
+    TS_NODE_UINT32(0x9F, "Services_ms", &(boot_times.services),
+        ID_OUTPUT_BOOT, TS_ANY_R, 0),
+
     TS_NODE_PATH(ID_EXEC, "rpc", 0, NULL),
 
     TS_NODE_EXEC(0xE1, "x-reset", &reset_device, ID_EXEC, TS_ANY_RW),
@@ -115,13 +318,126 @@ static DataNode data_nodes[] = {
 
 ThingSet ts(data_nodes, sizeof(data_nodes)/sizeof(DataNode));
 
+/* requests may be processed by several tasks in parallel (e.g. HTTP workers) */
+static SemaphoreHandle_t ts_lock;
+
+/* writes configuration changes to NVS and samples sys_stats, woken up by the timers */
+static TaskHandle_t nodes_task;
+
 /*
 * String array to loop over
 */
 const char *nodes[] = {DATA_NODE_GENERAL, DATA_NODE_EMONCMS, DATA_NODE_MQTT, NULL};
 
+static uint32_t uptime_ms()
+{
+    return esp_timer_get_time() / 1000;
+}
+
+/* current content of a configuration node as JSON */
+static int render_node(void *ctx, const char *node, char *buf, size_t size)
+{
+    char *ts_request = build_query(TS_GET, (char *) node, NULL);
+    int len = ts.process((uint8_t *) ts_request, strlen(ts_request), (uint8_t *) buf, size - 1);
+    free(ts_request);
+    buf[len] = '\0';
+    TSResponse res;
+    res.block = buf;
+    char *json_start = ts_serial_resp_data(&res);
+    if (json_start == NULL) {
+        ESP_LOGE(TAG, "Unable to read node %s: %s", node, buf);
+        return -1;
+    }
+    len -= json_start - buf;
+    memmove(buf, json_start, len);
+    return len;
+}
+
+static int read_blob(void *ctx, const char *node, char *buf, size_t size)
+{
+    size_t len = size;
+    return nvs_get_blob(nvs, node, buf, &len) == ESP_OK ? (int) len : -1;
+}
+
+static int write_blob(void *ctx, const char *node, const char *buf, size_t len)
+{
+    // the counter is committed together with the data, so it survives resets
+    if (nvs_set_blob(nvs, node, buf, len) != ESP_OK ||
+        nvs_set_u32(nvs, NVS_KEY_WRITES, nvs_writes + 1) != ESP_OK ||
+        nvs_commit(nvs) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Unable to write %s to NVS", node);
+        return -1;
+    }
+    nvs_writes++;
+    ESP_LOGI(TAG, "Node %s written to NVS (%u writes in total)", node,
+        (unsigned int) nvs_writes);
+    return len;
+}
+
+/* writes pending changes, called by data_nodes_task after save_timer expired */
+static void save_pending()
+{
+    xSemaphoreTake(ts_lock, portMAX_DELAY);
+    uint32_t now = uptime_ms();
+    config_store_flush(&config_store, now, false);
+    int32_t due = config_store_due(&config_store, now);
+    xSemaphoreGive(ts_lock);
+
+    if (due >= 0) {
+        // failed writes are retried
+        esp_timer_start_once(save_timer, (uint64_t) MAX(due, 1) * 1000);
+    }
+}
+
+static void update_sys_stats()
+{
+    // sampled outside of the lock, as it takes some time
+    static SysStats sample;
+    sys_stats_update(&sample);
+
+    xSemaphoreTake(ts_lock, portMAX_DELAY);
+    memcpy(&sys_stats, &sample, sizeof(sys_stats));
+    xSemaphoreGive(ts_lock);
+}
+
+/*
+ * Callbacks of all esp_timers run in the same task (e.g. also the reset timer), so the timers
+ * only wake up data_nodes_task, which may wait for ts_lock and NVS writes.
+ */
+static void notify_timer_cb(void *arg)
+{
+    xTaskNotify(nodes_task, (uint32_t) (uintptr_t) arg, eSetBits);
+}
+
+static void data_nodes_task(void *arg)
+{
+    while (1) {
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+
+        if (events & EVENT_SAVE) {
+            save_pending();
+        }
+        if (events & EVENT_SYS_STATS) {
+            update_sys_stats();
+        }
+    }
+}
+
 void data_nodes_init()
 {
+    ts_lock = xSemaphoreCreateMutex();
+    xTaskCreate(&data_nodes_task, "data_nodes", 4096, NULL, DATA_NODES_TASK_PRIO, &nodes_task);
+
+    const esp_timer_create_args_t save_timer_args = {
+            .callback = &notify_timer_cb,
+            .arg = (void *) EVENT_SAVE,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "config_save"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&save_timer_args, &save_timer));
+
     uint64_t id64 = 0;
     // MAC Address of WiFi Station equals base adress
     esp_read_mac(((uint8_t *) &id64) + 2, ESP_MAC_WIFI_STA);
@@ -139,13 +455,22 @@ void data_nodes_init()
         esp_restart();
     }
 
-    nvs_handle_t handle;
-    ret = nvs_open_from_partition(PARTITION, NAMESPACE, NVS_READWRITE, &handle);
+    ret = nvs_open_from_partition(PARTITION, NAMESPACE, NVS_READWRITE, &nvs);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Unable to init config partition");
         //continueing makes no sense at this point
         esp_restart();
     }
+    nvs_get_u32(nvs, NVS_KEY_WRITES, &nvs_writes);
+
+    const ConfigStoreIO nvs_io = {
+        .render = render_node,
+        .read = read_blob,
+        .write = write_blob,
+        .ctx = NULL,
+    };
+    config_store_init(&config_store, &nvs_io, nodes, sizeof(nodes) / sizeof(nodes[0]) - 1,
+        SAVE_DELAY_MS, config_store_buf, sizeof(config_store_buf));
 
     nvs_iterator_t it =  nvs_entry_find(PARTITION, NAMESPACE, NVS_TYPE_BLOB);
     if (it == NULL) {
@@ -157,6 +482,30 @@ void data_nodes_init()
     } else {
         config_nodes_load();
     }
+
+    // loading saves the nodes again, which only writes values changed by the firmware
+    config_nodes_flush();
+
+    const esp_timer_create_args_t sys_stats_timer_args = {
+            .callback = &notify_timer_cb,
+            .arg = (void *) EVENT_SYS_STATS,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "sys_stats"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&sys_stats_timer_args, &sys_stats_timer));
+    xTaskNotify(nodes_task, EVENT_SYS_STATS, eSetBits);
+    esp_timer_start_periodic(sys_stats_timer, SYS_STATS_INTERVAL_MS * 1000);
+}
+
+/* checks if the response did not fit into the buffer, so the request has to be repeated */
+static bool response_truncated(const char *resp, int len, size_t size)
+{
+    unsigned int status_code = 0;
+    if (len >= (int) size - 1) {
+        return true;
+    }
+    return sscanf(resp, ":%X ", &status_code) == 1 &&
+        status_code == TS_STATUS_RESPONSE_TOO_LARGE;
 }
 
 char *process_ts_request(uint8_t *req, uint32_t query_size, uint8_t can_address, uint32_t *block_len)
@@ -165,21 +514,40 @@ char *process_ts_request(uint8_t *req, uint32_t query_size, uint8_t can_address,
     if (r[strlen(r) - 1] == '\n') {
         r[strlen(r) - 1] = '\0';
     }
-    size_t res_len = BUFFER_SIZE;
-    char buf[res_len];
-    int len = ts.process((uint8_t *) r, strlen(r), (uint8_t *) buf, res_len);
+
+    // the buffer is grown until the response fits or the heap is exhausted
+    char *resp = NULL;
+    int len = 0;
+    for (size_t size = RESP_BUFFER_SIZE; ; size *= 2) {
+        char *buf = (char *) realloc(resp, size);
+        if (buf == NULL) {
+            ESP_LOGE(TAG, "Unable to allocate %u bytes for TSResponse", (unsigned int) size);
+            if (resp == NULL) {
+                return NULL;
+            }
+            // previous response reports that it was too large
+            break;
+        }
+        resp = buf;
+        xSemaphoreTake(ts_lock, portMAX_DELAY);
+        len = ts.process((uint8_t *) r, strlen(r), (uint8_t *) resp, size - 1);
+        xSemaphoreGive(ts_lock);
+        resp[len] = '\0';
+        // only GET and FETCH requests can be processed again without side effects
+        if (r[0] != '?' || !response_truncated(resp, len, size)) {
+            break;
+        }
+    }
     if (len == 0) {
+        free(resp);
         return NULL;
     }
-    char *resp = (char *) malloc(len + 1);
-    if (resp == NULL) {
-        ESP_LOGE(TAG, "Unable to allocate memory for TSResponse");
-        return NULL;
+    if (block_len != NULL) {
+        *block_len = len;
     }
-    memcpy(resp, buf, len);
-    resp[len] = '\0';
-    *block_len = len;
-    return resp;
+    // return unused part of the buffer to the heap
+    char *shrunk = (char *) realloc(resp, len + 1);
+    return shrunk != NULL ? shrunk : resp;
 }
 
 TSResponse *process_local_request(char *req, uint8_t can_address)
@@ -210,6 +578,9 @@ void config_nodes_load()
         ESP_LOGE(TAG, "Unable to open nvs from partition");
         return;
     }
+    // defaults for nodes not yet stored by a previous firmware version
+    config_nodes_load_kconfig();
+
     for (const char **node = nodes; *node != NULL; node++) {
         nvs_get_blob(handle, *node, NULL, &len);
         uint8_t *buf = (uint8_t *) malloc(len + 1);
@@ -233,6 +604,7 @@ void config_nodes_load()
 }
 static void reset_cb(void* arg)
 {
+    config_nodes_flush();
     esp_restart();
 }
 void reset_device()
@@ -251,43 +623,38 @@ void reset_device()
 void save_general()
 {
     config_nodes_save(DATA_NODE_GENERAL);
+    services_apply(SERVICES_CONF_GENERAL);
 }
 
 void save_mqtt()
 {
     config_nodes_save(DATA_NODE_MQTT);
+    services_apply(SERVICES_CONF_MQTT);
 }
 
 void save_emon()
 {
     config_nodes_save(DATA_NODE_EMONCMS);
+    services_apply(SERVICES_CONF_EMONCMS);
 }
 
 void config_nodes_save(const char *node)
 {
-    size_t res_len = BUFFER_SIZE;
-    char response[res_len];
-    nvs_handle_t handle;
-    esp_err_t ret = nvs_open_from_partition(PARTITION, NAMESPACE, NVS_READWRITE, &handle);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Unable to open nvs from partition");
+    // called by the callbacks of the nodes, so ts_lock is already taken (if needed)
+    if (config_store_request(&config_store, node, uptime_ms()) < 0) {
+        ESP_LOGE(TAG, "Unknown config node %s", node);
         return;
     }
-    char *ts_request = build_query(TS_GET, (char*) node, NULL);
-    int len = ts.process((uint8_t *) ts_request, strlen(ts_request), (uint8_t *) response, res_len);
-    ESP_LOGD(TAG, "Got response to query: %s", response);
-    TSResponse res;
-    res.block = response;
-    char *json_start = ts_serial_resp_data(&res);
-    len = len - (json_start - response);
-    ret = nvs_set_blob(handle, node, json_start, len);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Unable to write to NVS, Error: %d", ret);
-    } else {
-        nvs_commit(handle);
-    }
-    free(ts_request);
-    nvs_close(handle);
+    // fails if the timer is already running for previous changes, which are written together
+    int32_t due = config_store_due(&config_store, uptime_ms());
+    esp_timer_start_once(save_timer, (uint64_t) MAX(due, 1) * 1000);
+}
+
+void config_nodes_flush()
+{
+    xSemaphoreTake(ts_lock, portMAX_DELAY);
+    config_store_flush(&config_store, uptime_ms(), true);
+    xSemaphoreGive(ts_lock);
 }
 
 void config_nodes_load_kconfig()
@@ -325,6 +692,28 @@ void config_nodes_load_kconfig()
     strncpy(mqtt_config.username, CONFIG_THINGSET_MQTT_USER, sizeof(mqtt_config.username));
     strncpy(mqtt_config.password, CONFIG_THINGSET_MQTT_PASS, sizeof(mqtt_config.password));
     mqtt_config.pub_interval = CONFIG_THINGSET_MQTT_PUBLISH_INTERVAL;
+    mqtt_config.deadband_abs = 0;
+    mqtt_config.deadband_rel = 0;
+    mqtt_config.deadbands[0] = '\0';
+    mqtt_config.full_refresh = CONFIG_THINGSET_MQTT_FULL_REFRESH;
+    #ifdef CONFIG_THINGSET_MQTT_CBOR
+    mqtt_config.cbor_payload = CONFIG_THINGSET_MQTT_CBOR;
+    #else
+    mqtt_config.cbor_payload = false;
+    #endif
+    #ifdef CONFIG_THINGSET_MQTT_CBOR_IDS
+    mqtt_config.cbor_ids = CONFIG_THINGSET_MQTT_CBOR_IDS;
+    #else
+    mqtt_config.cbor_ids = false;
+    #endif
+    mqtt_config.qos = CONFIG_THINGSET_MQTT_QOS;
+    #ifdef CONFIG_THINGSET_MQTT_BATCH
+    mqtt_config.batch_size = CONFIG_THINGSET_MQTT_BATCH_SIZE;
+    mqtt_config.batch_delay = CONFIG_THINGSET_MQTT_BATCH_DELAY;
+    #else
+    mqtt_config.batch_size = 0;
+    mqtt_config.batch_delay = 0;
+    #endif
 
     #ifdef CONFIG_EMONCMS
     emon_config.active = CONFIG_EMONCMS;
@@ -338,6 +727,7 @@ void config_nodes_load_kconfig()
     strncpy(emon_config.serial_node, CONFIG_EMONCMS_NODE_SERIAL, sizeof(emon_config.serial_node));
     strncpy(emon_config.mppt, CONFIG_EMONCMS_NODE_MPPT, sizeof(emon_config.mppt));
     strncpy(emon_config.bms, CONFIG_EMONCMS_NODE_BMS, sizeof(emon_config.bms));
+    emon_config.interval = CONFIG_EMONCMS_INTERVAL;
 }
 
 char *build_query(uint8_t method, char *node, char *payload)
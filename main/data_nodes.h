@@ -14,6 +14,7 @@ extern "C"
 
 #include <stdint.h>
 #include "esp_err.h"
+#include "http_stats.h"
 #include "ts_client.h"
 
 
@@ -37,6 +38,11 @@ extern "C"
 #define ID_CONF_MQTT    0x40
 #define ID_INPUT    0x60        // input data (e.g. set-points)
 #define ID_OUTPUT   0x70        // output data (e.g. measurement values)
+#define ID_OUTPUT_HTTP  0x71
+#define ID_OUTPUT_MQTT  0x80
+#define ID_OUTPUT_SYS   0x88
+#define ID_OUTPUT_NVS   0x90
+#define ID_OUTPUT_BOOT  0x98
 #define ID_REC      0xA0        // recorded data (history-dependent)
 #define ID_CAL      0xD0        // calibration
 #define ID_EXEC     0xE0        // function call
@@ -67,6 +73,8 @@ void data_nodes_init();
  * Process incoming Thingset requests. Has CAN address to match
  * send function from TSDevice struct as it is used only internally,
  * but could also be used by a UART/CAN task to process ThingSet requests in general
+ *
+ * The size of responses to GET and FETCH requests is only limited by the available heap.
  */
 char *process_ts_request(uint8_t *req, uint32_t query_size, uint8_t can_address, uint32_t *block_len);
 
@@ -78,7 +86,8 @@ void uint64_to_base32(uint64_t in, char *out, size_t size);
 void reset_device();
 
 /*
- * Wrapper for saving nodes, used as callbacks. Always restarts the device after saving
+ * Wrapper for saving nodes, used as callbacks. The new configuration is applied to the running
+ * services, see services_apply
  */
 void save_mqtt();
 
@@ -98,9 +107,17 @@ void config_nodes_load();
 
 /**
  * Writes config to NVS
+ *
+ * The write is delayed, so further changes are written together, and skipped if the stored
+ * data is identical. See output/nvs for the number of writes.
  */
 void config_nodes_save(const char *node);
 
+/**
+ * Writes pending config changes to NVS immediately, e.g. before a restart
+ */
+void config_nodes_flush();
+
 /**
  * Wrapper for serial query builder. Eliminates newline termination used for serial communication
  */
@@ -126,6 +143,7 @@ typedef struct {
     char serial_node[STRING_LEN];
     char mppt[STRING_LEN];
     char bms[STRING_LEN];
+    uint32_t interval;          // minimum time between uploads in seconds
 } EmoncmsConfig;
 
 typedef struct {
@@ -136,8 +154,36 @@ typedef struct {
     char username[STRING_LEN];
     char password[STRING_LEN];
     uint32_t pub_interval;
+    float deadband_abs;             // default absolute deadband for report-by-exception
+    float deadband_rel;             // default relative deadband in percent
+    char deadbands[STRING_LEN];     // value-specific deadbands, e.g. "Bat_V=0.05,Solar_W=2%"
+    uint32_t full_refresh;          // publish all values every N intervals (0: never)
+    bool cbor_payload;              // publish data as CBOR instead of JSON
+    bool cbor_ids;                  // use numeric IDs instead of names in CBOR payload
+    uint32_t qos;                   // QoS level of published data (0 or 1)
+    uint32_t batch_size;            // maximum size of batches of messages (0: no batching)
+    uint32_t batch_delay;           // maximum delay of messages in a batch in seconds
 } MqttConfig;
 
+/**
+ * Time since reset in milliseconds when the phases of the startup were finished, 0 if not
+ * finished (yet). Phases partly run in parallel.
+ */
+typedef struct {
+    uint32_t config;                // configuration loaded from NVS
+    uint32_t fs;                    // filesystems mounted
+    uint32_t interfaces;            // CAN and serial interfaces started
+    uint32_t web_server;
+    uint32_t wifi;                  // connected and IP address obtained
+    uint32_t discovery;             // device on the serial interface scanned
+    uint32_t services;              // history, Emoncms and MQTT started
+} BootTimes;
+
+/**
+ * Summary of the request statistics of the web server, exposed in output/http
+ */
+extern HttpStatsSummary http_summary;
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "emon_bulk.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void emon_bulk_init(EmonBulk *bulk, char *buf, size_t size)
+{
+    bulk->buf = buf;
+    bulk->size = size;
+    bulk->len = 0;
+    bulk->num = 0;
+    bulk->dropped = 0;
+}
+
+int emon_bulk_add(EmonBulk *bulk, uint32_t time, const char *node, const char *json)
+{
+    char prefix[sizeof("[4294967295,\"\",")];
+    int prefix_len = snprintf(prefix, sizeof(prefix), "[%u,\"", (unsigned int) time);
+    size_t sample_len = prefix_len + strlen(node) + 2 + strlen(json) + 1;
+    if (sample_len + 1 > bulk->size) {
+        return -1;
+    }
+
+    while (bulk->len + sample_len + 1 > bulk->size) {
+        emon_bulk_remove(bulk, 1);
+        bulk->dropped++;
+    }
+
+    snprintf(bulk->buf + bulk->len, sample_len + 1, "%s%s\",%s]", prefix, node, json);
+    bulk->len += sample_len + 1;
+    bulk->num++;
+    return 0;
+}
+
+int emon_bulk_body(const EmonBulk *bulk, uint32_t sent_at, char *body, size_t size,
+    uint32_t *num)
+{
+    char suffix[sizeof("]&sentat=4294967295")];
+    int suffix_len = snprintf(suffix, sizeof(suffix), "]&sentat=%u", (unsigned int) sent_at);
+    size_t len = sizeof("data=[") - 1;
+
+    *num = 0;
+    if (bulk->num == 0) {
+        return 0;
+    }
+    else if (len + suffix_len >= size) {
+        return -1;
+    }
+    memcpy(body, "data=[", len);
+
+    const char *sample = bulk->buf;
+    while (*num < bulk->num) {
+        size_t sample_len = strlen(sample);
+        size_t sep = (*num > 0) ? 1 : 0;
+        if (len + sep + sample_len + suffix_len >= size) {
+            break;
+        }
+        if (sep) {
+            body[len++] = ',';
+        }
+        memcpy(body + len, sample, sample_len);
+        len += sample_len;
+        sample += sample_len + 1;
+        (*num)++;
+    }
+    if (*num == 0) {
+        return -1;
+    }
+
+    memcpy(body + len, suffix, suffix_len + 1);
+    return len + suffix_len;
+}
+
+void emon_bulk_remove(EmonBulk *bulk, uint32_t num)
+{
+    size_t removed = 0;
+    for (; num > 0 && bulk->num > 0; num--, bulk->num--) {
+        removed += strlen(bulk->buf + removed) + 1;
+    }
+    memmove(bulk->buf, bulk->buf + removed, bulk->len - removed);
+    bulk->len -= removed;
+}
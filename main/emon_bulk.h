@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef EMON_BULK_H_
+#define EMON_BULK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Samples waiting to be uploaded with the Emoncms input/bulk API
+ *
+ * Each sample is stored as [<time>,"<node>",<json>] in the order it was recorded. If the
+ * buffer is full, the oldest samples are dropped.
+ *
+ * Times are seconds of a monotonic clock (e.g. uptime). They are sent together with the
+ * current time of the same clock as "sentat", so that Emoncms calculates the actual time from
+ * its own clock. This way neither the delay of the request nor a missing time synchronization
+ * of the gateway affect the timestamps.
+ */
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;             // used bytes, samples are zero-terminated
+    uint32_t num;           // number of samples
+    uint32_t dropped;       // samples lost because the buffer was full
+} EmonBulk;
+
+void emon_bulk_init(EmonBulk *bulk, char *buf, size_t size);
+
+/**
+ * Add a sample
+ *
+ * \param time Time of the sample in seconds
+ * \param node Name of the Emoncms node
+ * \param json JSON object with the input values
+ *
+ * \returns 0 on success or -1 if the sample is larger than the buffer
+ */
+int emon_bulk_add(EmonBulk *bulk, uint32_t time, const char *node, const char *json);
+
+/**
+ * Build the body of a bulk request with as many of the oldest samples as fit into the buffer,
+ * e.g. data=[[100,"bms",{"Bat_V":13.1}],[110,"bms",{"Bat_V":13.2}]]&sentat=115
+ *
+ * \param sent_at Current time in seconds
+ * \param num Pointer to store the number of samples contained in the request
+ *
+ * \returns Length of the body, 0 if there are no samples or -1 if the buffer is too small for
+ *          the first sample
+ */
+int emon_bulk_body(const EmonBulk *bulk, uint32_t sent_at, char *body, size_t size,
+    uint32_t *num);
+
+/**
+ * Remove the oldest samples, e.g. after they were uploaded
+ */
+void emon_bulk_remove(EmonBulk *bulk, uint32_t num);
+
+#endif /* EMON_BULK_H_ */
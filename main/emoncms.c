@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -21,18 +22,16 @@
 #include "esp_log.h"
 #include "driver/gpio.h"
 #include "nvs_flash.h"
+#include "esp_timer.h"
 #include "sdkconfig.h"
 
-#include "lwip/err.h"
-#include "lwip/sockets.h"
-#include "lwip/sys.h"
-#include "lwip/netdb.h"
-#include "lwip/dns.h"
-
 #include "ts_serial.h"
 #include "can.h"
 #include "wifi.h"
 #include "data_nodes.h"
+#include "emoncms.h"
+#include "http_client.h"
+#include "emon_bulk.h"
 
 static const char* TAG = "emoncms";
 
@@ -40,144 +39,269 @@ extern EmoncmsConfig emon_config;
 
 char http_header[1024];
 
+static HttpClient client;
+
+// the resolved address of the server is reused for this time
+#define DNS_CACHE_TTL_S (60 * 60)
+
+#define STATS_INTERVAL_US (60 * 60 * 1000000LL)
+
+/* set while the task is running, notifications are ignored otherwise */
+static volatile TaskHandle_t emoncms_task;
+
+/* cleared by the task before it exits */
+static volatile bool task_running;
+
+// notification bit used to stop the task, not used by any EMONCMS_DATA_* source
+#define NOTIFY_STOP (1U << 31)
+
+#if CONFIG_EMONCMS_BULK
+/* samples of all devices, uploaded together with one request */
+static EmonBulk bulk;
+
+// space for the request parameters around the samples
+#define BULK_BODY_OVERHEAD 32
+
+/* seconds since boot, used as timestamp of the samples */
+static uint32_t uptime_s()
+{
+    return esp_timer_get_time() / 1000000;
+}
+
+/* bulk endpoint next to the configured post endpoint, e.g. /emoncms/input/bulk */
+static void get_url(char *buf, size_t size)
+{
+    strlcpy(buf, emon_config.url, size);
+    char *endpoint = strrchr(buf, '/');
+    if (endpoint != NULL && strcmp(endpoint, "/post") == 0) {
+        strlcpy(endpoint, "/bulk", size - (endpoint - buf));
+    }
+}
+#else
+static void get_url(char *buf, size_t size)
+{
+    strlcpy(buf, emon_config.url, size);
+}
+#endif
+
 void build_header()
 {
+    char url[STRING_LEN];
+    get_url(url, sizeof(url));
+
+    // Content-Length and the end of the header are added by the HTTP client
     snprintf(http_header, sizeof(http_header),
         "POST %s HTTP/1.1\r\n"
         "Host: %s\r\n"
         "Authorization: %s\r\n"
         "User-Agent: esp-idf/1.0 esp32\r\n"
         "Content-Type: application/x-www-form-urlencoded\r\n"
-        "Connection: close\r\n", emon_config.url, emon_config.emoncms_hostname, emon_config.api_key);
+        "Connection: keep-alive\r\n", url, emon_config.emoncms_hostname, emon_config.api_key);
         ESP_LOGD(TAG, "Header (%d bytes): \n%s", strlen(http_header), http_header);
 }
 
-static int send_emoncms(struct addrinfo *res, const char *node_name, const char *json_str)
+#if !CONFIG_EMONCMS_BULK
+
+static int send_emoncms(const char *node_name, const char *json_str)
 {
-    static char buf[500];
     static char http_body[600];
-    char recv_buf[64];
+    HttpResponse resp;
 
     snprintf(http_body, sizeof(http_body), "node=%s&json=%s", node_name, json_str);
     printf("HTTP body for %s: %s\n", node_name, http_body);
 
-    int s = socket(res->ai_family, res->ai_socktype, 0);
-    if (s < 0) {
-        ESP_LOGE(TAG, "... Failed to allocate socket.");
+    int status = http_client_request(&client, http_header, http_body, &resp);
+    if (status < 0) {
+        ESP_LOGE(TAG, "... request failed");
         return -1;
     }
-    ESP_LOGI(TAG, "... allocated socket\r\n");
+    ESP_LOGI(TAG, "... response %d: %s", status, resp.body);
 
-    if (connect(s, res->ai_addr, res->ai_addrlen) != 0) {
-        ESP_LOGE(TAG, "... socket connect failed errno=%d", errno);
-        close(s);
-        return -1;
-    }
-    ESP_LOGI(TAG, "... connected");
+    return 1;
+}
 
-    int err = write(s, http_header, strlen(http_header));
-    sprintf(buf, "Content-Length: %d\r\n\r\n", (int)strlen(http_body));
-    err += write(s, buf, strlen(buf));
-    err += write(s, http_body, strlen(http_body));
-    err += write(s, "\r\n", 1);
+#else
 
-    if (err < 0) {
-        ESP_LOGE(TAG, "... socket send failed");
-        close(s);
-        return -1;
+/* uploads all buffered samples, they are kept in the buffer if the upload fails */
+static void send_bulk()
+{
+    char *body = (char *) malloc(bulk.len + BULK_BODY_OVERHEAD);
+    if (body == NULL) {
+        return;
     }
-    ESP_LOGI(TAG, "... socket send success");
 
-    // Read HTTP response
-    int resp;
-    do {
-        bzero(recv_buf, sizeof(recv_buf));
-        resp = read(s, recv_buf, sizeof(recv_buf)-1);
-        for(int i = 0; i < resp; i++) {
-            putchar(recv_buf[i]);
+    uint32_t num;
+    int len = emon_bulk_body(&bulk, uptime_s(), body, bulk.len + BULK_BODY_OVERHEAD, &num);
+    if (len > 0) {
+        ESP_LOGD(TAG, "HTTP body: %s", body);
+        HttpResponse resp;
+        int status = http_client_request(&client, http_header, body, &resp);
+        if (status >= 200 && status < 300) {
+            ESP_LOGI(TAG, "%u samples uploaded, response: %s", (unsigned int) num, resp.body);
+            emon_bulk_remove(&bulk, num);
         }
-    } while (resp > 0);
+        else {
+            ESP_LOGW(TAG, "Bulk upload failed (status %d), %u samples buffered", status,
+                (unsigned int) bulk.num);
+        }
+    }
+    free(body);
+}
 
-    ESP_LOGI(TAG, "... done reading from socket. Last read return=%d errno=%d\r\n", resp, errno);
-    close(s);
+#endif /* CONFIG_EMONCMS_BULK */
 
-    return 1;
+/* adds the data to the bulk upload or sends it immediately */
+static void upload(const char *node_name, const char *json_str)
+{
+#if CONFIG_EMONCMS_BULK
+    uint32_t dropped = bulk.dropped;
+    if (emon_bulk_add(&bulk, uptime_s(), node_name, json_str) < 0) {
+        ESP_LOGE(TAG, "Data of %s too large for bulk buffer", node_name);
+    }
+    if (bulk.dropped != dropped) {
+        ESP_LOGW(TAG, "Bulk buffer full, %u oldest samples lost",
+            (unsigned int) (bulk.dropped - dropped));
+    }
+#else
+    send_emoncms(node_name, json_str);
+#endif
 }
 
-void emoncms_post_task(void *arg)
+/* logs the traffic of the last hour */
+static void log_stats(HttpClientStats *last, int64_t *last_us)
 {
-    build_header();
-    const struct addrinfo hints = {
-        .ai_family = AF_INET,
-        .ai_socktype = SOCK_STREAM,
-    };
-    struct addrinfo *res;
-    struct in_addr *addr;
+    int64_t now = esp_timer_get_time();
+    if (now - *last_us < STATS_INTERVAL_US) {
+        return;
+    }
+    HttpClientStats *cur = &client.stats;
+    ESP_LOGI(TAG, "Last hour: %u requests, %u errors, %u connects, %u DNS lookups, "
+        "%u bytes sent, %u bytes received",
+        (unsigned int) (cur->requests - last->requests),
+        (unsigned int) (cur->errors - last->errors),
+        (unsigned int) (cur->connects - last->connects),
+        (unsigned int) (cur->dns_lookups - last->dns_lookups),
+        (unsigned int) (cur->bytes_sent - last->bytes_sent),
+        (unsigned int) (cur->bytes_received - last->bytes_received));
+    *last = *cur;
+    *last_us = now;
+}
 
-    while (1) {
-        esp_err_t err;
+void emoncms_notify(uint32_t sources)
+{
+    TaskHandle_t task = emoncms_task;
+    if (task != NULL) {
+        xTaskNotify(task, sources, eSetBits);
+    }
+}
 
-        // attempt to get serial publication message
+/* collects the latest data of all sources with updates since the last upload */
+static void upload_sources(uint32_t sources)
+{
+    if (sources & EMONCMS_DATA_BMS) {
+        upload(emon_config.bms, get_bms_json_data());
+    }
+    if (sources & EMONCMS_DATA_MPPT) {
+        upload(emon_config.mppt, get_mppt_json_data());
+    }
+    if (sources & EMONCMS_DATA_SERIAL) {
         char *pub_msg = ts_serial_pubmsg(100);
-
-        // wait until we receive an update
-        while (update_bms_received == false &&
-               update_mppt_received == false &&
-               pub_msg == NULL)
-        {
-            // try again as long as a message from
-            pub_msg = ts_serial_pubmsg(100);
-            vTaskDelay(100/portTICK_PERIOD_MS);
+        if (pub_msg != NULL) {
+            if (strlen(pub_msg) > 2) {
+                upload(emon_config.serial_node, pub_msg + 2);
+            }
+            ts_serial_pubmsg_clear();
         }
+    }
+#if CONFIG_EMONCMS_BULK
+    send_bulk();
+#endif
+}
 
-        //esp_netif_ip_info_t ip_info;
-        //err = esp_netif_get_ip_info(wifi_get_netif, &ip_info);
+static void emoncms_post_task(void *arg)
+{
+    build_header();
+    http_client_init(&client, emon_config.emoncms_hostname, emon_config.port, DNS_CACHE_TTL_S);
+
+#if CONFIG_EMONCMS_BULK
+    char *bulk_buf = (char *) malloc(CONFIG_EMONCMS_BULK_BUFFER_SIZE);
+    if (bulk_buf == NULL) {
+        ESP_LOGE(TAG, "Allocating bulk buffer failed");
+        emoncms_task = NULL;
+        task_running = false;
+        vTaskDelete(NULL);
+    }
+    emon_bulk_init(&bulk, bulk_buf, CONFIG_EMONCMS_BULK_BUFFER_SIZE);
+#endif
 
-        err = getaddrinfo(emon_config.emoncms_hostname, emon_config.port, &hints, &res);
+    HttpClientStats last_stats = client.stats;
+    int64_t last_stats_us = esp_timer_get_time();
 
-        if (err != 0 || res == NULL) {
-            ESP_LOGE(TAG, "DNS lookup failed err=%d res=%p", err, res);
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-            continue;
-        }
+    uint32_t pending = 0;
+    TickType_t last_upload = xTaskGetTickCount();
 
-        // Code to print the resolved IP.
-        // Note: inet_ntoa is non-reentrant, look at ipaddr_ntoa_r for "real" code
-        addr = &((struct sockaddr_in *)res->ai_addr)->sin_addr;
-        ESP_LOGI(TAG, "DNS lookup succeeded. IP=%s", inet_ntoa(*addr));
+    while (!(pending & NOTIFY_STOP)) {
+        // interval may be changed at runtime
+        TickType_t interval = MAX(emon_config.interval, 1) * configTICK_RATE_HZ;
+        TickType_t elapsed = xTaskGetTickCount() - last_upload;
 
-        if (update_bms_received) {
-            gpio_set_level(CONFIG_GPIO_LED, 0);
-            send_emoncms(res, emon_config.bms, get_bms_json_data());
-            update_bms_received = false;
-            vTaskDelay(100 / portTICK_PERIOD_MS);
+        uint32_t sources = 0;
+        if (pending == 0) {
+            // sleep until any receive path reports new data
+            xTaskNotifyWait(0, UINT32_MAX, &sources, portMAX_DELAY);
         }
-        gpio_set_level(CONFIG_GPIO_LED, 1);
-
-        vTaskDelay(100 / portTICK_PERIOD_MS);
+        else if (elapsed < interval) {
+            // further updates are collected until the interval has passed
+            xTaskNotifyWait(0, UINT32_MAX, &sources, interval - elapsed);
+        }
+        pending |= sources;
 
-        if (update_mppt_received) {
-            gpio_set_level(CONFIG_GPIO_LED, 0);
-            send_emoncms(res, emon_config.mppt, get_mppt_json_data());
-            update_mppt_received = false;
-            vTaskDelay(100 / portTICK_PERIOD_MS);
+        if (pending == 0 || (pending & NOTIFY_STOP) ||
+            xTaskGetTickCount() - last_upload < interval)
+        {
+            continue;
         }
+        last_upload = xTaskGetTickCount();
+
+        gpio_set_level(CONFIG_GPIO_LED, 0);
+        upload_sources(pending);
+        pending = 0;
         gpio_set_level(CONFIG_GPIO_LED, 1);
 
-        vTaskDelay(100 / portTICK_PERIOD_MS);
+        log_stats(&last_stats, &last_stats_us);
+    }
 
-        if (pub_msg != NULL && strlen(pub_msg) > 2) {
-            gpio_set_level(CONFIG_GPIO_LED, 0);
-            send_emoncms(res, emon_config.serial_node, pub_msg + 2);
-            ts_serial_pubmsg_clear();
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-        }
-        gpio_set_level(CONFIG_GPIO_LED, 1);
+    // samples not uploaded yet are dropped, the server may have been changed
+    http_client_close(&client);
+#if CONFIG_EMONCMS_BULK
+    free(bulk_buf);
+#endif
+    ESP_LOGI(TAG, "Emoncms upload stopped");
+    task_running = false;
+    vTaskDelete(NULL);
+}
 
-        // sending interval almost 10s
-        vTaskDelay(8000 / portTICK_PERIOD_MS);
+void emoncms_start()
+{
+    if (task_running || !emon_config.active) {
+        return;
+    }
+    task_running = true;
+    xTaskCreate(&emoncms_post_task, "emoncms_post_task", 4096, NULL, 5,
+        (TaskHandle_t *) &emoncms_task);
+}
 
-        freeaddrinfo(res);
+void emoncms_stop()
+{
+    TaskHandle_t task = emoncms_task;
+    if (task == NULL) {
+        return;
+    }
+    // receive paths don't notify the task anymore
+    emoncms_task = NULL;
+    xTaskNotify(task, NOTIFY_STOP, eSetBits);
+    while (task_running) {
+        vTaskDelay(pdMS_TO_TICKS(10));
     }
 }
 
@@ -4,7 +4,40 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#ifndef EMONCMS_H_
+#define EMONCMS_H_
+
+#include <stdint.h>
+
+/*
+ * Sources of new data, passed to emoncms_notify
+ */
+#define EMONCMS_DATA_SERIAL (1U << 0)   // publication message received via UART
+#define EMONCMS_DATA_BMS    (1U << 1)   // data object of BMS received via CAN
+#define EMONCMS_DATA_MPPT   (1U << 2)   // data object of MPPT received via CAN
+
+/**
+ * Start the task sending HTTP post requests to the specified Emoncms server whenever new data
+ * was received, but not more often than the configured interval
+ *
+ * Does nothing if Emoncms is not active in the configuration or the task is already running.
+ */
+void emoncms_start();
+
+/**
+ * Stop the upload task and close the connection, e.g. to apply a new configuration
+ *
+ * Waits until a running upload is finished. Data not uploaded yet is dropped.
+ */
+void emoncms_stop();
+
 /**
- * Sends HTTP post request to specified Emoncms server in 10s interval
+ * Inform the Emoncms task about new data, can be called from any task
+ *
+ * Does nothing if Emoncms is not active.
+ *
+ * \param sources EMONCMS_DATA_* flags of the sources with new data
  */
-void emoncms_post_task(void *arg);
+void emoncms_notify(uint32_t sources);
+
+#endif /* EMONCMS_H_ */
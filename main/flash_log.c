@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "flash_log.h"
+
+#include <string.h>
+
+#define SECTOR_MAGIC 0x474F4C46     // "FLOG"
+
+// record states, bits are only cleared while a record passes through them
+#define STATE_ERASED    0xFF
+#define STATE_WRITTEN   0xFE        // header written, data may be incomplete
+#define STATE_VALID     0xFC        // data complete
+#define STATE_READ      0xF8        // delivered, can be overwritten
+
+#define ALIGN4(x) (((x) + 3) & ~3U)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;           // increased with each use of a sector
+    uint32_t erase_count;
+    uint32_t crc;
+} SectorHeader;
+
+typedef struct {
+    uint16_t len;
+    uint8_t state;
+    uint8_t reserved;
+    uint32_t timestamp;
+    uint32_t crc;           // of length, timestamp and data
+} RecordHeader;
+
+static uint32_t crc32(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *bytes = (const uint8_t *) data;
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t record_crc_start(const RecordHeader *hdr)
+{
+    uint32_t crc = crc32(0, &hdr->len, sizeof(hdr->len));
+    return crc32(crc, &hdr->timestamp, sizeof(hdr->timestamp));
+}
+
+static uint32_t sector_addr(uint32_t sector)
+{
+    return sector * FLASH_LOG_SECTOR_SIZE;
+}
+
+static bool read_sector_header(FlashLog *log, uint32_t sector, SectorHeader *hdr)
+{
+    return log->io.read(log->io.ctx, sector_addr(sector), hdr, sizeof(SectorHeader)) == 0 &&
+        hdr->magic == SECTOR_MAGIC &&
+        hdr->crc == crc32(0, hdr, offsetof(SectorHeader, crc));
+}
+
+/*
+ * Reads the header of the record at offset
+ *
+ * \returns Size of the record in the sector, 0 at the end of the data in the sector, -1 if the
+ *          header is damaged (remainder of the sector can't be used) or -2 if reading failed
+ */
+static int read_record(FlashLog *log, uint32_t sector, uint32_t offset, RecordHeader *hdr)
+{
+    if (offset + sizeof(RecordHeader) > FLASH_LOG_SECTOR_SIZE) {
+        return 0;
+    }
+    if (log->io.read(log->io.ctx, sector_addr(sector) + offset, hdr, sizeof(RecordHeader))) {
+        return -2;
+    }
+    if (hdr->len == 0xFFFF && hdr->state == STATE_ERASED) {
+        return 0;
+    }
+    uint32_t size = ALIGN4(sizeof(RecordHeader) + hdr->len);
+    if (hdr->len > FLASH_LOG_RECORD_MAX || offset + size > FLASH_LOG_SECTOR_SIZE ||
+        hdr->state == STATE_ERASED)
+    {
+        return -1;
+    }
+    return size;
+}
+
+/* checks the CRC of a complete record without reading it into RAM at once */
+static bool record_intact(FlashLog *log, uint32_t sector, uint32_t offset,
+    const RecordHeader *hdr)
+{
+    uint8_t buf[64];
+    uint32_t crc = record_crc_start(hdr);
+    uint32_t addr = sector_addr(sector) + offset + sizeof(RecordHeader);
+    for (uint32_t pos = 0; pos < hdr->len; pos += sizeof(buf)) {
+        uint32_t len = hdr->len - pos < sizeof(buf) ? hdr->len - pos : sizeof(buf);
+        if (log->io.read(log->io.ctx, addr + pos, buf, len)) {
+            return false;
+        }
+        crc = crc32(crc, buf, len);
+    }
+    return crc == hdr->crc;
+}
+
+static int set_record_state(FlashLog *log, uint32_t sector, uint32_t offset, uint8_t state)
+{
+    return log->io.write(log->io.ctx,
+        sector_addr(sector) + offset + offsetof(RecordHeader, state), &state, 1);
+}
+
+/* erases the sector and makes it the new head, keeping track of its erase counter */
+static int start_sector(FlashLog *log, uint32_t sector, uint32_t seq)
+{
+    SectorHeader hdr;
+    uint32_t erase_count = read_sector_header(log, sector, &hdr) ? hdr.erase_count + 1 : 1;
+    if (log->io.erase(log->io.ctx, sector_addr(sector))) {
+        return -1;
+    }
+    hdr.magic = SECTOR_MAGIC;
+    hdr.seq = seq;
+    hdr.erase_count = erase_count;
+    hdr.crc = crc32(0, &hdr, offsetof(SectorHeader, crc));
+    if (log->io.write(log->io.ctx, sector_addr(sector), &hdr, sizeof(hdr))) {
+        return -1;
+    }
+    log->head_sector = sector;
+    log->head_seq = seq;
+    log->head_offset = sizeof(SectorHeader);
+    return 0;
+}
+
+static uint32_t count_unread(FlashLog *log, uint32_t sector, uint32_t offset)
+{
+    uint32_t num = 0;
+    RecordHeader hdr;
+    int size;
+    while ((size = read_record(log, sector, offset, &hdr)) > 0) {
+        if (hdr.state == STATE_VALID) {
+            num++;
+        }
+        offset += size;
+    }
+    return num;
+}
+
+int flash_log_mount(FlashLog *log, const FlashLogIO *io)
+{
+    memset(log, 0, sizeof(FlashLog));
+    log->io = *io;
+    log->num_sectors = io->size / FLASH_LOG_SECTOR_SIZE;
+    if (log->num_sectors < 2) {
+        return -1;
+    }
+
+    bool found = false;
+    SectorHeader sector_hdr;
+    for (uint32_t s = 0; s < log->num_sectors; s++) {
+        if (read_sector_header(log, s, &sector_hdr) && (!found || sector_hdr.seq > log->head_seq)) {
+            log->head_sector = s;
+            log->head_seq = sector_hdr.seq;
+            found = true;
+        }
+    }
+    if (!found) {
+        // no valid log yet
+        if (start_sector(log, 0, 1)) {
+            return -1;
+        }
+        log->tail_sector = log->head_sector;
+        log->tail_offset = log->head_offset;
+        return 0;
+    }
+
+    // continue writing behind the last complete record of the head sector
+    RecordHeader hdr;
+    int size;
+    uint32_t offset = sizeof(SectorHeader);
+    while ((size = read_record(log, log->head_sector, offset, &hdr)) > 0) {
+        if (hdr.state != STATE_VALID && hdr.state != STATE_READ) {
+            // writing was interrupted, so the free space might not be erased anymore
+            size = -1;
+            break;
+        }
+        offset += size;
+    }
+    if (size == -2) {
+        return -1;
+    }
+    log->head_offset = (size < 0) ? FLASH_LOG_SECTOR_SIZE : offset;
+    log->tail_sector = log->head_sector;
+    log->tail_offset = log->head_offset;
+
+    // sectors are used in ring order, so the oldest one follows the head
+    bool tail_found = false;
+    for (uint32_t i = 1; i <= log->num_sectors; i++) {
+        uint32_t s = (log->head_sector + i) % log->num_sectors;
+        if (!read_sector_header(log, s, &sector_hdr) ||
+            (s != log->head_sector && sector_hdr.seq >= log->head_seq))
+        {
+            continue;
+        }
+        offset = sizeof(SectorHeader);
+        while ((size = read_record(log, s, offset, &hdr)) > 0) {
+            if (hdr.state == STATE_VALID && record_intact(log, s, offset, &hdr)) {
+                if (!tail_found) {
+                    log->tail_sector = s;
+                    log->tail_offset = offset;
+                    tail_found = true;
+                }
+                log->count++;
+            }
+            offset += size;
+        }
+    }
+    return 0;
+}
+
+int flash_log_append(FlashLog *log, uint32_t timestamp, const void *data, size_t len)
+{
+    if (len > FLASH_LOG_RECORD_MAX) {
+        return -1;
+    }
+    uint32_t size = ALIGN4(sizeof(RecordHeader) + len);
+
+    if (log->head_offset + size > FLASH_LOG_SECTOR_SIZE) {
+        uint32_t next = (log->head_sector + 1) % log->num_sectors;
+        if (log->count > 0 && log->tail_sector == next) {
+            // log is full, the oldest records are lost
+            uint32_t lost = count_unread(log, next, log->tail_offset);
+            log->dropped += lost;
+            log->count -= lost < log->count ? lost : log->count;
+            log->tail_sector = (next + 1) % log->num_sectors;
+            log->tail_offset = sizeof(SectorHeader);
+        }
+        if (start_sector(log, next, log->head_seq + 1)) {
+            return -1;
+        }
+    }
+
+    RecordHeader hdr = {
+        .len = len,
+        .state = STATE_WRITTEN,
+        .reserved = 0xFF,
+        .timestamp = timestamp,
+    };
+    hdr.crc = crc32(record_crc_start(&hdr), data, len);
+
+    uint32_t addr = sector_addr(log->head_sector) + log->head_offset;
+    if (log->io.write(log->io.ctx, addr, &hdr, sizeof(hdr)) ||
+        log->io.write(log->io.ctx, addr + sizeof(hdr), data, len) ||
+        set_record_state(log, log->head_sector, log->head_offset, STATE_VALID))
+    {
+        // don't write into this sector anymore, the record will be skipped
+        log->head_offset = FLASH_LOG_SECTOR_SIZE;
+        return -1;
+    }
+
+    if (log->count == 0) {
+        log->tail_sector = log->head_sector;
+        log->tail_offset = log->head_offset;
+    }
+    log->head_offset += size;
+    log->count++;
+    return 0;
+}
+
+int flash_log_peek(FlashLog *log, uint32_t *timestamp, void *buf, size_t size)
+{
+    while (log->count > 0) {
+        RecordHeader hdr;
+        bool at_head = (log->tail_sector == log->head_sector);
+        int rec_size = 0;
+        if (!at_head || log->tail_offset < log->head_offset) {
+            rec_size = read_record(log, log->tail_sector, log->tail_offset, &hdr);
+        }
+        if (rec_size == -2) {
+            return -1;
+        }
+        else if (rec_size <= 0) {
+            if (at_head) {
+                // remaining records were damaged
+                log->count = 0;
+                return 0;
+            }
+            log->tail_sector = (log->tail_sector + 1) % log->num_sectors;
+            log->tail_offset = sizeof(SectorHeader);
+            continue;
+        }
+
+        if (hdr.state == STATE_VALID) {
+            if (hdr.len > size) {
+                return -1;
+            }
+            uint32_t addr = sector_addr(log->tail_sector) + log->tail_offset +
+                sizeof(RecordHeader);
+            if (log->io.read(log->io.ctx, addr, buf, hdr.len)) {
+                return -1;
+            }
+            if (crc32(record_crc_start(&hdr), buf, hdr.len) == hdr.crc) {
+                *timestamp = hdr.timestamp;
+                return hdr.len;
+            }
+            log->count--;
+        }
+        log->tail_offset += rec_size;
+    }
+    return 0;
+}
+
+int flash_log_pop(FlashLog *log)
+{
+    RecordHeader hdr;
+    if (log->count == 0 ||
+        read_record(log, log->tail_sector, log->tail_offset, &hdr) <= 0 ||
+        hdr.state != STATE_VALID)
+    {
+        return -1;
+    }
+    if (set_record_state(log, log->tail_sector, log->tail_offset, STATE_READ)) {
+        return -1;
+    }
+    log->tail_offset += ALIGN4(sizeof(RecordHeader) + hdr.len);
+    log->count--;
+    return 0;
+}
+
+void flash_log_iter_init(FlashLog *log, FlashLogIter *it)
+{
+    // the sector following the head is the oldest one
+    it->sector = log->head_sector;
+    it->offset = FLASH_LOG_SECTOR_SIZE;
+    it->remaining = log->num_sectors;
+}
+
+int flash_log_iter_next(FlashLog *log, FlashLogIter *it, uint32_t *timestamp, void *buf,
+    size_t size)
+{
+    while (true) {
+        RecordHeader hdr;
+        int rec_size = read_record(log, it->sector, it->offset, &hdr);
+        if (rec_size == -2) {
+            return -1;
+        }
+        else if (rec_size <= 0) {
+            if (it->remaining == 0) {
+                return 0;
+            }
+            it->sector = (it->sector + 1) % log->num_sectors;
+            it->remaining--;
+            SectorHeader sector_hdr;
+            bool used = read_sector_header(log, it->sector, &sector_hdr) &&
+                (it->sector == log->head_sector || sector_hdr.seq < log->head_seq);
+            it->offset = used ? sizeof(SectorHeader) : FLASH_LOG_SECTOR_SIZE;
+            continue;
+        }
+
+        uint32_t addr = sector_addr(it->sector) + it->offset + sizeof(RecordHeader);
+        it->offset += rec_size;
+        if ((hdr.state != STATE_VALID && hdr.state != STATE_READ) || hdr.len > size) {
+            continue;
+        }
+        if (log->io.read(log->io.ctx, addr, buf, hdr.len)) {
+            return -1;
+        }
+        if (crc32(record_crc_start(&hdr), buf, hdr.len) == hdr.crc) {
+            *timestamp = hdr.timestamp;
+            return hdr.len;
+        }
+    }
+}
+
+#ifndef UNIT_TEST
+
+#include "esp_partition.h"
+
+static int partition_read(void *ctx, uint32_t addr, void *buf, size_t len)
+{
+    FlashLogArea *area = (FlashLogArea *) ctx;
+    return esp_partition_read((const esp_partition_t *) area->partition, area->offset + addr,
+        buf, len) == ESP_OK ? 0 : -1;
+}
+
+static int partition_write(void *ctx, uint32_t addr, const void *buf, size_t len)
+{
+    FlashLogArea *area = (FlashLogArea *) ctx;
+    return esp_partition_write((const esp_partition_t *) area->partition, area->offset + addr,
+        buf, len) == ESP_OK ? 0 : -1;
+}
+
+static int partition_erase(void *ctx, uint32_t addr)
+{
+    FlashLogArea *area = (FlashLogArea *) ctx;
+    return esp_partition_erase_range((const esp_partition_t *) area->partition,
+        area->offset + addr, FLASH_LOG_SECTOR_SIZE) == ESP_OK ? 0 : -1;
+}
+
+void flash_log_partition_io(FlashLogIO *io, FlashLogArea *area, uint32_t size)
+{
+    io->read = partition_read;
+    io->write = partition_write;
+    io->erase = partition_erase;
+    io->ctx = area;
+    io->size = size - size % FLASH_LOG_SECTOR_SIZE;
+}
+
+#endif /* UNIT_TEST */
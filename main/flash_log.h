@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FLASH_LOG_H_
+#define FLASH_LOG_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FLASH_LOG_SECTOR_SIZE 4096
+#define FLASH_LOG_RECORD_MAX 2048       // maximum size of record data
+
+/**
+ * Access to the flash area used for the log (addresses relative to its start)
+ *
+ * Functions return 0 on success. Like NOR flash, written bits can only be changed from 1 to 0
+ * until the sector is erased.
+ */
+typedef struct {
+    int (*read)(void *ctx, uint32_t addr, void *buf, size_t len);
+    int (*write)(void *ctx, uint32_t addr, const void *buf, size_t len);
+    int (*erase)(void *ctx, uint32_t addr);     // erases the sector starting at addr
+    void *ctx;
+    uint32_t size;                              // multiple of FLASH_LOG_SECTOR_SIZE
+} FlashLogIO;
+
+/**
+ * Persistent append-only FIFO of records in a ring of flash sectors
+ *
+ * Each sector starts with a header containing a sequence number and its erase counter. Sectors
+ * are used in ring order, so all of them are erased equally often. If the log is full, the
+ * sector with the oldest records is overwritten.
+ *
+ * Records are protected by a CRC and a state byte which is programmed step by step (header
+ * written, data complete, read), so records interrupted by a reset are detected and skipped.
+ * Records returned by flash_log_peek are only marked as read by flash_log_pop, so they are
+ * delivered at least once.
+ */
+typedef struct {
+    FlashLogIO io;
+    uint32_t num_sectors;
+    uint32_t head_sector;       // sector currently written
+    uint32_t head_offset;       // next write position in head sector
+    uint32_t head_seq;
+    uint32_t tail_sector;       // position of the oldest unread record
+    uint32_t tail_offset;
+    uint32_t count;             // number of unread records
+    uint32_t dropped;           // unread records overwritten because the log was full
+} FlashLog;
+
+/**
+ * Position for reading all records of the log, independent of their read state
+ */
+typedef struct {
+    uint32_t sector;
+    uint32_t offset;
+    uint32_t remaining;         // sectors not visited yet
+} FlashLogIter;
+
+/**
+ * Scan the flash area and restore the state of the log, an empty log is created if the area
+ * does not contain a valid log
+ *
+ * \returns 0 on success or -1 if the flash could not be accessed or is too small
+ */
+int flash_log_mount(FlashLog *log, const FlashLogIO *io);
+
+/**
+ * Append a record
+ *
+ * \returns 0 on success or -1 in case of error
+ */
+int flash_log_append(FlashLog *log, uint32_t timestamp, const void *data, size_t len);
+
+/**
+ * Read the oldest unread record without removing it
+ *
+ * \returns Length of the record, 0 if the log is empty or -1 if the buffer is too small or
+ *          the flash could not be read
+ */
+int flash_log_peek(FlashLog *log, uint32_t *timestamp, void *buf, size_t size);
+
+/**
+ * Mark the record returned by the last call of flash_log_peek as read
+ *
+ * \returns 0 on success or -1 in case of error
+ */
+int flash_log_pop(FlashLog *log);
+
+/**
+ * Start reading all records from the oldest one, e.g. if the log is used as a ring buffer of
+ * historical data instead of a FIFO
+ */
+void flash_log_iter_init(FlashLog *log, FlashLogIter *it);
+
+/**
+ * Read the next record, records which are larger than the buffer or damaged are skipped
+ *
+ * The log must not be changed while iterating.
+ *
+ * \returns Length of the record, 0 if there are no more records or -1 if the flash could not
+ *          be read
+ */
+int flash_log_iter_next(FlashLog *log, FlashLogIter *it, uint32_t *timestamp, void *buf,
+    size_t size);
+
+/**
+ * Area of an ESP-IDF flash partition used for a log
+ */
+typedef struct {
+    const void *partition;      // esp_partition_t
+    uint32_t offset;            // start of the area within the partition
+} FlashLogArea;
+
+/**
+ * Set up the access to an area of a flash partition
+ *
+ * \param area Partition and offset of the area, must stay valid while the log is mounted
+ * \param size Size of the area, rounded down to a multiple of FLASH_LOG_SECTOR_SIZE
+ */
+void flash_log_partition_io(FlashLogIO *io, FlashLogArea *area, uint32_t size);
+
+#endif /* FLASH_LOG_H_ */
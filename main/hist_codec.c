@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "hist_codec.h"
+
+#include <string.h>
+
+#define DATA_BITS (sizeof(((HistBlock *) 0)->data) * 8)
+
+// worst case size of a sample without the series index (new series with 32-bit time offset)
+#define SAMPLE_BITS_MAX (32 + 36 + 32)
+
+// leading/trailing zeros of a series without previous XOR value
+#define NO_WINDOW 0xFF
+
+/* number of bits needed to store the series index 0..num_series (num_series means new series) */
+static int index_bits(uint32_t num_series)
+{
+    int bits = 0;
+    while (num_series >> bits) {
+        bits++;
+    }
+    return bits;
+}
+
+/* appends the n lowest bits of value (MSB first), n <= 32 */
+static void write_bits(HistBlock *block, uint32_t value, int n)
+{
+    while (n > 0) {
+        uint32_t pos = block->hdr.bits;
+        int free = 8 - pos % 8;
+        int len = n < free ? n : free;
+        uint8_t part = (value >> (n - len)) & ((1U << len) - 1);
+        uint8_t *byte = &block->data[pos / 8];
+        if (free == 8) {
+            // data behind the used bits is undefined
+            *byte = 0;
+        }
+        *byte |= part << (free - len);
+        block->hdr.bits += len;
+        n -= len;
+    }
+}
+
+static bool read_bits(HistBlockReader *reader, int n, uint32_t *value)
+{
+    if (reader->pos + n > reader->block->hdr.bits) {
+        return false;
+    }
+    uint32_t v = 0;
+    while (n > 0) {
+        int avail = 8 - reader->pos % 8;
+        int len = n < avail ? n : avail;
+        uint8_t byte = reader->block->data[reader->pos / 8];
+        v = (v << len) | ((byte >> (avail - len)) & ((1U << len) - 1));
+        reader->pos += len;
+        n -= len;
+    }
+    *value = v;
+    return true;
+}
+
+/*
+ * Delta-of-delta of timestamps with variable length:
+ *   0                      -> '0'
+ *   [-63, 64]              -> '10' + 7 bits
+ *   [-255, 256]            -> '110' + 9 bits
+ *   [-2047, 2048]          -> '1110' + 12 bits
+ *   otherwise              -> '1111' + 32 bits
+ */
+static void write_dod(HistBlock *block, int32_t dod)
+{
+    if (dod == 0) {
+        write_bits(block, 0, 1);
+    }
+    else if (dod >= -63 && dod <= 64) {
+        write_bits(block, 0x2, 2);
+        write_bits(block, dod + 63, 7);
+    }
+    else if (dod >= -255 && dod <= 256) {
+        write_bits(block, 0x6, 3);
+        write_bits(block, dod + 255, 9);
+    }
+    else if (dod >= -2047 && dod <= 2048) {
+        write_bits(block, 0xE, 4);
+        write_bits(block, dod + 2047, 12);
+    }
+    else {
+        write_bits(block, 0xF, 4);
+        write_bits(block, (uint32_t) dod, 32);
+    }
+}
+
+static bool read_dod(HistBlockReader *reader, int32_t *dod)
+{
+    static const int value_bits[] = { 7, 9, 12, 32 };
+    static const int32_t offsets[] = { 63, 255, 2047, 0 };
+    uint32_t bit;
+    int ones = 0;
+    while (ones < 4) {
+        if (!read_bits(reader, 1, &bit)) {
+            return false;
+        }
+        if (bit == 0) {
+            break;
+        }
+        ones++;
+    }
+    if (ones == 0) {
+        *dod = 0;
+        return true;
+    }
+    uint32_t value;
+    if (!read_bits(reader, value_bits[ones - 1], &value)) {
+        return false;
+    }
+    *dod = (int32_t) value - offsets[ones - 1];
+    return true;
+}
+
+/*
+ * XOR with the previous value of the series:
+ *   identical              -> '0'
+ *   within previous window -> '10' + meaningful bits of the previous window
+ *   otherwise              -> '11' + 5 bits leading zeros + 5 bits length - 1 + meaningful bits
+ */
+static void write_value(HistBlock *block, HistSeriesState *series, uint32_t bits)
+{
+    uint32_t xor = bits ^ series->bits;
+    if (xor == 0) {
+        write_bits(block, 0, 1);
+        return;
+    }
+    int leading = __builtin_clz(xor);
+    int trailing = __builtin_ctz(xor);
+    if (series->leading != NO_WINDOW && leading >= series->leading &&
+        trailing >= series->trailing)
+    {
+        write_bits(block, 0x2, 2);
+        write_bits(block, xor >> series->trailing, 32 - series->leading - series->trailing);
+    }
+    else {
+        int len = 32 - leading - trailing;
+        write_bits(block, 0x3, 2);
+        write_bits(block, leading, 5);
+        write_bits(block, len - 1, 5);
+        write_bits(block, xor >> trailing, len);
+        series->leading = leading;
+        series->trailing = trailing;
+    }
+}
+
+static bool read_value(HistBlockReader *reader, HistSeriesState *series)
+{
+    uint32_t bit, xor;
+    if (!read_bits(reader, 1, &bit)) {
+        return false;
+    }
+    if (bit == 0) {
+        return true;
+    }
+    if (!read_bits(reader, 1, &bit)) {
+        return false;
+    }
+    if (bit == 0) {
+        if (series->leading == NO_WINDOW ||
+            !read_bits(reader, 32 - series->leading - series->trailing, &xor))
+        {
+            return false;
+        }
+    }
+    else {
+        uint32_t leading, len;
+        if (!read_bits(reader, 5, &leading) || !read_bits(reader, 5, &len) ||
+            leading + len + 1 > 32 || !read_bits(reader, len + 1, &xor))
+        {
+            return false;
+        }
+        series->leading = leading;
+        series->trailing = 32 - leading - (len + 1);
+    }
+    series->bits ^= xor << series->trailing;
+    return true;
+}
+
+void hist_block_start(HistBlock *block, HistCodec *codec, uint32_t seq)
+{
+    block->hdr.seq = seq;
+    block->hdr.first_time = 0;
+    block->hdr.last_time = 0;
+    block->hdr.num = 0;
+    block->hdr.bits = 0;
+    codec->num_series = 0;
+}
+
+int hist_block_add(HistBlock *block, HistCodec *codec, uint32_t time, uint32_t key, float value)
+{
+    uint32_t index = 0;
+    while (index < codec->num_series && codec->series[index].key != key) {
+        index++;
+    }
+    bool new_series = (index == codec->num_series);
+    int bits = index_bits(codec->num_series);
+    if ((new_series && codec->num_series == HIST_BLOCK_SERIES_MAX) ||
+        block->hdr.bits + bits + SAMPLE_BITS_MAX > DATA_BITS || block->hdr.num == UINT16_MAX)
+    {
+        return -1;
+    }
+
+    uint32_t value_bits;
+    memcpy(&value_bits, &value, sizeof(value_bits));
+    if (block->hdr.num == 0) {
+        block->hdr.first_time = time;
+    }
+
+    write_bits(block, index, bits);
+    HistSeriesState *series = &codec->series[index];
+    if (new_series) {
+        // time relative to the start of the block and raw value
+        write_bits(block, key, 32);
+        write_dod(block, time - block->hdr.first_time);
+        write_bits(block, value_bits, 32);
+        series->key = key;
+        series->delta = 0;
+        series->bits = value_bits;
+        series->leading = NO_WINDOW;
+        codec->num_series++;
+    }
+    else {
+        int32_t delta = time - series->time;
+        write_dod(block, delta - series->delta);
+        write_value(block, series, value_bits);
+        series->delta = delta;
+        series->bits = value_bits;
+    }
+    series->time = time;
+
+    block->hdr.last_time = time;
+    block->hdr.num++;
+    return 0;
+}
+
+size_t hist_block_len(const HistBlock *block)
+{
+    return sizeof(HistBlockHeader) + (block->hdr.bits + 7) / 8;
+}
+
+void hist_block_read_start(HistBlockReader *reader, const HistBlock *block)
+{
+    reader->block = block;
+    reader->codec.num_series = 0;
+    reader->pos = 0;
+    reader->index = 0;
+}
+
+int hist_block_read(HistBlockReader *reader, HistSample *sample)
+{
+    if (reader->index >= reader->block->hdr.num) {
+        return 0;
+    }
+
+    HistCodec *codec = &reader->codec;
+    uint32_t index;
+    int32_t dod;
+    if (!read_bits(reader, index_bits(codec->num_series), &index) || index > codec->num_series) {
+        return -1;
+    }
+    HistSeriesState *series = &codec->series[index];
+    if (index == codec->num_series) {
+        if (codec->num_series == HIST_BLOCK_SERIES_MAX || !read_bits(reader, 32, &series->key) ||
+            !read_dod(reader, &dod) || !read_bits(reader, 32, &series->bits))
+        {
+            return -1;
+        }
+        series->time = reader->block->hdr.first_time + dod;
+        series->delta = 0;
+        series->leading = NO_WINDOW;
+        codec->num_series++;
+    }
+    else {
+        if (!read_dod(reader, &dod) || !read_value(reader, series)) {
+            return -1;
+        }
+        series->delta += dod;
+        series->time += series->delta;
+    }
+
+    sample->time = series->time;
+    sample->key = series->key;
+    memcpy(&sample->value, &series->bits, sizeof(sample->value));
+    reader->index++;
+    return 1;
+}
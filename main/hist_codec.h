@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HIST_CODEC_H_
+#define HIST_CODEC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HIST_BLOCK_SIZE 2016        // two blocks fit into one flash log sector
+#define HIST_BLOCK_SERIES_MAX 64    // different series per block
+
+/**
+ * Value of one series at one point in time
+ *
+ * Series are identified by a hash of device ID and value name, so no table of series names
+ * has to be stored.
+ */
+typedef struct {
+    uint32_t time;          // UNIX time
+    uint32_t key;           // see hist_key
+    float value;
+} HistSample;
+
+/**
+ * Header of a block, allows to skip blocks outside of a queried time range without decoding
+ */
+typedef struct {
+    uint32_t seq;           // increased with each block, also across resets
+    uint32_t first_time;
+    uint32_t last_time;
+    uint16_t num;           // number of samples
+    uint16_t bits;          // length of the encoded samples in bits
+} HistBlockHeader;
+
+/**
+ * Block of samples of several series in chronological order, compressed similar to the
+ * Gorilla time series database (Pelkonen et al., 2015)
+ *
+ * Each sample starts with the index of its series in the block. The first sample of a series
+ * contains the key, the time offset to the start of the block and the raw value. Following
+ * samples of the series contain the delta-of-delta of the timestamps and the XOR of the value
+ * with the previous value of the series, with leading and trailing zeros removed.
+ *
+ * Blocks are decoded from the start, so each block can be read on its own.
+ */
+typedef struct {
+    HistBlockHeader hdr;
+    uint8_t data[HIST_BLOCK_SIZE - sizeof(HistBlockHeader)];
+} HistBlock;
+
+/**
+ * State of a series, needed to encode or decode the next sample
+ */
+typedef struct {
+    uint32_t key;
+    uint32_t time;
+    int32_t delta;          // previous difference of timestamps
+    uint32_t bits;          // previous value as IEEE 754 bits
+    uint8_t leading;        // zeros around the meaningful bits of the previous XOR value
+    uint8_t trailing;
+} HistSeriesState;
+
+/**
+ * Series of the block currently encoded or decoded
+ */
+typedef struct {
+    HistSeriesState series[HIST_BLOCK_SERIES_MAX];
+    uint32_t num_series;
+} HistCodec;
+
+/**
+ * Position while decoding a block
+ */
+typedef struct {
+    const HistBlock *block;
+    HistCodec codec;
+    uint32_t pos;           // bit position
+    uint32_t index;         // number of samples read
+} HistBlockReader;
+
+/**
+ * Start a new empty block
+ */
+void hist_block_start(HistBlock *block, HistCodec *codec, uint32_t seq);
+
+/**
+ * Append a sample to the block
+ *
+ * \returns 0 on success or -1 if the block is full
+ */
+int hist_block_add(HistBlock *block, HistCodec *codec, uint32_t time, uint32_t key, float value);
+
+/**
+ * Number of bytes of the block which are actually used (header and encoded samples)
+ */
+size_t hist_block_len(const HistBlock *block);
+
+void hist_block_read_start(HistBlockReader *reader, const HistBlock *block);
+
+/**
+ * Decode the next sample of the block
+ *
+ * \returns 1 if a sample was read, 0 at the end of the block or -1 if the block is damaged
+ */
+int hist_block_read(HistBlockReader *reader, HistSample *sample);
+
+#endif /* HIST_CODEC_H_ */
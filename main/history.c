@@ -0,0 +1,600 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "history.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint32_t key;
+    uint32_t from;
+    uint32_t to;
+    uint32_t step;
+    HistPointFn point;
+    void *ctx;
+    uint32_t interval;      // start of the interval currently combined
+    float sum;
+    float min;
+    float max;
+    uint32_t count;
+    int points;
+    bool aborted;
+} HistQuery;
+
+uint32_t hist_key(const char *device, const char *name)
+{
+    // FNV-1a hash of <device>/<name>
+    uint32_t hash = 2166136261U;
+    for (const char *c = device; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t) *c) * 16777619U;
+    }
+    hash = (hash ^ '/') * 16777619U;
+    for (const char *c = name; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t) *c) * 16777619U;
+    }
+    return hash;
+}
+
+/* checks a block read from flash */
+static bool block_valid(const HistBlock *block, int len)
+{
+    return len >= (int) sizeof(HistBlockHeader) && (size_t) len == hist_block_len(block);
+}
+
+void hist_init(HistStore *h, HistBlock *blocks, uint32_t num_blocks, FlashLog *log)
+{
+    memset(h, 0, sizeof(HistStore));
+    h->blocks = blocks;
+    h->num_blocks = num_blocks;
+    h->used = 1;
+    h->log = log;
+
+    uint32_t seq = 1;
+    if (log != NULL) {
+        // first block of the ring is used as buffer to find the newest block in flash
+        FlashLogIter it;
+        uint32_t timestamp;
+        int len;
+        flash_log_iter_init(log, &it);
+        while ((len = flash_log_iter_next(log, &it, &timestamp, blocks, HIST_BLOCK_SIZE)) > 0) {
+            if (block_valid(blocks, len) && blocks->hdr.seq >= seq) {
+                seq = blocks->hdr.seq + 1;
+                h->last_time = blocks->hdr.last_time;
+            }
+        }
+    }
+    hist_block_start(&blocks[0], &h->enc, seq);
+}
+
+void hist_tier_init(HistTier *tier, uint32_t period, FlashLog *log)
+{
+    memset(tier, 0, sizeof(HistTier));
+    tier->period = period;
+    tier->log = log;
+}
+
+void hist_set_tiers(HistStore *h, HistTier *tiers, uint32_t num_tiers)
+{
+    h->tiers = tiers;
+    h->num_tiers = num_tiers;
+}
+
+/* hash table with linear probing, series are never removed */
+static HistBucket *tier_bucket(HistTier *tier, uint32_t key, bool insert)
+{
+    for (uint32_t i = 0; i < HIST_ROLLUP_KEYS; i++) {
+        HistBucket *bucket = &tier->buckets[(key + i) & (HIST_ROLLUP_KEYS - 1)];
+        if (!bucket->used) {
+            if (!insert) {
+                return NULL;
+            }
+            bucket->used = true;
+            bucket->key = key;
+            bucket->count = 0;
+            return bucket;
+        }
+        if (bucket->key == key) {
+            return bucket;
+        }
+    }
+    return NULL;
+}
+
+/* writes the rollups of the current period to flash and resets the buckets */
+static void tier_close_period(HistTier *tier)
+{
+    HistRollup rollups[HIST_ROLLUP_KEYS];
+    uint32_t num = 0;
+    for (uint32_t i = 0; i < HIST_ROLLUP_KEYS; i++) {
+        HistBucket *bucket = &tier->buckets[i];
+        if (bucket->used && bucket->count > 0) {
+            rollups[num].key = bucket->key;
+            rollups[num].min = bucket->min;
+            rollups[num].max = bucket->max;
+            rollups[num].avg = bucket->sum / bucket->count;
+            rollups[num].count = bucket->count;
+            num++;
+            bucket->count = 0;
+        }
+    }
+    if (num > 0 && tier->log != NULL &&
+        flash_log_append(tier->log, tier->start, rollups, num * sizeof(HistRollup)) != 0)
+    {
+        tier->flash_errors++;
+    }
+}
+
+static void tier_add(HistTier *tier, uint32_t time, uint32_t key, float value)
+{
+    uint32_t start = time - time % tier->period;
+    if (start != tier->start) {
+        tier_close_period(tier);
+        tier->start = start;
+    }
+    if (!isfinite(value)) {
+        // would spoil the statistics of the whole period
+        return;
+    }
+    HistBucket *bucket = tier_bucket(tier, key, true);
+    if (bucket == NULL) {
+        tier->overflows++;
+        return;
+    }
+    if (bucket->count == 0) {
+        bucket->min = value;
+        bucket->max = value;
+        bucket->sum = 0;
+    }
+    else {
+        bucket->min = fminf(bucket->min, value);
+        bucket->max = fmaxf(bucket->max, value);
+    }
+    bucket->sum += value;
+    bucket->count++;
+}
+
+int hist_add(HistStore *h, uint32_t time, uint32_t key, float value)
+{
+    if (time < h->last_time) {
+        h->rejected++;
+        return -1;
+    }
+
+    HistBlock *block = &h->blocks[h->head];
+    if (hist_block_add(block, &h->enc, time, key, value) != 0) {
+        // block is full, a new one can take at least one sample
+        if (h->log != NULL &&
+            flash_log_append(h->log, block->hdr.first_time, block, hist_block_len(block)) != 0)
+        {
+            // block is still available as long as it is in RAM
+            h->flash_errors++;
+        }
+        uint32_t seq = block->hdr.seq + 1;
+        h->head = (h->head + 1) % h->num_blocks;
+        if (h->used < h->num_blocks) {
+            h->used++;
+        }
+        block = &h->blocks[h->head];
+        hist_block_start(block, &h->enc, seq);
+        hist_block_add(block, &h->enc, time, key, value);
+    }
+    h->last_time = time;
+
+    for (uint32_t i = 0; i < h->num_tiers; i++) {
+        tier_add(&h->tiers[i], time, key, value);
+    }
+    return 0;
+}
+
+static void emit(HistQuery *q, const HistPoint *point)
+{
+    if (!q->aborted) {
+        q->aborted = q->point(q->ctx, point) != 0;
+        q->points++;
+    }
+}
+
+static void emit_interval(HistQuery *q)
+{
+    HistPoint point = {
+        .time = q->interval,
+        .avg = q->sum / q->count,
+        .min = q->min,
+        .max = q->max,
+        .count = q->count,
+    };
+    emit(q, &point);
+    q->count = 0;
+    q->sum = 0;
+}
+
+/* adds a raw sample (count 1) or a rollup to the query */
+static void query_stats(HistQuery *q, uint32_t time, float avg, float min, float max,
+    uint32_t count)
+{
+    if (q->step == 0) {
+        HistPoint point = { .time = time, .avg = avg, .min = min, .max = max, .count = count };
+        emit(q, &point);
+        return;
+    }
+    uint32_t interval = q->from + (time - q->from) / q->step * q->step;
+    if (q->count > 0 && interval != q->interval) {
+        emit_interval(q);
+    }
+    if (q->count == 0) {
+        q->min = min;
+        q->max = max;
+    }
+    else {
+        q->min = fminf(q->min, min);
+        q->max = fmaxf(q->max, max);
+    }
+    q->interval = interval;
+    q->sum += avg * count;
+    q->count += count;
+}
+
+static void query_block(HistQuery *q, HistBlockReader *reader, const HistBlock *block)
+{
+    if (block->hdr.num == 0 || block->hdr.last_time < q->from || block->hdr.first_time > q->to) {
+        return;
+    }
+    HistSample sample;
+    hist_block_read_start(reader, block);
+    while (!q->aborted && hist_block_read(reader, &sample) > 0) {
+        if (sample.key == q->key && sample.time >= q->from && sample.time <= q->to) {
+            query_stats(q, sample.time, sample.value, sample.value, sample.value, 1);
+        }
+    }
+}
+
+static int query_raw(HistStore *h, HistQuery *q, void *buf)
+{
+    HistBlockReader reader;
+    uint32_t oldest = (h->head + h->num_blocks - (h->used - 1)) % h->num_blocks;
+
+    if (h->log != NULL &&
+        (h->blocks[oldest].hdr.num == 0 || q->from < h->blocks[oldest].hdr.first_time))
+    {
+        // blocks which are not in RAM anymore
+        HistBlock *block = (HistBlock *) buf;
+        FlashLogIter it;
+        uint32_t timestamp;
+        int len;
+        flash_log_iter_init(h->log, &it);
+        while (!q->aborted &&
+            (len = flash_log_iter_next(h->log, &it, &timestamp, block, HIST_BLOCK_SIZE)) > 0)
+        {
+            if (!block_valid(block, len)) {
+                continue;
+            }
+            if (block->hdr.seq >= h->blocks[oldest].hdr.seq || block->hdr.first_time > q->to) {
+                break;
+            }
+            query_block(q, &reader, block);
+        }
+        if (len < 0) {
+            return -1;
+        }
+    }
+
+    for (uint32_t i = 0; i < h->used && !q->aborted; i++) {
+        query_block(q, &reader, &h->blocks[(oldest + i) % h->num_blocks]);
+    }
+    return 0;
+}
+
+static int query_tier(HistTier *tier, HistQuery *q, void *buf)
+{
+    HistRollup *rollups = (HistRollup *) buf;
+    FlashLogIter it;
+    uint32_t start;
+    int len;
+    flash_log_iter_init(tier->log, &it);
+    while (!q->aborted &&
+        (len = flash_log_iter_next(tier->log, &it, &start, rollups, HIST_BLOCK_SIZE)) > 0)
+    {
+        if (start > q->to) {
+            break;
+        }
+        if (start < q->from || len % sizeof(HistRollup) != 0) {
+            continue;
+        }
+        for (uint32_t i = 0; i < len / sizeof(HistRollup); i++) {
+            if (rollups[i].key == q->key) {
+                query_stats(q, start, rollups[i].avg, rollups[i].min, rollups[i].max,
+                    rollups[i].count);
+                break;
+            }
+        }
+    }
+    if (len < 0) {
+        return -1;
+    }
+
+    // current period is not in flash yet
+    HistBucket *bucket = tier_bucket(tier, q->key, false);
+    if (bucket != NULL && bucket->count > 0 && tier->start >= q->from && tier->start <= q->to) {
+        query_stats(q, tier->start, bucket->sum / bucket->count, bucket->min, bucket->max,
+            bucket->count);
+    }
+    return 0;
+}
+
+/* time of the oldest raw sample, UINT32_MAX if there are no samples */
+static uint32_t raw_oldest(HistStore *h, void *buf)
+{
+    if (h->log != NULL) {
+        HistBlock *block = (HistBlock *) buf;
+        FlashLogIter it;
+        uint32_t timestamp;
+        int len;
+        flash_log_iter_init(h->log, &it);
+        while ((len = flash_log_iter_next(h->log, &it, &timestamp, block, HIST_BLOCK_SIZE)) > 0) {
+            if (block_valid(block, len)) {
+                return block->hdr.first_time;
+            }
+        }
+    }
+    uint32_t oldest = (h->head + h->num_blocks - (h->used - 1)) % h->num_blocks;
+    return h->blocks[oldest].hdr.num > 0 ? h->blocks[oldest].hdr.first_time : UINT32_MAX;
+}
+
+/* start of the oldest period of a tier, UINT32_MAX if it has no rollups */
+static uint32_t tier_oldest(HistTier *tier, void *buf)
+{
+    FlashLogIter it;
+    uint32_t start;
+    flash_log_iter_init(tier->log, &it);
+    if (flash_log_iter_next(tier->log, &it, &start, buf, HIST_BLOCK_SIZE) > 0) {
+        return start;
+    }
+    return tier->start > 0 ? tier->start : UINT32_MAX;
+}
+
+int hist_query(HistStore *h, uint32_t key, uint32_t from, uint32_t to, uint32_t step,
+    HistPointFn point, void *ctx, void *buf)
+{
+    HistQuery q = {
+        .key = key,
+        .from = from,
+        .to = to,
+        .step = step,
+        .point = point,
+        .ctx = ctx,
+    };
+
+    /*
+     * Coarsest tier which provides the requested resolution and still reaches back to from.
+     * Tiers with short periods keep a shorter time range than the raw samples, so if no tier
+     * reaches back far enough, the source with the oldest data is used.
+     */
+    HistTier *tier = NULL;
+    uint32_t oldest = (step > 0 && h->num_tiers > 0) ? raw_oldest(h, buf) : 0;
+    for (uint32_t i = h->num_tiers; i > 0 && step > 0; i--) {
+        HistTier *candidate = &h->tiers[i - 1];
+        if (candidate->log == NULL || candidate->period > step) {
+            continue;
+        }
+        uint32_t candidate_oldest = tier_oldest(candidate, buf);
+        if (candidate_oldest <= from) {
+            tier = candidate;
+            break;
+        }
+        else if (candidate_oldest < oldest) {
+            tier = candidate;
+            oldest = candidate_oldest;
+        }
+    }
+
+    int ret = (tier != NULL) ? query_tier(tier, &q, buf) : query_raw(h, &q, buf);
+    if (ret == 0 && q.count > 0) {
+        emit_interval(&q);
+    }
+    return (ret < 0 || q.aborted) ? -1 : q.points;
+}
+
+#ifndef UNIT_TEST
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "sdkconfig.h"
+
+#include "can.h"
+#include "cJSON.h"
+#include "time_sync.h"
+#include "ts_client.h"
+#include "ts_serial.h"
+
+static const char *TAG = "history";
+
+#define HISTORY_PARTITION_SUBTYPE 0x41
+
+// maximum length of names of nested values in publication messages
+#define VALUE_NAME_MAX 64
+
+#define JSON_BUF_SIZE 1024
+
+// rollup tiers and the share of the partition (in eighths) used for them
+//
+// A period with 20 series needs 412 bytes incl. header, so 9 periods fit into a sector. With
+// the 128 KiB partition, the tiers keep about 30 minutes, 8 hours and 3 days (with 64 series
+// only 1/3 of that). Longer ranges are queried from the tier or raw samples with older data.
+#define TIERS 3
+static const uint32_t tier_periods[TIERS] = { 60, 15 * 60, 60 * 60 };
+static const uint32_t area_eighths[1 + TIERS] = { 4, 1, 1, 2 };     // raw samples first
+
+static HistStore store;
+static HistTier tiers[TIERS];
+static FlashLog logs[1 + TIERS];
+static FlashLogArea areas[1 + TIERS];
+static SemaphoreHandle_t hist_lock;
+
+/*
+ * Mounts one flash log per area of the partition, logs which could not be mounted are set to
+ * NULL
+ */
+static void mount_partition(FlashLog *mounted[1 + TIERS])
+{
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+        HISTORY_PARTITION_SUBTYPE, "history");
+    if (partition == NULL) {
+        ESP_LOGW(TAG, "Partition history not found, values are kept in RAM only");
+    }
+
+    uint32_t sectors = partition != NULL ? partition->size / FLASH_LOG_SECTOR_SIZE : 0;
+    uint32_t offset = 0;
+    for (int i = 0; i < 1 + TIERS; i++) {
+        uint32_t size = sectors * area_eighths[i] / 8 * FLASH_LOG_SECTOR_SIZE;
+        areas[i].partition = partition;
+        areas[i].offset = offset;
+        offset += size;
+        mounted[i] = NULL;
+        if (partition == NULL) {
+            continue;
+        }
+
+        FlashLogIO io;
+        flash_log_partition_io(&io, &areas[i], size);
+        if (flash_log_mount(&logs[i], &io) == 0) {
+            mounted[i] = &logs[i];
+        }
+        else {
+            ESP_LOGE(TAG, "Mounting history area %d failed", i);
+        }
+    }
+}
+
+static void record_object(uint32_t now, const char *device, const cJSON *obj, char *name,
+    size_t name_size)
+{
+    size_t len = strlen(name);
+    const cJSON *item;
+    cJSON_ArrayForEach(item, obj) {
+        if (item->string == NULL) {
+            continue;
+        }
+        int ret = snprintf(name + len, name_size - len, "%s%s", len > 0 ? "/" : "",
+            item->string);
+        if (ret < 0 || ret >= name_size - len) {
+            continue;
+        }
+        if (cJSON_IsNumber(item)) {
+            hist_add(&store, now, hist_key(device, name), item->valuedouble);
+        }
+        else if (cJSON_IsBool(item)) {
+            hist_add(&store, now, hist_key(device, name), cJSON_IsTrue(item) ? 1 : 0);
+        }
+        else if (cJSON_IsObject(item)) {
+            record_object(now, device, item, name, name_size);
+        }
+    }
+    name[len] = '\0';
+}
+
+static void record_json(uint32_t now, const char *device, const char *json)
+{
+    cJSON *obj = cJSON_Parse(json);
+    if (cJSON_IsObject(obj)) {
+        char name[VALUE_NAME_MAX] = "";
+        xSemaphoreTake(hist_lock, portMAX_DELAY);
+        record_object(now, device, obj, name, sizeof(name));
+        xSemaphoreGive(hist_lock);
+    }
+    cJSON_Delete(obj);
+}
+
+/* only values received since the last call are recorded, so disconnected devices are skipped */
+static void record_values(uint32_t now, char *buf, size_t size)
+{
+    static uint32_t serial_pubmsgs;
+    static uint32_t can_pub_counts[UINT8_MAX];
+
+    TSSerialStats serial;
+    ts_serial_get_stats(&serial);
+    if (serial.pubmsgs != serial_pubmsgs && ts_serial_pubmsg_last(buf, size) > 0) {
+        serial_pubmsgs = serial.pubmsgs;
+        // message format: #<path> <json-data>
+        const char *json = strchr(buf, ' ');
+        if (json != NULL) {
+            // serial device is registered with CAN address UINT8_MAX
+            TSDevice *device = ts_get_can_device(UINT8_MAX);
+            record_json(now, device != NULL ? device->ts_device_id : "serial", json + 1);
+        }
+    }
+
+    for (int addr = 0; addr < UINT8_MAX; addr++) {
+        uint32_t pub_count;
+        if (can_get_data_json(addr, buf, size, &pub_count) == 0 ||
+            pub_count == can_pub_counts[addr])
+        {
+            continue;
+        }
+        can_pub_counts[addr] = pub_count;
+        // address 0 is also used for the gateway itself, so only look up other devices
+        TSDevice *device = addr > 0 ? ts_get_can_device(addr) : NULL;
+        char label[10];
+        if (device == NULL || device->ts_device_id == NULL) {
+            snprintf(label, sizeof(label), "can:%d", addr);
+        }
+        record_json(now, device != NULL && device->ts_device_id != NULL ?
+            device->ts_device_id : label, buf);
+    }
+}
+
+void history_task(void *arg)
+{
+    HistBlock *blocks = (HistBlock *) malloc(CONFIG_HISTORY_RAM_BLOCKS * HIST_BLOCK_SIZE);
+    char *json_buf = (char *) malloc(JSON_BUF_SIZE);
+    if (blocks == NULL || json_buf == NULL) {
+        ESP_LOGE(TAG, "Unable to allocate memory for history");
+        free(blocks);
+        free(json_buf);
+        vTaskDelete(NULL);
+    }
+    FlashLog *mounted[1 + TIERS];
+    mount_partition(mounted);
+    hist_init(&store, blocks, CONFIG_HISTORY_RAM_BLOCKS, mounted[0]);
+    for (int i = 0; i < TIERS; i++) {
+        hist_tier_init(&tiers[i], tier_periods[i], mounted[1 + i]);
+    }
+    hist_set_tiers(&store, tiers, TIERS);
+    hist_lock = xSemaphoreCreateMutex();
+
+    // samples are stored with absolute time, as they are kept across resets
+    time_sync_init();
+
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(CONFIG_HISTORY_INTERVAL * 1000));
+        uint32_t now = time_sync_unix();
+        if (now != 0) {
+            record_values(now, json_buf, JSON_BUF_SIZE);
+        }
+    }
+}
+
+int history_query(const char *device, const char *name, uint32_t from, uint32_t to,
+    uint32_t step, HistPointFn point, void *ctx, void *buf)
+{
+    if (hist_lock == NULL) {
+        return HISTORY_NOT_RUNNING;
+    }
+    // recording is delayed during the query
+    xSemaphoreTake(hist_lock, portMAX_DELAY);
+    int ret = hist_query(&store, hist_key(device, name), from, to, step, point, ctx, buf);
+    xSemaphoreGive(hist_lock);
+    return ret;
+}
+
+#endif /* UNIT_TEST */
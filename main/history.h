@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flash_log.h"
+#include "hist_codec.h"
+
+#define HIST_ROLLUP_KEYS 64         // series with rollups per tier, must be a power of 2
+
+/**
+ * Statistics of a series over one period of a rollup tier, as stored in flash
+ */
+typedef struct {
+    uint32_t key;
+    float min;
+    float max;
+    float avg;
+    uint32_t count;         // number of samples
+} HistRollup;
+
+/**
+ * Statistics of a series in the current period of a rollup tier
+ */
+typedef struct {
+    uint32_t key;
+    uint32_t count;         // 0 if the series has no samples in the current period
+    float min;
+    float max;
+    float sum;
+    bool used;
+} HistBucket;
+
+/**
+ * Rollups of all series with a fixed period length, e.g. 1 hour
+ *
+ * Samples are accumulated in a hash table of buckets (one per series). When the first sample
+ * of the next period arrives, the rollups of all series with samples are appended to the flash
+ * log as one record and the buckets are reset.
+ */
+typedef struct {
+    uint32_t period;        // length of the periods in seconds
+    uint32_t start;         // start of the current period
+    FlashLog *log;          // closed periods, NULL if only the current period is available
+    HistBucket buckets[HIST_ROLLUP_KEYS];
+    uint32_t overflows;     // samples of series which did not fit into the table
+    uint32_t flash_errors;
+} HistTier;
+
+/**
+ * Time-series store for values of connected devices
+ *
+ * Samples are collected in a ring of compressed blocks in RAM. Each full block is appended to a
+ * flash log, which overwrites the oldest blocks if it is full. Queries read the blocks from flash
+ * which are not in RAM anymore, followed by the blocks in RAM.
+ */
+typedef struct {
+    HistBlock *blocks;      // ring of blocks in RAM
+    uint32_t num_blocks;
+    uint32_t head;          // block currently filled
+    uint32_t used;          // number of blocks in RAM including head
+    HistCodec enc;          // series of the head block
+    FlashLog *log;          // NULL if samples are kept in RAM only
+    uint32_t last_time;     // time of the newest sample
+    uint32_t flash_errors;
+    uint32_t rejected;      // samples older than the previous one (e.g. after clock change)
+    HistTier *tiers;        // rollup tiers ordered by period length
+    uint32_t num_tiers;
+} HistStore;
+
+/**
+ * Result of a query, either a raw sample (count 1) or the statistics of an interval
+ */
+typedef struct {
+    uint32_t time;
+    float avg;
+    float min;
+    float max;
+    uint32_t count;         // number of samples
+} HistPoint;
+
+/**
+ * Receives the points of a query
+ *
+ * \returns 0 to continue or a different value to abort the query
+ */
+typedef int (*HistPointFn)(void *ctx, const HistPoint *point);
+
+/**
+ * Calculate the key of a series
+ */
+uint32_t hist_key(const char *device, const char *name);
+
+/**
+ * Initialize the store, sequence numbers continue behind the blocks found in flash
+ *
+ * \param blocks Buffer for at least 2 blocks
+ * \param log Mounted flash log or NULL
+ */
+void hist_init(HistStore *h, HistBlock *blocks, uint32_t num_blocks, FlashLog *log);
+
+/**
+ * Initialize a rollup tier
+ *
+ * \param period Length of the periods in seconds
+ * \param log Mounted flash log for closed periods or NULL
+ */
+void hist_tier_init(HistTier *tier, uint32_t period, FlashLog *log);
+
+/**
+ * Maintain rollups of all samples added to the store from now on
+ *
+ * \param tiers Initialized tiers ordered by period length
+ */
+void hist_set_tiers(HistStore *h, HistTier *tiers, uint32_t num_tiers);
+
+/**
+ * Add a sample, samples must be added in chronological order
+ *
+ * \returns 0 on success or -1 if the sample is older than the previous one
+ */
+int hist_add(HistStore *h, uint32_t time, uint32_t key, float value);
+
+/**
+ * Get the samples of a series in a time range
+ *
+ * If step is greater than zero, samples are combined over intervals of step seconds starting
+ * at from and one point per interval with samples is returned, timestamped with the start of
+ * the interval. Otherwise all samples are returned.
+ *
+ * Intervals are calculated from the coarsest rollup tier with a period not longer than step
+ * which still contains the periods starting at from, so long time ranges can be queried
+ * without decoding all samples. If no tier reaches back to from, the tier or the raw samples
+ * with the oldest data are used. Rollups are assigned to the interval containing the start of
+ * their period.
+ *
+ * \param from Start of the range (UNIX time, inclusive)
+ * \param to End of the range (UNIX time, inclusive)
+ * \param step Length of the intervals in seconds or 0 for raw samples
+ * \param buf Buffer of HIST_BLOCK_SIZE bytes to read blocks or rollups from flash
+ *
+ * \returns Number of points or -1 if the flash could not be read or the query was aborted
+ */
+int hist_query(HistStore *h, uint32_t key, uint32_t from, uint32_t to, uint32_t step,
+    HistPointFn point, void *ctx, void *buf);
+
+/**
+ * Thread recording the values of connected devices in regular intervals
+ */
+void history_task(void *arg);
+
+#define HISTORY_NOT_RUNNING (-2)
+
+/**
+ * Query the series of a device value, see hist_query
+ *
+ * Recording is delayed during the query, so the point function should not block (e.g. by
+ * sending data to a slow network client).
+ *
+ * \returns Number of points, -1 if the query failed or was aborted or HISTORY_NOT_RUNNING if
+ *          the history task was not started (yet)
+ */
+int history_query(const char *device, const char *name, uint32_t from, uint32_t to,
+    uint32_t step, HistPointFn point, void *ctx, void *buf);
+
+#endif /* HISTORY_H_ */
@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "http_client.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+void http_response_init(HttpResponse *resp)
+{
+    memset(resp, 0, sizeof(HttpResponse));
+    resp->state = HTTP_RESP_STATUS;
+    resp->content_length = -1;
+}
+
+/* returns the value of the header line if it has the given name, NULL otherwise */
+static const char *header_value(const char *line, const char *name)
+{
+    size_t name_len = strlen(name);
+    if (strncasecmp(line, name, name_len) != 0 || line[name_len] != ':') {
+        return NULL;
+    }
+    const char *value = line + name_len + 1;
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+    return value;
+}
+
+static bool contains_token(const char *value, const char *token)
+{
+    size_t len = strlen(token);
+    for (const char *pos = value; *pos != '\0'; pos++) {
+        if (strncasecmp(pos, token, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void headers_complete(HttpResponse *resp)
+{
+    if (resp->status >= 100 && resp->status < 200) {
+        // informational response, the actual response follows
+        resp->state = HTTP_RESP_STATUS;
+    }
+    else if (resp->status == 204 || resp->status == 304) {
+        resp->state = HTTP_RESP_DONE;
+    }
+    else if (resp->chunked) {
+        resp->state = HTTP_RESP_CHUNK_SIZE;
+    }
+    else if (resp->content_length >= 0) {
+        resp->remaining = resp->content_length;
+        resp->state = resp->remaining > 0 ? HTTP_RESP_BODY : HTTP_RESP_DONE;
+    }
+    else {
+        // body ends when the server closes the connection
+        resp->keep_alive = false;
+        resp->state = HTTP_RESP_BODY;
+    }
+}
+
+static void process_line(HttpResponse *resp)
+{
+    const char *value;
+    char *end;
+    int major, minor;
+
+    switch (resp->state) {
+        case HTTP_RESP_STATUS:
+            if (sscanf(resp->line, "HTTP/%d.%d %d", &major, &minor, &resp->status) != 3) {
+                resp->state = HTTP_RESP_ERROR;
+                break;
+            }
+            // persistent connections are the default since HTTP/1.1
+            resp->keep_alive = (major > 1 || (major == 1 && minor >= 1));
+            resp->chunked = false;
+            resp->content_length = -1;
+            resp->state = HTTP_RESP_HEADERS;
+            break;
+        case HTTP_RESP_HEADERS:
+            if (resp->line_len == 0) {
+                headers_complete(resp);
+            }
+            else if ((value = header_value(resp->line, "Content-Length")) != NULL) {
+                resp->content_length = strtol(value, &end, 10);
+                if (end == value || resp->content_length < 0) {
+                    resp->state = HTTP_RESP_ERROR;
+                }
+            }
+            else if ((value = header_value(resp->line, "Transfer-Encoding")) != NULL) {
+                resp->chunked = contains_token(value, "chunked");
+            }
+            else if ((value = header_value(resp->line, "Connection")) != NULL) {
+                if (contains_token(value, "close")) {
+                    resp->keep_alive = false;
+                }
+                else if (contains_token(value, "keep-alive")) {
+                    resp->keep_alive = true;
+                }
+            }
+            break;
+        case HTTP_RESP_CHUNK_SIZE:
+            // chunk extensions after ';' are ignored
+            resp->remaining = strtoul(resp->line, &end, 16);
+            if (end == resp->line) {
+                resp->state = HTTP_RESP_ERROR;
+            }
+            else {
+                resp->state = resp->remaining > 0 ? HTTP_RESP_CHUNK_DATA : HTTP_RESP_TRAILER;
+            }
+            break;
+        case HTTP_RESP_CHUNK_END:
+            resp->state = resp->line_len == 0 ? HTTP_RESP_CHUNK_SIZE : HTTP_RESP_ERROR;
+            break;
+        case HTTP_RESP_TRAILER:
+            if (resp->line_len == 0) {
+                resp->state = HTTP_RESP_DONE;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static size_t consume_body(HttpResponse *resp, const char *data, size_t len)
+{
+    bool until_close = (resp->state == HTTP_RESP_BODY && resp->content_length < 0);
+    size_t n = (until_close || len < resp->remaining) ? len : resp->remaining;
+
+    size_t store = HTTP_RESP_BODY_MAX - 1 - resp->body_len;
+    store = n < store ? n : store;
+    memcpy(resp->body + resp->body_len, data, store);
+    resp->body_len += store;
+    resp->body[resp->body_len] = '\0';
+
+    if (!until_close) {
+        resp->remaining -= n;
+        if (resp->remaining == 0) {
+            resp->state = (resp->state == HTTP_RESP_BODY) ? HTTP_RESP_DONE : HTTP_RESP_CHUNK_END;
+        }
+    }
+    return n;
+}
+
+size_t http_response_parse(HttpResponse *resp, const char *data, size_t len)
+{
+    size_t pos = 0;
+    while (pos < len && resp->state != HTTP_RESP_DONE && resp->state != HTTP_RESP_ERROR) {
+        if (resp->state == HTTP_RESP_BODY || resp->state == HTTP_RESP_CHUNK_DATA) {
+            pos += consume_body(resp, data + pos, len - pos);
+            continue;
+        }
+
+        char c = data[pos++];
+        if (c == '\n') {
+            if (resp->line_len > 0 && resp->line[resp->line_len - 1] == '\r') {
+                resp->line_len--;
+            }
+            resp->line[resp->line_len] = '\0';
+            process_line(resp);
+            resp->line_len = 0;
+        }
+        else if (resp->line_len < sizeof(resp->line) - 1) {
+            resp->line[resp->line_len++] = c;
+        }
+    }
+    return pos;
+}
+
+bool http_response_eof(HttpResponse *resp)
+{
+    if (resp->state == HTTP_RESP_BODY && resp->content_length < 0) {
+        resp->state = HTTP_RESP_DONE;
+    }
+    resp->keep_alive = false;
+    return resp->state == HTTP_RESP_DONE;
+}
+
+void http_client_init(HttpClient *client, const char *host, const char *port, uint32_t dns_ttl_s)
+{
+    memset(client, 0, sizeof(HttpClient));
+    client->host = host;
+    client->port = port;
+    client->dns_ttl_s = dns_ttl_s;
+    client->sock = -1;
+}
+
+#ifndef UNIT_TEST
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include <sys/param.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static const char *TAG = "http_client";
+
+#define BACKOFF_MIN_MS 1000
+#define BACKOFF_MAX_MS (64 * 1000)
+
+#define SOCKET_TIMEOUT_S 5
+
+static void close_socket(HttpClient *client)
+{
+    if (client->sock >= 0) {
+        close(client->sock);
+        client->sock = -1;
+    }
+}
+
+static int resolve(HttpClient *client, int64_t now)
+{
+    if (client->ip_addr != 0 && now < client->dns_expiry_us) {
+        return 0;
+    }
+
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res;
+    client->stats.dns_lookups++;
+    int err = getaddrinfo(client->host, client->port, &hints, &res);
+    if (err != 0 || res == NULL) {
+        ESP_LOGE(TAG, "DNS lookup of %s failed err=%d", client->host, err);
+        return -1;
+    }
+    client->ip_addr = ((struct sockaddr_in *) res->ai_addr)->sin_addr.s_addr;
+    client->dns_expiry_us = now + (int64_t) client->dns_ttl_s * 1000000;
+    freeaddrinfo(res);
+    return 0;
+}
+
+static int connect_server(HttpClient *client)
+{
+    int64_t now = esp_timer_get_time();
+    if (now < client->next_attempt_us) {
+        return -1;
+    }
+
+    if (resolve(client, now) == 0) {
+        struct sockaddr_in addr = {
+            .sin_family = AF_INET,
+            .sin_port = htons(atoi(client->port)),
+            .sin_addr.s_addr = client->ip_addr,
+        };
+        int s = socket(AF_INET, SOCK_STREAM, 0);
+        if (s >= 0) {
+            struct timeval timeout = { .tv_sec = SOCKET_TIMEOUT_S };
+            setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            client->stats.connects++;
+            if (connect(s, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+                ESP_LOGI(TAG, "Connected to %s", client->host);
+                client->sock = s;
+                client->backoff_ms = 0;
+                return 0;
+            }
+            ESP_LOGE(TAG, "Connecting to %s failed errno=%d", client->host, errno);
+            close(s);
+        }
+        // the server may have moved to a different address
+        client->ip_addr = 0;
+    }
+
+    client->backoff_ms = (client->backoff_ms == 0) ? BACKOFF_MIN_MS :
+        MIN(client->backoff_ms * 2, BACKOFF_MAX_MS);
+    client->next_attempt_us = now + client->backoff_ms * 1000LL;
+    ESP_LOGW(TAG, "Next connection attempt in %u s",
+        (unsigned int) (client->backoff_ms / 1000));
+    return -1;
+}
+
+/* writes all buffers with as few calls as possible */
+static int write_all(HttpClient *client, struct iovec *iov, int iovcnt)
+{
+    while (1) {
+        while (iovcnt > 0 && iov->iov_len == 0) {
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt == 0) {
+            return 0;
+        }
+
+        ssize_t n = writev(client->sock, iov, iovcnt);
+        if (n <= 0) {
+            return -1;
+        }
+        client->stats.bytes_sent += n;
+
+        // continue behind the written part
+        while (n > 0) {
+            size_t part = MIN((size_t) n, iov->iov_len);
+            iov->iov_base = (char *) iov->iov_base + part;
+            iov->iov_len -= part;
+            n -= part;
+            if (iov->iov_len == 0) {
+                iov++;
+                iovcnt--;
+            }
+        }
+    }
+}
+
+static int read_response(HttpClient *client, HttpResponse *resp)
+{
+    char buf[128];
+    while (resp->state != HTTP_RESP_DONE && resp->state != HTTP_RESP_ERROR) {
+        int n = recv(client->sock, buf, sizeof(buf), 0);
+        if (n == 0) {
+            return http_response_eof(resp) ? 0 : -1;
+        }
+        else if (n < 0) {
+            return -1;
+        }
+        client->stats.bytes_received += n;
+        // further data (e.g. pipelined responses) is not expected and ignored
+        http_response_parse(resp, buf, n);
+    }
+    return resp->state == HTTP_RESP_DONE ? 0 : -1;
+}
+
+int http_client_request(HttpClient *client, const char *head, const char *body,
+    HttpResponse *resp)
+{
+    char length[40];
+    size_t body_len = (body != NULL) ? strlen(body) : 0;
+    snprintf(length, sizeof(length), "Content-Length: %u\r\n\r\n", (unsigned int) body_len);
+
+    client->stats.requests++;
+    while (1) {
+        bool reused = (client->sock >= 0);
+        if (!reused && connect_server(client) < 0) {
+            break;
+        }
+
+        struct iovec iov[] = {
+            { .iov_base = (void *) head, .iov_len = strlen(head) },
+            { .iov_base = length, .iov_len = strlen(length) },
+            { .iov_base = (void *) body, .iov_len = body_len },
+        };
+        http_response_init(resp);
+        if (write_all(client, iov, sizeof(iov) / sizeof(iov[0])) == 0 &&
+            read_response(client, resp) == 0)
+        {
+            if (!resp->keep_alive) {
+                close_socket(client);
+            }
+            return resp->status;
+        }
+        close_socket(client);
+
+        // the server may have closed the idle connection before receiving the request, which
+        // is only retried if nothing was received (request may not be idempotent)
+        if (!reused || resp->state != HTTP_RESP_STATUS || resp->line_len > 0) {
+            break;
+        }
+        ESP_LOGD(TAG, "Connection closed by server, reconnecting");
+    }
+    client->stats.errors++;
+    return -1;
+}
+
+void http_client_close(HttpClient *client)
+{
+    close_socket(client);
+    client->ip_addr = 0;
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HTTP_CLIENT_H_
+#define HTTP_CLIENT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HTTP_RESP_LINE_MAX 128      // longer header lines are truncated
+#define HTTP_RESP_BODY_MAX 64       // beginning of the body stored for logging
+
+typedef enum {
+    HTTP_RESP_STATUS,
+    HTTP_RESP_HEADERS,
+    HTTP_RESP_BODY,
+    HTTP_RESP_CHUNK_SIZE,
+    HTTP_RESP_CHUNK_DATA,
+    HTTP_RESP_CHUNK_END,
+    HTTP_RESP_TRAILER,
+    HTTP_RESP_DONE,
+    HTTP_RESP_ERROR,
+} HttpRespState;
+
+/**
+ * Incremental parser for HTTP/1.x responses
+ *
+ * The parser determines where a response ends (Content-Length or chunked transfer encoding),
+ * so that the connection can be kept open for further requests.
+ */
+typedef struct {
+    HttpRespState state;
+    int status;
+    bool keep_alive;            // connection can be used for further requests
+    bool chunked;
+    int32_t content_length;     // -1 if not specified
+    uint32_t remaining;         // bytes of the body or current chunk not received yet
+    char line[HTTP_RESP_LINE_MAX];
+    size_t line_len;
+    char body[HTTP_RESP_BODY_MAX];
+    size_t body_len;
+} HttpResponse;
+
+/**
+ * Statistics of a client connection
+ */
+typedef struct {
+    uint32_t requests;
+    uint32_t errors;
+    uint32_t connects;
+    uint32_t dns_lookups;
+    uint32_t bytes_sent;
+    uint32_t bytes_received;
+} HttpClientStats;
+
+/**
+ * Client keeping a connection to one server open across requests
+ */
+typedef struct {
+    const char *host;
+    const char *port;
+    uint32_t dns_ttl_s;         // time the resolved address is reused
+    int sock;                   // -1 if not connected
+    uint32_t ip_addr;           // resolved IPv4 address in network byte order, 0 if unknown
+    int64_t dns_expiry_us;
+    uint32_t backoff_ms;        // current delay after failed connection attempts
+    int64_t next_attempt_us;
+    HttpClientStats stats;
+} HttpClient;
+
+void http_response_init(HttpResponse *resp);
+
+/**
+ * Parse the next part of a response
+ *
+ * \returns Number of bytes consumed, which is less than len if the data contains bytes after
+ *          the end of the response
+ */
+size_t http_response_parse(HttpResponse *resp, const char *data, size_t len);
+
+/**
+ * Inform the parser that the server closed the connection
+ *
+ * \returns true if the response is complete (e.g. body without Content-Length)
+ */
+bool http_response_eof(HttpResponse *resp);
+
+/**
+ * Initialize the client, no connection is established yet
+ *
+ * \param host Hostname of the server (string must stay valid)
+ * \param port Port number as string (string must stay valid)
+ * \param dns_ttl_s Time in seconds the address of the server is cached
+ */
+void http_client_init(HttpClient *client, const char *host, const char *port, uint32_t dns_ttl_s);
+
+/**
+ * Send a request and wait for the response, the connection is established or re-established
+ * if necessary
+ *
+ * After failed connection attempts further attempts are delayed with exponential backoff.
+ *
+ * \param head Request line and headers, each terminated with \r\n, but without Content-Length
+ *             and the empty line at the end of the headers
+ * \param body Request body (may be NULL)
+ * \param resp Parser to store the response
+ *
+ * \returns HTTP status code of the response or -1 in case of error
+ */
+int http_client_request(HttpClient *client, const char *head, const char *body,
+    HttpResponse *resp);
+
+/**
+ * Close the connection and forget the cached address, e.g. after the server was changed
+ */
+void http_client_close(HttpClient *client);
+
+#endif /* HTTP_CLIENT_H_ */
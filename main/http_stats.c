@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "http_stats.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const uint32_t http_stats_bounds_ms[HTTP_STATS_BUCKETS - 1] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000
+};
+
+static const char *phase_names[HTTP_PHASE_COUNT] = { "recv", "bus", "send" };
+
+void http_trace_init(HttpTrace *trace, const char *endpoint)
+{
+    memset(trace, 0, sizeof(HttpTrace));
+    trace->endpoint = endpoint;
+}
+
+void http_trace_source(HttpTrace *trace, const char *device, const char *transport)
+{
+    if (trace == NULL) {
+        return;
+    }
+    trace->device = device;
+    trace->transport = transport;
+}
+
+void http_trace_add(HttpTrace *trace, HttpPhase phase, uint32_t us)
+{
+    if (trace == NULL) {
+        return;
+    }
+    trace->phase_us[phase] += us;
+    trace->phases |= 1U << phase;
+}
+
+void http_trace_sent(HttpTrace *trace, const char *buf, int len, uint32_t us)
+{
+    if (trace == NULL) {
+        return;
+    }
+    http_trace_add(trace, HTTP_PHASE_SEND, us);
+    if (len <= 0) {
+        return;
+    }
+    trace->bytes_out += len;
+
+    // status line is always sent at once, e.g. "HTTP/1.1 404 Not Found\r\n"
+    const char prefix[] = "HTTP/1.1 ";
+    if (trace->status == 0 && (size_t) len >= sizeof(prefix) + 2 &&
+        strncmp(buf, prefix, sizeof(prefix) - 1) == 0)
+    {
+        trace->status = atoi(buf + sizeof(prefix) - 1);
+    }
+}
+
+void http_trace_bus_begin(HttpTrace *trace, int64_t now_us)
+{
+    if (trace == NULL) {
+        return;
+    }
+    trace->bus_start_us = now_us;
+    trace->bus_io_us = trace->phase_us[HTTP_PHASE_RECV] + trace->phase_us[HTTP_PHASE_SEND];
+}
+
+void http_trace_bus_end(HttpTrace *trace, int64_t now_us)
+{
+    if (trace == NULL) {
+        return;
+    }
+    uint32_t io_us = trace->phase_us[HTTP_PHASE_RECV] + trace->phase_us[HTTP_PHASE_SEND] -
+        trace->bus_io_us;
+    int64_t bus_us = now_us - trace->bus_start_us - io_us;
+    http_trace_add(trace, HTTP_PHASE_BUS, bus_us > 0 ? bus_us : 0);
+}
+
+static void histogram_add(HttpHistogram *hist, uint32_t us)
+{
+    int bucket = 0;
+    while (bucket < HTTP_STATS_BUCKETS - 1 && us >= http_stats_bounds_ms[bucket] * 1000) {
+        bucket++;
+    }
+    hist->buckets[bucket]++;
+    hist->count++;
+    hist->sum_us += us;
+    if (us > hist->max_us) {
+        hist->max_us = us;
+    }
+}
+
+static HttpStatsEntry *find_entry(HttpStats *stats, const char *endpoint, const char *device,
+    const char *transport)
+{
+    for (int i = 0; i < stats->num_entries; i++) {
+        HttpStatsEntry *entry = &stats->entries[i];
+        if (strcmp(entry->endpoint, endpoint) == 0 && strcmp(entry->device, device) == 0 &&
+            strcmp(entry->transport, transport) == 0)
+        {
+            return entry;
+        }
+    }
+    if (stats->num_entries == HTTP_STATS_ENTRIES) {
+        return NULL;
+    }
+    HttpStatsEntry *entry = &stats->entries[stats->num_entries++];
+    memset(entry, 0, sizeof(HttpStatsEntry));
+    strncpy(entry->endpoint, endpoint, sizeof(entry->endpoint) - 1);
+    strncpy(entry->device, device, sizeof(entry->device) - 1);
+    strncpy(entry->transport, transport, sizeof(entry->transport) - 1);
+    return entry;
+}
+
+void http_stats_record(HttpStats *stats, const HttpTrace *trace)
+{
+    char device[HTTP_STATS_NAME_MAX] = "";
+    char transport[HTTP_STATS_NAME_MAX] = "none";
+    if (trace->device != NULL) {
+        strncpy(device, trace->device, sizeof(device) - 1);
+    }
+    if (trace->transport != NULL) {
+        strncpy(transport, trace->transport, sizeof(transport) - 1);
+    }
+
+    HttpStatsEntry *entry = find_entry(stats, trace->endpoint, device, transport);
+    if (entry == NULL) {
+        stats->dropped++;
+        return;
+    }
+    entry->requests++;
+    if (trace->error || trace->status >= 400) {
+        entry->errors++;
+    }
+    entry->bytes_out += trace->bytes_out;
+    for (int i = 0; i < HTTP_PHASE_COUNT; i++) {
+        if (trace->phases & (1U << i)) {
+            histogram_add(&entry->phases[i], trace->phase_us[i]);
+        }
+    }
+}
+
+static float average_ms(uint64_t sum_us, uint32_t count)
+{
+    return count > 0 ? sum_us / 1000.0F / count : 0;
+}
+
+void http_stats_summarize(const HttpStats *stats, HttpStatsSummary *summary)
+{
+    uint64_t bytes_out = 0;
+    uint64_t sum_us[HTTP_PHASE_COUNT] = {0};
+    uint32_t count[HTTP_PHASE_COUNT] = {0};
+    uint32_t bus_max_us = 0;
+    const char *transports[] = { "serial", "can", "spiffs" };
+    uint64_t transport_sum_us[3] = {0};
+    uint32_t transport_count[3] = {0};
+
+    memset(summary, 0, sizeof(HttpStatsSummary));
+    for (int i = 0; i < stats->num_entries; i++) {
+        const HttpStatsEntry *entry = &stats->entries[i];
+        summary->requests += entry->requests;
+        summary->errors += entry->errors;
+        bytes_out += entry->bytes_out;
+        for (int p = 0; p < HTTP_PHASE_COUNT; p++) {
+            sum_us[p] += entry->phases[p].sum_us;
+            count[p] += entry->phases[p].count;
+        }
+        const HttpHistogram *bus = &entry->phases[HTTP_PHASE_BUS];
+        if (bus->max_us > bus_max_us) {
+            bus_max_us = bus->max_us;
+        }
+        for (int t = 0; t < 3; t++) {
+            if (strcmp(entry->transport, transports[t]) == 0) {
+                transport_sum_us[t] += bus->sum_us;
+                transport_count[t] += bus->count;
+            }
+        }
+    }
+    summary->bytes_out = bytes_out > UINT32_MAX ? UINT32_MAX : bytes_out;
+    summary->recv_avg_ms = average_ms(sum_us[HTTP_PHASE_RECV], count[HTTP_PHASE_RECV]);
+    summary->bus_avg_ms = average_ms(sum_us[HTTP_PHASE_BUS], count[HTTP_PHASE_BUS]);
+    summary->send_avg_ms = average_ms(sum_us[HTTP_PHASE_SEND], count[HTTP_PHASE_SEND]);
+    summary->bus_max_ms = bus_max_us / 1000.0F;
+    summary->serial_bus_avg_ms = average_ms(transport_sum_us[0], transport_count[0]);
+    summary->can_bus_avg_ms = average_ms(transport_sum_us[1], transport_count[1]);
+    summary->spiffs_bus_avg_ms = average_ms(transport_sum_us[2], transport_count[2]);
+}
+
+/* appends formatted text at pos, returns false if the buffer is full */
+static bool append(char *buf, size_t size, int *pos, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buf + *pos, size - *pos, fmt, args);
+    va_end(args);
+    if (len < 0 || (size_t) len >= size - *pos) {
+        return false;
+    }
+    *pos += len;
+    return true;
+}
+
+int http_stats_entry_json(const HttpStatsEntry *entry, char *buf, size_t size)
+{
+    // names are set by the firmware (endpoints, transports) or ThingSet device IDs (base32),
+    // so they don't need escaping
+    int pos = 0;
+    if (!append(buf, size, &pos,
+        "{\"endpoint\":\"%s\",\"device\":\"%s\",\"transport\":\"%s\","
+        "\"requests\":%u,\"errors\":%u,\"bytes_out\":%llu",
+        entry->endpoint, entry->device, entry->transport,
+        (unsigned int) entry->requests, (unsigned int) entry->errors,
+        (unsigned long long) entry->bytes_out))
+    {
+        return -1;
+    }
+    for (int p = 0; p < HTTP_PHASE_COUNT; p++) {
+        const HttpHistogram *hist = &entry->phases[p];
+        if (!append(buf, size, &pos, ",\"%s\":{\"count\":%u,\"avg_ms\":%.2f,\"max_ms\":%.2f,"
+            "\"hist\":[", phase_names[p], (unsigned int) hist->count,
+            average_ms(hist->sum_us, hist->count), hist->max_us / 1000.0))
+        {
+            return -1;
+        }
+        for (int b = 0; b < HTTP_STATS_BUCKETS; b++) {
+            if (!append(buf, size, &pos, "%s%u", b > 0 ? "," : "",
+                (unsigned int) hist->buckets[b]))
+            {
+                return -1;
+            }
+        }
+        if (!append(buf, size, &pos, "]}")) {
+            return -1;
+        }
+    }
+    if (!append(buf, size, &pos, "}")) {
+        return -1;
+    }
+    return pos;
+}
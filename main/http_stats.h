@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HTTP_STATS_H_
+#define HTTP_STATS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HTTP_STATS_BUCKETS 12       // number of histogram buckets, the last one is unbounded
+#define HTTP_STATS_ENTRIES 16       // maximum number of endpoint/device/transport combinations
+#define HTTP_STATS_NAME_MAX 16
+
+/**
+ * Phases of a request, each tracked in a separate histogram
+ */
+typedef enum {
+    HTTP_PHASE_RECV,        // receiving the request body from the client
+    HTTP_PHASE_BUS,         // waiting for the data source (ThingSet device, file system, flash)
+    HTTP_PHASE_SEND,        // sending the response to the client
+    HTTP_PHASE_COUNT
+} HttpPhase;
+
+/**
+ * Upper bounds of the histogram buckets in milliseconds
+ */
+extern const uint32_t http_stats_bounds_ms[HTTP_STATS_BUCKETS - 1];
+
+typedef struct {
+    uint32_t count;
+    uint64_t sum_us;
+    uint32_t max_us;
+    uint32_t buckets[HTTP_STATS_BUCKETS];
+} HttpHistogram;
+
+typedef struct {
+    char endpoint[HTTP_STATS_NAME_MAX];
+    char device[HTTP_STATS_NAME_MAX];
+    char transport[HTTP_STATS_NAME_MAX];
+    uint32_t requests;
+    uint32_t errors;
+    uint64_t bytes_out;
+    HttpHistogram phases[HTTP_PHASE_COUNT];
+} HttpStatsEntry;
+
+typedef struct {
+    HttpStatsEntry entries[HTTP_STATS_ENTRIES];
+    int num_entries;
+    uint32_t dropped;       // requests not recorded because all entries were used
+} HttpStats;
+
+/**
+ * Measurements of a single request, collected while it is processed
+ */
+typedef struct {
+    const char *endpoint;
+    const char *device;     // ThingSet device ID or NULL
+    const char *transport;  // e.g. "serial", "can" or "spiffs", NULL if unknown
+    uint32_t phase_us[HTTP_PHASE_COUNT];
+    uint8_t phases;         // bit mask of phases that occurred
+    uint32_t bytes_out;
+    int status;             // HTTP status code of the response, 0 if not sent yet
+    bool error;             // handler failed or response was incomplete
+    bool detached;          // request is finished and recorded by another task
+    int64_t bus_start_us;
+    uint32_t bus_io_us;     // receive and send time at the beginning of the bus phase
+} HttpTrace;
+
+/**
+ * Totals over all entries, exposed as data nodes of the gateway itself
+ */
+typedef struct {
+    uint32_t requests;
+    uint32_t errors;
+    uint32_t bytes_out;
+    float recv_avg_ms;
+    float bus_avg_ms;
+    float send_avg_ms;
+    float bus_max_ms;
+    float serial_bus_avg_ms;
+    float can_bus_avg_ms;
+    float spiffs_bus_avg_ms;
+} HttpStatsSummary;
+
+/**
+ * Initialize the trace of a request
+ *
+ * All other http_trace functions accept NULL, so callers don't have to check whether the
+ * request is traced.
+ */
+void http_trace_init(HttpTrace *trace, const char *endpoint);
+
+/**
+ * Set device and interface the data of the response is obtained from
+ */
+void http_trace_source(HttpTrace *trace, const char *device, const char *transport);
+
+/**
+ * Add time spent in a phase
+ */
+void http_trace_add(HttpTrace *trace, HttpPhase phase, uint32_t us);
+
+/**
+ * Account data sent to the client. The status code is taken from the status line at the
+ * beginning of the response.
+ */
+void http_trace_sent(HttpTrace *trace, const char *buf, int len, uint32_t us);
+
+/**
+ * Start and end of the bus phase. Receive and send times in between are not added to the bus
+ * phase, so data forwarded between device and client while it arrives is accounted correctly.
+ */
+void http_trace_bus_begin(HttpTrace *trace, int64_t now_us);
+
+void http_trace_bus_end(HttpTrace *trace, int64_t now_us);
+
+/**
+ * Add a finished request to the statistics
+ */
+void http_stats_record(HttpStats *stats, const HttpTrace *trace);
+
+void http_stats_summarize(const HttpStats *stats, HttpStatsSummary *summary);
+
+/**
+ * Write an entry as JSON object
+ *
+ * \returns Number of characters written (without zero termination) or -1 if the buffer is
+ *          too small
+ */
+int http_stats_entry_json(const HttpStatsEntry *entry, char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HTTP_STATS_H_ */
@@ -19,6 +19,7 @@
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "nvs_flash.h"
 #include "sdkconfig.h"
@@ -40,11 +41,52 @@
 #include "provisioning.h"
 #include "data_nodes.h"
 #include "ota.h"
+#include "history.h"
+#include "services.h"
 
-#define RX_TASK_PRIO    9       // receiving task priority
 extern EmoncmsConfig emon_config;
 extern MqttConfig mqtt_config;
 extern GeneralConfig general_config;
+extern BootTimes boot_times;
+
+#define BOOT_FS_MOUNTED (1U << 0)
+
+static EventGroupHandle_t boot_events;
+
+static void boot_phase_done(uint32_t *time, const char *phase)
+{
+    *time = esp_timer_get_time() / 1000;
+    ESP_LOGI("boot", "%s finished after %u ms", phase, (unsigned int) *time);
+}
+
+static void fs_task(void *arg)
+{
+    init_fs();
+    boot_phase_done(&boot_times.fs, "Mounting filesystems");
+    xEventGroupSetBits(boot_events, BOOT_FS_MOUNTED);
+    vTaskDelete(NULL);
+}
+
+static void wifi_task(void *arg)
+{
+    if (strlen(general_config.wifi_ssid) > 0) {
+        wifi_connect();
+    }
+    else {
+        // no hard-coded WiFi credentials --> start provisioning via BLE
+        provision();
+    }
+    boot_phase_done(&boot_times.wifi, "WiFi connection");
+    vTaskDelete(NULL);
+}
+
+static void discovery_task(void *arg)
+{
+    // waits for responses of the device, CAN devices are discovered by their publications
+    ts_devices_scan_serial();
+    boot_phase_done(&boot_times.discovery, "Device discovery");
+    vTaskDelete(NULL);
+}
 
 void app_main(void)
 {
@@ -55,49 +97,54 @@ void app_main(void)
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
     data_nodes_init();
+    boot_phase_done(&boot_times.config, "Loading configuration");
 
     // configure the LED pad as GPIO and set direction
     gpio_pad_select_gpio(CONFIG_GPIO_LED);
     gpio_set_direction(CONFIG_GPIO_LED, GPIO_MODE_OUTPUT);
     gpio_set_level(CONFIG_GPIO_LED, 1);
-    // wait 3s to open serial terminal after flashing finished
-    vTaskDelay(3000 / portTICK_PERIOD_MS);
+#if CONFIG_BOOT_DELAY > 0
+    // time to open serial terminal after flashing finished
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_BOOT_DELAY));
+#endif
     printf("Booting Libre Solar ESP32 Edge...\n");
 
-    init_fs();
+    // independent phases run in parallel, so the web server is available as early as possible
+    boot_events = xEventGroupCreate();
+    xTaskCreate(&fs_task, "boot_fs", 4096, NULL, 5, NULL);
+    xTaskCreate(&wifi_task, "boot_wifi", 4096, NULL, 5, NULL);
 
     ts_devices_init();
 
     if (general_config.ts_can_active) {
-        can_setup();
-        xTaskCreatePinnedToCore(can_receive_task, "CAN_rx", 4096,
-        NULL, RX_TASK_PRIO, NULL, 1);
+        can_start();
     }
 
     if (general_config.ts_serial_active) {
-        ts_serial_setup();
-        xTaskCreatePinnedToCore(ts_serial_rx_task, "ts_serial_rx", 4096,
-            NULL, RX_TASK_PRIO, NULL, 1);
-        ts_devices_scan_serial();
-    }
-
-    if (strlen(general_config.wifi_ssid) > 0) {
-        wifi_connect();
-    }
-    else {
-        // no hard-coded WiFi credentials --> start provisioning via BLE
-        provision();
+        ts_serial_start();
+        xTaskCreate(&discovery_task, "boot_discovery", 4096, NULL, 5, NULL);
     }
+    boot_phase_done(&boot_times.interfaces, "Starting interfaces");
 
+#ifndef CONFIG_WEB_ASSETS_PACKED
+    // webapp is served from the filesystem
+    xEventGroupWaitBits(boot_events, BOOT_FS_MOUNTED, pdFALSE, pdTRUE, portMAX_DELAY);
+#endif
+    // requests are received as soon as the WiFi is connected
     start_web_server("/www");
+    boot_phase_done(&boot_times.web_server, "Starting web server");
 
-    if (emon_config.active) {
-        xTaskCreate(&emoncms_post_task, "emoncms_post_task", 4096, NULL, 5, NULL);
-    }
+#if CONFIG_HISTORY
+    xTaskCreate(&history_task, "history", 6144, NULL, 3, NULL);
+#endif
 
-    if (mqtt_config.active) {
-        xTaskCreate(&ts_mqtt_pub_task, "mqtt_pub", 4096, NULL, 5, NULL);
-    }
+    // only started if activated in the configuration
+    emoncms_start();
+    ts_mqtt_start();
+
+    // configuration changes are applied from now on
+    services_init();
+    boot_phase_done(&boot_times.services, "Starting services");
 }
 
 #endif //unit tests
\ No newline at end of file
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "metrics.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cJSON.h"
+
+// maximum length of names of nested values in publication messages
+#define PUBMSG_NAME_MAX 64
+
+void metrics_init(MetricsWriter *w, char *buf, size_t size,
+    int (*flush)(void *ctx, const char *buf, size_t len), void *ctx)
+{
+    w->buf = buf;
+    w->size = size;
+    w->pos = 0;
+    w->flush = flush;
+    w->ctx = ctx;
+    w->err = 0;
+    w->lost = 0;
+}
+
+static void flush(MetricsWriter *w)
+{
+    if (w->pos > 0 && w->err == 0 && w->flush(w->ctx, w->buf, w->pos) != 0) {
+        w->err = -1;
+    }
+    // after an error all data is discarded
+    w->pos = 0;
+}
+
+/* appends formatted text at pos, returns false if the buffer is full */
+static bool append(MetricsWriter *w, size_t *pos, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(w->buf + *pos, w->size - *pos, fmt, args);
+    va_end(args);
+    if (len < 0 || len >= w->size - *pos) {
+        return false;
+    }
+    *pos += len;
+    return true;
+}
+
+/* appends label value with backslash, double-quote and line feed escaped */
+static bool append_escaped(MetricsWriter *w, size_t *pos, const char *str)
+{
+    for (const char *c = str; *c != '\0'; c++) {
+        char esc = 0;
+        if (*c == '\\' || *c == '"') {
+            esc = *c;
+        }
+        else if (*c == '\n') {
+            esc = 'n';
+        }
+        if (*pos + (esc ? 2 : 1) >= w->size) {
+            return false;
+        }
+        if (esc) {
+            w->buf[(*pos)++] = '\\';
+            w->buf[(*pos)++] = esc;
+        }
+        else {
+            w->buf[(*pos)++] = *c;
+        }
+    }
+    return true;
+}
+
+static bool append_value(MetricsWriter *w, size_t *pos, double value)
+{
+    if (isnan(value)) {
+        return append(w, pos, "NaN\n");
+    }
+    else if (isinf(value)) {
+        return append(w, pos, value > 0 ? "+Inf\n" : "-Inf\n");
+    }
+    return append(w, pos, "%.10g\n", value);
+}
+
+static bool write_family(MetricsWriter *w, size_t *pos, const char *name, const char *type,
+    const char *help)
+{
+    return append(w, pos, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static bool write_sample(MetricsWriter *w, size_t *pos, const char *name,
+    const char *label1, const char *value1, const char *label2, const char *value2, double value)
+{
+    if (!append(w, pos, "%s", name)) {
+        return false;
+    }
+    const char *labels[] = { label1, label2 };
+    const char *values[] = { value1, value2 };
+    int num_labels = 0;
+    for (int i = 0; i < 2; i++) {
+        if (labels[i] == NULL) {
+            continue;
+        }
+        if (!append(w, pos, "%s%s=\"", num_labels == 0 ? "{" : ",", labels[i]) ||
+            !append_escaped(w, pos, values[i] != NULL ? values[i] : "") ||
+            !append(w, pos, "\""))
+        {
+            return false;
+        }
+        num_labels++;
+    }
+    if (num_labels > 0 && !append(w, pos, "}")) {
+        return false;
+    }
+    return append(w, pos, " ") && append_value(w, pos, value);
+}
+
+void metrics_family(MetricsWriter *w, const char *name, const char *type, const char *help)
+{
+    size_t pos = w->pos;
+    if (!write_family(w, &pos, name, type, help)) {
+        // try again with empty buffer
+        flush(w);
+        pos = 0;
+        if (!write_family(w, &pos, name, type, help)) {
+            w->lost++;
+            return;
+        }
+    }
+    w->pos = pos;
+}
+
+void metrics_sample(MetricsWriter *w, const char *name, const char *label1, const char *value1,
+    const char *label2, const char *value2, double value)
+{
+    size_t pos = w->pos;
+    if (!write_sample(w, &pos, name, label1, value1, label2, value2, value)) {
+        // try again with empty buffer
+        flush(w);
+        pos = 0;
+        if (!write_sample(w, &pos, name, label1, value1, label2, value2, value)) {
+            w->lost++;
+            return;
+        }
+    }
+    w->pos = pos;
+}
+
+void metrics_value(MetricsWriter *w, const char *name, const char *type, const char *help,
+    double value)
+{
+    metrics_family(w, name, type, help);
+    metrics_sample(w, name, NULL, NULL, NULL, NULL, value);
+}
+
+static int write_object(MetricsWriter *w, const char *name, const char *device,
+    const cJSON *obj, char *path, size_t path_size)
+{
+    int num = 0;
+    size_t len = strlen(path);
+    const cJSON *item;
+    cJSON_ArrayForEach(item, obj) {
+        if (item->string == NULL) {
+            continue;
+        }
+        int ret = snprintf(path + len, path_size - len, "%s%s", len > 0 ? "/" : "",
+            item->string);
+        if (ret < 0 || ret >= path_size - len) {
+            continue;
+        }
+        if (cJSON_IsNumber(item)) {
+            metrics_sample(w, name, "device", device, "name", path, item->valuedouble);
+            num++;
+        }
+        else if (cJSON_IsBool(item)) {
+            metrics_sample(w, name, "device", device, "name", path, cJSON_IsTrue(item) ? 1 : 0);
+            num++;
+        }
+        else if (cJSON_IsObject(item)) {
+            num += write_object(w, name, device, item, path, path_size);
+        }
+    }
+    path[len] = '\0';
+    return num;
+}
+
+int metrics_pubmsg(MetricsWriter *w, const char *name, const char *device, const char *pubmsg)
+{
+    // message format: #<path> <json-data>
+    if (pubmsg == NULL || pubmsg[0] != '#') {
+        return -1;
+    }
+    const char *json = strchr(pubmsg, ' ');
+    if (json == NULL) {
+        return -1;
+    }
+    cJSON *obj = cJSON_Parse(json + 1);
+    if (!cJSON_IsObject(obj)) {
+        cJSON_Delete(obj);
+        return -1;
+    }
+    char path[PUBMSG_NAME_MAX] = "";
+    int num = write_object(w, name, device, obj, path, sizeof(path));
+    cJSON_Delete(obj);
+    return num;
+}
+
+int metrics_finish(MetricsWriter *w)
+{
+    flush(w);
+    return (w->err != 0 || w->lost > 0) ? -1 : 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Writer for metrics in Prometheus text exposition format
+ *
+ * Lines are collected in a fixed buffer which is passed to the flush function whenever the
+ * next line would not fit anymore, so the document never has to be stored completely.
+ */
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t pos;
+    // sends len bytes from buf and returns 0 on success
+    int (*flush)(void *ctx, const char *buf, size_t len);
+    void *ctx;
+    int err;                // set if flush failed, nothing is sent anymore afterwards
+    int lost;               // number of lines that didn't fit into the buffer
+} MetricsWriter;
+
+void metrics_init(MetricsWriter *w, char *buf, size_t size,
+    int (*flush)(void *ctx, const char *buf, size_t len), void *ctx);
+
+/**
+ * Write HELP and TYPE lines of a metric family (type is "gauge" or "counter")
+ */
+void metrics_family(MetricsWriter *w, const char *name, const char *type, const char *help);
+
+/**
+ * Write a sample with up to two labels (label names may be NULL if not used)
+ *
+ * Label values are escaped as required by the format.
+ */
+void metrics_sample(MetricsWriter *w, const char *name, const char *label1, const char *value1,
+    const char *label2, const char *value2, double value);
+
+/**
+ * Write a metric family consisting of a single sample without labels
+ */
+void metrics_value(MetricsWriter *w, const char *name, const char *type, const char *help,
+    double value);
+
+/**
+ * Write all numeric and boolean values of a ThingSet publication message (#<path> <json>) as
+ * samples of the given metric, labeled with device and name. Values of nested objects get
+ * names like "parent/child".
+ *
+ * \returns Number of samples written or -1 if the message could not be parsed
+ */
+int metrics_pubmsg(MetricsWriter *w, const char *name, const char *device, const char *pubmsg);
+
+/**
+ * Flush remaining data
+ *
+ * \returns 0 on success or -1 if sending failed or any line was lost
+ */
+int metrics_finish(MetricsWriter *w);
+
+#endif /* METRICS_H_ */
@@ -14,6 +14,8 @@
 #include "errno.h"
 #include "driver/gpio.h"
 
+#include "data_nodes.h"
+
 static const char *TAG = "esp_ota";
 
 #define DIAGNOSTIC_PIN 4
@@ -208,6 +210,7 @@ void esp_ota_reset_device()
 {
     vTaskDelay(pdMS_TO_TICKS(1000));
     ESP_LOGI("reset_task", "Prepare to restart system!");
+    config_nodes_flush();
     esp_restart();
 }
 
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "pub_batch.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void pub_batch_init(PubBatch *batch, char *buf, size_t size)
+{
+    batch->buf = buf;
+    batch->size = size;
+    pub_batch_clear(batch);
+}
+
+int pub_batch_add(PubBatch *batch, const char *key, const char *data, uint32_t now_ms)
+{
+    // separator, brackets, quotes and comma of the new pair
+    size_t pair_len = strlen(key) + strlen(data) + 6;
+    // space for closing bracket and zero termination is always reserved
+    if (pair_len + 2 > batch->size) {
+        return -1;
+    }
+    if (batch->len + pair_len + 2 > batch->size) {
+        return 1;
+    }
+
+    if (batch->num == 0) {
+        batch->start_ms = now_ms;
+    }
+    batch->len += snprintf(batch->buf + batch->len, batch->size - batch->len, "%c[\"%s\",%s]",
+        batch->num == 0 ? '[' : ',', key, data);
+    batch->num++;
+    return 0;
+}
+
+bool pub_batch_due(const PubBatch *batch, uint32_t now_ms, uint32_t max_delay_ms)
+{
+    return batch->num > 0 && now_ms - batch->start_ms >= max_delay_ms;
+}
+
+const char *pub_batch_finish(PubBatch *batch)
+{
+    if (batch->num == 0) {
+        return NULL;
+    }
+    // space was reserved when adding the data
+    batch->buf[batch->len] = ']';
+    batch->buf[batch->len + 1] = '\0';
+    return batch->buf;
+}
+
+void pub_batch_clear(PubBatch *batch)
+{
+    batch->len = 0;
+    batch->num = 0;
+    if (batch->size > 0) {
+        batch->buf[0] = '\0';
+    }
+}
+
+void pub_window_init(PubWindow *window, int max)
+{
+    memset(window, 0, sizeof(PubWindow));
+    window->max = (max > PUB_WINDOW_MAX) ? PUB_WINDOW_MAX : (max < 1 ? 1 : max);
+}
+
+bool pub_window_full(const PubWindow *window)
+{
+    return window->num >= window->max;
+}
+
+static void record_ack(PubWindow *window, uint32_t latency)
+{
+    window->acked++;
+    window->latency_sum_ms += latency;
+    if (latency > window->latency_max_ms) {
+        window->latency_max_ms = latency;
+    }
+}
+
+static void remove_early_ack(PubWindow *window, int index)
+{
+    memmove(&window->early_acks[index], &window->early_acks[index + 1],
+        (window->num_early_acks - index - 1) * sizeof(PubEarlyAck));
+    window->num_early_acks--;
+}
+
+int pub_window_add(PubWindow *window, int msg_id, uint32_t sent_ms)
+{
+    for (int i = 0; i < window->num_early_acks; i++) {
+        if (window->early_acks[i].msg_id == msg_id) {
+            int32_t latency = window->early_acks[i].ack_ms - sent_ms;
+            remove_early_ack(window, i);
+            record_ack(window, latency > 0 ? latency : 0);
+            return 0;
+        }
+    }
+    if (pub_window_full(window)) {
+        return -1;
+    }
+    window->msgs[window->num].msg_id = msg_id;
+    window->msgs[window->num].sent_ms = sent_ms;
+    window->num++;
+    return 0;
+}
+
+static void remove_msg(PubWindow *window, int index)
+{
+    // keep messages sorted by the time they were sent
+    memmove(&window->msgs[index], &window->msgs[index + 1],
+        (window->num - index - 1) * sizeof(PubInflight));
+    window->num--;
+}
+
+int pub_window_ack(PubWindow *window, int msg_id, uint32_t now_ms)
+{
+    for (int i = 0; i < window->num; i++) {
+        if (window->msgs[i].msg_id == msg_id) {
+            uint32_t latency = now_ms - window->msgs[i].sent_ms;
+            remove_msg(window, i);
+            record_ack(window, latency);
+            return latency;
+        }
+    }
+
+    // the message may be added after the acknowledgement was received, see pub_window_add
+    if (window->num_early_acks == PUB_WINDOW_EARLY_ACKS) {
+        remove_early_ack(window, 0);
+    }
+    window->early_acks[window->num_early_acks].msg_id = msg_id;
+    window->early_acks[window->num_early_acks].ack_ms = now_ms;
+    window->num_early_acks++;
+    return -1;
+}
+
+int pub_window_expire(PubWindow *window, uint32_t now_ms, uint32_t timeout_ms)
+{
+    int num = 0;
+    while (window->num > 0 && now_ms - window->msgs[0].sent_ms >= timeout_ms) {
+        remove_msg(window, 0);
+        window->expired++;
+        num++;
+    }
+    // acknowledgements of expired messages are never matched
+    while (window->num_early_acks > 0 && now_ms - window->early_acks[0].ack_ms >= timeout_ms) {
+        remove_early_ack(window, 0);
+    }
+    return num;
+}
+
+void pub_window_stats(const PubWindow *window, PubStats *stats)
+{
+    stats->published = window->published;
+    stats->acked = window->acked;
+    stats->expired = window->expired;
+    stats->inflight = window->num;
+    // messages still in flight are not counted as lost yet
+    uint32_t completed = window->acked + window->expired;
+    stats->ack_rate_pct = completed > 0 ? 100.0f * window->acked / completed : 0;
+    stats->latency_avg_ms = window->acked > 0 ?
+        (float) window->latency_sum_ms / window->acked : 0;
+    stats->latency_max_ms = window->latency_max_ms;
+}
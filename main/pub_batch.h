@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef PUB_BATCH_H_
+#define PUB_BATCH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PUB_WINDOW_MAX 16           // maximum number of unacknowledged messages
+#define PUB_WINDOW_EARLY_ACKS 4     // acknowledgements received before the message was added
+
+/**
+ * Aggregation of several publication messages into one JSON array
+ *
+ * Each message is stored as pair of "<device_id>/<path>" and its data in the order the
+ * messages were added, e.g. [["MPPT1/serial",{"Bat_V":14.1}],["can:10/can",{"Bat_V":14.0}]].
+ */
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;             // length of the array without the closing bracket
+    uint32_t num;           // number of messages in the batch
+    uint32_t start_ms;      // time the first message was added
+} PubBatch;
+
+/**
+ * Message sent with QoS 1 that was not acknowledged by the broker yet
+ */
+typedef struct {
+    int msg_id;
+    uint32_t sent_ms;
+} PubInflight;
+
+/**
+ * Acknowledgement of a message which was not in the window (yet)
+ */
+typedef struct {
+    int msg_id;
+    uint32_t ack_ms;
+} PubEarlyAck;
+
+/**
+ * Bounded window of messages in flight, used to limit the number of messages stored in the
+ * outbox of the MQTT client and to measure the time until they are acknowledged
+ */
+typedef struct {
+    PubInflight msgs[PUB_WINDOW_MAX];
+    int num;
+    int max;                        // configured window size
+    PubEarlyAck early_acks[PUB_WINDOW_EARLY_ACKS];  // oldest one is overwritten if full
+    int num_early_acks;
+    uint32_t published;             // all messages sent, counted by the caller as QoS 0
+                                    // messages are not added to the window
+    uint32_t acked;
+    uint32_t expired;               // not acknowledged within the timeout
+    uint64_t latency_sum_ms;
+    uint32_t latency_max_ms;
+} PubWindow;
+
+/**
+ * Publication statistics, exposed as data nodes of the gateway itself
+ */
+typedef struct {
+    uint32_t published;
+    uint32_t acked;
+    uint32_t expired;
+    uint32_t inflight;
+    float ack_rate_pct;             // acknowledged QoS 1 messages in percent of all acknowledged
+                                    // or expired ones
+    float latency_avg_ms;
+    float latency_max_ms;
+} PubStats;
+
+/**
+ * Initialize an empty batch using the given buffer
+ */
+void pub_batch_init(PubBatch *batch, char *buf, size_t size);
+
+/**
+ * Add the data of a message to the batch
+ *
+ * \returns 0 if the data was added, 1 if the batch has to be sent first because there is not
+ *          enough space left or -1 if the data does not even fit into an empty batch
+ */
+int pub_batch_add(PubBatch *batch, const char *key, const char *data, uint32_t now_ms);
+
+/**
+ * Check if the oldest message in the batch has waited at least max_delay_ms
+ */
+bool pub_batch_due(const PubBatch *batch, uint32_t now_ms, uint32_t max_delay_ms);
+
+/**
+ * Close the JSON array so that it can be sent
+ *
+ * \returns Pointer to the zero-terminated JSON array or NULL if the batch is empty
+ */
+const char *pub_batch_finish(PubBatch *batch);
+
+/**
+ * Remove all messages from the batch
+ */
+void pub_batch_clear(PubBatch *batch);
+
+/**
+ * Initialize an empty window with up to max messages in flight (limited to PUB_WINDOW_MAX)
+ */
+void pub_window_init(PubWindow *window, int max);
+
+bool pub_window_full(const PubWindow *window);
+
+/**
+ * Add a message which has to be acknowledged by the broker
+ *
+ * Messages can only be added after they were published, so the broker may have acknowledged
+ * it already. In this case it is counted as acknowledged right away.
+ *
+ * \param sent_ms Time before the message was published
+ *
+ * \returns 0 on success or -1 if the window is full
+ */
+int pub_window_add(PubWindow *window, int msg_id, uint32_t sent_ms);
+
+/**
+ * Remove an acknowledged message from the window
+ *
+ * \returns Time in milliseconds until the message was acknowledged or -1 if the message is
+ *          not in the window (e.g. because it was already expired or not added yet)
+ */
+int pub_window_ack(PubWindow *window, int msg_id, uint32_t now_ms);
+
+/**
+ * Remove messages which were not acknowledged within timeout_ms, and acknowledgements of
+ * messages which were not added within timeout_ms
+ *
+ * \returns Number of expired messages
+ */
+int pub_window_expire(PubWindow *window, uint32_t now_ms, uint32_t timeout_ms);
+
+void pub_window_stats(const PubWindow *window, PubStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PUB_BATCH_H_ */
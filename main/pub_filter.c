@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "pub_filter.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char *key;        // name without quotes (not zero-terminated)
+    size_t key_len;
+    const char *value;      // JSON text of the value
+    size_t value_len;
+} Member;
+
+void pub_filter_init(PubFilter *filter, float abs_deadband, float rel_deadband,
+    uint32_t refresh_intervals)
+{
+    memset(filter, 0, sizeof(PubFilter));
+    filter->abs_deadband = abs_deadband;
+    filter->rel_deadband = rel_deadband;
+    filter->refresh_intervals = refresh_intervals;
+    filter->refresh = true;
+}
+
+void pub_filter_refresh(PubFilter *filter)
+{
+    filter->refresh = true;
+}
+
+static PubFilterRule *find_rule(PubFilter *filter, const char *key, size_t key_len)
+{
+    for (int i = 0; i < filter->num_rules; i++) {
+        if (strncmp(filter->rules[i].key, key, key_len) == 0 &&
+            filter->rules[i].key[key_len] == '\0')
+        {
+            return &filter->rules[i];
+        }
+    }
+    return NULL;
+}
+
+int pub_filter_set_rules(PubFilter *filter, const char *rules)
+{
+    filter->num_rules = 0;
+    const char *pos = rules;
+    while (*pos != '\0') {
+        while (*pos == ' ') {
+            pos++;
+        }
+        const char *sep = pos + strcspn(pos, ",");
+        const char *eq = strchr(pos, '=');
+        if (eq == NULL || eq > sep || eq == pos || eq - pos >= PUB_FILTER_KEY_LEN) {
+            goto error;
+        }
+
+        char *end;
+        double deadband = strtod(eq + 1, &end);
+        bool relative = *end == '%';
+        if (relative) {
+            end++;
+        }
+        if (end == eq + 1 || end != sep || deadband < 0) {
+            goto error;
+        }
+
+        PubFilterRule *rule = find_rule(filter, pos, eq - pos);
+        if (rule == NULL) {
+            if (filter->num_rules == PUB_FILTER_RULES_MAX) {
+                goto error;
+            }
+            rule = &filter->rules[filter->num_rules++];
+            memset(rule, 0, sizeof(PubFilterRule));
+            memcpy(rule->key, pos, eq - pos);
+        }
+        if (relative) {
+            rule->rel = deadband;
+        }
+        else {
+            rule->abs = deadband;
+        }
+        pos = (*sep == ',') ? sep + 1 : sep;
+    }
+    return filter->num_rules;
+
+error:
+    filter->num_rules = 0;
+    return -1;
+}
+
+static const char *skip_whitespace(const char *pos)
+{
+    while (*pos == ' ' || *pos == '\t' || *pos == '\r' || *pos == '\n') {
+        pos++;
+    }
+    return pos;
+}
+
+/* returns position behind the closing quote or NULL if the string is not terminated */
+static const char *scan_string(const char *pos)
+{
+    for (pos++; *pos != '"'; pos++) {
+        if (*pos == '\0' || (*pos == '\\' && *++pos == '\0')) {
+            return NULL;
+        }
+    }
+    return pos + 1;
+}
+
+/* returns position behind the value or NULL in case of error */
+static const char *scan_value(const char *pos)
+{
+    if (*pos == '"') {
+        return scan_string(pos);
+    }
+    else if (*pos == '{' || *pos == '[') {
+        int depth = 0;
+        while (*pos != '\0') {
+            if (*pos == '"') {
+                pos = scan_string(pos);
+                if (pos == NULL) {
+                    return NULL;
+                }
+                continue;
+            }
+            else if (*pos == '{' || *pos == '[') {
+                depth++;
+            }
+            else if ((*pos == '}' || *pos == ']') && --depth == 0) {
+                return pos + 1;
+            }
+            pos++;
+        }
+        return NULL;
+    }
+
+    // number or literal (true, false, null)
+    const char *start = pos;
+    while (*pos != '\0' && strchr(",}] \t\r\n", *pos) == NULL) {
+        pos++;
+    }
+    return pos > start ? pos : NULL;
+}
+
+/*
+ * Gets the next member of an object, pos must point behind the opening brace or the previous
+ * member
+ *
+ * \returns 1 if a member was found, 0 at the end of the object or -1 in case of syntax error
+ */
+static int next_member(const char **pos, bool first, Member *member)
+{
+    const char *p = skip_whitespace(*pos);
+    if (*p == '}') {
+        *pos = p + 1;
+        return 0;
+    }
+    if (!first) {
+        if (*p != ',') {
+            return -1;
+        }
+        p = skip_whitespace(p + 1);
+    }
+    if (*p != '"') {
+        return -1;
+    }
+    const char *end = scan_string(p);
+    if (end == NULL) {
+        return -1;
+    }
+    member->key = p + 1;
+    member->key_len = end - p - 2;
+
+    p = skip_whitespace(end);
+    if (*p != ':') {
+        return -1;
+    }
+    p = skip_whitespace(p + 1);
+    end = scan_value(p);
+    if (end == NULL) {
+        return -1;
+    }
+    member->value = p;
+    member->value_len = end - p;
+    *pos = end;
+    return 1;
+}
+
+static bool valid_object(const char *pos)
+{
+    Member member;
+    int ret;
+    bool first = true;
+    pos++;
+    while ((ret = next_member(&pos, first, &member)) == 1) {
+        first = false;
+    }
+    return ret == 0 && *skip_whitespace(pos) == '\0';
+}
+
+static uint32_t hash(const char *data, size_t len)
+{
+    // 32-bit FNV-1a
+    uint32_t h = 0x811C9DC5;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t) data[i]) * 0x01000193;
+    }
+    return h;
+}
+
+static bool exceeds_deadband(double last, double value, float abs, float rel)
+{
+    if (isnan(last) || isnan(value)) {
+        return isnan(last) != isnan(value);
+    }
+    double deadband = fmax(abs, fabs(last) * rel / 100);
+    return fabs(value - last) > deadband;
+}
+
+/* decides if the value has to be published and stores it as the last published value */
+static bool publish_value(PubFilter *filter, const Member *member, bool full)
+{
+    if (member->key_len >= PUB_FILTER_KEY_LEN) {
+        // can't be tracked
+        return true;
+    }
+
+    char *end;
+    double value = strtod(member->value, &end);
+    bool numeric = (end == member->value + member->value_len);
+    uint32_t value_hash = numeric ? 0 : hash(member->value, member->value_len);
+
+    PubFilterValue *last = NULL;
+    for (int i = 0; i < filter->num_values; i++) {
+        if (strncmp(filter->values[i].key, member->key, member->key_len) == 0 &&
+            filter->values[i].key[member->key_len] == '\0')
+        {
+            last = &filter->values[i];
+            break;
+        }
+    }
+
+    if (last == NULL) {
+        if (filter->num_values == PUB_FILTER_VALUES_MAX) {
+            return true;
+        }
+        last = &filter->values[filter->num_values++];
+        memcpy(last->key, member->key, member->key_len);
+        last->key[member->key_len] = '\0';
+    }
+    else if (!full && last->numeric == numeric) {
+        if (numeric) {
+            PubFilterRule *rule = find_rule(filter, member->key, member->key_len);
+            if (!exceeds_deadband(last->value, value,
+                rule != NULL ? rule->abs : filter->abs_deadband,
+                rule != NULL ? rule->rel : filter->rel_deadband))
+            {
+                return false;
+            }
+        }
+        else if (last->hash == value_hash) {
+            return false;
+        }
+    }
+
+    last->numeric = numeric;
+    last->value = value;
+    last->hash = value_hash;
+    return true;
+}
+
+int pub_filter_apply(PubFilter *filter, const char *json, char *buf, size_t size)
+{
+    const char *pos = skip_whitespace(json);
+    if (*pos != '{' || size < strlen(json) + 1 || !valid_object(pos)) {
+        return -1;
+    }
+
+    bool full = filter->refresh;
+    if (filter->refresh_intervals > 0 && ++filter->intervals >= filter->refresh_intervals) {
+        full = true;
+    }
+    if (full) {
+        filter->intervals = 0;
+        filter->refresh = false;
+    }
+
+    size_t len = 0;
+    int num = 0;
+    bool first = true;
+    Member member;
+    buf[len++] = '{';
+    pos++;
+    while (next_member(&pos, first, &member) == 1) {
+        first = false;
+        if (publish_value(filter, &member, full)) {
+            if (num > 0) {
+                buf[len++] = ',';
+            }
+            // copy including quotes of the name, the output can't be longer than the input
+            const char *start = member.key - 1;
+            size_t member_len = member.value + member.value_len - start;
+            memcpy(buf + len, start, member_len);
+            len += member_len;
+            num++;
+        }
+    }
+
+    if (num == 0) {
+        buf[0] = '\0';
+        return 0;
+    }
+    buf[len++] = '}';
+    buf[len] = '\0';
+    return len;
+}
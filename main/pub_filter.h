@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef PUB_FILTER_H_
+#define PUB_FILTER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PUB_FILTER_KEY_LEN 32       // maximum length of value names (incl. zero termination)
+#define PUB_FILTER_VALUES_MAX 64    // values tracked, further values are always published
+#define PUB_FILTER_RULES_MAX 16     // value-specific deadbands
+
+typedef struct {
+    char key[PUB_FILTER_KEY_LEN];
+    float abs;              // absolute deadband
+    float rel;              // relative deadband in percent of the last published value
+} PubFilterRule;
+
+typedef struct {
+    char key[PUB_FILTER_KEY_LEN];
+    bool numeric;
+    double value;           // last published value (numbers)
+    uint32_t hash;          // hash of last published JSON text (strings, bools, objects, ...)
+} PubFilterValue;
+
+/**
+ * Report-by-exception filter for ThingSet publication messages
+ *
+ * Only values which changed by more than their deadband since they were last published are
+ * passed on. Numbers have to move beyond both the absolute and the relative deadband (so that
+ * the absolute deadband suppresses noise around zero), all other values are passed on as soon
+ * as they change. Every refresh_intervals messages all values are passed on.
+ */
+typedef struct {
+    float abs_deadband;
+    float rel_deadband;
+    uint32_t refresh_intervals;     // 0 to disable forced refresh
+    uint32_t intervals;             // messages since the last full refresh
+    bool refresh;                   // next message is passed on completely
+    PubFilterRule rules[PUB_FILTER_RULES_MAX];
+    int num_rules;
+    PubFilterValue values[PUB_FILTER_VALUES_MAX];
+    int num_values;
+} PubFilter;
+
+/**
+ * Initialize the filter with the default deadbands for all values
+ */
+void pub_filter_init(PubFilter *filter, float abs_deadband, float rel_deadband,
+    uint32_t refresh_intervals);
+
+/**
+ * Set value-specific deadbands, replacing the default deadbands for these values
+ *
+ * Format: comma-separated list of name=deadband, where deadbands with a trailing % are
+ * relative, e.g. "Bat_V=0.05,Solar_W=2%". Both types can be set for the same value by
+ * listing it twice.
+ *
+ * \returns Number of rules or -1 if the string could not be parsed completely
+ */
+int pub_filter_set_rules(PubFilter *filter, const char *rules);
+
+/**
+ * Pass the next message on completely, e.g. after the connection was re-established
+ */
+void pub_filter_refresh(PubFilter *filter);
+
+/**
+ * Filter the JSON object of a publication message
+ *
+ * The output contains the members of the input whose values have to be published, copied
+ * verbatim. It is never longer than the input.
+ *
+ * \returns Length of the output object, 0 if no value has to be published or -1 if the input
+ *          is not a valid JSON object or the buffer is too small
+ */
+int pub_filter_apply(PubFilter *filter, const char *json, char *buf, size_t size);
+
+#endif /* PUB_FILTER_H_ */
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef UNIT_TEST
+
+#include "services.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include <mdns.h>
+
+#include "data_nodes.h"
+#include "ts_client.h"
+#include "ts_serial.h"
+#include "ts_mqtt.h"
+#include "can.h"
+#include "emoncms.h"
+
+static const char *TAG = "services";
+
+extern GeneralConfig general_config;
+
+// a request may save several configuration nodes, which are collected for this time
+#define APPLY_DELAY_MS 500
+
+static TaskHandle_t apply_task;
+
+/* general configuration the running services are based on */
+static GeneralConfig applied;
+
+static void apply_general()
+{
+    if (strcmp(applied.wifi_ssid, general_config.wifi_ssid) != 0 ||
+        strcmp(applied.wifi_password, general_config.wifi_password) != 0)
+    {
+        // the connection used by the web server and all other services is affected
+        ESP_LOGI(TAG, "WiFi credentials changed, restarting device");
+        reset_device();
+        return;
+    }
+
+    if (strcmp(applied.mdns_hostname, general_config.mdns_hostname) != 0) {
+        // fails if mDNS was not started, e.g. with hard-coded WiFi credentials
+        if (mdns_hostname_set(general_config.mdns_hostname) == ESP_OK) {
+            mdns_instance_name_set(general_config.mdns_hostname);
+            ESP_LOGI(TAG, "mDNS hostname changed to %s", general_config.mdns_hostname);
+        }
+    }
+
+    if (applied.ts_can_active != general_config.ts_can_active) {
+        if (general_config.ts_can_active) {
+            can_start();
+        }
+        else {
+            can_stop();
+        }
+    }
+
+    if (applied.ts_serial_active != general_config.ts_serial_active) {
+        if (general_config.ts_serial_active) {
+            ts_serial_start();
+            // the device stays registered while the interface is stopped
+            if (ts_get_can_device(UINT8_MAX) == NULL) {
+                ts_devices_scan_serial();
+            }
+        }
+        else {
+            ts_serial_stop();
+        }
+    }
+
+    applied = general_config;
+}
+
+static void services_apply_task(void *arg)
+{
+    while (1) {
+        uint32_t changed = 0;
+        uint32_t more;
+        xTaskNotifyWait(0, UINT32_MAX, &changed, portMAX_DELAY);
+        while (xTaskNotifyWait(0, UINT32_MAX, &more, pdMS_TO_TICKS(APPLY_DELAY_MS)) == pdTRUE) {
+            changed |= more;
+        }
+
+        if (changed & SERVICES_CONF_GENERAL) {
+            apply_general();
+        }
+        if (changed & SERVICES_CONF_EMONCMS) {
+            emoncms_stop();
+            emoncms_start();
+        }
+        if (changed & SERVICES_CONF_MQTT) {
+            ts_mqtt_stop();
+            ts_mqtt_start();
+        }
+    }
+}
+
+void services_init()
+{
+    applied = general_config;
+    xTaskCreate(&services_apply_task, "services", 4096, NULL, 4, &apply_task);
+}
+
+void services_apply(uint32_t changed)
+{
+    if (apply_task != NULL) {
+        xTaskNotify(apply_task, changed, eSetBits);
+    }
+}
+
+#endif // UNIT_TEST
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SERVICES_H_
+#define SERVICES_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+/*
+ * Configuration nodes, passed to services_apply
+ */
+#define SERVICES_CONF_GENERAL   (1U << 0)
+#define SERVICES_CONF_EMONCMS   (1U << 1)
+#define SERVICES_CONF_MQTT      (1U << 2)
+
+/**
+ * Start the task applying configuration changes at runtime
+ *
+ * Must be called after the services were started with the current configuration.
+ */
+void services_init();
+
+/**
+ * Apply saved configuration changes without restarting the device
+ *
+ * The affected services are stopped and started again with the new configuration in a
+ * separate task, so the request which changed the configuration can return first. Changes
+ * within a short time are applied together. Only changed WiFi credentials restart the device.
+ *
+ * Does nothing before services_init was called.
+ *
+ * \param changed SERVICES_CONF_* flags of the saved configuration nodes
+ */
+void services_apply(uint32_t changed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SERVICES_H_ */
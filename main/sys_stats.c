@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "sys_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* appends an entry only if it fits completely, so lists are truncated at entry boundaries */
+static int append_entry(char *buf, size_t size, size_t *pos, const char *entry)
+{
+    size_t len = strlen(entry) + (*pos > 0 ? 1 : 0);
+    if (*pos + len >= size) {
+        return -1;
+    }
+    snprintf(buf + *pos, size - *pos, "%s%s", *pos > 0 ? "," : "", entry);
+    *pos += len;
+    return 0;
+}
+
+int sys_stats_stack_list(const SysTaskSample *tasks, uint32_t num, char *buf, size_t size)
+{
+    char entry[32];
+    size_t pos = 0;
+    int written = 0;
+
+    buf[0] = '\0';
+    for (uint32_t i = 0; i < num; i++) {
+        snprintf(entry, sizeof(entry), "%s=%u", tasks[i].name,
+            (unsigned int) tasks[i].stack_free);
+        if (append_entry(buf, size, &pos, entry) < 0) {
+            break;
+        }
+        written++;
+    }
+    return written;
+}
+
+/* run time of a task since the previous sample */
+static uint32_t runtime_delta(const SysTaskSample *prev, uint32_t num_prev,
+    const SysTaskSample *task)
+{
+    for (uint32_t i = 0; i < num_prev; i++) {
+        if (prev[i].id == task->id) {
+            // unsigned arithmetic handles the wrap-around of the counter
+            return task->runtime - prev[i].runtime;
+        }
+    }
+    return task->runtime;
+}
+
+int sys_stats_cpu_list(const SysTaskSample *prev, uint32_t num_prev, const SysTaskSample *cur,
+    uint32_t num_cur, char *buf, size_t size)
+{
+    char entry[32];
+    size_t pos = 0;
+    int written = 0;
+
+    buf[0] = '\0';
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < num_cur; i++) {
+        total += runtime_delta(prev, num_prev, &cur[i]);
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < num_cur; i++) {
+        // percent with one decimal, rounded
+        uint64_t delta = runtime_delta(prev, num_prev, &cur[i]);
+        uint32_t permille = (delta * 1000 + total / 2) / total;
+        snprintf(entry, sizeof(entry), "%s=%u.%u", cur[i].name,
+            (unsigned int) permille / 10, (unsigned int) permille % 10);
+        if (append_entry(buf, size, &pos, entry) < 0) {
+            break;
+        }
+        written++;
+    }
+    return written;
+}
+
+#ifndef UNIT_TEST
+
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "esp_log.h"
+
+#include "can.h"
+#include "ts_mqtt.h"
+#include "web_server.h"
+
+static const char *reset_reason_name(esp_reset_reason_t reason)
+{
+    switch (reason) {
+        case ESP_RST_POWERON:   return "PowerOn";
+        case ESP_RST_EXT:       return "External";
+        case ESP_RST_SW:        return "Software";
+        case ESP_RST_PANIC:     return "Panic";
+        case ESP_RST_INT_WDT:   return "IntWatchdog";
+        case ESP_RST_TASK_WDT:  return "TaskWatchdog";
+        case ESP_RST_WDT:       return "Watchdog";
+        case ESP_RST_DEEPSLEEP: return "DeepSleep";
+        case ESP_RST_BROWNOUT:  return "Brownout";
+        case ESP_RST_SDIO:      return "SDIO";
+        default:                return "Unknown";
+    }
+}
+
+/* task states are only available with CONFIG_FREERTOS_USE_TRACE_FACILITY */
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+
+static const char *TAG = "sys_stats";
+
+/* samples of the current and the previous update, only accessed by sys_stats_update */
+static SysTaskSample samples[2][SYS_STATS_TASKS_MAX];
+static uint32_t num_samples[2];
+static int prev_index;
+
+static void update_tasks(SysStats *stats)
+{
+    UBaseType_t num_tasks = uxTaskGetNumberOfTasks();
+    TaskStatus_t *tasks = (TaskStatus_t *) malloc(num_tasks * sizeof(TaskStatus_t));
+    if (tasks == NULL) {
+        ESP_LOGE(TAG, "Unable to allocate memory for task states");
+        return;
+    }
+    num_tasks = uxTaskGetSystemState(tasks, num_tasks, NULL);
+
+    int cur_index = prev_index ^ 1;
+    SysTaskSample *cur = samples[cur_index];
+    uint32_t num_cur = 0;
+    for (UBaseType_t i = 0; i < num_tasks && num_cur < SYS_STATS_TASKS_MAX; i++) {
+        strlcpy(cur[num_cur].name, tasks[i].pcTaskName, sizeof(cur[num_cur].name));
+        cur[num_cur].id = tasks[i].xTaskNumber;
+        cur[num_cur].runtime = tasks[i].ulRunTimeCounter;
+        // stack of ESP-IDF tasks is counted in bytes
+        cur[num_cur].stack_free = tasks[i].usStackHighWaterMark;
+        num_cur++;
+    }
+    free(tasks);
+    num_samples[cur_index] = num_cur;
+
+    sys_stats_stack_list(cur, num_cur, stats->task_stack_free, sizeof(stats->task_stack_free));
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    sys_stats_cpu_list(samples[prev_index], num_samples[prev_index], cur, num_cur,
+        stats->task_cpu, sizeof(stats->task_cpu));
+#endif
+    prev_index = cur_index;
+}
+
+#endif /* CONFIG_FREERTOS_USE_TRACE_FACILITY */
+
+void sys_stats_update(SysStats *stats)
+{
+    stats->uptime_s = esp_timer_get_time() / 1000000;
+    strlcpy(stats->reset_reason, reset_reason_name(esp_reset_reason()),
+        sizeof(stats->reset_reason));
+
+    stats->heap_free = esp_get_free_heap_size();
+    stats->heap_min_free = esp_get_minimum_free_heap_size();
+    stats->heap_largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+    wifi_ap_record_t ap;
+    stats->wifi_rssi = esp_wifi_sta_get_ap_info(&ap) == ESP_OK ? ap.rssi : 0;
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    update_tasks(stats);
+#endif
+
+    CanStats can;
+    can_get_stats(&can);
+    snprintf(stats->queues, sizeof(stats->queues), "can_rx=%u,mqtt_rx=%u,ts_jobs=%u",
+        (unsigned int) can.rx_queue_waiting, (unsigned int) ts_mqtt_rx_waiting(),
+        (unsigned int) web_server_ts_jobs_waiting());
+}
+
+#endif /* UNIT_TEST */
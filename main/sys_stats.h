@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SYS_STATS_H_
+#define SYS_STATS_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SYS_STATS_TASKS_MAX 32
+
+/**
+ * State of a FreeRTOS task at the time of a sample
+ */
+typedef struct {
+    char name[16];
+    uint32_t id;                    // task number, unique during the lifetime of the task
+    uint32_t runtime;               // run-time counter, wraps around
+    uint32_t stack_free;            // minimum free stack space since start in bytes
+} SysTaskSample;
+
+/**
+ * Runtime statistics of the gateway itself, see output/sys
+ *
+ * Task lists have the format "name=value,...", the same as e.g. the MQTT deadbands.
+ */
+typedef struct {
+    uint32_t uptime_s;
+    char reset_reason[16];
+    uint32_t heap_free;
+    uint32_t heap_min_free;         // minimum since boot
+    uint32_t heap_largest_block;    // largest block that can be allocated
+    int32_t wifi_rssi;              // signal strength of the access point (0: not connected)
+    char task_stack_free[512];      // minimum free stack space of each task in bytes
+    char task_cpu[512];             // CPU share of each task since previous update in percent
+    char queues[128];               // messages waiting in queues
+} SysStats;
+
+/**
+ * Write the free stack space of all tasks to a list
+ *
+ * The list is truncated after the last entry that fits into the buffer.
+ *
+ * \returns Number of tasks written to the list
+ */
+int sys_stats_stack_list(const SysTaskSample *tasks, uint32_t num, char *buf, size_t size);
+
+/**
+ * Write the CPU share of all tasks between two samples to a list
+ *
+ * The share refers to the run time of all tasks (including the idle tasks) on all cores.
+ * Tasks started after the previous sample are considered with their total run time.
+ *
+ * \returns Number of tasks written to the list, 0 if no run time passed between the samples
+ */
+int sys_stats_cpu_list(const SysTaskSample *prev, uint32_t num_prev, const SysTaskSample *cur,
+    uint32_t num_cur, char *buf, size_t size);
+
+/**
+ * Sample the current runtime statistics
+ *
+ * CPU shares are calculated since the previous call, so this function must not be called by
+ * different tasks.
+ */
+void sys_stats_update(SysStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SYS_STATS_H_ */
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef UNIT_TEST
+
+#include "time_sync.h"
+
+#include <time.h>
+
+#include "esp_sntp.h"
+
+#define TIME_SYNC_SERVER "pool.ntp.org"
+
+// earlier times are assumed to be the default time after reset
+#define TIME_SYNC_VALID_AFTER 1577836800     // 2020-01-01
+
+void time_sync_init(void)
+{
+    if (sntp_enabled()) {
+        // already started by another service
+        return;
+    }
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, TIME_SYNC_SERVER);
+    sntp_init();
+}
+
+uint32_t time_sync_unix(void)
+{
+    time_t now = time(NULL);
+    return now > TIME_SYNC_VALID_AFTER ? now : 0;
+}
+
+#endif /* UNIT_TEST */
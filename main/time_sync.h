@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TIME_SYNC_H_
+#define TIME_SYNC_H_
+
+#include <stdint.h>
+
+/**
+ * Start the synchronization of the system time via SNTP unless it was already started
+ *
+ * Used by all services which store data with absolute timestamps (e.g. history, MQTT buffer),
+ * so they share the same server and operating mode.
+ */
+void time_sync_init(void);
+
+/**
+ * Get the current UNIX time
+ *
+ * \returns Seconds since 1970-01-01 or 0 if the time was not synchronized yet
+ */
+uint32_t time_sync_unix(void);
+
+#endif /* TIME_SYNC_H_ */
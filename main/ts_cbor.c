@@ -9,7 +9,10 @@
 #include "../lib/tinycbor/src/cbor.h"
 #include "../lib/tinycbor/src/cborjson.h"
 #include "esp_err.h"
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "cJSON.h"
 
 #ifndef UNIT_TEST
@@ -140,6 +143,14 @@ void *ts_build_query_bin(uint8_t ts_method, TSUriElems *params, uint32_t *query_
         case TS_DELETE:
             ts_query[pos] = TS_DELETE;
             break;
+        case TS_FETCH:
+            if (params->ts_payload == NULL) {
+                // a FETCH always needs the array of requested names
+                ts_query[pos] = 0;
+                return ts_query;
+            }
+            ts_query[pos] = TS_FETCH;
+            break;
         default:
             ts_query[pos] = 0;
             return ts_query;    // nothing else to do here
@@ -203,3 +214,171 @@ uint8_t ts_cbor_resp_status(TSResponse *res)
 {
     return res->block[0];
 }
+
+void ts_id_map_init(TSIdMap *map)
+{
+    memset(map, 0, sizeof(TSIdMap));
+}
+
+static TSIdMapEntry *find_id(const TSIdMap *map, uint16_t id)
+{
+    for (int i = 0; i < map->num; i++) {
+        if (map->entries[i].id == id) {
+            return (TSIdMapEntry *) &map->entries[i];
+        }
+    }
+    return NULL;
+}
+
+int ts_id_map_add(TSIdMap *map, uint16_t id, const char *name)
+{
+    TSIdMapEntry *entry = find_id(map, id);
+    if (entry != NULL) {
+        return strcmp(entry->name, name) == 0 ? 0 : -1;
+    }
+    if (map->num == TS_ID_MAP_SIZE || strlen(name) >= TS_ID_NAME_LEN) {
+        return -1;
+    }
+    entry = &map->entries[map->num++];
+    entry->id = id;
+    strcpy(entry->name, name);
+    map->changed = true;
+    return 0;
+}
+
+int ts_id_map_lookup(TSIdMap *map, const char *name)
+{
+    for (int i = 0; i < map->num; i++) {
+        if (strcmp(map->entries[i].name, name) == 0) {
+            return map->entries[i].id;
+        }
+    }
+
+    uint16_t id = 1;
+    while (find_id(map, id) != NULL) {
+        id++;
+    }
+    return ts_id_map_add(map, id, name) == 0 ? id : -1;
+}
+
+/* writes the content of a JSON string, returns the length like snprintf */
+static size_t json_escape(char *buf, size_t size, const char *str)
+{
+    size_t pos = 0;
+    for (const char *c = str; *c != '\0'; c++) {
+        char esc[8];
+        unsigned char ch = *c;
+        if (ch == '"' || ch == '\\') {
+            snprintf(esc, sizeof(esc), "\\%c", ch);
+        }
+        else if (ch < 0x20) {
+            snprintf(esc, sizeof(esc), "\\u%04x", ch);
+        }
+        else {
+            snprintf(esc, sizeof(esc), "%c", ch);
+        }
+        size_t len = strlen(esc);
+        if (pos + len < size) {
+            memcpy(buf + pos, esc, len);
+        }
+        pos += len;
+    }
+    if (size > 0) {
+        buf[pos < size ? pos : size - 1] = '\0';
+    }
+    return pos;
+}
+
+int ts_id_map_json(const TSIdMap *map, char *buf, size_t size)
+{
+    size_t pos = 0;
+    for (int i = 0; i < map->num && pos < size; i++) {
+        // names are received from the devices, so they may contain any character
+        pos += snprintf(buf + pos, size - pos, "%c\"%u\":\"", i == 0 ? '{' : ',',
+            map->entries[i].id);
+        if (pos < size) {
+            pos += json_escape(buf + pos, size - pos, map->entries[i].name);
+        }
+        if (pos < size) {
+            pos += snprintf(buf + pos, size - pos, "\"");
+        }
+    }
+    if (map->num == 0 && pos < size) {
+        pos += snprintf(buf + pos, size - pos, "{");
+    }
+    if (pos < size) {
+        pos += snprintf(buf + pos, size - pos, "}");
+    }
+    return pos < size ? pos : 0;
+}
+
+static CborError pubmsg_value2cbor(const cJSON *json, CborEncoder *encoder)
+{
+    CborEncoder sub_encoder;
+    CborError err = CborNoError;
+    const cJSON *item;
+
+    if (cJSON_IsNumber(json)) {
+        double value = json->valuedouble;
+        // range is checked first, as the conversion of values out of range is undefined
+        if (isfinite(value) && value < 9.2e18 && value > -9.2e18 && value == (int64_t) value) {
+            return cbor_encode_int(encoder, (int64_t) value);
+        }
+        return cbor_encode_float(encoder, (float) value);
+    }
+    else if (cJSON_IsBool(json)) {
+        return cbor_encode_boolean(encoder, cJSON_IsTrue(json));
+    }
+    else if (cJSON_IsString(json)) {
+        return cbor_encode_text_stringz(encoder, json->valuestring);
+    }
+    else if (cJSON_IsArray(json) || cJSON_IsObject(json)) {
+        bool object = cJSON_IsObject(json);
+        int count = getItemCount((cJSON *) json);
+        err = object ? cbor_encoder_create_map(encoder, &sub_encoder, count) :
+            cbor_encoder_create_array(encoder, &sub_encoder, count);
+        cJSON_ArrayForEach(item, json) {
+            if (object) {
+                err |= cbor_encode_text_stringz(&sub_encoder, item->string);
+            }
+            err |= pubmsg_value2cbor(item, &sub_encoder);
+        }
+        return err | cbor_encoder_close_container(encoder, &sub_encoder);
+    }
+    return cbor_encode_null(encoder);
+}
+
+size_t ts_pubmsg_json2cbor(const char *json, uint8_t *buf, size_t size, TSIdMap *ids)
+{
+    cJSON *obj = cJSON_ParseWithOpts(json, NULL, true);
+    if (!cJSON_IsObject(obj)) {
+        cJSON_Delete(obj);
+        return 0;
+    }
+
+    CborEncoder encoder;
+    CborEncoder map_encoder;
+    cbor_encoder_init(&encoder, buf, size, 0);
+    CborError err = cbor_encoder_create_map(&encoder, &map_encoder, getItemCount(obj));
+    const cJSON *item;
+    cJSON_ArrayForEach(item, obj) {
+        if (ids != NULL) {
+            int id = ts_id_map_lookup(ids, item->string);
+            if (id < 0) {
+                err = CborErrorInternalError;
+                break;
+            }
+            err |= cbor_encode_uint(&map_encoder, id);
+        }
+        else {
+            err |= cbor_encode_text_stringz(&map_encoder, item->string);
+        }
+        err |= pubmsg_value2cbor(item, &map_encoder);
+    }
+    if (err == CborNoError) {
+        err = cbor_encoder_close_container(&encoder, &map_encoder);
+    }
+    cJSON_Delete(obj);
+
+    return err == CborNoError ? cbor_encoder_get_buffer_size(&encoder, buf) : 0;
+}
@@ -9,12 +9,70 @@
 
 #include "ts_client.h"
 
+#define TS_ID_MAP_SIZE 64
+#define TS_ID_NAME_LEN 32       // maximum length of names (incl. zero termination)
+
+typedef struct {
+    uint16_t id;
+    char name[TS_ID_NAME_LEN];
+} TSIdMapEntry;
+
+/**
+ * Numeric IDs used instead of value names in compact CBOR publication messages
+ *
+ * Names without a known ThingSet ID (e.g. from text mode publication messages) get the
+ * smallest unused ID, as small numbers need the least space in CBOR.
+ */
+typedef struct {
+    TSIdMapEntry entries[TS_ID_MAP_SIZE];
+    int num;
+    bool changed;           // entries were added since the map was last published
+} TSIdMap;
+
 void *ts_build_query_bin(uint8_t ts_method, TSUriElems *params, uint32_t *query_length);
 
 char *cbor2json(uint8_t *cbor, size_t len);
 
 uint8_t ts_cbor_resp_status(TSResponse *resp);
 
+/**
+ * Initialize an empty ID map
+ */
+void ts_id_map_init(TSIdMap *map);
+
+/**
+ * Add a name with its ThingSet ID to the map
+ *
+ * \returns 0 on success or -1 if the map is full or the ID is used for a different name
+ */
+int ts_id_map_add(TSIdMap *map, uint16_t id, const char *name);
+
+/**
+ * Get the ID of a name, a new ID is assigned if the name is not yet in the map
+ *
+ * \returns ID or -1 if the map is full
+ */
+int ts_id_map_lookup(TSIdMap *map, const char *name);
+
+/**
+ * Write the map as JSON object with IDs as keys, e.g. {"1":"Bat_V","2":"Bat_A"}
+ *
+ * \returns Length of the JSON string or 0 if the buffer is too small
+ */
+int ts_id_map_json(const TSIdMap *map, char *buf, size_t size);
+
+/**
+ * Convert the JSON object of a publication message into a CBOR map
+ *
+ * Integers are encoded as CBOR integers and all other numbers as single-precision floats,
+ * which is the data type used by ThingSet devices for measurements. If an ID map is given,
+ * the names of the top-level values are replaced by their IDs.
+ *
+ * \returns Size of the CBOR data or 0 if the input is not a JSON object, the ID map is full or
+ *          the buffer is too small
+ */
+size_t ts_pubmsg_json2cbor(const char *json, uint8_t *buf, size_t size, TSIdMap *ids);
+
 char *ts_cbor_resp_data(TSResponse *res);
 
 #endif // TS_CBOR_H__
@@ -27,7 +27,7 @@ extern GeneralConfig general_config;
 void ts_devices_init()
 {
     // Add self to devices
-    devices[0] = (TSDevice *) malloc(sizeof(TSDevice));
+    devices[0] = (TSDevice *) calloc(1, sizeof(TSDevice));
     devices[0]->ts_device_id = device_id;
     devices[0]->ts_name = "self";
     devices[0]->can_address = 0;
@@ -128,6 +128,27 @@ TSDevice *ts_get_can_device(uint8_t can_addr)
     return NULL;
 }
 
+TSDevice *ts_get_device_from_uri(const char *uri)
+{
+    char id[32];
+    int len = strcspn(uri, "/?");
+    if (len >= sizeof(id)) {
+        return NULL;
+    }
+    memcpy(id, uri, len);
+    id[len] = '\0';
+    return ts_get_device(id);
+}
+
+const char *ts_device_transport(const TSDevice *device)
+{
+    if (device == devices[0]) {
+        return "self";
+    }
+    // serial device is registered with CAN address UINT8_MAX
+    return device->can_address == UINT8_MAX ? "serial" : "can";
+}
+
 int ts_parse_device_info(cJSON *json, TSDevice *device)
 {
     size_t ts_string_len = strlen(cJSON_GetStringValue(cJSON_GetObjectItem(json, "DeviceType")));
@@ -192,19 +213,22 @@ void ts_parse_uri(const char *uri, TSUriElems *params)
     params->ts_device_id = NULL;
     params->ts_target_node = NULL;
 
-    if (uri == NULL || uri[0] == '\0') {
+    if (uri == NULL || uri[0] == '\0' || uri[0] == '?') {
         ESP_LOGE(TAG, "Got invalid uri");
         return;
     }
-    params->ts_list_subnodes = uri[strlen(uri)-1] == '/' ? 0 : 1;
+    // query string (if any) is not part of the path, see ts_build_fetch_payload
+    size_t path_len = strcspn(uri, "?");
+    params->ts_list_subnodes = uri[path_len-1] == '/' ? 0 : 1;
 
     // copy uri so we can safely modify
-    char *temp_uri = (char *) malloc(strlen(uri)+1);
+    char *temp_uri = (char *) malloc(path_len+1);
     if (temp_uri == NULL) {
         ESP_LOGE(TAG, "Unable to allocate memory for temp_uri");
         return;
     }
-    strcpy(temp_uri, uri);
+    strncpy(temp_uri, uri, path_len);
+    temp_uri[path_len] = '\0';
     // extract device ID
     int i = 0;
     while (temp_uri[i] != '\0' && temp_uri[i] != '/') {
@@ -221,6 +245,227 @@ void ts_parse_uri(const char *uri, TSUriElems *params)
     ESP_LOGD(TAG, "List the sub nodes: %s", params->ts_list_subnodes == 0 ? "yes" : "no");
 }
 
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/*
+ * Writes a percent-encoded name of the query string as content of a JSON string, so
+ * e.g. Bat%5FV becomes Bat_V and quotes can't end the string early. Invalid percent
+ * sequences are copied unchanged.
+ *
+ * \returns Number of bytes written (at most 6 per byte of the name)
+ */
+static int fetch_name_to_json(char *out, const char *name, int len)
+{
+    int pos = 0;
+    for (int i = 0; i < len; i++) {
+        unsigned char c = name[i];
+        if (c == '%' && i + 2 < len && hex_value(name[i + 1]) >= 0 && hex_value(name[i + 2]) >= 0) {
+            c = hex_value(name[i + 1]) << 4 | hex_value(name[i + 2]);
+            i += 2;
+        }
+        if (c == '"' || c == '\\') {
+            out[pos++] = '\\';
+            out[pos++] = c;
+        }
+        else if (c < 0x20) {
+            pos += sprintf(out + pos, "\\u%04x", c);
+        }
+        else {
+            out[pos++] = c;
+        }
+    }
+    return pos;
+}
+
+char *ts_build_fetch_payload(const char *uri)
+{
+    const char *query = (uri != NULL) ? strchr(uri, '?') : NULL;
+    if (query == NULL || query[1] == '\0') {
+        return NULL;
+    }
+    query++;
+
+    // every name is enclosed in quotes and followed by a comma (or closing bracket), escaped
+    // characters need up to 6 bytes
+    int nbytes = 3;     // brackets + zero termination
+    int num_names = 1;
+    for (const char *c = query; *c != '\0'; c++) {
+        if (*c == ',') {
+            num_names++;
+        }
+    }
+    nbytes += 6 * strlen(query) + 2 * num_names;
+
+    char *payload = (char *) malloc(nbytes);
+    if (payload == NULL) {
+        ESP_LOGE(TAG, "Unable to allocate memory for fetch payload");
+        return NULL;
+    }
+
+    int pos = 0;
+    payload[pos++] = '[';
+    const char *name = query;
+    while (*name != '\0') {
+        int len = strcspn(name, ",");
+        if (len > 0) {
+            if (pos > 1) {
+                payload[pos++] = ',';
+            }
+            payload[pos++] = '"';
+            pos += fetch_name_to_json(payload + pos, name, len);
+            payload[pos++] = '"';
+        }
+        name += len;
+        if (*name == ',') {
+            name++;
+        }
+    }
+    payload[pos++] = ']';
+    payload[pos] = '\0';
+
+    if (pos == 2) {
+        // only separators, no names given
+        free(payload);
+        return NULL;
+    }
+    ESP_LOGD(TAG, "Fetch payload: %s", payload);
+    return payload;
+}
+
+static size_t skip_spaces(const char *data, size_t len, size_t pos)
+{
+    while (pos < len && (data[pos] == ' ' || data[pos] == '\n')) {
+        pos++;
+    }
+    return pos;
+}
+
+uint8_t ts_parse_mqtt_request(const char *topic, size_t topic_len, const char *prefix,
+    const char *data, size_t data_len, char **uri, char **payload)
+{
+    *uri = NULL;
+    *payload = NULL;
+
+    // topic: <prefix><device_id>/rx[/<path>]
+    size_t prefix_len = strlen(prefix);
+    if (topic_len <= prefix_len || strncmp(topic, prefix, prefix_len) != 0) {
+        return 0;
+    }
+    const char *id = topic + prefix_len;
+    const char *end = topic + topic_len;
+    const char *sep = (const char *) memchr(id, '/', end - id);
+    if (sep == NULL || sep == id || end - sep < 3 || strncmp(sep + 1, "rx", 2) != 0 ||
+        (end - sep > 3 && sep[3] != '/'))
+    {
+        return 0;
+    }
+    const char *path = (end - sep > 3) ? sep + 4 : end;
+
+    uint8_t ts_method;
+    size_t pos = skip_spaces(data, data_len, 0);
+    switch (pos < data_len ? data[pos] : '\0') {
+        case '?':
+            ts_method = TS_GET;
+            pos++;
+            break;
+        case '=':
+            ts_method = TS_PATCH;
+            pos++;
+            break;
+        case '!':
+        case '+':
+            // distinguished by the path, see exec_or_create
+            ts_method = TS_POST;
+            pos++;
+            break;
+        case '-':
+            ts_method = TS_DELETE;
+            pos++;
+            break;
+        default:
+            // plain JSON data is written to the path
+            ts_method = pos < data_len ? TS_PATCH : TS_GET;
+            break;
+    }
+    pos = skip_spaces(data, data_len, pos);
+
+    if (pos < data_len) {
+        if (ts_method == TS_GET) {
+            ts_method = TS_FETCH;
+        }
+        *payload = (char *) malloc(data_len - pos + 1);
+        if (*payload == NULL) {
+            return 0;
+        }
+        memcpy(*payload, data + pos, data_len - pos);
+        (*payload)[data_len - pos] = '\0';
+    }
+
+    // same format as the URIs of the HTTP API: <device_id>/<path>
+    size_t id_len = sep - id;
+    size_t path_len = end - path;
+    *uri = (char *) malloc(id_len + 1 + path_len + 1);
+    if (*uri == NULL) {
+        free(*payload);
+        *payload = NULL;
+        return 0;
+    }
+    memcpy(*uri, id, id_len + 1);
+    memcpy(*uri + id_len + 1, path, path_len);
+    (*uri)[id_len + 1 + path_len] = '\0';
+    return ts_method;
+}
+
+int ts_build_query_header(char *buf, size_t buf_size, uint8_t ts_method, TSUriElems *params,
+    bool payload)
+{
+    if (params == NULL) {
+        return 0;
+    }
+    char function_code;
+    switch (ts_method) {
+        case TS_GET:
+        case TS_FETCH:
+            // text mode uses the same function code for GET and FETCH, the array of names
+            // in the payload marks a FETCH
+            function_code = '?';
+            break;
+        case TS_POST:
+            function_code = *(exec_or_create(params->ts_target_node));
+            break;
+        case TS_PATCH:
+            function_code = '=';
+            break;
+        case TS_DELETE:
+            function_code = '-';
+            break;
+        default:
+            return 0;
+    }
+    const char *path = params->ts_target_node != NULL ? params->ts_target_node : "";
+    // corner case for getting device categories
+    if (path[0] == '\0' && params->ts_list_subnodes == 0) {
+        path = "/";
+    }
+    int len = snprintf(buf, buf_size, "%c%s%s", function_code, path, payload ? " " : "");
+    if (len < 0 || len >= buf_size) {
+        return 0;
+    }
+    return len;
+}
+
 void *ts_build_query_serial(uint8_t ts_method, TSUriElems *params, uint32_t *query_size)
 {
     if (params == NULL) {
@@ -248,36 +493,17 @@ void *ts_build_query_serial(uint8_t ts_method, TSUriElems *params, uint32_t *que
         ESP_LOGE(TAG, "Unable to allocate memory for ts_query");
         return NULL;
     }
-    int pos = 0;
-    switch (ts_method){
-        case TS_GET:
-            ts_query[pos] = '?';
-            break;
-        case TS_POST:
-            ts_query[pos] = *(exec_or_create(params->ts_target_node));
-            break;
-        case TS_PATCH:
-            ts_query[pos] = '=';
-            break;
-        case TS_DELETE:
-            ts_query[pos] = '-';
-            break;
-        default:
-            ts_query[pos] = '\0';
-            return ts_query;    // nothing else to do here
+    ts_query[0] = '\0';
+    if (ts_method == TS_FETCH && params->ts_payload == NULL) {
+        // fetch without names is meaningless, the caller should use GET instead
+        return ts_query;
     }
-    pos++;
-    // corner case for getting device categories
-    if (strlen(params->ts_target_node) == 0 && params->ts_list_subnodes == 0) {
-        ts_query[pos] = '/';
-        pos++;
-    } else {
-        strncpy(ts_query + pos, params->ts_target_node, strlen_null(params->ts_target_node));
-        pos += strlen_null(params->ts_target_node);
+    int pos = ts_build_query_header(ts_query, nbytes, ts_method, params,
+        params->ts_payload != NULL);
+    if (pos == 0) {
+        return ts_query;    // nothing else to do here
     }
     if (params->ts_payload != NULL) {
-        ts_query[pos] = ' ';
-        pos++;
         strncpy(ts_query + pos, params->ts_payload, strlen_null(params->ts_payload));
         pos += strlen_null(params->ts_payload);
     }
@@ -289,68 +515,255 @@ void *ts_build_query_serial(uint8_t ts_method, TSUriElems *params, uint32_t *que
     return (void *) ts_query;
 }
 
+void ts_resp_stream_init(TSResponseStream *resp, int (*start)(void *ctx, uint8_t ts_status),
+    int (*data)(void *ctx, const char *buf, size_t len), void *ctx)
+{
+    resp->start = start;
+    resp->data = data;
+    resp->ctx = ctx;
+    resp->started = false;
+    resp->hdr_len = 0;
+    resp->hdr[0] = '\0';
+}
+
+static int resp_stream_start(TSResponseStream *resp)
+{
+    unsigned int status_code = -1;
+    resp->hdr[resp->hdr_len] = '\0';
+    sscanf(resp->hdr, ":%X ", &status_code);
+    resp->started = true;
+    return resp->start(resp->ctx, status_code);
+}
+
+int ts_resp_stream_feed(TSResponseStream *resp, const char *buf, size_t len)
+{
+    size_t pos = 0;
+    while (!resp->started && pos < len) {
+        // characters beyond the maximum length are dropped, as for buffered responses
+        if (resp->hdr_len < sizeof(resp->hdr) - 1) {
+            resp->hdr[resp->hdr_len++] = buf[pos];
+        }
+        pos++;
+        if (resp->hdr_len >= 2 && resp->hdr[resp->hdr_len - 2] == '.' &&
+            resp->hdr[resp->hdr_len - 1] == ' ')
+        {
+            int err = resp_stream_start(resp);
+            if (err != 0) {
+                return err;
+            }
+        }
+    }
+    if (pos < len) {
+        return resp->data(resp->ctx, buf + pos, len - pos);
+    }
+    return 0;
+}
+
+int ts_resp_stream_finish(TSResponseStream *resp)
+{
+    if (!resp->started) {
+        return resp_stream_start(resp);
+    }
+    return 0;
+}
+
 #ifndef UNIT_TEST
 
-TSResponse *ts_execute(const char *uri, char *content, int http_method)
+static uint8_t ts_method_from_http(int http_method)
 {
-    uint8_t ts_method;
     switch (http_method) {
     case HTTP_DELETE:
-        ts_method = TS_DELETE;
-        break;
-    case HTTP_GET:
-        ts_method = TS_GET;
-        break;
+        return TS_DELETE;
     case HTTP_POST:
-        ts_method = TS_POST;
-        break;
+        return TS_POST;
     case HTTP_PATCH:
-        ts_method = TS_PATCH;
-        break;
+        return TS_PATCH;
+    case HTTP_GET:
     default:
-        ts_method = TS_GET;
-        break;
+        return TS_GET;
+    }
+}
+
+/* takes ownership of the response block */
+static TSResponse *ts_response_from_block(TSDevice *device, char *block, uint32_t block_len)
+{
+    if (block == NULL) {
+        ESP_LOGI(TAG, "No Response");
+        return NULL;
+    }
+    TSResponse *res = (TSResponse *) malloc(sizeof(TSResponse));
+    if (res == NULL) {
+        ESP_LOGE(TAG, "Unable to allocate memory for ts response");
+        heap_caps_free(block);
+        return NULL;
     }
+    res->block = block;
+    res->block_len = block_len;
+
+    //call status code first, data will be overwritten when device is using CAN binary methods
+    res->ts_status_code = device->ts_resp_status(res);
+    res->data = device->ts_resp_data(res);
+    return res;
+}
+
+/*
+ * Builds the query for a request with the query builder of the device
+ *
+ * \returns Query to be freed by the caller or NULL if the device was not found
+ */
+static char *ts_build_device_query(const char *uri, char *content, int http_method,
+    TSDevice **device, uint32_t *query_size)
+{
+    uint8_t ts_method = ts_method_from_http(http_method);
     TSUriElems params;
     params.ts_payload = content;
     params.ts_list_subnodes = -1;
+
+    // GET /ts/<id>/<path>?name1,name2 only retrieves the given values of the path
+    char *fetch_payload = NULL;
+    if (ts_method == TS_GET && content == NULL) {
+        fetch_payload = ts_build_fetch_payload(uri);
+        if (fetch_payload != NULL) {
+            ts_method = TS_FETCH;
+            params.ts_payload = fetch_payload;
+        }
+    }
+
     ts_parse_uri(uri, &params);
-    TSDevice *device = ts_get_device(params.ts_device_id);
-    if (device == NULL) {
+    *device = ts_get_device(params.ts_device_id);
+    char *query = NULL;
+    if (*device != NULL) {
+        query = (*device)->build_query(ts_method, &params, query_size);
+    }
+    else {
         ESP_LOGD(TAG, "No Device, freeing query string and device id");
-        heap_caps_free(params.ts_device_id);
-        return NULL;
     }
-    uint32_t query_size;
-    char *ts_query_string = device->build_query(ts_method, &params, &query_size);
+    free(fetch_payload);
+    heap_caps_free(params.ts_device_id);
+    return query;
+}
 
-    TSResponse *res = (TSResponse *) malloc(sizeof(TSResponse));
-    if (res == NULL) {
-        ESP_LOGE(TAG, "Unable to allocate memory for ts response");
-        heap_caps_free(ts_query_string);
-        heap_caps_free(params.ts_device_id);
+TSResponse *ts_execute(const char *uri, char *content, int http_method)
+{
+    TSDevice *device;
+    uint32_t query_size;
+    char *ts_query_string = ts_build_device_query(uri, content, http_method, &device,
+        &query_size);
+    if (ts_query_string == NULL) {
         return NULL;
     }
+
     // send is already a pointer to the correct function
     uint32_t block_len = 0;
-    res->block = device->send((uint8_t *)ts_query_string, query_size, device->can_address, &block_len);
-    res->block_len = block_len;
-    if (res->block == NULL) {
-        ESP_LOGI(TAG, "No Response, freeing query string and device id");
-        heap_caps_free(ts_query_string);
+    char *block = device->send((uint8_t *)ts_query_string, query_size, device->can_address,
+        &block_len);
+    heap_caps_free(ts_query_string);
+
+    return ts_response_from_block(device, block, block_len);
+}
+
+int ts_execute_resp_stream(const char *uri, int http_method, TSResponseStream *resp)
+{
+    TSDevice *device;
+    uint32_t query_size;
+    char *ts_query_string = ts_build_device_query(uri, NULL, http_method, &device, &query_size);
+    if (ts_query_string == NULL) {
+        return -1;
+    }
+
+    int ret = -1;
+    if (device->send_resp_stream != NULL) {
+        ret = device->send_resp_stream((uint8_t *)ts_query_string, query_size,
+            device->can_address, resp);
+    }
+    else {
+        uint32_t block_len = 0;
+        char *block = device->send((uint8_t *)ts_query_string, query_size,
+            device->can_address, &block_len);
+        TSResponse *res = ts_response_from_block(device, block, block_len);
+        if (res != NULL) {
+            ret = resp->start(resp->ctx, res->ts_status_code);
+            if (ret == 0 && res->data != NULL) {
+                ret = resp->data(resp->ctx, res->data, strlen(res->data));
+            }
+            heap_caps_free(res->block);
+            heap_caps_free(res);
+        }
+    }
+    heap_caps_free(ts_query_string);
+    return ret;
+}
+
+static int read_content(TSContentReader *content, char *buf)
+{
+    uint32_t pos = 0;
+    while (pos < content->len) {
+        int len = content->read(content->ctx, buf + pos, content->len - pos);
+        if (len <= 0) {
+            return -1;
+        }
+        pos += len;
+    }
+    return pos;
+}
+
+TSResponse *ts_execute_stream(const char *uri, TSContentReader *content, int http_method)
+{
+    TSUriElems params;
+    params.ts_payload = NULL;
+    ts_parse_uri(uri, &params);
+    TSDevice *device = ts_get_device(params.ts_device_id);
+    if (device == NULL || params.ts_target_node == NULL) {
         heap_caps_free(params.ts_device_id);
-        heap_caps_free(res);
         return NULL;
     }
 
-    //call status code first, data will be overwritten when device is using CAN binary methods
-    res->ts_status_code = device->ts_resp_status(res);
-    res->data = device->ts_resp_data(res);
-
-    heap_caps_free(ts_query_string);
+    // function code, path (or '/'), whitespace and zero termination
+    size_t hdr_size = strlen(params.ts_target_node) + 4;
+    char *hdr = (char *) malloc(hdr_size);
+    int hdr_len = 0;
+    if (hdr != NULL) {
+        hdr_len = ts_build_query_header(hdr, hdr_size, ts_method_from_http(http_method),
+            &params, true);
+    }
     heap_caps_free(params.ts_device_id);
+    if (hdr_len == 0) {
+        ESP_LOGE(TAG, "Unable to build query header");
+        free(hdr);
+        return NULL;
+    }
 
-    return res;
+    if (device->max_query_size > 0 && hdr_len + content->len > device->max_query_size) {
+        ESP_LOGW(TAG, "Request with %u bytes too large for device", hdr_len + content->len);
+        free(hdr);
+        TSResponse *res = (TSResponse *) calloc(1, sizeof(TSResponse));
+        if (res != NULL) {
+            res->ts_status_code = TS_STATUS_REQUEST_TOO_LARGE;
+        }
+        return res;
+    }
+
+    // devices need the entire query in one buffer, so the content is received directly
+    // behind the header (+2 for termination and zero termination)
+    char *query = (char *) realloc(hdr, hdr_len + content->len + 2);
+    if (query == NULL) {
+        ESP_LOGE(TAG, "Unable to allocate memory for ts_query");
+        free(hdr);
+        return NULL;
+    }
+    if (read_content(content, query + hdr_len) < 0) {
+        ESP_LOGE(TAG, "Receiving content failed");
+        free(query);
+        return NULL;
+    }
+    query[hdr_len + content->len] = '\n';
+    query[hdr_len + content->len + 1] = '\0';
+    uint32_t block_len = 0;
+    char *block = device->send((uint8_t *)query, hdr_len + content->len, device->can_address,
+        &block_len);
+    free(query);
+
+    return ts_response_from_block(device, block, block_len);
 }
 
 char *ts_serial_resp_data(TSResponse *res)
@@ -52,6 +52,7 @@ extern "C" {
 // server errors
 #define TS_STATUS_INTERNAL_SERVER_ERR   0xC0
 #define TS_STATUS_NOT_IMPLEMENTED       0xC1
+#define TS_STATUS_GATEWAY_TIMEOUT       0xC4        // device did not respond
 
 // ThingSet specific errors
 #define TS_STATUS_RESPONSE_TOO_LARGE    0xE1
@@ -76,6 +77,34 @@ typedef struct {
     uint32_t block_len;
 } TSResponse;
 
+/**
+ * Source of request content, read in parts directly into the query buffer
+ */
+typedef struct {
+    // reads up to len bytes into buf and returns the number of bytes read (<= 0 on error)
+    int (*read)(void *ctx, char *buf, size_t len);
+    void *ctx;
+    uint32_t len;           // total length of the content
+} TSContentReader;
+
+// maximum length of the status section of a text mode response, e.g. ":85 Content. "
+#define TS_RESP_HDR_MAX 32
+
+/**
+ * Receiver of a response that is passed on in parts while it arrives from the device
+ */
+typedef struct {
+    // called once with the status code before any data
+    int (*start)(void *ctx, uint8_t ts_status);
+    // called for each part of the payload, returns 0 on success
+    int (*data)(void *ctx, const char *buf, size_t len);
+    void *ctx;
+    // state of ts_resp_stream_feed
+    bool started;
+    int hdr_len;
+    char hdr[TS_RESP_HDR_MAX];
+} TSResponseStream;
+
 /**
 * Struct to hold device information
 * when a new device is connected, the function pointer
@@ -90,6 +119,10 @@ typedef struct {
     void *(*build_query)(uint8_t ts_method, TSUriElems *params, uint32_t* query_size);
     char *(*ts_resp_data)(TSResponse *res);
     uint8_t (*ts_resp_status)(TSResponse *res);
+    uint32_t max_query_size;    // maximum request size accepted by the interface, 0 if unlimited
+    // optional function to pass the response on in parts while it is received
+    int (*send_resp_stream)(uint8_t *req, uint32_t query_size, uint8_t can_address,
+        TSResponseStream *resp);
 } TSDevice;
 
 /**
@@ -99,6 +132,52 @@ typedef struct {
  */
 TSResponse *ts_execute(const char *uri, char *content, int http_method);
 
+/**
+ * Handler for requests with content (e.g. PATCH or POST)
+ *
+ * The content is received completely behind the query header before the request is sent, so
+ * slow clients don't block the interface of the device and incomplete requests are never
+ * executed. Requests exceeding the size limit of the device are rejected with status
+ * TS_STATUS_REQUEST_TOO_LARGE before any content is read.
+ *
+ * \returns a pointer to a response object containing status code and data string or NULL if
+ *          the device was not found or did not respond
+ */
+TSResponse *ts_execute_stream(const char *uri, TSContentReader *content, int http_method);
+
+/**
+ * Handler for requests without content, where the response is passed to the stream
+ *
+ * Devices without support for streaming responses are handled via their send function, so
+ * the entire response is passed to the stream at once.
+ *
+ * \returns 0 on success or -1 if the device was not found or did not respond completely
+ */
+int ts_execute_resp_stream(const char *uri, int http_method, TSResponseStream *resp);
+
+/**
+ * Initializes a response stream with the given callbacks
+ */
+void ts_resp_stream_init(TSResponseStream *resp, int (*start)(void *ctx, uint8_t ts_status),
+    int (*data)(void *ctx, const char *buf, size_t len), void *ctx);
+
+/**
+ * Parses raw data of a text mode response received from the device. The status is passed
+ * on as soon as the status section (e.g. ":85 Content. ") is complete, the remaining data as
+ * it arrives.
+ *
+ * \returns 0 on success or the error returned by the callbacks
+ */
+int ts_resp_stream_feed(TSResponseStream *resp, const char *buf, size_t len);
+
+/**
+ * Must be called after the response was received completely, so that the status is passed on
+ * for responses without payload (e.g. ":84 Changed.")
+ *
+ * \returns 0 on success or the error returned by the callbacks
+ */
+int ts_resp_stream_finish(TSResponseStream *resp);
+
 /**
  * Parses the response for the beginning of the payload. Does not work on binary data!
  * \returns A pointer to the first character of the payload
@@ -142,6 +221,19 @@ char *ts_get_device_list();
  */
 TSDevice *ts_get_can_device(uint8_t can_addr);
 
+/**
+ * Find the device addressed by an URI of the HTTP API (e.g. "ABCD1234/conf") without
+ * building a query
+ *
+ * \returns pointer to TSDevice or NULL in case the device is not found
+ */
+TSDevice *ts_get_device_from_uri(const char *uri);
+
+/**
+ * Name of the interface used to communicate with the device ("self", "serial" or "can")
+ */
+const char *ts_device_transport(const TSDevice *device);
+
 /**
  * Generate a ThingSet request header from HTTP URL and mode
  *
@@ -155,6 +247,39 @@ int ts_req_hdr_from_http(char *buf, size_t buf_size, int method, const char *uri
  */
 void ts_parse_uri(const char *uri, TSUriElems *params);
 
+/**
+ * Converts the query string of an URI (e.g. "output?Bat_V,Bat_A") into the JSON array of names
+ * used as payload of a ThingSet FETCH request (e.g. ["Bat_V","Bat_A"]). Names are URL-decoded
+ * and escaped for JSON.
+ *
+ * \returns String with the payload or NULL if the URI does not contain any names
+ * Caller is responsible to free() string
+ */
+char *ts_build_fetch_payload(const char *uri);
+
+/**
+ * Parses a request received via MQTT on the topic <prefix><device_id>/rx[/<path>]
+ *
+ * The message starts with an optional ThingSet function code (? = ! + -) followed by the
+ * JSON payload. Messages without function code are PATCH requests if they contain data and
+ * GET requests otherwise.
+ *
+ * \returns ThingSet method (e.g. TS_PATCH) or 0 if the request is invalid. The URI in the
+ *          format of the HTTP API (<device_id>/<path>) and the payload (NULL if empty) must be
+ *          freed by the caller.
+ */
+uint8_t ts_parse_mqtt_request(const char *topic, size_t topic_len, const char *prefix,
+    const char *data, size_t data_len, char **uri, char **payload);
+
+/**
+ * Writes the beginning of a ThingSet query in string format (function code and path) to the
+ * buffer. If the query has a payload, the separating whitespace is added as well.
+ *
+ * \returns Number of characters written (without zero termination) or 0 in case of error
+ */
+int ts_build_query_header(char *buf, size_t buf_size, uint8_t ts_method, TSUriElems *params,
+    bool payload);
+
 /**
  * Builds the ThingSet query in string format.
  * \returns String with the query
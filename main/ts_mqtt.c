@@ -13,6 +13,8 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 #include "esp_system.h"
 #include "esp_wifi.h"
@@ -20,6 +22,8 @@
 #include "esp_event.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "nvs_flash.h"
 #include "sdkconfig.h"
@@ -27,35 +31,643 @@
 #include "mqtt_client.h"
 #include "esp_tls.h"
 #include "esp_ota_ops.h"
+#include "esp_partition.h"
 #include <sys/param.h>
 
 #include "ts_serial.h"
 #include "ts_client.h"
+#include "ts_cbor.h"
 #include "can.h"
 #include "wifi.h"
 #include "data_nodes.h"
+#include "pub_filter.h"
+#include "flash_log.h"
+#include "pub_batch.h"
+#include "time_sync.h"
 
 MqttConfig mqtt_config;
 
+extern GeneralConfig general_config;
+extern PubStats mqtt_stats;
+extern char device_id[];        // of the gateway itself
+
 static const char* TAG = "ts_mqtt";
 
+/* device whose data is published, each one with its own topic */
+typedef struct {
+    char id[32];                // device ID used in the topic
+    uint8_t can_address;        // UINT8_MAX for the serial device
+    uint32_t pub_count;         // CAN publication messages received until the last publication
+    PubFilter filter;           // only changed values are sent (report-by-exception)
+    TSIdMap ids;                // numeric IDs used instead of names in CBOR payload
+} MqttDevice;
+
+#define MQTT_DEVICES_MAX 4
+
+static MqttDevice *mqtt_devices[MQTT_DEVICES_MAX];
+
+// size of JSON objects generated from CAN data objects
+#define CAN_JSON_SIZE 512
+
+#define SERIAL_SCAN_INTERVAL_MS (60 * 1000)
+
+static volatile bool mqtt_connected;
+
+/* requests received via MQTT, processed by mqtt_rx_task */
+typedef struct {
+    uint8_t ts_method;
+    char *uri;              // <device_id>/<path> as used by the HTTP API
+    char *payload;
+} MqttRequest;
+
+#define MQTT_RX_QUEUE_SIZE 4
+
+static QueueHandle_t rx_queue;
+
+/* tasks are set to NULL before they exit, so the stopping task can wait for them */
+static volatile TaskHandle_t pub_task;
+static volatile TaskHandle_t rx_task;
+static volatile bool pub_stop;
+
+/* QoS 1 messages not acknowledged yet, shared by the publishing tasks and the event handler */
+static PubWindow window;
+static SemaphoreHandle_t window_lock;
+
+#define WINDOW_POLL_INTERVAL_MS 10
+
+/* messages of several devices and intervals published together */
+static PubBatch batch;
+static char *batch_buf;
+
+// batches buffered in flash must fit into one record together with the topic
+#define BATCH_SIZE_MAX 1800
+
+// space needed to insert a timestamp into a JSON object
+#define TS_MEMBER_SIZE sizeof("\"t_s\":4294967295,")
+
+#if CONFIG_THINGSET_MQTT_BUFFER
+/* messages which could not be sent are stored in flash and sent after reconnecting */
+static FlashLog msg_log;
+static bool msg_log_mounted;
+
+#define MSG_LOG_PARTITION_SUBTYPE 0x40
+#endif
+
 #if CONFIG_THINGSET_MQTT_TLS
 /* the certificate path is linked in via root CMakeLists.txt */
 extern const uint8_t mqtt_root_pem_start[]  asm("_binary_isrgrootx1_pem_start");
 //extern const uint8_t mqtt_root_pem_end[]    asm("_binary_isrgrootx1_pem_end");
 #endif
 
-static void send_data(esp_mqtt_client_handle_t client, char *device_id, char *path, char *data)
+static uint32_t uptime_ms()
+{
+    return esp_timer_get_time() / 1000;
+}
+
+/*
+ * Inserts "t_s":<timestamp> as first member of a JSON object, the buffer must provide
+ * TS_MEMBER_SIZE bytes of space behind the object. Other data is not changed.
+ */
+static void insert_timestamp(char *data, uint32_t timestamp)
+{
+    if (timestamp == 0 || data[0] != '{') {
+        return;
+    }
+    char ts_member[TS_MEMBER_SIZE];
+    int n = snprintf(ts_member, sizeof(ts_member), "\"t_s\":%u%s",
+        (unsigned int) timestamp, data[1] == '}' ? "" : ",");
+    memmove(data + 1 + n, data + 1, strlen(data + 1) + 1);
+    memcpy(data + 1, ts_member, n);
+}
+
+/*
+ * Waits until the window allows to send another QoS 1 message. Messages which were not
+ * acknowledged within the timeout are removed from the window.
+ *
+ * \returns false if the connection was lost while waiting
+ */
+static bool wait_window_space()
+{
+    while (1) {
+        xSemaphoreTake(window_lock, portMAX_DELAY);
+        int expired = pub_window_expire(&window, uptime_ms(), CONFIG_THINGSET_MQTT_ACK_TIMEOUT);
+        bool full = pub_window_full(&window);
+        xSemaphoreGive(window_lock);
+        if (expired > 0) {
+            ESP_LOGW(TAG, "%d messages not acknowledged by the broker", expired);
+        }
+        if (!full) {
+            return true;
+        }
+        else if (!mqtt_connected) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(WINDOW_POLL_INTERVAL_MS));
+    }
+}
+
+/* sends data with given length or a zero-terminated string if len is 0 */
+static int send_data(esp_mqtt_client_handle_t client, const char *device_id, const char *path,
+    const char *data, int len)
 {
     char mqtt_topic[256];
     snprintf(mqtt_topic, sizeof(mqtt_topic), "ts/%s/%s/tx/%s",
         mqtt_config.username, device_id, path);
-    int msg_id = esp_mqtt_client_publish(client, mqtt_topic, data, 0, 0, 0);
+    int qos = mqtt_config.qos > 0 ? 1 : 0;
+    if (qos > 0 && !wait_window_space()) {
+        return -1;
+    }
+
+    // the window must not be locked while publishing, as the MQTT task may be waiting for it
+    uint32_t sent_ms = uptime_ms();
+    int msg_id = esp_mqtt_client_publish(client, mqtt_topic, data, len, qos, 0);
     ESP_LOGI(TAG, "message sent to %s with msg_id=%d", mqtt_topic, msg_id);
+    if (msg_id >= 0) {
+        xSemaphoreTake(window_lock, portMAX_DELAY);
+        window.published++;
+        if (qos > 0) {
+            // the acknowledgement may already have been received by the event handler
+            pub_window_add(&window, msg_id, sent_ms);
+        }
+        xSemaphoreGive(window_lock);
+    }
+    return msg_id;
+}
+
+static MqttDevice *find_mqtt_device(const char *device_id)
+{
+    for (int i = 0; i < MQTT_DEVICES_MAX; i++) {
+        if (mqtt_devices[i] != NULL && strcmp(mqtt_devices[i]->id, device_id) == 0) {
+            return mqtt_devices[i];
+        }
+    }
+    return NULL;
 }
 
 /*
- * Event handler called by the MQTT client event loop. Currently only used for debugging
+ * Publishes the names of the numeric IDs as retained message on ts/<user>/<device_id>/meta/ids,
+ * so that subscribers can decode CBOR payload with IDs at any time
+ */
+static void publish_id_map(esp_mqtt_client_handle_t client, MqttDevice *dev)
+{
+    char mqtt_topic[128];
+    snprintf(mqtt_topic, sizeof(mqtt_topic), "ts/%s/%s/meta/ids",
+        mqtt_config.username, dev->id);
+
+    size_t size = TS_ID_MAP_SIZE * (TS_ID_NAME_LEN + 10);
+    char *buf = (char *) malloc(size);
+    if (buf == NULL) {
+        return;
+    }
+    int len = ts_id_map_json(&dev->ids, buf, size);
+    if (len > 0 && esp_mqtt_client_publish(client, mqtt_topic, buf, len, 1, 1) >= 0) {
+        ESP_LOGI(TAG, "ID map with %d entries sent to %s", dev->ids.num, mqtt_topic);
+        dev->ids.changed = false;
+    }
+    free(buf);
+}
+
+/*
+ * Sends a JSON object in the configured payload format. Data which can't be converted to CBOR
+ * is sent unchanged.
+ */
+static int send_json(esp_mqtt_client_handle_t client, const char *device_id, const char *path,
+    const char *json)
+{
+    if (!mqtt_config.cbor_payload) {
+        return send_data(client, device_id, path, json, 0);
+    }
+
+    MqttDevice *dev = mqtt_config.cbor_ids ? find_mqtt_device(device_id) : NULL;
+    size_t size = 2 * strlen(json) + 16;
+    uint8_t *cbor = (uint8_t *) malloc(size);
+    if (cbor == NULL) {
+        return -1;
+    }
+    size_t len = ts_pubmsg_json2cbor(json, cbor, size, dev != NULL ? &dev->ids : NULL);
+
+    int msg_id;
+    if (len > 0) {
+        if (dev != NULL && dev->ids.changed) {
+            // subscribers need to know new IDs before receiving them
+            publish_id_map(client, dev);
+        }
+        msg_id = send_data(client, device_id, path, (const char *) cbor, len);
+    }
+    else {
+        msg_id = send_data(client, device_id, path, json, 0);
+    }
+    free(cbor);
+    return msg_id;
+}
+
+#if CONFIG_THINGSET_MQTT_BUFFER
+
+static void msg_log_init()
+{
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+        MSG_LOG_PARTITION_SUBTYPE, "mqtt_log");
+    if (partition == NULL) {
+        ESP_LOGW(TAG, "Partition mqtt_log not found, messages are not buffered");
+        return;
+    }
+
+    static FlashLogArea area;
+    area.partition = partition;
+    FlashLogIO io;
+    flash_log_partition_io(&io, &area, partition->size);
+    if (flash_log_mount(&msg_log, &io) == 0) {
+        msg_log_mounted = true;
+        ESP_LOGI(TAG, "%u buffered messages found in flash",
+            (unsigned int) msg_log.count);
+    }
+    else {
+        ESP_LOGE(TAG, "Mounting message buffer failed");
+    }
+}
+
+/* stores the message in flash as "<device_id>/<path> <data>" */
+static void msg_log_store(const char *device_id, const char *path, const char *data)
+{
+    size_t topic_len = strlen(device_id) + 1 + strlen(path);
+    size_t data_len = strlen(data);
+    if (!msg_log_mounted || topic_len + 1 + data_len > FLASH_LOG_RECORD_MAX) {
+        ESP_LOGW(TAG, "Message to %s/%s lost", device_id, path);
+        return;
+    }
+
+    char *record = (char *) malloc(topic_len + 1 + data_len + 1);
+    if (record == NULL) {
+        return;
+    }
+    snprintf(record, topic_len + 2, "%s/%s ", device_id, path);
+    memcpy(record + topic_len + 1, data, data_len);
+
+    uint32_t dropped = msg_log.dropped;
+    if (flash_log_append(&msg_log, time_sync_unix(), record, topic_len + 1 + data_len) == 0) {
+        ESP_LOGI(TAG, "Message buffered in flash (%u pending)",
+            (unsigned int) msg_log.count);
+    }
+    else {
+        ESP_LOGE(TAG, "Buffering message failed");
+    }
+    if (msg_log.dropped != dropped) {
+        ESP_LOGW(TAG, "Buffer full, %u oldest messages lost",
+            (unsigned int) (msg_log.dropped - dropped));
+    }
+    free(record);
+}
+
+/*
+ * Sends up to CONFIG_THINGSET_MQTT_DRAIN_BATCH buffered messages. The time the message was
+ * recorded is added to JSON objects as "t_s".
+ *
+ * \returns true if further messages are pending
+ */
+static bool msg_log_drain(esp_mqtt_client_handle_t client)
+{
+    // the space behind the record is used to insert the timestamp
+    char *buf = (char *) malloc(FLASH_LOG_RECORD_MAX + TS_MEMBER_SIZE);
+    if (buf == NULL) {
+        return true;
+    }
+
+    for (int i = 0; i < CONFIG_THINGSET_MQTT_DRAIN_BATCH && mqtt_connected; i++) {
+        uint32_t timestamp;
+        int len = flash_log_peek(&msg_log, &timestamp, buf, FLASH_LOG_RECORD_MAX);
+        if (len <= 0) {
+            break;
+        }
+        buf[len] = '\0';
+
+        char *data = strchr(buf, ' ');
+        char *path = strchr(buf, '/');
+        if (data == NULL || path == NULL || path > data) {
+            // not created by this firmware
+            flash_log_pop(&msg_log);
+            continue;
+        }
+        *data++ = '\0';
+        *path++ = '\0';
+
+        insert_timestamp(data, timestamp);
+
+        if (send_json(client, buf, path, data) < 0) {
+            break;
+        }
+        flash_log_pop(&msg_log);
+    }
+    free(buf);
+    return msg_log.count > 0;
+}
+
+#endif /* CONFIG_THINGSET_MQTT_BUFFER */
+
+/*
+ * Sends the message or stores it in flash if the broker is not reachable
+ */
+static void send_or_store(esp_mqtt_client_handle_t client, const char *device_id,
+    const char *path, const char *data)
+{
+    if (mqtt_connected && send_json(client, device_id, path, data) >= 0) {
+        ESP_LOGD(TAG, "Publishing via MQTT: %s %s", path, data);
+        return;
+    }
+#if CONFIG_THINGSET_MQTT_BUFFER
+    msg_log_store(device_id, path, data);
+#endif
+}
+
+static void publish_batch(esp_mqtt_client_handle_t client)
+{
+    const char *data = pub_batch_finish(&batch);
+    if (data != NULL) {
+        send_or_store(client, device_id, "batch", data);
+        pub_batch_clear(&batch);
+    }
+}
+
+/*
+ * Adds the message to the current batch or sends it immediately if batching is disabled
+ */
+static void publish(esp_mqtt_client_handle_t client, const char *device_id, const char *path,
+    const char *data)
+{
+    if (batch_buf != NULL) {
+        char key[128];
+        snprintf(key, sizeof(key), "%s/%s", device_id, path);
+        char *sample = (char *) malloc(strlen(data) + TS_MEMBER_SIZE);
+        if (sample != NULL) {
+            // messages of the same batch may have been recorded at different times
+            strcpy(sample, data);
+            insert_timestamp(sample, time_sync_unix());
+            int res = pub_batch_add(&batch, key, sample, uptime_ms());
+            if (res > 0) {
+                publish_batch(client);
+                res = pub_batch_add(&batch, key, sample, uptime_ms());
+            }
+            free(sample);
+            if (res == 0) {
+                return;
+            }
+        }
+        // too large for a batch
+    }
+    send_or_store(client, device_id, path, data);
+}
+
+/*
+ * Waits until the next publication interval. Buffered messages are sent in the meantime in
+ * batches to avoid flooding the broker after reconnecting.
+ */
+static void wait_next_interval(esp_mqtt_client_handle_t client, TickType_t *last_pub_ticks)
+{
+    const TickType_t interval = mqtt_config.pub_interval * 1000 / portTICK_PERIOD_MS;
+#if CONFIG_THINGSET_MQTT_BUFFER
+    const TickType_t drain_ticks = CONFIG_THINGSET_MQTT_DRAIN_INTERVAL / portTICK_PERIOD_MS;
+    while (msg_log_mounted && mqtt_connected && !pub_stop &&
+        xTaskGetTickCount() - *last_pub_ticks + drain_ticks < interval &&
+        msg_log_drain(client))
+    {
+        ulTaskNotifyTake(pdTRUE, drain_ticks);
+    }
+#endif
+    // same as vTaskDelayUntil, but ts_mqtt_stop wakes the task up with a notification
+    TickType_t elapsed = xTaskGetTickCount() - *last_pub_ticks;
+    if (elapsed < interval && !pub_stop) {
+        ulTaskNotifyTake(pdTRUE, interval - elapsed);
+    }
+    *last_pub_ticks += interval;
+}
+
+/*
+ * Finds the publication state of a device or creates it
+ *
+ * \returns Pointer to the device or NULL if too many devices are connected
+ */
+static MqttDevice *get_mqtt_device(uint8_t can_address, const char *id)
+{
+    MqttDevice **free_slot = NULL;
+    for (int i = 0; i < MQTT_DEVICES_MAX; i++) {
+        if (mqtt_devices[i] == NULL) {
+            free_slot = (free_slot == NULL) ? &mqtt_devices[i] : free_slot;
+        }
+        else if (mqtt_devices[i]->can_address == can_address) {
+            // ID of CAN devices may become known later
+            strlcpy(mqtt_devices[i]->id, id, sizeof(mqtt_devices[i]->id));
+            return mqtt_devices[i];
+        }
+    }
+    if (free_slot == NULL) {
+        ESP_LOGW(TAG, "Too many devices, data of %s is not published", id);
+        return NULL;
+    }
+
+    MqttDevice *dev = (MqttDevice *) calloc(1, sizeof(MqttDevice));
+    if (dev == NULL) {
+        return NULL;
+    }
+    strlcpy(dev->id, id, sizeof(dev->id));
+    dev->can_address = can_address;
+    pub_filter_init(&dev->filter, mqtt_config.deadband_abs, mqtt_config.deadband_rel,
+        mqtt_config.full_refresh);
+    if (pub_filter_set_rules(&dev->filter, mqtt_config.deadbands) < 0) {
+        ESP_LOGW(TAG, "Ignoring invalid deadbands: %s", mqtt_config.deadbands);
+    }
+
+    // data objects on the CAN bus have fixed IDs, other names get IDs assigned on first use
+    ts_id_map_init(&dev->ids);
+    size_t num_objs;
+    DataObject *objs = can_address != UINT8_MAX ? can_get_data_objects(can_address, &num_objs) :
+        NULL;
+    for (size_t i = 0; objs != NULL && i < num_objs; i++) {
+        ts_id_map_add(&dev->ids, objs[i].id, objs[i].name);
+    }
+    *free_slot = dev;
+    return dev;
+}
+
+/* publishes the values of the JSON data that changed beyond their deadbands */
+static void publish_device(esp_mqtt_client_handle_t client, MqttDevice *dev, const char *path,
+    const char *data)
+{
+    char *changed = (char *) malloc(strlen(data) + 1);
+    int len = changed != NULL ? pub_filter_apply(&dev->filter, data, changed,
+        strlen(data) + 1) : -1;
+    if (len > 0) {
+        publish(client, dev->id, path, changed);
+    }
+    else if (len < 0) {
+        // no JSON object, so values can't be compared
+        publish(client, dev->id, path, data);
+    }
+    else {
+        ESP_LOGD(TAG, "%s: No values changed beyond deadband", dev->id);
+    }
+    free(changed);
+}
+
+/* publishes the latest publication message of the serial device (if any) */
+static void publish_serial_device(esp_mqtt_client_handle_t client, TSDevice *ts_device)
+{
+    char *pub_msg = ts_serial_pubmsg(1000);
+    if (pub_msg == NULL) {
+        ESP_LOGD(TAG, "No pub msg received from serial device");
+        return;
+    }
+
+    // message format: #<path> <json-data>
+    char *delimiter = strchr(pub_msg, ' ');
+    MqttDevice *dev = get_mqtt_device(UINT8_MAX, ts_device->ts_device_id);
+    if (delimiter != NULL && pub_msg[0] == '#' && dev != NULL) {
+        *delimiter = '\0';          // null-terminate path section
+        // old ThingSet statement format without path is published as "serial"
+        char *path = (delimiter != pub_msg + 1) ? pub_msg + 1 : "serial";
+        publish_device(client, dev, path, delimiter + 1);
+    }
+    ts_serial_pubmsg_clear();
+}
+
+/* publishes the data objects of CAN devices received since the last publication */
+static void publish_can_devices(esp_mqtt_client_handle_t client)
+{
+    char *buf = (char *) malloc(CAN_JSON_SIZE);
+    if (buf == NULL) {
+        return;
+    }
+
+    for (int addr = 0; addr < UINT8_MAX; addr++) {
+        uint32_t pub_count;
+        if (can_get_data_json(addr, buf, CAN_JSON_SIZE, &pub_count) == 0) {
+            continue;
+        }
+
+        // address 0 is also used for the gateway itself, so only look up other devices
+        TSDevice *device = addr > 0 ? ts_get_can_device(addr) : NULL;
+        char label[10];
+        snprintf(label, sizeof(label), "can:%d", addr);
+        MqttDevice *dev = get_mqtt_device(addr, device != NULL && device->ts_device_id != NULL ?
+            device->ts_device_id : label);
+        if (dev == NULL || dev->pub_count == pub_count) {
+            // no new data received
+            continue;
+        }
+        dev->pub_count = pub_count;
+        publish_device(client, dev, "can", buf);
+    }
+    free(buf);
+}
+
+static void subscribe_requests(esp_mqtt_client_handle_t client)
+{
+    char topic[128];
+    snprintf(topic, sizeof(topic), "ts/%s/+/rx/#", mqtt_config.username);
+    int msg_id = esp_mqtt_client_subscribe(client, topic, 0);
+    ESP_LOGI(TAG, "subscribed to %s with msg_id=%d", topic, msg_id);
+}
+
+/*
+ * Queues a request received on ts/<user>/<device_id>/rx/<path>. Requests are not processed
+ * in the MQTT event task, as the device may need up to the bus timeout to respond.
+ */
+static void queue_request(esp_mqtt_event_handle_t event)
+{
+    if (event->data_len != event->total_data_len) {
+        ESP_LOGW(TAG, "Request too large (%d bytes)", event->total_data_len);
+        return;
+    }
+
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "ts/%s/", mqtt_config.username);
+    MqttRequest req;
+    req.ts_method = ts_parse_mqtt_request(event->topic, event->topic_len, prefix, event->data,
+        event->data_len, &req.uri, &req.payload);
+    if (req.ts_method == 0) {
+        ESP_LOGW(TAG, "Invalid request on topic %.*s", event->topic_len, event->topic);
+        return;
+    }
+
+    if (xQueueSend(rx_queue, &req, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Too many pending requests, dropping request to %s", req.uri);
+        free(req.uri);
+        free(req.payload);
+    }
+}
+
+/*
+ * Sends the request to the device and publishes the response in ThingSet text mode format
+ * (e.g. ":85 {...}") on the tx topic of the same path
+ */
+static void process_request(esp_mqtt_client_handle_t client, MqttRequest *req)
+{
+    TSUriElems params;
+    params.ts_payload = req->payload;
+    ts_parse_uri(req->uri, &params);
+    if (params.ts_device_id == NULL) {
+        return;
+    }
+
+    uint8_t status = TS_STATUS_NOT_FOUND;
+    char *data = NULL;
+    char *block = NULL;
+    TSDevice *device = ts_get_device_from_uri(req->uri);
+    if (device != NULL) {
+        uint32_t query_size = 0;
+        char *query = (char *) device->build_query(req->ts_method, &params, &query_size);
+        if (query != NULL) {
+            uint32_t block_len = 0;
+            block = device->send((uint8_t *) query, query_size, device->can_address,
+                &block_len);
+            heap_caps_free(query);
+
+            if (block != NULL) {
+                TSResponse res = { .block = block, .block_len = block_len };
+                // status first, data is overwritten by devices using the binary mode
+                status = device->ts_resp_status(&res);
+                data = device->ts_resp_data(&res);
+            }
+            else {
+                status = TS_STATUS_GATEWAY_TIMEOUT;
+            }
+        }
+        else {
+            status = TS_STATUS_BAD_REQUEST;
+        }
+    }
+
+    size_t resp_size = strlen_null(data) + 5;
+    char *resp = (char *) malloc(resp_size);
+    if (resp != NULL) {
+        snprintf(resp, resp_size, ":%.2X%s%s", status, data != NULL ? " " : "",
+            data != NULL ? data : "");
+        send_data(client, params.ts_device_id, params.ts_target_node, resp, 0);
+        free(resp);
+    }
+    heap_caps_free(block);
+    heap_caps_free(params.ts_device_id);
+}
+
+static void mqtt_rx_task(void *arg)
+{
+    esp_mqtt_client_handle_t client = (esp_mqtt_client_handle_t) arg;
+    MqttRequest req;
+    while (1) {
+        if (xQueueReceive(rx_queue, &req, portMAX_DELAY) == pdTRUE) {
+            if (req.uri == NULL) {
+                // sent by the publishing task to stop
+                break;
+            }
+            process_request(client, &req);
+            free(req.uri);
+            free(req.payload);
+        }
+    }
+    rx_task = NULL;
+    vTaskDelete(NULL);
+}
+
+/*
+ * Event handler called by the MQTT client event loop
  */
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id,
     void *event_data)
@@ -67,15 +679,20 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     switch ((esp_mqtt_event_id_t)event_id) {
         case MQTT_EVENT_CONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-            //msg_id = esp_mqtt_client_subscribe(client, "/topic/qos0", 0);
-            //ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
-            //msg_id = esp_mqtt_client_subscribe(client, "/topic/qos1", 1);
-            //ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
-            //msg_id = esp_mqtt_client_unsubscribe(client, "/topic/qos1");
-            //ESP_LOGI(TAG, "sent unsubscribe successful, msg_id=%d", msg_id);
+            mqtt_connected = true;
+            // messages may have been lost while disconnected
+            for (int i = 0; i < MQTT_DEVICES_MAX; i++) {
+                if (mqtt_devices[i] != NULL) {
+                    pub_filter_refresh(&mqtt_devices[i]->filter);
+                    mqtt_devices[i]->ids.changed = true;
+                }
+            }
+            // subscriptions are not persistent if clean sessions are used
+            subscribe_requests(event->client);
             break;
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+            mqtt_connected = false;
             break;
         case MQTT_EVENT_SUBSCRIBED:
             ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
@@ -87,15 +704,13 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
             break;
         case MQTT_EVENT_PUBLISHED:
             ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+            xSemaphoreTake(window_lock, portMAX_DELAY);
+            pub_window_ack(&window, event->msg_id, uptime_ms());
+            xSemaphoreGive(window_lock);
             break;
         case MQTT_EVENT_DATA:
             ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-            //printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
-            //printf("DATA=%.*s\r\n", event->data_len, event->data);
-            //if (strncmp(event->data, "send binary please", event->data_len) == 0) {
-            //    ESP_LOGI(TAG, "Sending the binary");
-            //    send_binary(client);
-            //}
+            queue_request(event);
             break;
         case MQTT_EVENT_ERROR:
             ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
@@ -116,12 +731,50 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     }
 }
 
-void ts_mqtt_pub_task(void *arg)
+/* stops the client and the RX task and releases all resources allocated by the publishing task */
+static void client_shutdown(esp_mqtt_client_handle_t client)
+{
+    if (batch_buf != NULL) {
+        // batched data is not lost, but sent or buffered in flash
+        publish_batch(client);
+    }
+
+    // requests in progress use the client, so the RX task is stopped first
+    MqttRequest req = { .uri = NULL };
+    xQueueSend(rx_queue, &req, portMAX_DELAY);
+    while (rx_task != NULL) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    // no further events (and requests) after the client was stopped
+    esp_mqtt_client_stop(client);
+    esp_mqtt_client_destroy(client);
+    mqtt_connected = false;
+
+    while (xQueueReceive(rx_queue, &req, 0) == pdTRUE) {
+        free(req.uri);
+        free(req.payload);
+    }
+    vQueueDelete(rx_queue);
+    rx_queue = NULL;
+
+    free(batch_buf);
+    batch_buf = NULL;
+
+    // devices are created again with the new deadbands
+    for (int i = 0; i < MQTT_DEVICES_MAX; i++) {
+        free(mqtt_devices[i]);
+        mqtt_devices[i] = NULL;
+    }
+}
+
+static void ts_mqtt_pub_task(void *arg)
 {
     TSDevice ts_device;
     ts_device.ts_device_id = NULL;
-    bool device_found = false;
-    esp_err_t err;
+    ts_device.ts_name = NULL;
+    bool serial_found = false;
+    TickType_t serial_scan_ticks = 0;
 
     esp_mqtt_client_config_t mqtt_cfg = {
         .uri = mqtt_config.broker_hostname,
@@ -135,59 +788,115 @@ void ts_mqtt_pub_task(void *arg)
         mqtt_cfg.password = mqtt_config.password;
     }
 
-    // wait 3s for device to boot
-    vTaskDelay(3000 / portTICK_PERIOD_MS);
+    if (mqtt_config.qos > 0) {
+        // unacknowledged messages are sent again from the outbox of the client after
+        // reconnecting, which requires the broker to keep the session
+        mqtt_cfg.disable_clean_session = true;
+    }
+    if (window_lock == NULL) {
+        window_lock = xSemaphoreCreateMutex();
+    }
+    pub_window_init(&window, CONFIG_THINGSET_MQTT_INFLIGHT_MAX);
+
+    if (mqtt_config.batch_size > 0) {
+        size_t size = MIN(mqtt_config.batch_size, BATCH_SIZE_MAX);
+        batch_buf = (char *) malloc(size);
+        if (batch_buf != NULL) {
+            pub_batch_init(&batch, batch_buf, size);
+        }
+    }
+
+    bool sync_time = (batch_buf != NULL);
+#if CONFIG_THINGSET_MQTT_BUFFER
+    if (!msg_log_mounted) {
+        // stays mounted if the task is restarted
+        msg_log_init();
+    }
+    sync_time = true;
+#endif
+    if (sync_time) {
+        time_sync_init();
+    }
 
+    // the client keeps trying to connect until the WiFi is available
     esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
 
+    rx_queue = xQueueCreate(MQTT_RX_QUEUE_SIZE, sizeof(MqttRequest));
+    xTaskCreate(mqtt_rx_task, "mqtt_rx", 4096, client, 5, (TaskHandle_t *) &rx_task);
+
     // the last argument may be used to pass data to the event handler
     esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     esp_mqtt_client_start(client);
 
     TickType_t mqtt_pub_ticks = xTaskGetTickCount();
 
-    while (1) {
-        if (!device_found) {
-            err = ts_serial_scan_device_info(&ts_device);
-            if (err) {
-                ESP_LOGE(TAG, "No device found, waiting 1 minute");
-                vTaskDelay(60 * 1000 / portTICK_PERIOD_MS);
-                continue;
-            }
-            else {
-                device_found = true;
+    while (!pub_stop) {
+        if (general_config.ts_serial_active && !serial_found &&
+            (serial_scan_ticks == 0 ||
+            xTaskGetTickCount() - serial_scan_ticks > pdMS_TO_TICKS(SERIAL_SCAN_INTERVAL_MS)))
+        {
+            serial_scan_ticks = xTaskGetTickCount();
+            serial_found = (ts_serial_scan_device_info(&ts_device) == 0);
+            if (!serial_found) {
+                ESP_LOGE(TAG, "No serial device found, trying again in 1 minute");
             }
         }
 
-        // wait until we get a serial publication message
-        char *pub_msg = ts_serial_pubmsg(1000);
-        while (pub_msg == NULL) {
-            pub_msg = ts_serial_pubmsg(1000);
-            printf("Waiting for pub msg\n");
+        // all devices are published in one cycle, each at most once per interval
+        gpio_set_level(CONFIG_GPIO_LED, 0);
+        if (serial_found) {
+            publish_serial_device(client, &ts_device);
         }
-
-        // message format: #<path> <json-data>
-        char *delimiter = strchr(pub_msg, ' ');
-        if (delimiter != NULL && pub_msg[0] == '#') {
-            gpio_set_level(CONFIG_GPIO_LED, 0);
-            if (delimiter != pub_msg + 1) {
-                *delimiter = '\0';      // null-terminate path section
-                send_data(client, ts_device.ts_device_id, pub_msg + 1, delimiter + 1);
-            }
-            else {
-                // old ThingSet statement format without path
-                send_data(client, ts_device.ts_device_id, "serial", delimiter + 1);
-            }
-            printf("Publishing via MQTT: %s\n", pub_msg);
+        if (general_config.ts_can_active) {
+            publish_can_devices(client);
         }
-        ts_serial_pubmsg_clear();
-
+        if (batch_buf != NULL &&
+            pub_batch_due(&batch, uptime_ms(), mqtt_config.batch_delay * 1000))
+        {
+            publish_batch(client);
+        }
+        xSemaphoreTake(window_lock, portMAX_DELAY);
+        pub_window_stats(&window, &mqtt_stats);
+        xSemaphoreGive(window_lock);
         vTaskDelay(100 / portTICK_PERIOD_MS);
         gpio_set_level(CONFIG_GPIO_LED, 1);
 
-        vTaskDelayUntil(&mqtt_pub_ticks,
-            mqtt_config.pub_interval * 1000 / portTICK_PERIOD_MS);
+        wait_next_interval(client, &mqtt_pub_ticks);
+    }
+
+    client_shutdown(client);
+    free(ts_device.ts_name);
+    free(ts_device.ts_device_id);
+    ESP_LOGI(TAG, "MQTT client stopped");
+    pub_task = NULL;
+    vTaskDelete(NULL);
+}
+
+void ts_mqtt_start()
+{
+    if (pub_task != NULL || !mqtt_config.active) {
+        return;
     }
+    pub_stop = false;
+    xTaskCreate(&ts_mqtt_pub_task, "mqtt_pub", 4096, NULL, 5, (TaskHandle_t *) &pub_task);
+}
+
+void ts_mqtt_stop()
+{
+    if (pub_task == NULL) {
+        return;
+    }
+    pub_stop = true;
+    xTaskNotifyGive(pub_task);
+    while (pub_task != NULL) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+uint32_t ts_mqtt_rx_waiting()
+{
+    QueueHandle_t queue = rx_queue;
+    return queue != NULL ? uxQueueMessagesWaiting(queue) : 0;
 }
 
 #endif /* UNIT_TEST */
@@ -4,7 +4,36 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <stdint.h>
+
 /**
  * Sends MQTT pub request to specified server in 10s interval
+ *
+ * The data of the serial device and of all CAN devices sending publication messages is
+ * published in one cycle, each device on its own topic ts/<user>/<device_id>/tx/<path>.
+ *
+ * Only values that changed by more than their deadband are published, except for a full
+ * refresh every mqtt_config.full_refresh intervals.
+ *
+ * If batching is configured, the messages are combined and published together on
+ * ts/<user>/<gateway_id>/tx/batch. With QoS 1 the number of unacknowledged messages is
+ * limited, see output/mqtt for publication statistics.
+ *
+ * Requests to connected devices can be sent to ts/<user>/<device_id>/rx/<path>, the response
+ * is published on ts/<user>/<device_id>/tx/<path>.
+ *
+ * Starts the publishing task if MQTT is activated in the configuration and not running yet.
+ */
+void ts_mqtt_start();
+
+/**
+ * Disconnect from the broker and stop the publishing task, e.g. to apply a new configuration
+ *
+ * Waits until a running publication cycle or request is finished.
+ */
+void ts_mqtt_stop();
+
+/**
+ * Number of requests received from the broker and waiting to be processed
  */
-void ts_mqtt_pub_task(void *arg);
+uint32_t ts_mqtt_rx_waiting();
@@ -15,6 +15,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/stream_buffer.h"
 
 #include "esp_system.h"
 #include "esp_log.h"
@@ -23,18 +24,30 @@
 #include "driver/uart.h"
 
 #include "stm32bl.h"
+#include "web_events.h"
+#include "emoncms.h"
 
 static const char *TAG = "ts_ser";
 
 
 #define PUBMSG_BUF_SIZE     (1024)
 #define RESP_BUF_SIZE       (1024)
-#define UART_RX_BUF_SIZE    (256)
+#define UART_RX_BUF_SIZE    (1024)
+
+/* streamed responses are forwarded in parts of this size */
+#define STREAM_WINDOW_SIZE  (256)
+
+#define RESP_STREAM_SIZE        (1024)
+#define RESP_CHUNK_SIZE         (64)
+#define RESP_TIMEOUT_MS         (200)   // maximum time between two parts of a response
+#define RESP_STREAM_TIMEOUT_MS  (50)    // maximum time the RX task waits for the receiver
 
 EventGroupHandle_t events = NULL;
 #define FLAG_AWAITING_RESPONSE  (1U << 0)
 #define FLAG_RESPONSE_RECEIVED  (1U << 1)
 #define FLAG_PUBMSG_RECEIVED    (1U << 2)
+#define FLAG_STREAM_RESPONSE    (1U << 3)   // forward response to resp_stream
+#define FLAG_RESPONSE_TRUNCATED (1U << 4)   // parts of streamed response were lost
 
 /* stores incoming publication messages */
 static uint8_t pubmsg_buf[PUBMSG_BUF_SIZE];
@@ -44,28 +57,31 @@ SemaphoreHandle_t pubmsg_buf_lock = NULL;
 static uint8_t resp_buf[RESP_BUF_SIZE];
 SemaphoreHandle_t resp_buf_lock = NULL;
 
+/* streamed responses (also protected by resp_buf_lock), terminated with '\n' */
+static StreamBufferHandle_t resp_stream = NULL;
+static uint8_t resp_chunk[RESP_CHUNK_SIZE];
+static int resp_chunk_len;
+
 SemaphoreHandle_t uart_lock = NULL;
 
+/* copy of the latest pub message for readers that don't consume it (e.g. metrics) */
+static char pubmsg_last[PUBMSG_BUF_SIZE];
+static SemaphoreHandle_t pubmsg_last_lock = NULL;
+
+static TSSerialStats serial_stats;
+
 /* used UART interface */
 static const int uart_num = UART_NUM_2;
 
-void ts_serial_setup(void)
-{
-    const uart_config_t uart_config = {
-        .baud_rate = 115200,
-        .data_bits = UART_DATA_8_BITS,
-        .parity = UART_PARITY_DISABLE,
-        .stop_bits = UART_STOP_BITS_1,
-        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
-    };
-    ESP_ERROR_CHECK(
-        uart_param_config(uart_num, &uart_config));
-    ESP_ERROR_CHECK(
-        uart_set_pin(uart_num, CONFIG_GPIO_UART_TX, CONFIG_GPIO_UART_RX,
-            UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
-    ESP_ERROR_CHECK(
-        uart_driver_install(uart_num, UART_RX_BUF_SIZE, 0, 0, NULL, 0));
+#define RX_TASK_PRIO 9
+
+/* set while the RX task is running, cleared by the task before it exits */
+static volatile TaskHandle_t rx_task;
+static volatile bool rx_stop;
 
+/* locks and buffers are created once and kept if the interface is stopped */
+static void create_locks(void)
+{
     /* mutex: expected to be taken and given from same task */
     resp_buf_lock = xSemaphoreCreateMutex();
 
@@ -76,6 +92,10 @@ void ts_serial_setup(void)
     uart_lock = xSemaphoreCreateBinary();
     xSemaphoreGive(uart_lock);
 
+    pubmsg_last_lock = xSemaphoreCreateMutex();
+
+    resp_stream = xStreamBufferCreate(RESP_STREAM_SIZE, 1);
+
     events = xEventGroupCreate();
 }
 
@@ -89,22 +109,37 @@ static inline void terminate_buffer(uint8_t *buf, int pos)
     }
 }
 
-void ts_serial_rx_task(void *arg)
+/* forwards collected bytes of a streamed response, called from RX task */
+static void forward_resp_chunk(void)
+{
+    if (resp_chunk_len > 0 &&
+        xStreamBufferSend(resp_stream, resp_chunk, resp_chunk_len,
+            pdMS_TO_TICKS(RESP_STREAM_TIMEOUT_MS)) != resp_chunk_len)
+    {
+        // receiver is too slow, so the rest of the response is incomplete
+        xEventGroupSetBits(events, FLAG_RESPONSE_TRUNCATED);
+    }
+    resp_chunk_len = 0;
+}
+
+static void ts_serial_rx_task(void *arg)
 {
     // following two flags indicate in which buffer new characters should be stored
-    static bool receiving_pubmsg = false;
-    static bool receiving_resp = false;
+    bool receiving_pubmsg = false;
+    bool receiving_resp = false;
+    bool streaming_resp = false;
 
     int pos = 0;        // stores next free position in currently used buffer
 
-    while (true) {
+    while (!rx_stop) {
         uint8_t byte;
         // wait for incoming characters
-        while (uart_read_bytes(uart_num, &byte, 1, pdMS_TO_TICKS(50)) == 0) {
+        if (uart_read_bytes(uart_num, &byte, 1, pdMS_TO_TICKS(50)) == 0) {
             // this allows other threads to block UART read access in this thread (e.g. for
             // firmware upgrade)
             xSemaphoreTake(uart_lock, portMAX_DELAY);
             xSemaphoreGive(uart_lock);
+            continue;
         }
 
         if (pos == 0 && byte == '#') {
@@ -116,9 +151,12 @@ void ts_serial_rx_task(void *arg)
         }
         else if (pos == 0 && byte == ':') {
             // only store response if someone is actually waiting for it
-            if (xEventGroupGetBits(events) & FLAG_AWAITING_RESPONSE) {
+            EventBits_t bits = xEventGroupGetBits(events);
+            if (bits & FLAG_AWAITING_RESPONSE) {
                 xEventGroupClearBits(events, FLAG_AWAITING_RESPONSE);
                 receiving_resp = true;
+                streaming_resp = (bits & FLAG_STREAM_RESPONSE) != 0;
+                resp_chunk_len = 0;
             }
         }
 
@@ -128,11 +166,29 @@ void ts_serial_rx_task(void *arg)
         if (byte == '\n') {
             if (receiving_pubmsg) {
                 terminate_buffer(pubmsg_buf, pos);
+                serial_stats.pubmsgs++;
+                if (xSemaphoreTake(pubmsg_last_lock, pdMS_TO_TICKS(10)) == pdTRUE) {
+                    strcpy(pubmsg_last, (char *)pubmsg_buf);
+                    xSemaphoreGive(pubmsg_last_lock);
+                }
+                if (web_events_num_clients() > 0) {
+                    // serial device is registered with CAN address UINT8_MAX
+                    TSDevice *device = ts_get_can_device(UINT8_MAX);
+                    web_events_publish_pubmsg(device != NULL ? device->ts_device_id : NULL,
+                        UINT8_MAX, (char *)pubmsg_buf);
+                }
                 xEventGroupSetBits(events, FLAG_PUBMSG_RECEIVED);
                 xSemaphoreGive(pubmsg_buf_lock);
+                emoncms_notify(EMONCMS_DATA_SERIAL);
                 receiving_pubmsg = false;
                 //ESP_LOGI("serial", "Received pub message with %d bytes: %s\n", pos, pubmsg_buf);
             }
+            else if (receiving_resp && streaming_resp) {
+                // line feed marks the end for the receiver (buffer is never full here)
+                resp_chunk[resp_chunk_len++] = '\n';
+                forward_resp_chunk();
+                receiving_resp = false;
+            }
             else if (receiving_resp) {
                 terminate_buffer(resp_buf, pos);
                 xEventGroupSetBits(events, FLAG_RESPONSE_RECEIVED);
@@ -145,6 +201,16 @@ void ts_serial_rx_task(void *arg)
         else if (receiving_pubmsg && pos < (sizeof(pubmsg_buf) - 1)) {
             pubmsg_buf[pos++] = byte;
         }
+        else if (receiving_resp && streaming_resp) {
+            // carriage return of the line end is not forwarded
+            if (byte != '\r') {
+                resp_chunk[resp_chunk_len++] = byte;
+                if (resp_chunk_len == sizeof(resp_chunk)) {
+                    forward_resp_chunk();
+                }
+            }
+            pos++;
+        }
         else if (receiving_resp && pos < (sizeof(resp_buf) - 1)) {
             resp_buf[pos++] = byte;
         }
@@ -154,10 +220,69 @@ void ts_serial_rx_task(void *arg)
             pos++;
         }
     }
+
+    if (receiving_pubmsg) {
+        // incomplete message is dropped
+        xSemaphoreGive(pubmsg_buf_lock);
+    }
+    rx_task = NULL;
+    vTaskDelete(NULL);
+}
+
+void ts_serial_start(void)
+{
+    if (rx_task != NULL) {
+        return;
+    }
+    if (events == NULL) {
+        create_locks();
+    }
+
+    const uart_config_t uart_config = {
+        .baud_rate = 115200,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+    };
+    if (uart_param_config(uart_num, &uart_config) != ESP_OK ||
+        uart_set_pin(uart_num, CONFIG_GPIO_UART_TX, CONFIG_GPIO_UART_RX,
+            UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK ||
+        uart_driver_install(uart_num, UART_RX_BUF_SIZE, 0, 0, NULL, 0) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to install UART driver");
+        return;
+    }
+
+    rx_stop = false;
+    xTaskCreatePinnedToCore(ts_serial_rx_task, "ts_serial_rx", 4096, NULL, RX_TASK_PRIO,
+        (TaskHandle_t *) &rx_task, 1);
+    ESP_LOGI(TAG, "Serial interface started");
+}
+
+void ts_serial_stop(void)
+{
+    if (rx_task == NULL) {
+        return;
+    }
+    // wait for a running request, which holds the response buffer
+    xSemaphoreTake(resp_buf_lock, portMAX_DELAY);
+    rx_stop = true;
+    while (rx_task != NULL) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    uart_driver_delete(uart_num);
+    xEventGroupClearBits(events, FLAG_AWAITING_RESPONSE | FLAG_STREAM_RESPONSE);
+    xSemaphoreGive(resp_buf_lock);
+    ESP_LOGI(TAG, "Serial interface stopped");
 }
 
 char *ts_serial_pubmsg(int timeout_ms)
 {
+    if (pubmsg_buf_lock == NULL) {
+        // interface was never started
+        return NULL;
+    }
     if (xSemaphoreTake(pubmsg_buf_lock, pdMS_TO_TICKS(timeout_ms)) == pdFALSE) {
         ESP_LOGE(TAG, "Could not take semaphore resp_buf_lock");
         return NULL;
@@ -180,13 +305,24 @@ void ts_serial_pubmsg_clear()
 
 int ts_serial_request(char *req, int timeout_ms)
 {
+    if (rx_task == NULL) {
+        ESP_LOGE(TAG, "Serial interface not running");
+        return ESP_FAIL;
+    }
     if (xSemaphoreTake(resp_buf_lock, pdMS_TO_TICKS(timeout_ms)) == pdFALSE) {
         ESP_LOGE(TAG, "Could not take semaphore resp_buf_lock");
         return ESP_FAIL;
     }
+    if (rx_task == NULL) {
+        // stopped while waiting for the lock
+        xSemaphoreGive(resp_buf_lock);
+        return ESP_FAIL;
+    }
 
+    xEventGroupClearBits(events, FLAG_STREAM_RESPONSE);
     xEventGroupSetBits(events, FLAG_AWAITING_RESPONSE);
     uart_write_bytes(uart_num, req, strlen(req));
+    serial_stats.requests++;
 
     return ESP_OK;
 }
@@ -200,16 +336,58 @@ char *ts_serial_response(int timeout_ms)
         return (char *)resp_buf;
     }
     else {
+        serial_stats.timeouts++;
         return NULL;
     }
 }
 
+int ts_serial_pubmsg_last(char *buf, size_t size)
+{
+    if (pubmsg_last_lock == NULL ||
+        xSemaphoreTake(pubmsg_last_lock, pdMS_TO_TICKS(100)) == pdFALSE)
+    {
+        return -1;
+    }
+    int len = strlen(pubmsg_last);
+    if (len >= size) {
+        len = -1;
+    }
+    else {
+        strcpy(buf, pubmsg_last);
+    }
+    xSemaphoreGive(pubmsg_last_lock);
+    return len;
+}
+
+void ts_serial_get_stats(TSSerialStats *stats)
+{
+    *stats = serial_stats;
+}
+
 void ts_serial_response_clear()
 {
     xEventGroupClearBits(events, FLAG_RESPONSE_RECEIVED);
     xSemaphoreGive(resp_buf_lock);
 }
 
+/* waits for the response of a request and copies it, the response buffer is released */
+static char *copy_response(int timeout_ms)
+{
+    char *buf = ts_serial_response(timeout_ms);
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "Response failed");
+        ts_serial_response_clear();
+        return NULL;
+    }
+
+    char *resp = (char *) heap_caps_malloc(strlen(buf)+1, MALLOC_CAP_8BIT);
+    if (resp != NULL) {
+        strcpy(resp, buf);
+    }
+    ts_serial_response_clear();
+    return resp;
+}
+
 // can_address and request length is not needed here, but we need the same signature
 // as CAN send
 char *ts_serial_send(uint8_t *req, uint32_t query_size, uint8_t can_address, uint32_t *block_len)
@@ -224,22 +402,66 @@ char *ts_serial_send(uint8_t *req, uint32_t query_size, uint8_t can_address, uin
         return NULL;
     }
 
-    char *buf = ts_serial_response(200);
-    if (buf == NULL) {
-        ESP_LOGE(TAG, "Response failed");
-        ts_serial_response_clear();
-        return NULL;
+    return copy_response(200);
+}
+
+int ts_serial_send_resp_stream(uint8_t *req, uint32_t query_size, uint8_t can_address,
+    TSResponseStream *resp)
+{
+    if (rx_task == NULL) {
+        ESP_LOGE(TAG, "Serial interface not running");
+        return -1;
+    }
+    if (xSemaphoreTake(resp_buf_lock, pdMS_TO_TICKS(200)) == pdFALSE) {
+        ESP_LOGE(TAG, "Could not take semaphore resp_buf_lock");
+        return -1;
+    }
+    if (rx_task == NULL) {
+        xSemaphoreGive(resp_buf_lock);
+        return -1;
     }
 
-    char *resp = (char *) heap_caps_malloc(strlen(buf)+1, MALLOC_CAP_8BIT);
-    strcpy(resp, buf);
-    ts_serial_response_clear();
-    return resp;
+    xStreamBufferReset(resp_stream);
+    xEventGroupClearBits(events, FLAG_RESPONSE_TRUNCATED);
+    xEventGroupSetBits(events, FLAG_STREAM_RESPONSE | FLAG_AWAITING_RESPONSE);
+    uart_write_bytes(uart_num, (char *) req, strlen((char *) req));
+    serial_stats.requests++;
+
+    char buf[STREAM_WINDOW_SIZE];
+    int ret = -1;
+    while (true) {
+        size_t len = xStreamBufferReceive(resp_stream, buf, sizeof(buf),
+            pdMS_TO_TICKS(RESP_TIMEOUT_MS));
+        if (len == 0) {
+            ESP_LOGE(TAG, "Response failed");
+            serial_stats.timeouts++;
+            break;
+        }
+        if (xEventGroupGetBits(events) & FLAG_RESPONSE_TRUNCATED) {
+            ESP_LOGE(TAG, "Response incomplete");
+            break;
+        }
+        char *end = memchr(buf, '\n', len);
+        if (ts_resp_stream_feed(resp, buf, end != NULL ? end - buf : len) != 0) {
+            break;
+        }
+        if (end != NULL) {
+            ret = ts_resp_stream_finish(resp);
+            break;
+        }
+    }
+
+    xEventGroupClearBits(events, FLAG_STREAM_RESPONSE | FLAG_AWAITING_RESPONSE);
+    xSemaphoreGive(resp_buf_lock);
+    return ret;
 }
 
 int ts_serial_scan_device_info(TSDevice *device)
 {
     char req[7]= "?info\n\0";
+    if (rx_task == NULL) {
+        return -1;
+    }
     // First request mostly fails, so we request it twice
     if (ts_serial_request(req, 500) == ESP_FAIL) {
         ESP_LOGE(TAG, "Could not scan for devices on serial adapter");
@@ -282,6 +504,7 @@ int ts_serial_scan_device_info(TSDevice *device)
 
     // link functions
     device->send = ts_serial_send;
+    device->send_resp_stream = ts_serial_send_resp_stream;
     device->build_query = ts_build_query_serial;
     device->ts_resp_data = ts_serial_resp_data;
     device->ts_resp_status = ts_serial_resp_status;
@@ -297,6 +520,11 @@ esp_err_t ts_serial_ota(int flash_size, int page_size)
     int ret = ESP_FAIL;
     uint16_t pages = flash_size * 1024 / page_size;
 
+    if (rx_task == NULL) {
+        ESP_LOGE(TAG, "Serial interface not running");
+        return ret;
+    }
+
     ts_serial_request("!dfu/bootloader-stm\n", 100);
     ts_serial_response_clear();
 
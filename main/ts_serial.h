@@ -16,16 +16,28 @@
 #define OTA_UART_LOCK_TIMEOUT 500
 
 /**
- * Initiate the UART interface, event groups and semaphores.
+ * Counters of the serial interface
+ */
+typedef struct {
+    uint32_t pubmsgs;       // received publication messages
+    uint32_t requests;
+    uint32_t timeouts;      // requests without response
+} TSSerialStats;
+
+/**
+ * Initiate the UART interface and start the thread listening to it
  *
- * Must be called before starting the task.
+ * Event groups and semaphores are created with the first start. Does nothing if the interface
+ * is already running.
  */
-void ts_serial_setup(void);
+void ts_serial_start(void);
 
 /**
- * Thread listening to UART interface, needs to be spawned from main.
+ * Stop the thread listening to the UART interface and remove the driver
+ *
+ * Waits for a running request. Requests fail while the interface is stopped.
  */
-void ts_serial_rx_task(void *arg);
+void ts_serial_stop(void);
 
 /**
  * Returns latest pub message received on the interface and waits until timeout if receiving is
@@ -44,6 +56,23 @@ char *ts_serial_pubmsg(int timeout_ms);
  */
 void ts_serial_pubmsg_clear(void);
 
+/**
+ * Copy the latest pub message received on the interface
+ *
+ * In contrast to ts_serial_pubmsg, the message is not consumed and stays available.
+ *
+ * \param buf Buffer for the message
+ * \param size Size of the buffer
+ *
+ * \returns Length of the message (0 if nothing was received yet) or -1 in case of error
+ */
+int ts_serial_pubmsg_last(char *buf, size_t size);
+
+/**
+ * Get counters of the serial interface
+ */
+void ts_serial_get_stats(TSSerialStats *stats);
+
 /**
  * Send request and lock response buffer
  *
@@ -72,6 +101,16 @@ char *ts_serial_response(int timeout_ms);
  */
 void ts_serial_response_clear(void);
 
+/**
+ * Send request and pass the response on in parts while it is received, so the size of the
+ * response is not limited by the response buffer
+ *
+ * \returns 0 on success or -1 in case of timeout, incomplete response or error returned by
+ *          the callbacks of the stream
+ */
+int ts_serial_send_resp_stream(uint8_t *req, uint32_t query_size, uint8_t can_address,
+    TSResponseStream *resp);
+
 /**
  * Scan for device on the serial connection
  *
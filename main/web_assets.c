@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "web_assets.h"
+#include "web_pack.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool web_assets_is_hashed_name(const char *filepath)
+{
+    const char *name = strrchr(filepath, '/');
+    name = (name != NULL) ? name + 1 : filepath;
+
+    // look for a segment of exactly WEB_ASSETS_NAME_HASH_LEN hex digits between two dots
+    const char *dot = strchr(name, '.');
+    while (dot != NULL) {
+        const char *next = strchr(dot + 1, '.');
+        if (next == NULL) {
+            break;
+        }
+        if (next - dot - 1 == WEB_ASSETS_NAME_HASH_LEN) {
+            bool hex = true;
+            for (const char *c = dot + 1; c < next; c++) {
+                hex = hex && isxdigit((unsigned char)*c);
+            }
+            if (hex) {
+                return true;
+            }
+        }
+        dot = next;
+    }
+    return false;
+}
+
+bool web_assets_etag_match(const char *if_none_match, const char *etag)
+{
+    size_t etag_len = strlen(etag);
+    const char *pos = if_none_match;
+    while (*pos != '\0') {
+        if (*pos == ' ' || *pos == '\t' || *pos == ',') {
+            pos++;
+            continue;
+        }
+        if (*pos == '*') {
+            return true;
+        }
+        // weak comparison is used for If-None-Match, so the weakness indicator is ignored
+        if (strncmp(pos, "W/", 2) == 0) {
+            pos += 2;
+        }
+        const char *end = (*pos == '"') ? strchr(pos + 1, '"') : NULL;
+        end = (end != NULL) ? end + 1 : pos + strcspn(pos, ",");
+        if ((size_t) (end - pos) == etag_len && strncmp(pos, etag, etag_len) == 0) {
+            return true;
+        }
+        pos = end;
+    }
+    return false;
+}
+
+#ifndef UNIT_TEST
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "sdkconfig.h"
+
+#include "web_fs.h"
+
+static const char *TAG = "web_assets";
+
+#define CACHE_SIZE      (CONFIG_WEB_ASSETS_CACHE_SIZE * 1024)
+#define HASH_BUFSIZE    (512)
+
+static WebAsset *assets = NULL;
+static int num_assets = 0;
+
+static size_t cache_used = 0;
+static uint32_t access_count = 0;
+static SemaphoreHandle_t cache_lock = NULL;
+
+static bool packed = false;
+
+static int calc_etag(WebAsset *asset, uint8_t *buf, size_t buf_size)
+{
+    int fd = open(asset->path, O_RDONLY, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    uint32_t hash = WEB_PACK_HASH_INIT;
+    ssize_t read_bytes;
+    size_t size = 0;
+    while ((read_bytes = read(fd, buf, buf_size)) > 0) {
+        hash = web_pack_hash(hash, buf, read_bytes);
+        size += read_bytes;
+    }
+    close(fd);
+    if (read_bytes < 0) {
+        return -1;
+    }
+    asset->size = size;
+    snprintf(asset->etag, sizeof(asset->etag), "\"%08x-%x\"", hash, size);
+    return 0;
+}
+
+static esp_err_t init_packed(const char *base_path)
+{
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+        ESP_PARTITION_SUBTYPE_ANY, "website");
+    if (part == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const void *image;
+    spi_flash_mmap_handle_t handle;
+    esp_err_t err = esp_partition_mmap(part, 0, part->size, SPI_FLASH_MMAP_DATA, &image, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map website partition (%s)", esp_err_to_name(err));
+        return err;
+    }
+
+    int num_files = web_pack_validate((const uint8_t *) image, part->size);
+    if (num_files < 0) {
+        // no packed image, e.g. SPIFFS
+        spi_flash_munmap(handle);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    assets = (WebAsset *) calloc(num_files, sizeof(WebAsset));
+    if (assets == NULL && num_files > 0) {
+        ESP_LOGE(TAG, "Unable to allocate memory for asset index");
+        spi_flash_munmap(handle);
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < num_files; i++) {
+        const WebPackEntry *entry = web_pack_entry((const uint8_t *) image, i);
+        WebAsset *asset = &assets[num_assets];
+
+        size_t path_len = strlen(base_path) + strlen(entry->path) + 1;
+        asset->path = (char *) malloc(path_len);
+        if (asset->path == NULL) {
+            break;
+        }
+        snprintf(asset->path, path_len, "%s%s", base_path, entry->path);
+        asset->size = entry->length;
+        snprintf(asset->etag, sizeof(asset->etag), "\"%08x-%x\"", entry->hash, entry->length);
+        asset->immutable = web_assets_is_hashed_name(asset->path);
+        asset->mapped = true;
+        asset->content_type = entry->content_type;
+        // the mapping is never released, so the pointer stays valid
+        asset->data = (char *) image + entry->offset;
+        num_assets++;
+    }
+
+    packed = true;
+    ESP_LOGI(TAG, "Mapped packed image with %d files", num_assets);
+    return ESP_OK;
+}
+
+esp_err_t web_assets_init(const char *base_path)
+{
+    esp_err_t err = init_packed(base_path);
+    if (err == ESP_OK) {
+        return ESP_OK;
+    }
+#ifdef CONFIG_WEB_ASSETS_PACKED
+    // filesystem was not mounted by init_fs, as a packed image was expected
+    if (err == ESP_ERR_NOT_FOUND) {
+        ESP_LOGW(TAG, "No packed image found, mounting website partition as SPIFFS");
+        if (init_www_fs(base_path) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+#endif
+
+    DIR *dir = opendir(base_path);
+    if (dir == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", base_path);
+        return ESP_FAIL;
+    }
+
+    cache_lock = xSemaphoreCreateMutex();
+    uint8_t *buf = (uint8_t *) malloc(HASH_BUFSIZE);
+    if (buf == NULL || cache_lock == NULL) {
+        ESP_LOGE(TAG, "Unable to allocate memory for asset index");
+        free(buf);
+        closedir(dir);
+        return ESP_FAIL;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_type != DT_REG) {
+            continue;
+        }
+        WebAsset *new_assets = (WebAsset *) realloc(assets, (num_assets + 1) * sizeof(WebAsset));
+        if (new_assets == NULL) {
+            ESP_LOGE(TAG, "Unable to allocate memory for asset index");
+            break;
+        }
+        assets = new_assets;
+        WebAsset *asset = &assets[num_assets];
+        memset(asset, 0, sizeof(WebAsset));
+
+        // SPIFFS has a flat structure, so d_name may also contain subdirectories
+        size_t path_len = strlen(base_path) + strlen(entry->d_name) + 2;
+        asset->path = (char *) malloc(path_len);
+        if (asset->path == NULL) {
+            break;
+        }
+        snprintf(asset->path, path_len, "%s/%s", base_path, entry->d_name);
+
+        if (calc_etag(asset, buf, HASH_BUFSIZE) != 0) {
+            ESP_LOGE(TAG, "Failed to read %s", asset->path);
+            free(asset->path);
+            continue;
+        }
+        asset->immutable = web_assets_is_hashed_name(asset->path);
+        ESP_LOGD(TAG, "%s: %d bytes, ETag %s", asset->path, asset->size, asset->etag);
+        num_assets++;
+    }
+
+    free(buf);
+    closedir(dir);
+    ESP_LOGI(TAG, "Indexed %d files", num_assets);
+    return ESP_OK;
+}
+
+bool web_assets_packed(void)
+{
+    return packed;
+}
+
+WebAsset *web_assets_find(const char *filepath)
+{
+    for (int i = 0; i < num_assets; i++) {
+        if (strcmp(assets[i].path, filepath) == 0) {
+            return &assets[i];
+        }
+    }
+    return NULL;
+}
+
+/* must be called with cache_lock taken */
+static bool reserve_cache(size_t size)
+{
+    while (cache_used + size > CACHE_SIZE) {
+        WebAsset *lru = NULL;
+        for (int i = 0; i < num_assets; i++) {
+            if (assets[i].data != NULL && !assets[i].mapped && assets[i].refs == 0 &&
+                (lru == NULL || assets[i].last_used < lru->last_used))
+            {
+                lru = &assets[i];
+            }
+        }
+        if (lru == NULL) {
+            return false;
+        }
+        ESP_LOGD(TAG, "Evicting %s from cache", lru->path);
+        free(lru->data);
+        lru->data = NULL;
+        cache_used -= lru->size;
+    }
+    cache_used += size;
+    return true;
+}
+
+const char *web_assets_acquire(WebAsset *asset)
+{
+    if (asset != NULL && asset->mapped) {
+        return asset->data;
+    }
+    if (asset == NULL || cache_lock == NULL || asset->size > CACHE_SIZE) {
+        return NULL;
+    }
+
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    asset->last_used = ++access_count;
+    if (asset->data != NULL) {
+        asset->refs++;
+        xSemaphoreGive(cache_lock);
+        return asset->data;
+    }
+    bool reserved = reserve_cache(asset->size);
+    xSemaphoreGive(cache_lock);
+    if (!reserved) {
+        return NULL;
+    }
+
+    // load file outside of the lock, the space in the cache is already reserved
+    char *data = (char *) malloc(asset->size);
+    int fd = (data != NULL) ? open(asset->path, O_RDONLY, 0) : -1;
+    size_t pos = 0;
+    if (fd != -1) {
+        ssize_t read_bytes;
+        while (pos < asset->size &&
+            (read_bytes = read(fd, data + pos, asset->size - pos)) > 0)
+        {
+            pos += read_bytes;
+        }
+        close(fd);
+    }
+
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    if (pos != asset->size || asset->data != NULL) {
+        // loading failed or another request was faster
+        cache_used -= asset->size;
+        free(data);
+        data = NULL;
+    }
+    else {
+        asset->data = data;
+        ESP_LOGD(TAG, "Cached %s, %d of %d bytes used", asset->path, cache_used, CACHE_SIZE);
+    }
+    const char *cached = asset->data;
+    if (cached != NULL) {
+        asset->refs++;
+    }
+    xSemaphoreGive(cache_lock);
+
+    return cached;
+}
+
+void web_assets_release(WebAsset *asset)
+{
+    if (asset->mapped) {
+        return;
+    }
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    asset->refs--;
+    xSemaphoreGive(cache_lock);
+}
+
+#endif // UNIT_TEST
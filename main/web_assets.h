@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WEB_ASSETS_H_
+#define WEB_ASSETS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// length of the content hash in file names, see webapp/vue.config.js
+#define WEB_ASSETS_NAME_HASH_LEN 6
+
+/**
+ * Static file of the webapp with its validator and (optional) copy in RAM
+ */
+typedef struct {
+    char *path;             // full VFS path including base path
+    size_t size;
+    char etag[24];          // quoted strong validator as sent in HTTP header
+    bool immutable;         // file name contains content hash, so it can be cached forever
+    bool mapped;            // data points to memory-mapped flash (packed image)
+    const char *content_type;   // MIME type from packed image or NULL
+    char *data;             // file content if mapped or stored in RAM cache, otherwise NULL
+    int refs;               // number of requests currently sending the cached data
+    uint32_t last_used;     // for LRU eviction
+} WebAsset;
+
+/**
+ * Indexes the files of the webapp
+ *
+ * If the website partition contains a packed image (see web_pack.h), it is memory-mapped and
+ * all files are served directly from flash. Otherwise all files below base_path are scanned
+ * and their content hashes are calculated. If the filesystem was not mounted by init_fs
+ * because a packed image was expected, it is mounted at base_path.
+ *
+ * Must be called after the filesystem was mounted and before the web server is started.
+ */
+esp_err_t web_assets_init(const char *base_path);
+
+/**
+ * Find asset by its full VFS path
+ *
+ * \returns Pointer to asset or NULL if the file did not exist at init time
+ */
+WebAsset *web_assets_find(const char *filepath);
+
+/**
+ * Check if files are served from a memory-mapped packed image instead of the filesystem
+ */
+bool web_assets_packed(void);
+
+/**
+ * Get the file content from memory-mapped flash or RAM cache. If not yet cached, the file is
+ * loaded into the cache if it fits, evicting the least recently used files if necessary.
+ *
+ * web_assets_release must be called after the data was sent.
+ *
+ * \returns Pointer to the file content or NULL if the file can't be cached
+ */
+const char *web_assets_acquire(WebAsset *asset);
+
+/**
+ * Release cached data obtained with web_assets_acquire
+ */
+void web_assets_release(WebAsset *asset);
+
+/**
+ * Check if a file name contains a content hash as generated by webpack, e.g. app.1a2b3c.js
+ */
+bool web_assets_is_hashed_name(const char *filepath);
+
+/**
+ * Check if the ETag of a file matches the value of an If-None-Match header
+ *
+ * The header may contain a list of ETags, "*" or weak ETags (W/"..."), which are compared
+ * with the weak comparison function as required for If-None-Match.
+ */
+bool web_assets_etag_match(const char *if_none_match, const char *etag);
+
+#endif /* WEB_ASSETS_H_ */
@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef UNIT_TEST
+
+#include "web_events.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+
+static const char *TAG = "web_events";
+
+/* message shared between the queues of all clients, freed after last client has sent it */
+typedef struct {
+    int refs;
+    size_t len;
+    char data[];
+} EventMsg;
+
+typedef struct {
+    int fd;                 // socket of the client or -1 if slot is unused
+    EventMsg *queue[WEB_EVENTS_QUEUE_LEN];
+    uint8_t head;
+    uint8_t count;
+    uint32_t dropped;
+    EventMsg *sending;      // message taken from the queue, but not completely sent yet
+    size_t offset;          // bytes of the sending message already written to the socket
+} EventClient;
+
+static EventClient clients[WEB_EVENTS_MAX_CLIENTS];
+static int num_clients = 0;
+static bool flush_pending = false;
+
+static httpd_handle_t server = NULL;
+static SemaphoreHandle_t lock = NULL;
+
+static const char sse_header[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "\r\n"
+    "retry: 5000\n\n";
+
+/* must be called with lock taken */
+static void msg_unref(EventMsg *msg)
+{
+    if (--msg->refs <= 0) {
+        free(msg);
+    }
+}
+
+/* must be called with lock taken */
+static EventMsg *client_pop(EventClient *client)
+{
+    if (client->fd < 0 || client->count == 0) {
+        return NULL;
+    }
+    EventMsg *msg = client->queue[client->head];
+    client->head = (client->head + 1) % WEB_EVENTS_QUEUE_LEN;
+    client->count--;
+    return msg;
+}
+
+/* must be called with lock taken */
+static void client_push(EventClient *client, EventMsg *msg)
+{
+    if (client->count == WEB_EVENTS_QUEUE_LEN) {
+        // drop oldest message
+        msg_unref(client_pop(client));
+        client->dropped++;
+    }
+    int tail = (client->head + client->count) % WEB_EVENTS_QUEUE_LEN;
+    client->queue[tail] = msg;
+    client->count++;
+    msg->refs++;
+}
+
+/*
+ * Writes as much of the pending messages as the socket accepts without blocking
+ *
+ * \returns 0 if all messages were sent or the socket is full, -1 in case of error
+ */
+static int client_flush(EventClient *client)
+{
+    while (true) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (client->sending == NULL) {
+            client->sending = client_pop(client);
+            client->offset = 0;
+        }
+        int fd = client->fd;
+        EventMsg *msg = client->sending;
+        xSemaphoreGive(lock);
+        if (msg == NULL) {
+            return 0;
+        }
+
+        // a stalled client (e.g. browser tab in background) must not block the server task
+        int ret = httpd_socket_send(server, fd, msg->data + client->offset,
+            msg->len - client->offset, MSG_DONTWAIT);
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT || ret == 0) {
+            // remaining data is sent with the next flush
+            return 0;
+        }
+        else if (ret < 0) {
+            return -1;
+        }
+
+        client->offset += ret;
+        if (client->offset < msg->len) {
+            // socket buffer is full
+            return 0;
+        }
+        xSemaphoreTake(lock, portMAX_DELAY);
+        client->sending = NULL;
+        msg_unref(msg);
+        xSemaphoreGive(lock);
+    }
+}
+
+/* runs in the context of the HTTP server task */
+static void flush_work(void *arg)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    flush_pending = false;
+    xSemaphoreGive(lock);
+
+    for (int i = 0; i < WEB_EVENTS_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0 && client_flush(&clients[i]) < 0) {
+            ESP_LOGI(TAG, "Sending to client %d failed, closing stream", clients[i].fd);
+            // calls web_events_socket_closed, which frees the remaining queue
+            httpd_sess_trigger_close(server, clients[i].fd);
+        }
+    }
+}
+
+static void remove_client(int fd)
+{
+    if (lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < WEB_EVENTS_MAX_CLIENTS; i++) {
+        if (clients[i].fd == fd) {
+            EventMsg *msg;
+            while ((msg = client_pop(&clients[i])) != NULL) {
+                msg_unref(msg);
+            }
+            if (clients[i].sending != NULL) {
+                msg_unref(clients[i].sending);
+                clients[i].sending = NULL;
+            }
+            ESP_LOGI(TAG, "Client %d unsubscribed, %u events dropped", fd, clients[i].dropped);
+            clients[i].fd = -1;
+            num_clients--;
+        }
+    }
+    xSemaphoreGive(lock);
+}
+
+void web_events_init(httpd_handle_t hd)
+{
+    server = hd;
+    lock = xSemaphoreCreateMutex();
+    for (int i = 0; i < WEB_EVENTS_MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+}
+
+esp_err_t web_events_add_client(httpd_req_t *req)
+{
+    int fd = httpd_req_to_sockfd(req);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    EventClient *client = NULL;
+    for (int i = 0; i < WEB_EVENTS_MAX_CLIENTS; i++) {
+        if (clients[i].fd < 0) {
+            client = &clients[i];
+            break;
+        }
+    }
+    if (client == NULL) {
+        xSemaphoreGive(lock);
+        return ESP_ERR_NO_MEM;
+    }
+    memset(client, 0, sizeof(EventClient));
+    client->fd = fd;
+    num_clients++;
+    xSemaphoreGive(lock);
+
+    // The response header is sent manually, as the response must not be finished when the
+    // handler returns. Subsequent events are written directly to the socket.
+    if (httpd_send(req, sse_header, sizeof(sse_header) - 1) < 0) {
+        remove_client(fd);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Client %d subscribed to event stream", fd);
+    return ESP_OK;
+}
+
+void web_events_socket_closed(int sockfd)
+{
+    remove_client(sockfd);
+}
+
+int web_events_num_clients(void)
+{
+    return num_clients;
+}
+
+void web_events_publish(const char *event, const char *data)
+{
+    if (num_clients == 0 || event == NULL || data == NULL) {
+        return;
+    }
+
+    int len = snprintf(NULL, 0, "event: %s\ndata: %s\n\n", event, data);
+    EventMsg *msg = (EventMsg *) malloc(sizeof(EventMsg) + len + 1);
+    if (msg == NULL) {
+        ESP_LOGE(TAG, "Unable to allocate memory for event");
+        return;
+    }
+    snprintf(msg->data, len + 1, "event: %s\ndata: %s\n\n", event, data);
+    msg->len = len;
+    msg->refs = 1;      // held by this function until all clients got it
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < WEB_EVENTS_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) {
+            client_push(&clients[i], msg);
+        }
+    }
+    msg_unref(msg);
+
+    bool trigger_flush = !flush_pending;
+    flush_pending = true;
+    xSemaphoreGive(lock);
+
+    if (trigger_flush && httpd_queue_work(server, flush_work, NULL) != ESP_OK) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        flush_pending = false;
+        xSemaphoreGive(lock);
+    }
+}
+
+void web_events_publish_data(const char *device_id, uint8_t can_address, const char *path,
+    const char *json)
+{
+    if (num_clients == 0 || json == NULL) {
+        return;
+    }
+
+    const char fmt[] = "{\"id\":\"%s\",\"can\":%d,\"path\":\"%s\",\"data\":%s}";
+    const char *id = (device_id != NULL) ? device_id : "";
+    int can = (can_address == UINT8_MAX) ? -1 : can_address;
+
+    int len = snprintf(NULL, 0, fmt, id, can, path, json);
+    char *data = (char *) malloc(len + 1);
+    if (data == NULL) {
+        ESP_LOGE(TAG, "Unable to allocate memory for event data");
+        return;
+    }
+    snprintf(data, len + 1, fmt, id, can, path, json);
+    web_events_publish("pub", data);
+    free(data);
+}
+
+void web_events_publish_pubmsg(const char *device_id, uint8_t can_address, const char *pubmsg)
+{
+    if (num_clients == 0 || pubmsg == NULL || pubmsg[0] != '#') {
+        return;
+    }
+
+    // message format: #<path> <json-data>
+    const char *delimiter = strchr(pubmsg, ' ');
+    if (delimiter == NULL) {
+        return;
+    }
+
+    char path[64] = "serial";   // old ThingSet statement format without path
+    int path_len = delimiter - pubmsg - 1;
+    if (path_len > 0 && path_len < sizeof(path)) {
+        strncpy(path, pubmsg + 1, path_len);
+        path[path_len] = '\0';
+    }
+    web_events_publish_data(device_id, can_address, path, delimiter + 1);
+}
+
+#endif // UNIT_TEST
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WEB_EVENTS_H_
+#define WEB_EVENTS_H_
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+/*
+ * Server-Sent Events (SSE) stream of publication messages received from the connected devices.
+ *
+ * Each subscribed browser gets its own bounded queue. If a client can't keep up, the oldest
+ * messages in its queue are dropped, so slow clients never block the bus receive tasks.
+ * Messages are written without blocking the HTTP server task. If the socket is full, the rest
+ * of the message is sent with the next event.
+ */
+
+#define WEB_EVENTS_MAX_CLIENTS  4
+#define WEB_EVENTS_QUEUE_LEN    8
+
+/**
+ * Store the server handle used to send queued messages from the HTTP server task
+ */
+void web_events_init(httpd_handle_t server);
+
+/**
+ * Send the SSE response header and keep the connection of this request open for future events
+ *
+ * \returns ESP_OK on success, ESP_ERR_NO_MEM if the maximum number of clients is reached
+ */
+esp_err_t web_events_add_client(httpd_req_t *req);
+
+/**
+ * Remove the client if the socket belonged to an event stream
+ *
+ * Must be called from the close function of the HTTP server sessions.
+ */
+void web_events_socket_closed(int sockfd);
+
+/**
+ * Number of currently subscribed clients
+ */
+int web_events_num_clients(void);
+
+/**
+ * Queue an event for all subscribed clients
+ *
+ * Returns immediately without any allocation if no client is subscribed.
+ *
+ * \param event SSE event name
+ * \param data Event data (single line, typically JSON)
+ */
+void web_events_publish(const char *event, const char *data);
+
+/**
+ * Queue device data as "pub" event with JSON data {"id":..,"can":..,"path":..,"data":..}
+ *
+ * \param device_id ID of the device which sent the data (may be NULL if unknown)
+ * \param can_address CAN address of the device or UINT8_MAX for the serial interface
+ * \param path Path of the published data (e.g. "serial" or "output")
+ * \param json Published data as JSON object
+ */
+void web_events_publish_data(const char *device_id, uint8_t can_address, const char *path,
+    const char *json);
+
+/**
+ * Queue a ThingSet publication message in the format #<path> <json-data> as "pub" event
+ *
+ * \param device_id ID of the device which sent the message (may be NULL if unknown)
+ * \param can_address CAN address of the device or UINT8_MAX for the serial interface
+ * \param pubmsg Publication message (without line termination)
+ */
+void web_events_publish_pubmsg(const char *device_id, uint8_t can_address, const char *pubmsg);
+
+#endif /* WEB_EVENTS_H_ */
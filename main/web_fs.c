@@ -33,17 +33,35 @@ static esp_err_t check_response(esp_err_t ret)
     }
 }
 
-esp_err_t init_fs(void)
+esp_err_t init_www_fs(const char *base_path)
 {
     esp_vfs_spiffs_conf_t www_conf = {
-        .base_path = "/www",
+        .base_path = base_path,
         .partition_label = "website",
         .max_files = 5,
         .format_if_mount_failed = false
     };
-    if(check_response(esp_vfs_spiffs_register(&www_conf)) != ESP_OK) {
+    if (check_response(esp_vfs_spiffs_register(&www_conf)) != ESP_OK) {
         return ESP_FAIL;
-    };
+    }
+
+    size_t total = 0, used = 0;
+    esp_err_t ret = esp_spiffs_info("website", &total, &used);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to get SPIFFS partition information for website (%s)", esp_err_to_name(ret));
+    } else {
+        ESP_LOGI(TAG, "Partition size for website: total: %d, used: %d", total, used);
+    }
+    return ESP_OK;
+}
+
+esp_err_t init_fs(void)
+{
+#ifndef CONFIG_WEB_ASSETS_PACKED
+    if (init_www_fs("/www") != ESP_OK) {
+        return ESP_FAIL;
+    }
+#endif
 
     esp_vfs_spiffs_conf_t ota_conf = {
         .base_path = "/stm_ota",
@@ -56,14 +74,7 @@ esp_err_t init_fs(void)
     };
 
     size_t total = 0, used = 0;
-    esp_err_t ret = esp_spiffs_info("website", &total, &used);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to get SPIFFS partition information for website (%s)", esp_err_to_name(ret));
-    } else {
-        ESP_LOGI(TAG, "Partition size for website: total: %d, used: %d", total, used);
-    }
-
-    ret = esp_spiffs_info("stm_ota", &total, &used);
+    esp_err_t ret = esp_spiffs_info("stm_ota", &total, &used);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to get SPIFFS partition information for ota (%s)", esp_err_to_name(ret));
     } else {
@@ -7,6 +7,15 @@
 #include "esp_err.h"
 
 /**
- * Mount SPIFSS containing website data at /www
+ * Mount SPIFSS containing website data at /www (unless a packed image is used) and the partition
+ * for STM32 firmware images at /stm_ota
  */
 esp_err_t init_fs(void);
+
+/**
+ * Mount SPIFFS containing website data at base_path
+ *
+ * Also used by web_assets_init if the website partition does not contain a packed image, e.g.
+ * on devices which were only updated via OTA and still have a SPIFFS image.
+ */
+esp_err_t init_www_fs(const char *base_path);
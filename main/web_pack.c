@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "web_pack.h"
+
+#include <string.h>
+
+uint32_t web_pack_hash(uint32_t hash, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+int web_pack_validate(const uint8_t *image, size_t size)
+{
+    if (image == NULL || size < sizeof(WebPackHeader)) {
+        return -1;
+    }
+
+    const WebPackHeader *hdr = (const WebPackHeader *) image;
+    if (hdr->magic != WEB_PACK_MAGIC || hdr->version != WEB_PACK_VERSION ||
+        hdr->image_size > size)
+    {
+        return -1;
+    }
+
+    size_t index_end = sizeof(WebPackHeader) + hdr->num_files * sizeof(WebPackEntry);
+    if (index_end > hdr->image_size) {
+        return -1;
+    }
+
+    const uint8_t *index = image + sizeof(WebPackHeader);
+    if (web_pack_hash(WEB_PACK_HASH_INIT, index, index_end - sizeof(WebPackHeader)) !=
+        hdr->index_hash)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < hdr->num_files; i++) {
+        const WebPackEntry *entry = web_pack_entry(image, i);
+        if (entry->path[0] != '/' ||
+            memchr(entry->path, '\0', sizeof(entry->path)) == NULL ||
+            memchr(entry->content_type, '\0', sizeof(entry->content_type)) == NULL ||
+            entry->offset < index_end ||
+            entry->offset > hdr->image_size ||
+            entry->length > hdr->image_size - entry->offset)
+        {
+            return -1;
+        }
+    }
+
+    return hdr->num_files;
+}
+
+const WebPackEntry *web_pack_entry(const uint8_t *image, int index)
+{
+    const WebPackHeader *hdr = (const WebPackHeader *) image;
+    if (index < 0 || index >= hdr->num_files) {
+        return NULL;
+    }
+    return (const WebPackEntry *) (image + sizeof(WebPackHeader)) + index;
+}
+
+const WebPackEntry *web_pack_find(const uint8_t *image, const char *path)
+{
+    const WebPackHeader *hdr = (const WebPackHeader *) image;
+    for (int i = 0; i < hdr->num_files; i++) {
+        const WebPackEntry *entry = web_pack_entry(image, i);
+        if (strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WEB_PACK_H_
+#define WEB_PACK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Read-only image of the webapp files, generated by tools/pack_webapp.py and flashed to the
+ * website partition.
+ *
+ * Layout (all integers little-endian):
+ *
+ *   WebPackHeader
+ *   WebPackEntry[num_files]
+ *   file data, each file aligned to 4 bytes
+ *
+ * The image is memory-mapped, so the file data can be passed to the HTTP server without copy.
+ */
+
+#define WEB_PACK_MAGIC      0x4B504157      // "WAPK"
+#define WEB_PACK_VERSION    1
+
+#define WEB_PACK_PATH_LEN   64
+#define WEB_PACK_TYPE_LEN   32
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t num_files;
+    uint32_t image_size;        // total size including header and index
+    uint32_t index_hash;        // FNV-1a hash of all index entries
+} WebPackHeader;
+
+typedef struct __attribute__((packed)) {
+    char path[WEB_PACK_PATH_LEN];           // null-terminated, starting with '/'
+    char content_type[WEB_PACK_TYPE_LEN];   // null-terminated MIME type
+    uint32_t offset;            // from start of image
+    uint32_t length;
+    uint32_t hash;              // FNV-1a hash of file data
+    uint32_t reserved;
+} WebPackEntry;
+
+/**
+ * Calculate 32-bit FNV-1a hash
+ *
+ * \param hash Previous hash value or WEB_PACK_HASH_INIT for the first block of data
+ */
+uint32_t web_pack_hash(uint32_t hash, const uint8_t *data, size_t len);
+
+#define WEB_PACK_HASH_INIT  2166136261U
+
+/**
+ * Check header and index of an image
+ *
+ * \param image Pointer to start of the image
+ * \param size Available size (e.g. partition size)
+ *
+ * \returns Number of files in the image or -1 if the image is invalid
+ */
+int web_pack_validate(const uint8_t *image, size_t size);
+
+/**
+ * Get index entry of a validated image
+ *
+ * \returns Pointer to the entry or NULL if index is out of range
+ */
+const WebPackEntry *web_pack_entry(const uint8_t *image, int index);
+
+/**
+ * Find file in a validated image
+ *
+ * \returns Pointer to the entry or NULL if not found
+ */
+const WebPackEntry *web_pack_find(const uint8_t *image, const char *path);
+
+#endif /* WEB_PACK_H_ */
@@ -6,19 +6,36 @@
 #ifndef UNIT_TEST
 
 #include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_http_server.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_vfs.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "cJSON.h"
 #include <sys/param.h>
+#include <sys/socket.h>
 
 #include "ts_serial.h"
 #include "ts_client.h"
+#include "can.h"
+#include "metrics.h"
+#include "http_stats.h"
 #include "data_nodes.h"
 #include "ota.h"
+#include "web_events.h"
+#include "web_assets.h"
+#include "history.h"
 
 //just temporary until we implemented a way to select the chip
 #include "stm32bl.h"
@@ -27,17 +44,69 @@ static const char *TAG = "websrv";
 
 static int url_offset_ts;
 static int url_offset_ota;
+static int url_offset_hist;
 
 extern char device_id[9];
 
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + 128)
-#define SCRATCH_BUFSIZE (10240)
+#define SCRATCH_BUFSIZE (4096)
+#define SCRATCH_TIMEOUT_MS (1000)
+
+/* part of the scratch buffer used for a copy of the latest serial pub message */
+#define METRICS_PUBMSG_SIZE (1024)
+
+// default time range of history queries
+#define HIST_RANGE_DEFAULT_S (60 * 60)
+
+#define TS_WORKER_PRIO (5)
+#define TS_JOBS_MAX (8)
 
 typedef struct web_server_context {
     char base_path[ESP_VFS_PATH_MAX + 1];
-    char scratch[SCRATCH_BUFSIZE];
+    httpd_handle_t server;
+    QueueHandle_t scratch_pool;     // pointers to free I/O buffers of size SCRATCH_BUFSIZE
+    QueueHandle_t ts_jobs;          // ThingSet requests waiting for a worker task
 } web_server_context_t;
 
+/*
+ * ThingSet request processed by a worker task, so that the HTTP server task can handle other
+ * requests (e.g. static files) while waiting for the response from the bus.
+ */
+typedef struct {
+    web_server_context_t *ctx;
+    int fd;                 // socket of the HTTP session
+    volatile bool closed;   // session was closed, socket is shut down and closed with the job
+    bool failed;            // response was not sent completely, session has to be closed
+    int method;
+    char *uri;
+    HttpTrace trace;
+} TSJob;
+
+/*
+ * ThingSet response forwarded to the client while it is received from the device, either via
+ * the request in the handler (req set) or via the socket of a job after the handler returned
+ */
+typedef struct {
+    httpd_req_t *req;
+    TSJob *job;
+    HttpTrace *trace;
+    uint8_t ts_status;
+    bool chunked;           // header was sent, body follows in chunks
+} TSHttpStream;
+
+/* jobs with pending response, only accessed from HTTP server task */
+static TSJob *pending_jobs[TS_JOBS_MAX];
+
+/* statistics of finished requests, recorded by HTTP server and worker tasks */
+static HttpStats http_stats;
+static SemaphoreHandle_t stats_lock;
+
+/* trace of the request currently processed by a handler, only set in the HTTP server task */
+static HttpTrace *current_trace;
+
+/* context of the running server for functions called by other modules */
+static web_server_context_t *running_server;
+
 #define CHECK_FILE_EXTENSION(filename, ext) \
     (strcasecmp(&filename[strlen(filename) - strlen(ext)], ext) == 0)
 
@@ -100,6 +169,21 @@ static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filepa
     return httpd_resp_set_type(req, type);
 }
 
+static char *scratch_acquire(web_server_context_t *ctx)
+{
+    char *buf = NULL;
+    if (xQueueReceive(ctx->scratch_pool, &buf, pdMS_TO_TICKS(SCRATCH_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "No free scratch buffer");
+        return NULL;
+    }
+    return buf;
+}
+
+static void scratch_release(web_server_context_t *ctx, char *buf)
+{
+    xQueueSend(ctx->scratch_pool, &buf, 0);
+}
+
 /* Send HTTP response with the contents of the requested file */
 static esp_err_t common_get_handler(httpd_req_t *req)
 {
@@ -120,6 +204,40 @@ static esp_err_t common_get_handler(httpd_req_t *req)
         strlcat(filepath, ".gz", sizeof(filepath));
     }
 
+    WebAsset *asset = web_assets_find(filepath);
+    if (asset != NULL) {
+        if (asset->content_type != NULL) {
+            httpd_resp_set_type(req, asset->content_type);
+        }
+        httpd_resp_set_hdr(req, "ETag", asset->etag);
+        httpd_resp_set_hdr(req, "Cache-Control", asset->immutable ?
+            "public, max-age=31536000, immutable" : "no-cache");
+
+        // browsers may send several ETags, e.g. of different encodings
+        char if_none_match[128];
+        if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match,
+                sizeof(if_none_match)) == ESP_OK &&
+            web_assets_etag_match(if_none_match, asset->etag))
+        {
+            httpd_resp_set_status(req, "304 Not Modified");
+            httpd_resp_send(req, NULL, 0);
+            return ESP_OK;
+        }
+
+        // served from RAM cache or memory-mapped flash
+        http_trace_source(current_trace, NULL, "memory");
+        http_trace_bus_begin(current_trace, esp_timer_get_time());
+        const char *data = web_assets_acquire(asset);
+        http_trace_bus_end(current_trace, esp_timer_get_time());
+        if (data != NULL) {
+            esp_err_t err = httpd_resp_send(req, data, asset->size);
+            web_assets_release(asset);
+            return err;
+        }
+    }
+
+    http_trace_source(current_trace, NULL, "spiffs");
+    http_trace_bus_begin(current_trace, esp_timer_get_time());
     int fd = open(filepath, O_RDONLY, 0);
     if (fd == -1) {
         ESP_LOGE(TAG, "Failed to open file : %s", filepath);
@@ -128,7 +246,12 @@ static esp_err_t common_get_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
-    char *chunk = server_ctx->scratch;
+    char *chunk = scratch_acquire(server_ctx);
+    if (chunk == NULL) {
+        close(fd);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Server busy.\n");
+        return ESP_FAIL;
+    }
     ssize_t read_bytes;
     do {
         /* Read file in chunks into the scratch buffer */
@@ -140,6 +263,7 @@ static esp_err_t common_get_handler(httpd_req_t *req)
             /* Send the buffer contents as HTTP response chunk */
             if (httpd_resp_send_chunk(req, chunk, read_bytes) != ESP_OK) {
                 close(fd);
+                scratch_release(server_ctx, chunk);
                 ESP_LOGE(TAG, "File sending failed!");
                 /* Abort sending file */
                 httpd_resp_sendstr_chunk(req, NULL);
@@ -151,38 +275,18 @@ static esp_err_t common_get_handler(httpd_req_t *req)
     } while (read_bytes > 0);
     /* Close file after sending complete */
     close(fd);
+    http_trace_bus_end(current_trace, esp_timer_get_time());
+    scratch_release(server_ctx, chunk);
     ESP_LOGI(TAG, "File sending complete");
     /* Respond with an empty chunk to signal HTTP response completion */
     httpd_resp_send_chunk(req, NULL, 0);
     return ESP_OK;
 }
 
-static char *receive_content(httpd_req_t *req)
+/* reads the next part of the request content for ts_execute_stream */
+static int read_request_content(void *ctx, char *buf, size_t len)
 {
-    // +1 for termination
-    char *buf = (char *) malloc(req->content_len+1);
-    if (buf == NULL) {
-        ESP_LOGE(TAG, "Unable to allocate memory for content");
-        return NULL;
-    }
-    int bytes_received = 0;
-    while (req->content_len - bytes_received > 0) {
-        bytes_received += httpd_req_recv(req, buf, req->content_len);
-    }
-    ESP_LOGD(TAG, "received %d bytes: %s", bytes_received, buf);
-    buf[req->content_len] = '\0';
-    return buf;
-}
-
-static esp_err_t get_content(httpd_req_t *req, char **content)
-{
-    if (req->content_len != 0) {
-        *content = receive_content(req);
-    }
-    if (*content == NULL && req->content_len > 0) {
-        return ESP_FAIL;
-    }
-    return ESP_OK;
+    return httpd_req_recv((httpd_req_t *) ctx, buf, len);
 }
 
 static esp_err_t send_response(httpd_req_t *req, TSResponse *res)
@@ -193,17 +297,324 @@ static esp_err_t send_response(httpd_req_t *req, TSResponse *res)
         ESP_LOGD(TAG, "Sending out data: %s", res->data);
         // res->data points to res->block behind the "header" section of ts-response
         httpd_resp_sendstr(req, res->data);
-        heap_caps_free(res->block);
     } else {
         httpd_resp_send(req, NULL, 0);
     }
+    heap_caps_free(res->block);
     heap_caps_free(res);
     return ESP_OK;
 }
 
+/* sends data via the socket of a job from the worker task, returns 0 on success */
+static int job_send(TSJob *job, const char *buf, size_t len, int flags)
+{
+    int ret = -1;
+    int64_t start = esp_timer_get_time();
+    // no lock needed: while the job is pending, close_fn only shuts the socket down (a blocked
+    // send returns with an error) and its number can't be reused by another session
+    if (!job->closed) {
+        ret = send(job->fd, buf, len, flags);
+    }
+    http_trace_sent(&job->trace, buf, ret, esp_timer_get_time() - start);
+    return ret == (int) len ? 0 : -1;
+}
+
+/* sends the response header, content_len < 0 selects chunked transfer encoding */
+static int job_send_header(TSJob *job, const char *status, const char *type, int content_len)
+{
+    char hdr[128];
+    int len;
+    if (content_len < 0) {
+        len = snprintf(hdr, sizeof(hdr),
+            "HTTP/1.1 %s\r\nContent-Type: %s\r\nTransfer-Encoding: chunked\r\n\r\n",
+            status, type);
+    }
+    else {
+        len = snprintf(hdr, sizeof(hdr),
+            "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %d\r\n\r\n",
+            status, type, content_len);
+    }
+    return job_send(job, hdr, len, content_len != 0 ? MSG_MORE : 0);
+}
+
+static int http_stream_start(void *ctx, uint8_t ts_status)
+{
+    ((TSHttpStream *) ctx)->ts_status = ts_status;
+    return 0;
+}
+
+static int http_stream_data(void *ctx, const char *buf, size_t len)
+{
+    TSHttpStream *stream = (TSHttpStream *) ctx;
+    if (len == 0) {
+        return 0;
+    }
+
+    if (stream->req != NULL) {
+        if (!stream->chunked) {
+            httpd_resp_set_status(stream->req, translate_status_code(stream->ts_status));
+            httpd_resp_set_type(stream->req, "application/json");
+            stream->chunked = true;
+        }
+        return httpd_resp_send_chunk(stream->req, buf, len) == ESP_OK ? 0 : -1;
+    }
+
+    if (!stream->chunked) {
+        if (job_send_header(stream->job, translate_status_code(stream->ts_status),
+            "application/json", -1) != 0)
+        {
+            return -1;
+        }
+        stream->chunked = true;
+    }
+    char size[12];
+    int size_len = snprintf(size, sizeof(size), "%x\r\n", (unsigned int) len);
+    if (job_send(stream->job, size, size_len, MSG_MORE) != 0 ||
+        job_send(stream->job, buf, len, MSG_MORE) != 0 ||
+        job_send(stream->job, "\r\n", 2, 0) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* completes the response after the device finished, returns 0 on success */
+static int http_stream_end(TSHttpStream *stream)
+{
+    if (stream->req != NULL) {
+        if (stream->chunked) {
+            return httpd_resp_send_chunk(stream->req, NULL, 0) == ESP_OK ? 0 : -1;
+        }
+        // response without payload, e.g. 204 after a PATCH
+        httpd_resp_set_status(stream->req, translate_status_code(stream->ts_status));
+        httpd_resp_set_type(stream->req, "application/json");
+        return httpd_resp_send(stream->req, NULL, 0) == ESP_OK ? 0 : -1;
+    }
+
+    if (stream->chunked) {
+        return job_send(stream->job, "0\r\n\r\n", 5, 0);
+    }
+    return job_send_header(stream->job, translate_status_code(stream->ts_status),
+        "application/json", 0);
+}
+
+static int http_stream_not_connected(TSHttpStream *stream)
+{
+    const char *body = "Device not connected";
+    if (stream->req != NULL) {
+        httpd_resp_send_err(stream->req, HTTPD_404_NOT_FOUND, body);
+        return 0;
+    }
+    if (job_send_header(stream->job, "404", "text/plain", strlen(body)) != 0 ||
+        job_send(stream->job, body, strlen(body), 0) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Process a ThingSet request without content and forward the response to the client while it
+ * is received from the device
+ *
+ * \returns 0 if the response was sent completely, otherwise the session has to be closed
+ */
+static int ts_stream_request(TSHttpStream *stream, const char *uri, int method)
+{
+    TSResponseStream resp;
+    ts_resp_stream_init(&resp, http_stream_start, http_stream_data, stream);
+
+    http_trace_bus_begin(stream->trace, esp_timer_get_time());
+    int err = ts_execute_resp_stream(uri, method, &resp);
+    http_trace_bus_end(stream->trace, esp_timer_get_time());
+    if (err == 0) {
+        return http_stream_end(stream);
+    }
+    else if (!stream->chunked) {
+        // nothing was sent yet, so the client can still get a proper error
+        return http_stream_not_connected(stream);
+    }
+    ESP_LOGE(TAG, "ThingSet response for %s incomplete", uri);
+    return -1;
+}
+
+static void stats_record(const HttpTrace *trace)
+{
+    xSemaphoreTake(stats_lock, portMAX_DELAY);
+    http_stats_record(&http_stats, trace);
+    http_stats_summarize(&http_stats, &http_summary);
+    xSemaphoreGive(stats_lock);
+}
+
+/* runs in the context of the HTTP server task after the worker finished */
+static void ts_job_done_work(void *arg)
+{
+    TSJob *job = (TSJob *) arg;
+
+    bool fd_in_use = false;
+    for (int i = 0; i < TS_JOBS_MAX; i++) {
+        if (pending_jobs[i] == job) {
+            pending_jobs[i] = NULL;
+        }
+        else if (pending_jobs[i] != NULL && pending_jobs[i]->fd == job->fd) {
+            fd_in_use = true;
+        }
+    }
+
+    if (job->closed) {
+        // session was already closed by the server, see close_fn
+        if (!fd_in_use) {
+            close(job->fd);
+        }
+    }
+    else if (job->failed) {
+        // client would wait forever for the rest of the response
+        httpd_sess_trigger_close(job->ctx->server, job->fd);
+    }
+
+    free(job->uri);
+    free(job);
+}
+
+static void ts_worker_task(void *arg)
+{
+    web_server_context_t *ctx = (web_server_context_t *) arg;
+    TSJob *job;
+
+    while (true) {
+        xQueueReceive(ctx->ts_jobs, &job, portMAX_DELAY);
+
+        // the handler already returned, so the response is written to the socket directly
+        TSHttpStream stream = { .job = job, .trace = &job->trace };
+        job->failed = ts_stream_request(&stream, job->uri, job->method) != 0;
+        job->trace.error = job->failed;
+        stats_record(&job->trace);
+
+        while (httpd_queue_work(ctx->server, ts_job_done_work, job) != ESP_OK) {
+            // control queue of the server is full, try again later
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }
+}
+
+/*
+ * Hand a request without content over to a worker task
+ *
+ * \returns ESP_OK if the request was queued, otherwise it has to be processed synchronously
+ */
+static esp_err_t ts_job_start(httpd_req_t *req)
+{
+    web_server_context_t *ctx = (web_server_context_t *) req->user_ctx;
+    if (ctx->ts_jobs == NULL) {
+        return ESP_FAIL;
+    }
+
+    int slot = 0;
+    while (slot < TS_JOBS_MAX && pending_jobs[slot] != NULL) {
+        slot++;
+    }
+    if (slot == TS_JOBS_MAX) {
+        return ESP_FAIL;
+    }
+
+    TSJob *job = (TSJob *) calloc(1, sizeof(TSJob));
+    char *uri = strdup(req->uri + url_offset_ts);
+    if (job == NULL || uri == NULL) {
+        free(job);
+        free(uri);
+        return ESP_FAIL;
+    }
+    job->ctx = ctx;
+    job->fd = httpd_req_to_sockfd(req);
+    job->method = req->method;
+    job->uri = uri;
+    // the worker continues the trace and records the request when it's finished
+    if (current_trace != NULL) {
+        job->trace = *current_trace;
+    }
+    else {
+        http_trace_init(&job->trace, "ts");
+    }
+
+    pending_jobs[slot] = job;
+    if (xQueueSend(ctx->ts_jobs, &job, 0) != pdTRUE) {
+        pending_jobs[slot] = NULL;
+        free(job->uri);
+        free(job);
+        return ESP_FAIL;
+    }
+    if (current_trace != NULL) {
+        current_trace->detached = true;
+    }
+    return ESP_OK;
+}
+
+/* same as the default send function of the server, but accounts for the current request */
+static int traced_send(httpd_handle_t hd, int sockfd, const char *buf, size_t len, int flags)
+{
+    if (buf == NULL) {
+        return HTTPD_SOCK_ERR_INVALID;
+    }
+    int64_t start = esp_timer_get_time();
+    int ret = send(sockfd, buf, len, flags);
+    http_trace_sent(current_trace, buf, ret, esp_timer_get_time() - start);
+    if (ret < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+    }
+    return ret;
+}
+
+static int traced_recv(httpd_handle_t hd, int sockfd, char *buf, size_t len, int flags)
+{
+    if (buf == NULL) {
+        return HTTPD_SOCK_ERR_INVALID;
+    }
+    int64_t start = esp_timer_get_time();
+    int ret = recv(sockfd, buf, len, flags);
+    // request headers are received before the handler sets the current trace
+    http_trace_add(current_trace, HTTP_PHASE_RECV, esp_timer_get_time() - start);
+    if (ret < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+    }
+    return ret;
+}
+
+/* Open function for all sessions of the HTTP server */
+static esp_err_t open_fn(httpd_handle_t hd, int sockfd)
+{
+    httpd_sess_set_send_override(hd, sockfd, traced_send);
+    httpd_sess_set_recv_override(hd, sockfd, traced_recv);
+    return ESP_OK;
+}
+
+/* Close function for all sessions of the HTTP server */
+static void close_fn(httpd_handle_t hd, int sockfd)
+{
+    web_events_socket_closed(sockfd);
+
+    bool job_pending = false;
+    for (int i = 0; i < TS_JOBS_MAX; i++) {
+        if (pending_jobs[i] != NULL && pending_jobs[i]->fd == sockfd) {
+            pending_jobs[i]->closed = true;
+            job_pending = true;
+        }
+    }
+    if (job_pending) {
+        // The worker may still send to the socket. It is only shut down, so a blocked send
+        // returns, and closed by ts_job_done_work, so the number can't be reused meanwhile.
+        shutdown(sockfd, SHUT_RDWR);
+    }
+    else {
+        close(sockfd);
+    }
+}
+
 static esp_err_t ts_get_devices_handler(httpd_req_t *req)
 {
+    // information of new CAN devices is requested while creating the list
+    http_trace_bus_begin(current_trace, esp_timer_get_time());
     char *names = ts_get_device_list();
+    http_trace_bus_end(current_trace, esp_timer_get_time());
     if (names != NULL) {
         httpd_resp_set_status(req, "200");
         httpd_resp_sendstr(req, names);
@@ -220,28 +631,386 @@ static esp_err_t ts_handler(httpd_req_t *req)
         httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Resource not found");
         return ESP_OK;
     }
-    char *content = NULL;
-    if (get_content(req, &content) != ESP_OK) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Could not receive content");
+    if (req->content_len > CONFIG_WEB_SERVER_TS_MAX_CONTENT) {
+        httpd_resp_set_status(req, "413");
+        httpd_resp_sendstr(req, "Request too large");
+        return ESP_OK;
+    }
+
+    TSDevice *device = ts_get_device_from_uri(req->uri + url_offset_ts);
+    if (device != NULL) {
+        http_trace_source(current_trace, device->ts_device_id, ts_device_transport(device));
+    }
+
+    if (req->content_len > 0) {
+        // content is forwarded to the device while it is received, so the request can't be
+        // handed over to a worker task
+        TSContentReader content = {
+            .read = read_request_content,
+            .ctx = req,
+            .len = req->content_len,
+        };
+        http_trace_bus_begin(current_trace, esp_timer_get_time());
+        TSResponse *res = ts_execute_stream(req->uri + url_offset_ts, &content, req->method);
+        http_trace_bus_end(current_trace, esp_timer_get_time());
+        if (res == NULL) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Device not connected");
+            return ESP_OK;
+        }
+        return send_response(req, res);
+    }
+    else if (ts_job_start(req) == ESP_OK) {
+        // response is sent by the worker task as soon as it is received from the device
+        return ESP_OK;
+    }
+
+    TSHttpStream stream = { .req = req, .trace = current_trace };
+    return ts_stream_request(&stream, req->uri + url_offset_ts, req->method) == 0 ?
+        ESP_OK : ESP_FAIL;
+}
+
+static int send_metrics_chunk(void *ctx, const char *buf, size_t len)
+{
+    return httpd_resp_send_chunk((httpd_req_t *) ctx, buf, len) == ESP_OK ? 0 : -1;
+}
+
+static void write_gateway_metrics(MetricsWriter *w, web_server_context_t *ctx)
+{
+    metrics_value(w, "gateway_uptime_seconds", "gauge", "Time since boot",
+        esp_timer_get_time() / 1e6);
+    metrics_value(w, "gateway_heap_free_bytes", "gauge", "Free heap memory",
+        esp_get_free_heap_size());
+    metrics_value(w, "gateway_heap_min_free_bytes", "gauge", "Minimum free heap memory since boot",
+        esp_get_minimum_free_heap_size());
+    metrics_value(w, "gateway_heap_largest_free_block_bytes", "gauge",
+        "Largest block of heap memory that can be allocated",
+        heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    metrics_value(w, "gateway_tasks", "gauge", "Number of FreeRTOS tasks",
+        uxTaskGetNumberOfTasks());
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    UBaseType_t num_tasks = uxTaskGetNumberOfTasks();
+    TaskStatus_t *tasks = (TaskStatus_t *) malloc(num_tasks * sizeof(TaskStatus_t));
+    if (tasks != NULL) {
+        num_tasks = uxTaskGetSystemState(tasks, num_tasks, NULL);
+        metrics_family(w, "gateway_task_stack_free_bytes", "gauge",
+            "Minimum free stack space of task since start");
+        for (int i = 0; i < num_tasks; i++) {
+            metrics_sample(w, "gateway_task_stack_free_bytes", "task", tasks[i].pcTaskName,
+                NULL, NULL, tasks[i].usStackHighWaterMark);
+        }
+        free(tasks);
+    }
+#endif
+
+    CanStats can;
+    can_get_stats(&can);
+    metrics_family(w, "gateway_queue_messages", "gauge", "Number of messages waiting in queue");
+    metrics_sample(w, "gateway_queue_messages", "queue", "ts_jobs", NULL, NULL,
+        ctx->ts_jobs != NULL ? uxQueueMessagesWaiting(ctx->ts_jobs) : 0);
+    metrics_sample(w, "gateway_queue_messages", "queue", "can_rx", NULL, NULL,
+        can.rx_queue_waiting);
+    metrics_value(w, "gateway_io_buffers_free", "gauge", "Number of unused I/O buffers",
+        uxQueueMessagesWaiting(ctx->scratch_pool));
+    metrics_value(w, "gateway_event_clients", "gauge", "Number of event stream clients",
+        web_events_num_clients());
+
+    metrics_value(w, "gateway_can_frames_received_total", "counter",
+        "Frames received on the CAN bus", can.rx_frames);
+    metrics_value(w, "gateway_can_frames_missed_total", "counter",
+        "Frames lost because of full driver queue", can.rx_missed);
+    metrics_value(w, "gateway_can_bus_errors_total", "counter", "CAN bus errors",
+        can.bus_errors);
+    metrics_family(w, "gateway_can_error_counter", "gauge", "CAN controller error counter");
+    metrics_sample(w, "gateway_can_error_counter", "direction", "tx", NULL, NULL,
+        can.tx_error_counter);
+    metrics_sample(w, "gateway_can_error_counter", "direction", "rx", NULL, NULL,
+        can.rx_error_counter);
+    metrics_value(w, "gateway_can_requests_total", "counter", "ISO-TP requests sent",
+        can.isotp_requests);
+    metrics_value(w, "gateway_can_timeouts_total", "counter", "ISO-TP requests without response",
+        can.isotp_timeouts);
+
+    TSSerialStats serial;
+    ts_serial_get_stats(&serial);
+    metrics_value(w, "gateway_serial_pubmsgs_received_total", "counter",
+        "Publication messages received via serial interface", serial.pubmsgs);
+    metrics_value(w, "gateway_serial_requests_total", "counter",
+        "Requests sent via serial interface", serial.requests);
+    metrics_value(w, "gateway_serial_timeouts_total", "counter",
+        "Serial requests without response", serial.timeouts);
+}
+
+/* only cached values are used, the request never causes any traffic on the buses */
+static void write_device_metrics(MetricsWriter *w, char *pubmsg_buf, size_t pubmsg_size)
+{
+    metrics_family(w, "thingset_value", "gauge", "Latest value published by a ThingSet device");
+
+    if (ts_serial_pubmsg_last(pubmsg_buf, pubmsg_size) > 0) {
+        // serial device is registered with CAN address UINT8_MAX
+        TSDevice *device = ts_get_can_device(UINT8_MAX);
+        metrics_pubmsg(w, "thingset_value", device != NULL ? device->ts_device_id : "serial",
+            pubmsg_buf);
+    }
+
+    for (int addr = 0; addr < UINT8_MAX; addr++) {
+        size_t num_objs;
+        DataObject *objs = can_get_data_objects(addr, &num_objs);
+        if (objs == NULL) {
+            continue;
+        }
+        // address 0 is also used for the gateway itself, so only look up other devices
+        TSDevice *device = addr > 0 ? ts_get_can_device(addr) : NULL;
+        char label[10];
+        if (device == NULL || device->ts_device_id == NULL) {
+            snprintf(label, sizeof(label), "can:%d", addr);
+        }
+        for (int i = 0; i < num_objs; i++) {
+            double value;
+            if (can_data_object_value(&objs[i], &value)) {
+                metrics_sample(w, "thingset_value", "device",
+                    device != NULL && device->ts_device_id != NULL ? device->ts_device_id : label,
+                    "name", objs[i].name, value);
+            }
+        }
+    }
+}
+
+/* Prometheus text exposition format, sent in chunks without storing the entire document */
+static esp_err_t metrics_handler(httpd_req_t *req)
+{
+    web_server_context_t *ctx = (web_server_context_t *) req->user_ctx;
+    char *buf = scratch_acquire(ctx);
+    if (buf == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Server busy.\n");
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "text/plain; version=0.0.4; charset=utf-8");
+
+    MetricsWriter w;
+    metrics_init(&w, buf + METRICS_PUBMSG_SIZE, SCRATCH_BUFSIZE - METRICS_PUBMSG_SIZE,
+        send_metrics_chunk, req);
+    write_gateway_metrics(&w, ctx);
+    write_device_metrics(&w, buf, METRICS_PUBMSG_SIZE);
+    int err = metrics_finish(&w);
+
+    scratch_release(ctx, buf);
+    if (err != 0) {
+        ESP_LOGE(TAG, "Sending metrics failed");
         return ESP_FAIL;
     }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
 
-    TSResponse *res = ts_execute(req->uri + url_offset_ts, content, req->method);
-    if (content != NULL) {
-        heap_caps_free(content);
+/* request statistics as JSON, sent in chunks of one entry each */
+static esp_err_t stats_handler(httpd_req_t *req)
+{
+    char buf[768];
+    int len = snprintf(buf, sizeof(buf), "{\"bucket_ms\":[");
+    for (int i = 0; i < HTTP_STATS_BUCKETS - 1; i++) {
+        len += snprintf(buf + len, sizeof(buf) - len, "%s%u", i > 0 ? "," : "",
+            (unsigned int) http_stats_bounds_ms[i]);
     }
+    len += snprintf(buf + len, sizeof(buf) - len, "],\"entries\":[");
 
-    if (res == NULL) {
-        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Device not connected");
+    httpd_resp_set_type(req, "application/json");
+    if (httpd_resp_send_chunk(req, buf, len) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    uint32_t dropped = 0;
+    for (int i = 0; ; i++) {
+        // entry is copied, so the lock is not held while sending
+        HttpStatsEntry entry;
+        xSemaphoreTake(stats_lock, portMAX_DELAY);
+        bool valid = i < http_stats.num_entries;
+        if (valid) {
+            entry = http_stats.entries[i];
+        }
+        dropped = http_stats.dropped;
+        xSemaphoreGive(stats_lock);
+        if (!valid) {
+            break;
+        }
+
+        buf[0] = ',';
+        len = http_stats_entry_json(&entry, buf + 1, sizeof(buf) - 1);
+        if (len > 0 && httpd_resp_send_chunk(req, i > 0 ? buf : buf + 1,
+            i > 0 ? len + 1 : len) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+    }
+
+    len = snprintf(buf, sizeof(buf), "],\"dropped\":%u}", (unsigned int) dropped);
+    if (httpd_resp_send_chunk(req, buf, len) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/*
+ * JSON array of [time,value] points, sent in chunks
+ *
+ * Points of averaged intervals are sent as [time,avg,min,max]. The history is locked during
+ * a query, so points are only copied into the buffer. If it is full, the query is aborted,
+ * and continued at the time of the first missing point after the buffer was sent.
+ */
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t pos;
+    int num;
+    bool stats;
+    bool full;
+    uint32_t resume_time;
+} HistResponse;
+
+static int send_hist_point(void *ctx, const HistPoint *point)
+{
+    HistResponse *resp = (HistResponse *) ctx;
+    char item[64];
+    const char *sep = resp->num > 0 ? "," : "";
+    int len = resp->stats ?
+        snprintf(item, sizeof(item), "%s[%u,%.7g,%.7g,%.7g]", sep, (unsigned int) point->time,
+            point->avg, point->min, point->max) :
+        snprintf(item, sizeof(item), "%s[%u,%.7g]", sep, (unsigned int) point->time,
+            point->avg);
+    if (len >= sizeof(item)) {
+        return -1;
+    }
+    // keep room for the closing brackets
+    if (len + sizeof("]}") > resp->size - resp->pos) {
+        resp->full = true;
+        resp->resume_time = point->time;
+        return -1;
+    }
+    memcpy(resp->buf + resp->pos, item, len);
+    resp->pos += len;
+    resp->num++;
+    return 0;
+}
+
+static uint32_t query_param(const char *query, const char *key, uint32_t default_value)
+{
+    char value[16];
+    if (httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK) {
+        return default_value;
+    }
+    return strtoul(value, NULL, 10);
+}
+
+/*
+ * Recorded values of a device, e.g. /hist/<device>/<name>?from=<time>&to=<time>&step=<s>
+ *
+ * Times are UNIX timestamps, the default range is the last hour with raw samples (step 0).
+ * Long ranges should be queried with a step of at least 1 hour, which is served from rollups.
+ */
+static esp_err_t hist_handler(httpd_req_t *req)
+{
+    web_server_context_t *ctx = (web_server_context_t *) req->user_ctx;
+    char device[32];
+    char name[64];
+    const char *path = req->uri + url_offset_hist;
+    const char *sep = strchr(path, '/');
+    size_t name_len = strcspn(sep != NULL ? sep + 1 : "", "?");
+    if (sep == NULL || sep - path >= sizeof(device) || name_len == 0 || name_len >= sizeof(name)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Use /hist/<device>/<name>\n");
+        return ESP_FAIL;
+    }
+    strlcpy(device, path, sep - path + 1);
+    strlcpy(name, sep + 1, name_len + 1);
+
+    char query[64] = "";
+    httpd_req_get_url_query_str(req, query, sizeof(query));
+    uint32_t to = query_param(query, "to", time(NULL));
+    uint32_t from = query_param(query, "from", to > HIST_RANGE_DEFAULT_S ?
+        to - HIST_RANGE_DEFAULT_S : 0);
+    uint32_t step = query_param(query, "step", 0);
+    if (from > to) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid time range\n");
+        return ESP_FAIL;
+    }
+
+    char *buf = scratch_acquire(ctx);
+    if (buf == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Server busy.\n");
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/json");
+
+    // beginning of the buffer is used to read stored blocks
+    HistResponse resp = {
+        .buf = buf + HIST_BLOCK_SIZE,
+        .size = SCRATCH_BUFSIZE - HIST_BLOCK_SIZE,
+        .stats = step > 0,
+    };
+    resp.pos = snprintf(resp.buf, resp.size, "{\"from\":%u,\"to\":%u,\"step\":%u,\"data\":[",
+        (unsigned int) from, (unsigned int) to, (unsigned int) step);
+    bool sent = false;
+    int ret;
+    while (true) {
+        resp.full = false;
+        ret = history_query(device, name, from, to, step, send_hist_point, &resp, buf);
+        if (!resp.full) {
+            break;
+        }
+        // sent without holding the history lock, so a slow client doesn't delay recording
+        sent = true;
+        if (httpd_resp_send_chunk(req, resp.buf, resp.pos) != ESP_OK) {
+            break;
+        }
+        resp.pos = 0;
+        // with step > 0, the resume time is the start of an interval, so the intervals of the
+        // continued query stay the same
+        from = resp.resume_time;
+    }
+    if (ret >= 0) {
+        resp.pos += snprintf(resp.buf + resp.pos, resp.size - resp.pos, "]}");
+        sent = true;
+        if (httpd_resp_send_chunk(req, resp.buf, resp.pos) != ESP_OK) {
+            ret = -1;
+        }
+    }
+
+    scratch_release(ctx, buf);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Sending history of %s/%s failed", device, name);
+        if (!sent) {
+            // the client gets a proper error instead of an empty reply
+            if (ret == HISTORY_NOT_RUNNING) {
+                httpd_resp_set_status(req, "503 Service Unavailable");
+                httpd_resp_set_type(req, "text/plain");
+                httpd_resp_sendstr(req, "History not available\n");
+            }
+            else {
+                httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                    "Reading history failed\n");
+            }
+        }
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t events_handler(httpd_req_t *req)
+{
+    esp_err_t err = web_events_add_client(req);
+    if (err == ESP_ERR_NO_MEM) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_sendstr(req, "Too many event stream clients");
         return ESP_OK;
     }
-    return send_response(req, res);
+    return err;
 }
 
 esp_err_t esp_ota_start_handler(httpd_req_t *req)
 {
     cJSON *res = cJSON_CreateObject();
+    http_trace_source(current_trace, device_id, "flash");
+    http_trace_bus_begin(current_trace, esp_timer_get_time());
     esp_err_t err = esp_ota_handler(req, res);
+    http_trace_bus_end(current_trace, esp_timer_get_time());
     char *res_string = cJSON_Print(res);
     cJSON_Delete(res);
 
@@ -268,6 +1037,11 @@ static esp_err_t stm_ota_start_handler(httpd_req_t *req)
     strcpy(uri + id_len, "/dfu");
     ESP_LOGI(TAG, "URL: %s", uri);
 
+    TSDevice *device = ts_get_device_from_uri(uri);
+    if (device != NULL) {
+        http_trace_source(current_trace, device->ts_device_id, ts_device_transport(device));
+    }
+    http_trace_bus_begin(current_trace, esp_timer_get_time());
     TSResponse *res = ts_execute(uri, NULL, HTTP_GET);
     free(uri);
     if (res == NULL) {
@@ -289,6 +1063,7 @@ static esp_err_t stm_ota_start_handler(httpd_req_t *req)
     httpd_resp_set_type(req, "text/plain");
 
     int ret = ts_serial_ota(flash_size->valueint, page_size->valueint);
+    http_trace_bus_end(current_trace, esp_timer_get_time());
     /* Give it time to reboot, otherwise subsequent request could fail */
     vTaskDelay(pdMS_TO_TICKS(1000));
 
@@ -319,32 +1094,84 @@ esp_err_t ota_upload_handler(httpd_req_t *req)
     unsigned int bytes_written = 0;
     int buffer_size = 8 * 1024;
     char * buf = (char *) malloc(buffer_size);
+    if (buf == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_OK;
+    }
+
+    // failed uploads are recorded with the time until the error as well
+    const char *error = NULL;
+    http_trace_source(current_trace, NULL, "spiffs");
+    http_trace_bus_begin(current_trace, esp_timer_get_time());
     FILE *fd = fopen("/stm_ota/firmware.bin", "w");
     if (fd == NULL) {
         ESP_LOGE(TAG, "Failed to create file for image");
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Unable to create file");
-        goto out;
+        error = "Unable to create file";
     }
-    while (req->content_len - bytes_received > 0) {
+    while (error == NULL && req->content_len - bytes_received > 0) {
         int chunk_size = httpd_req_recv(req, buf, buffer_size);
+        if (chunk_size == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        else if (chunk_size <= 0) {
+            error = "Receiving file failed";
+            break;
+        }
         bytes_received += chunk_size;
         ESP_LOGD(TAG, "Got chunk of %d bytes", chunk_size);
         bytes_written = fwrite(buf, 1, chunk_size, fd);
         ESP_LOGD(TAG, "Wrote chunk of %d bytes", bytes_written);
         if (ferror(fd)) {
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Unable to write file");
-            goto out;
+            error = "Unable to write file";
         }
     }
+    if (fd != NULL) {
+        fclose(fd);
+    }
+    http_trace_bus_end(current_trace, esp_timer_get_time());
+    free(buf);
+
+    if (error != NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, error);
+        return ESP_OK;
+    }
     ESP_LOGD(TAG, "Wrote %d to flash", bytes_received);
     httpd_resp_set_status(req, "200");
     httpd_resp_send(req, NULL, 0);
-out:
-    free(buf);
-    fclose(fd);
     return ESP_OK;
 }
 
+/* runs the handler with a trace of the request and records it afterwards */
+static esp_err_t traced(httpd_req_t *req, const char *endpoint,
+    esp_err_t (*handler)(httpd_req_t *req))
+{
+    HttpTrace trace;
+    http_trace_init(&trace, endpoint);
+    current_trace = &trace;
+    esp_err_t err = handler(req);
+    current_trace = NULL;
+    if (!trace.detached) {
+        trace.error = trace.error || err != ESP_OK;
+        stats_record(&trace);
+    }
+    return err;
+}
+
+#define TRACED_HANDLER(handler, endpoint) \
+    static esp_err_t handler##_traced(httpd_req_t *req) \
+    { \
+        return traced(req, endpoint, handler); \
+    }
+
+TRACED_HANDLER(common_get_handler, "files")
+TRACED_HANDLER(ts_get_devices_handler, "devices")
+TRACED_HANDLER(ts_handler, "ts")
+TRACED_HANDLER(stm_ota_start_handler, "ota")
+TRACED_HANDLER(ota_upload_handler, "ota")
+TRACED_HANDLER(hist_handler, "hist")
+TRACED_HANDLER(metrics_handler, "metrics")
+TRACED_HANDLER(stats_handler, "stats")
+
 esp_err_t start_web_server(const char *base_path)
 {
     if (base_path == NULL) {
@@ -359,6 +1186,22 @@ esp_err_t start_web_server(const char *base_path)
     }
     strlcpy(server_ctx->base_path, base_path, sizeof(server_ctx->base_path));
 
+    web_assets_init(base_path);
+
+    server_ctx->scratch_pool = xQueueCreate(CONFIG_WEB_SERVER_SCRATCH_BUFFERS, sizeof(char *));
+    stats_lock = xSemaphoreCreateMutex();
+    if (server_ctx->scratch_pool == NULL || stats_lock == NULL) {
+        ESP_LOGE(TAG, "No memory for web server");
+        free(server_ctx);
+        return ESP_FAIL;
+    }
+    for (int i = 0; i < CONFIG_WEB_SERVER_SCRATCH_BUFFERS; i++) {
+        char *buf = (char *) malloc(SCRATCH_BUFSIZE);
+        if (buf != NULL) {
+            xQueueSend(server_ctx->scratch_pool, &buf, 0);
+        }
+    }
+
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.uri_match_fn = httpd_uri_match_wildcard;
@@ -367,22 +1210,34 @@ esp_err_t start_web_server(const char *base_path)
     config.stack_size = 8*1024;
     config.lru_purge_enable = true;
     config.recv_wait_timeout = 20;
+    config.open_fn = open_fn;
+    config.close_fn = close_fn;
 
     ESP_LOGI(TAG, "Starting HTTP Server");
     url_offset_ts = strlen("/ts/");
     url_offset_ota = strlen("/ota/");
+    url_offset_hist = strlen("/hist/");
 
     if (httpd_start(&server, &config) != ESP_OK) {
         ESP_LOGE(TAG, "Start server failed");
         free(server_ctx);
         return ESP_FAIL;
     }
+    server_ctx->server = server;
+
+#if CONFIG_WEB_SERVER_TS_WORKERS > 0
+    server_ctx->ts_jobs = xQueueCreate(TS_JOBS_MAX, sizeof(TSJob *));
+    for (int i = 0; i < CONFIG_WEB_SERVER_TS_WORKERS && server_ctx->ts_jobs != NULL; i++) {
+        xTaskCreate(ts_worker_task, "ts_worker", 4096, server_ctx, TS_WORKER_PRIO, NULL);
+    }
+#endif
+    running_server = server_ctx;
 
     /* URI handler to get connected device list */
     httpd_uri_t ts_get_devices_uri = {
         .uri = "/ts/",
         .method = HTTP_GET,
-        .handler = ts_get_devices_handler,
+        .handler = ts_get_devices_handler_traced,
         .user_ctx = server_ctx
     };
     httpd_register_uri_handler(server, &ts_get_devices_uri);
@@ -391,7 +1246,7 @@ esp_err_t start_web_server(const char *base_path)
     httpd_uri_t ts_get_uri = {
         .uri = "/ts/*",
         .method = HTTP_GET,
-        .handler = ts_handler,
+        .handler = ts_handler_traced,
         .user_ctx = server_ctx
     };
     httpd_register_uri_handler(server, &ts_get_uri);
@@ -399,7 +1254,7 @@ esp_err_t start_web_server(const char *base_path)
     httpd_uri_t ts_patch_uri = {
         .uri = "/ts/*",
         .method = HTTP_PATCH,
-        .handler = ts_handler,
+        .handler = ts_handler_traced,
         .user_ctx = server_ctx
     };
     httpd_register_uri_handler(server, &ts_patch_uri);
@@ -407,7 +1262,7 @@ esp_err_t start_web_server(const char *base_path)
     httpd_uri_t ts_post_uri = {
         .uri = "/ts/*",
         .method = HTTP_POST,
-        .handler = ts_handler,
+        .handler = ts_handler_traced,
         .user_ctx = server_ctx
     };
     httpd_register_uri_handler(server, &ts_post_uri);
@@ -415,7 +1270,7 @@ esp_err_t start_web_server(const char *base_path)
     httpd_uri_t ts_delete_uri = {
         .uri = "/ts/*",
         .method = HTTP_DELETE,
-        .handler = ts_handler,
+        .handler = ts_handler_traced,
         .user_ctx = server_ctx
     };
     httpd_register_uri_handler(server, &ts_delete_uri);
@@ -423,7 +1278,7 @@ esp_err_t start_web_server(const char *base_path)
     httpd_uri_t stm_ota_start_uri = {
         .uri = "/ota/*",
         .method = HTTP_GET,
-        .handler = stm_ota_start_handler,
+        .handler = stm_ota_start_handler_traced,
         .user_ctx = server_ctx
     };
     httpd_register_uri_handler(server, &stm_ota_start_uri);
@@ -431,16 +1286,53 @@ esp_err_t start_web_server(const char *base_path)
     httpd_uri_t ota_upload_uri = {
         .uri = "/ota/*",
         .method = HTTP_POST,
-        .handler = ota_upload_handler,
+        .handler = ota_upload_handler_traced,
         .user_ctx = server_ctx
     };
     httpd_register_uri_handler(server, &ota_upload_uri);
 
+    /* URI handler for live stream of publication messages (Server-Sent Events) */
+    web_events_init(server);
+    httpd_uri_t events_uri = {
+        .uri = "/events",
+        .method = HTTP_GET,
+        .handler = events_handler,
+        .user_ctx = server_ctx
+    };
+    httpd_register_uri_handler(server, &events_uri);
+
+    /* URI handler for metrics in Prometheus format */
+    httpd_uri_t metrics_uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_handler_traced,
+        .user_ctx = server_ctx
+    };
+    httpd_register_uri_handler(server, &metrics_uri);
+
+    /* URI handler for request statistics */
+    httpd_uri_t stats_uri = {
+        .uri = "/stats",
+        .method = HTTP_GET,
+        .handler = stats_handler_traced,
+        .user_ctx = server_ctx
+    };
+    httpd_register_uri_handler(server, &stats_uri);
+
+    /* URI handler for recorded values of devices */
+    httpd_uri_t hist_uri = {
+        .uri = "/hist/*",
+        .method = HTTP_GET,
+        .handler = hist_handler_traced,
+        .user_ctx = server_ctx
+    };
+    httpd_register_uri_handler(server, &hist_uri);
+
     /* URI handler for getting web server files */
     httpd_uri_t common_get_uri = {
         .uri = "/*",
         .method = HTTP_GET,
-        .handler = common_get_handler,
+        .handler = common_get_handler_traced,
         .user_ctx = server_ctx
     };
     httpd_register_uri_handler(server, &common_get_uri);
@@ -448,4 +1340,10 @@ esp_err_t start_web_server(const char *base_path)
     return ESP_OK;
 }
 
+uint32_t web_server_ts_jobs_waiting()
+{
+    web_server_context_t *ctx = running_server;
+    return ctx != NULL && ctx->ts_jobs != NULL ? uxQueueMessagesWaiting(ctx->ts_jobs) : 0;
+}
+
 #endif // UNIT_TEST
\ No newline at end of file
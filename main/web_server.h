@@ -4,6 +4,12 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <stdint.h>
 #include "esp_err.h"
 
 esp_err_t start_web_server(const char *base_path);
+
+/**
+ * Number of ThingSet requests waiting for a worker task
+ */
+uint32_t web_server_ts_jobs_waiting();
@@ -4,5 +4,7 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+typedef int esp_err_t;
+
 #define ESP_LOGE(fmt, ...)  {};
 #define ESP_LOGD(fmt, ...)  {};
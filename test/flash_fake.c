@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "flash_fake.h"
+#include <string.h>
+
+static int fake_read(void *ctx, uint32_t addr, void *buf, size_t len)
+{
+    FlashFake *fake = (FlashFake *) ctx;
+    memcpy(buf, fake->mem + addr, len);
+    return 0;
+}
+
+static int fake_write(void *ctx, uint32_t addr, const void *buf, size_t len)
+{
+    FlashFake *fake = (FlashFake *) ctx;
+    // like NOR flash, bits can only be cleared
+    for (size_t i = 0; i < len; i++) {
+        if (fake->write_budget == 0) {
+            return -1;
+        }
+        else if (fake->write_budget > 0) {
+            fake->write_budget--;
+        }
+        fake->mem[addr + i] &= ((const uint8_t *) buf)[i];
+    }
+    return 0;
+}
+
+static int fake_erase(void *ctx, uint32_t addr)
+{
+    FlashFake *fake = (FlashFake *) ctx;
+    memset(fake->mem + addr, 0xFF, FLASH_LOG_SECTOR_SIZE);
+    fake->erase_counts[addr / FLASH_LOG_SECTOR_SIZE]++;
+    return 0;
+}
+
+void flash_fake_init(FlashFake *fake, uint8_t *mem, size_t size)
+{
+    memset(fake, 0, sizeof(*fake));
+    memset(mem, 0xFF, size);
+    fake->mem = mem;
+    fake->write_budget = -1;
+    fake->io.read = fake_read;
+    fake->io.write = fake_write;
+    fake->io.erase = fake_erase;
+    fake->io.ctx = fake;
+    fake->io.size = size;
+}
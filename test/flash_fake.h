@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FLASH_FAKE_H_
+#define FLASH_FAKE_H_
+
+#include <flash_log.h>
+#include <stdint.h>
+
+#define FLASH_FAKE_SECTORS_MAX 8
+
+/**
+ * NOR flash simulated in RAM, used as the storage of a FlashLog in tests
+ */
+typedef struct {
+    FlashLogIO io;                  // to be passed to flash_log_mount
+    uint8_t *mem;
+    int write_budget;               // bytes written before simulated power loss, -1 for no limit
+    uint32_t erase_counts[FLASH_FAKE_SECTORS_MAX];
+} FlashFake;
+
+/**
+ * Set up the fake with the given memory and erase it
+ *
+ * The size must be a multiple of FLASH_LOG_SECTOR_SIZE with at most FLASH_FAKE_SECTORS_MAX
+ * sectors. The memory can be accessed directly by the tests, e.g. to corrupt data.
+ */
+void flash_fake_init(FlashFake *fake, uint8_t *mem, size_t size);
+
+#endif /* FLASH_FAKE_H_ */
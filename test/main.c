@@ -20,6 +20,19 @@ void tearDown (void) {}
 int main()
 {
     ts_client_tests();
+    web_pack_tests();
+    web_assets_tests();
+    metrics_tests();
+    http_stats_tests();
+    pub_filter_tests();
+    flash_log_tests();
+    pub_batch_tests();
+    http_client_tests();
+    emon_bulk_tests();
+    history_tests();
+    hist_codec_tests();
+    config_store_tests();
+    sys_stats_tests();
 
 #ifdef CUSTOM_TESTS
     custom_tests();
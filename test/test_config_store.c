@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tests.h"
+#include <config_store.h>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#define DELAY_MS 2000
+
+static const char *const keys[] = { "general", "emoncms", "mqtt" };
+
+/* configuration data in RAM and in the simulated storage */
+static char current[3][64];
+static char stored[3][64];
+static bool is_stored[3];
+static int writes[3];
+static bool fail_writes;
+
+static ConfigStore store;
+static char buf[128];
+
+static int key_index(const char *key)
+{
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(keys[i], key) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int ram_render(void *ctx, const char *key, char *data, size_t size)
+{
+    int i = key_index(key);
+    size_t len = strlen(current[i]);
+    if (len > size) {
+        return -1;
+    }
+    memcpy(data, current[i], len);
+    return len;
+}
+
+static int ram_read(void *ctx, const char *key, char *data, size_t size)
+{
+    int i = key_index(key);
+    size_t len = strlen(stored[i]);
+    if (!is_stored[i] || len > size) {
+        return -1;
+    }
+    memcpy(data, stored[i], len);
+    return len;
+}
+
+static int ram_write(void *ctx, const char *key, const char *data, size_t len)
+{
+    int i = key_index(key);
+    if (fail_writes) {
+        return -1;
+    }
+    memcpy(stored[i], data, len);
+    stored[i][len] = '\0';
+    is_stored[i] = true;
+    writes[i]++;
+    return len;
+}
+
+static const ConfigStoreIO ram_io = {
+    .render = ram_render,
+    .read = ram_read,
+    .write = ram_write,
+};
+
+static void init_store(void)
+{
+    memset(stored, 0, sizeof(stored));
+    memset(is_stored, 0, sizeof(is_stored));
+    memset(writes, 0, sizeof(writes));
+    fail_writes = false;
+    strcpy(current[0], "{\"WifiSSID\":\"home\",\"TsUseCan\":true}");
+    strcpy(current[1], "{\"Activate\":false}");
+    strcpy(current[2], "{\"Activate\":true,\"QoS\":1}");
+    config_store_init(&store, &ram_io, keys, 3, DELAY_MS, buf, sizeof(buf));
+}
+
+void config_store_first_save(void)
+{
+    init_store();
+    TEST_ASSERT_EQUAL(-1, config_store_due(&store, 0));
+
+    // nothing stored yet, e.g. after erasing the flash
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(0, config_store_request(&store, keys[i], 0));
+    }
+    TEST_ASSERT_EQUAL(-1, config_store_request(&store, "unknown", 0));
+
+    TEST_ASSERT_EQUAL(3, config_store_flush(&store, 0, true));
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(1, writes[i]);
+        TEST_ASSERT_EQUAL_STRING(current[i], stored[i]);
+    }
+    TEST_ASSERT_EQUAL(3, store.stats.requests);
+    TEST_ASSERT_EQUAL(3, store.stats.writes);
+    TEST_ASSERT_EQUAL(-1, config_store_due(&store, 0));
+}
+
+void config_store_debounce(void)
+{
+    init_store();
+    config_store_request(&store, "general", 0);
+    config_store_flush(&store, 0, true);
+
+    // several changes of the same node within the delay, e.g. repeated saves in the UI
+    strcpy(current[0], "{\"WifiSSID\":\"home\",\"TsUseCan\":false}");
+    config_store_request(&store, "general", 1000);
+    TEST_ASSERT_EQUAL(DELAY_MS, config_store_due(&store, 1000));
+    strcpy(current[0], "{\"WifiSSID\":\"work\",\"TsUseCan\":false}");
+    config_store_request(&store, "general", 2500);
+    config_store_request(&store, "mqtt", 2900);
+
+    // the window is not extended by further requests
+    TEST_ASSERT_EQUAL(100, config_store_due(&store, 2900));
+    TEST_ASSERT_EQUAL(0, config_store_flush(&store, 2900, false));
+    TEST_ASSERT_EQUAL(1, writes[0]);
+
+    TEST_ASSERT_EQUAL(0, config_store_due(&store, 3000));
+    TEST_ASSERT_EQUAL(2, config_store_flush(&store, 3000, false));
+    TEST_ASSERT_EQUAL(2, writes[0]);
+    TEST_ASSERT_EQUAL(1, writes[2]);
+    TEST_ASSERT_EQUAL_STRING(current[0], stored[0]);
+    TEST_ASSERT_EQUAL(-1, config_store_due(&store, 3000));
+}
+
+void config_store_unchanged_not_written(void)
+{
+    init_store();
+    for (int i = 0; i < 3; i++) {
+        config_store_request(&store, keys[i], 0);
+    }
+    config_store_flush(&store, 0, true);
+
+    // same values saved again, e.g. by loading the configuration during boot
+    for (int i = 0; i < 3; i++) {
+        config_store_request(&store, keys[i], 100);
+    }
+    TEST_ASSERT_EQUAL(0, config_store_flush(&store, 100 + DELAY_MS, false));
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(1, writes[i]);
+    }
+    TEST_ASSERT_EQUAL(3, store.stats.writes);
+    TEST_ASSERT_EQUAL(3, store.stats.unchanged);
+    TEST_ASSERT_EQUAL(6, store.stats.requests);
+
+    // value changed and changed back before the write is due
+    strcpy(current[1], "{\"Activate\":true}");
+    config_store_request(&store, "emoncms", 5000);
+    strcpy(current[1], "{\"Activate\":false}");
+    config_store_request(&store, "emoncms", 6000);
+    TEST_ASSERT_EQUAL(0, config_store_flush(&store, 5000 + DELAY_MS, false));
+    TEST_ASSERT_EQUAL(1, writes[1]);
+
+    // shorter data with identical prefix is a change
+    strcpy(current[2], "{\"Activate\":true");
+    config_store_request(&store, "mqtt", 8000);
+    TEST_ASSERT_EQUAL(1, config_store_flush(&store, 8000, true));
+    TEST_ASSERT_EQUAL_STRING(current[2], stored[2]);
+}
+
+void config_store_write_error_retried(void)
+{
+    init_store();
+    config_store_request(&store, "general", 0);
+    config_store_request(&store, "mqtt", 0);
+
+    fail_writes = true;
+    TEST_ASSERT_EQUAL(-1, config_store_flush(&store, DELAY_MS, false));
+    TEST_ASSERT_EQUAL(2, store.stats.errors);
+    TEST_ASSERT_EQUAL(DELAY_MS, config_store_due(&store, DELAY_MS));
+
+    fail_writes = false;
+    TEST_ASSERT_EQUAL(0, config_store_flush(&store, DELAY_MS + 1000, false));
+    TEST_ASSERT_EQUAL(2, config_store_flush(&store, 2 * DELAY_MS, false));
+    TEST_ASSERT_EQUAL(1, writes[0]);
+    TEST_ASSERT_EQUAL(1, writes[2]);
+    TEST_ASSERT_EQUAL(-1, config_store_due(&store, 2 * DELAY_MS));
+}
+
+void config_store_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(config_store_first_save);
+    RUN_TEST(config_store_debounce);
+    RUN_TEST(config_store_unchanged_not_written);
+    RUN_TEST(config_store_write_error_retried);
+    UNITY_END();
+}
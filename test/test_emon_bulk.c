@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tests.h"
+#include <emon_bulk.h>
+#include <string.h>
+#include <unity.h>
+
+static EmonBulk bulk;
+static char buf[96];
+static char body[128];
+
+void emon_bulk_request_body(void)
+{
+    uint32_t num;
+
+    emon_bulk_init(&bulk, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL(0, emon_bulk_body(&bulk, 0, body, sizeof(body), &num));
+
+    TEST_ASSERT_EQUAL(0, emon_bulk_add(&bulk, 100, "bms", "{\"Bat_V\":13.1}"));
+    TEST_ASSERT_EQUAL(0, emon_bulk_add(&bulk, 110, "mppt", "{\"Solar_W\":80}"));
+    TEST_ASSERT_EQUAL(2, bulk.num);
+
+    const char expected[] = "data=[[100,\"bms\",{\"Bat_V\":13.1}],[110,\"mppt\",{\"Solar_W\":80}]]"
+        "&sentat=115";
+    TEST_ASSERT_EQUAL(strlen(expected), emon_bulk_body(&bulk, 115, body, sizeof(body), &num));
+    TEST_ASSERT_EQUAL_STRING(expected, body);
+    TEST_ASSERT_EQUAL(2, num);
+
+    // only the oldest samples fit into a smaller request
+    TEST_ASSERT_EQUAL(-1, emon_bulk_body(&bulk, 115, body, 40, &num));
+    TEST_ASSERT_EQUAL(44, emon_bulk_body(&bulk, 115, body, 60, &num));
+    TEST_ASSERT_EQUAL_STRING("data=[[100,\"bms\",{\"Bat_V\":13.1}]]&sentat=115", body);
+    TEST_ASSERT_EQUAL(1, num);
+
+    emon_bulk_remove(&bulk, num);
+    TEST_ASSERT_EQUAL(1, bulk.num);
+    emon_bulk_body(&bulk, 120, body, sizeof(body), &num);
+    TEST_ASSERT_EQUAL_STRING("data=[[110,\"mppt\",{\"Solar_W\":80}]]&sentat=120", body);
+
+    emon_bulk_remove(&bulk, 5);
+    TEST_ASSERT_EQUAL(0, bulk.num);
+    TEST_ASSERT_EQUAL(0, bulk.len);
+}
+
+void emon_bulk_drop_oldest(void)
+{
+    uint32_t num;
+
+    // each sample needs 24 bytes, so 4 of them fit into the buffer
+    emon_bulk_init(&bulk, buf, sizeof(buf));
+    for (uint32_t t = 10; t <= 50; t += 10) {
+        TEST_ASSERT_EQUAL(0, emon_bulk_add(&bulk, t, "bms", "{\"Bat_V\":13}"));
+    }
+    TEST_ASSERT_EQUAL(4, bulk.num);
+    TEST_ASSERT_EQUAL(1, bulk.dropped);
+
+    emon_bulk_body(&bulk, 60, body, sizeof(body), &num);
+    TEST_ASSERT_EQUAL_STRING("data=[[20,\"bms\",{\"Bat_V\":13}],[30,\"bms\",{\"Bat_V\":13}],"
+        "[40,\"bms\",{\"Bat_V\":13}],[50,\"bms\",{\"Bat_V\":13}]]&sentat=60", body);
+
+    char json[sizeof(buf)];
+    memset(json, 'x', sizeof(json) - 1);
+    json[sizeof(json) - 1] = '\0';
+    TEST_ASSERT_EQUAL(-1, emon_bulk_add(&bulk, 70, "bms", json));
+    TEST_ASSERT_EQUAL(4, bulk.num);
+}
+
+void emon_bulk_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(emon_bulk_request_body);
+    RUN_TEST(emon_bulk_drop_oldest);
+    UNITY_END();
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tests.h"
+#include "flash_fake.h"
+#include <flash_log.h>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#define NUM_SECTORS 3
+
+static uint8_t flash[NUM_SECTORS * FLASH_LOG_SECTOR_SIZE];
+static FlashFake fake;
+
+static FlashLog flog;
+
+static void mount_blank(void)
+{
+    flash_fake_init(&fake, flash, sizeof(flash));
+    TEST_ASSERT_EQUAL(0, flash_log_mount(&flog, &fake.io));
+}
+
+static void append_msg(uint32_t ts)
+{
+    char msg[32];
+    int len = snprintf(msg, sizeof(msg), "msg %u", (unsigned int) ts);
+    TEST_ASSERT_EQUAL(0, flash_log_append(&flog, ts, msg, len));
+}
+
+static void check_next(uint32_t ts_expected)
+{
+    char expected[32];
+    char buf[64];
+    uint32_t ts;
+    snprintf(expected, sizeof(expected), "msg %u", (unsigned int) ts_expected);
+    int len = flash_log_peek(&flog, &ts, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL(strlen(expected), len);
+    buf[len] = '\0';
+    TEST_ASSERT_EQUAL_STRING(expected, buf);
+    TEST_ASSERT_EQUAL(ts_expected, ts);
+    TEST_ASSERT_EQUAL(0, flash_log_pop(&flog));
+}
+
+void flash_log_fifo_order(void)
+{
+    char buf[64];
+    uint32_t ts;
+
+    mount_blank();
+    TEST_ASSERT_EQUAL(0, flash_log_peek(&flog, &ts, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL(-1, flash_log_pop(&flog));
+
+    for (uint32_t i = 1; i <= 5; i++) {
+        append_msg(i);
+    }
+    TEST_ASSERT_EQUAL(5, flog.count);
+
+    // peek without pop returns the same record again
+    TEST_ASSERT_EQUAL(5, flash_log_peek(&flog, &ts, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL(-1, flash_log_peek(&flog, &ts, buf, 3));
+    for (uint32_t i = 1; i <= 5; i++) {
+        check_next(i);
+    }
+    TEST_ASSERT_EQUAL(0, flash_log_peek(&flog, &ts, buf, sizeof(buf)));
+}
+
+void flash_log_persistent(void)
+{
+    mount_blank();
+    for (uint32_t i = 1; i <= 4; i++) {
+        append_msg(i);
+    }
+    check_next(1);
+
+    // popped records stay read after remount
+    TEST_ASSERT_EQUAL(0, flash_log_mount(&flog, &fake.io));
+    TEST_ASSERT_EQUAL(3, flog.count);
+    check_next(2);
+
+    TEST_ASSERT_EQUAL(0, flash_log_mount(&flog, &fake.io));
+    append_msg(5);
+    check_next(3);
+    check_next(4);
+    check_next(5);
+    TEST_ASSERT_EQUAL(0, flog.count);
+}
+
+void flash_log_wrap_around(void)
+{
+    static char data[1000];
+    uint32_t ts;
+    memset(data, 'x', sizeof(data));
+
+    // 4 records with 1012 bytes fit into one sector
+    mount_blank();
+    for (uint32_t i = 0; i < 20; i++) {
+        data[0] = i;
+        TEST_ASSERT_EQUAL(0, flash_log_append(&flog, i, data, sizeof(data)));
+    }
+
+    // records 0..7 were overwritten when sectors 0 and 1 were reused
+    TEST_ASSERT_EQUAL(12, flog.count);
+    TEST_ASSERT_EQUAL(8, flog.dropped);
+    TEST_ASSERT_EQUAL(2, fake.erase_counts[0]);
+    TEST_ASSERT_EQUAL(2, fake.erase_counts[1]);
+    TEST_ASSERT_EQUAL(1, fake.erase_counts[2]);
+
+    TEST_ASSERT_EQUAL(0, flash_log_mount(&flog, &fake.io));
+    TEST_ASSERT_EQUAL(12, flog.count);
+    for (uint32_t i = 8; i < 20; i++) {
+        TEST_ASSERT_EQUAL(sizeof(data), flash_log_peek(&flog, &ts, data, sizeof(data)));
+        TEST_ASSERT_EQUAL(i, ts);
+        TEST_ASSERT_EQUAL(i, data[0]);
+        TEST_ASSERT_EQUAL(0, flash_log_pop(&flog));
+    }
+    TEST_ASSERT_EQUAL(0, flash_log_peek(&flog, &ts, data, sizeof(data)));
+}
+
+void flash_log_power_loss(void)
+{
+    mount_blank();
+    append_msg(1);
+    append_msg(2);
+
+    // reset while writing the data of the third record
+    fake.write_budget = 15;
+    TEST_ASSERT_EQUAL(-1, flash_log_append(&flog, 3, "msg 3", 5));
+    fake.write_budget = -1;
+
+    TEST_ASSERT_EQUAL(0, flash_log_mount(&flog, &fake.io));
+    TEST_ASSERT_EQUAL(2, flog.count);
+    append_msg(4);
+    check_next(1);
+    check_next(2);
+    check_next(4);
+    TEST_ASSERT_EQUAL(0, flog.count);
+
+    // corrupted data is detected by the CRC
+    append_msg(5);
+    append_msg(6);
+    flash[(flog.head_sector * FLASH_LOG_SECTOR_SIZE) + flog.head_offset - 4] = 0;
+    TEST_ASSERT_EQUAL(0, flash_log_mount(&flog, &fake.io));
+    TEST_ASSERT_EQUAL(1, flog.count);
+    check_next(5);
+}
+
+void flash_log_invalid_flash(void)
+{
+    uint32_t ts;
+    char buf[16];
+
+    // random content is not interpreted as a log
+    flash_fake_init(&fake, flash, sizeof(flash));
+    memset(flash, 0x5A, sizeof(flash));
+    TEST_ASSERT_EQUAL(0, flash_log_mount(&flog, &fake.io));
+    TEST_ASSERT_EQUAL(0, flog.count);
+    TEST_ASSERT_EQUAL(0, flash_log_peek(&flog, &ts, buf, sizeof(buf)));
+    append_msg(1);
+    check_next(1);
+
+    FlashLogIO small_io = fake.io;
+    small_io.size = FLASH_LOG_SECTOR_SIZE;
+    TEST_ASSERT_EQUAL(-1, flash_log_mount(&flog, &small_io));
+
+    mount_blank();
+    TEST_ASSERT_EQUAL(-1, flash_log_append(&flog, 0, flash, FLASH_LOG_RECORD_MAX + 1));
+}
+
+void flash_log_iterate(void)
+{
+    static char data[1000];
+    FlashLogIter it;
+    uint32_t ts;
+    memset(data, 'x', sizeof(data));
+
+    mount_blank();
+    flash_log_iter_init(&flog, &it);
+    TEST_ASSERT_EQUAL(0, flash_log_iter_next(&flog, &it, &ts, data, sizeof(data)));
+
+    // two sectors overwritten, read records are returned as well
+    for (uint32_t i = 0; i < 18; i++) {
+        data[0] = i;
+        TEST_ASSERT_EQUAL(0, flash_log_append(&flog, i, data, sizeof(data)));
+    }
+    TEST_ASSERT_EQUAL(sizeof(data), flash_log_peek(&flog, &ts, data, sizeof(data)));
+    TEST_ASSERT_EQUAL(0, flash_log_pop(&flog));
+
+    flash_log_iter_init(&flog, &it);
+    for (uint32_t i = 8; i < 18; i++) {
+        TEST_ASSERT_EQUAL(sizeof(data), flash_log_iter_next(&flog, &it, &ts, data, sizeof(data)));
+        TEST_ASSERT_EQUAL(i, ts);
+        TEST_ASSERT_EQUAL(i, data[0]);
+    }
+    TEST_ASSERT_EQUAL(0, flash_log_iter_next(&flog, &it, &ts, data, sizeof(data)));
+
+    // records larger than the buffer are skipped
+    append_msg(100);
+    flash_log_iter_init(&flog, &it);
+    TEST_ASSERT_EQUAL(7, flash_log_iter_next(&flog, &it, &ts, data, 16));
+    TEST_ASSERT_EQUAL(100, ts);
+}
+
+void flash_log_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(flash_log_fifo_order);
+    RUN_TEST(flash_log_persistent);
+    RUN_TEST(flash_log_wrap_around);
+    RUN_TEST(flash_log_power_loss);
+    RUN_TEST(flash_log_invalid_flash);
+    RUN_TEST(flash_log_iterate);
+    UNITY_END();
+}
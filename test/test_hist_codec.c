@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tests.h"
+#include <hist_codec.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unity.h>
+
+#define DAY_S 86400
+#define INTERVAL_S 30
+#define PROFILE_SERIES 6
+#define PROFILE_SAMPLES (DAY_S / INTERVAL_S * PROFILE_SERIES)
+
+static HistBlock block;
+static HistCodec codec;
+static HistBlockReader reader;
+
+static HistSample samples[PROFILE_SAMPLES];
+static HistBlock encoded[PROFILE_SAMPLES / 200];
+
+static uint32_t random_state;
+
+/* deterministic pseudo-random number in [-1, 1] */
+static float noise()
+{
+    random_state = random_state * 1664525U + 1013904223U;
+    return (float) (random_state >> 8) / (1U << 23) - 1.0F;
+}
+
+static float quantize(float value, float resolution)
+{
+    return roundf(value / resolution) * resolution;
+}
+
+/*
+ * Synthetic day of a solar charge controller with values rounded like the data sent by the
+ * devices, as no recordings are available in the test environment
+ */
+static int solar_day_profile(HistSample *buf)
+{
+    float soc = 40;
+    int num = 0;
+    random_state = 1;
+    for (uint32_t t = 0; t < DAY_S; t += INTERVAL_S) {
+        float daylight = sinf((t / (float) DAY_S - 0.25F) * 2 * (float) M_PI);
+        float solar = daylight > 0 ? 300 * daylight * (0.9F + 0.1F * noise()) : 0;
+        float load = (t % 3600 < 600) ? 60 + 2 * noise() : 5;
+        float bat_a = (solar - load) / 12.8F;
+        soc = fminf(100, fmaxf(0, soc + bat_a * INTERVAL_S / 3600 / 1.0F));
+        // Bat_V, Bat_A, Solar_W, Load_W, Internal_degC, SOC_pct
+        float values[PROFILE_SERIES] = {
+            quantize(12.4F + soc * 0.02F + bat_a * 0.01F + 0.01F * noise(), 0.01F),
+            quantize(bat_a, 0.01F),
+            quantize(solar, 0.1F),
+            quantize(load, 0.1F),
+            quantize(20 + 10 * fmaxf(daylight, 0) + 0.2F * noise(), 0.1F),
+            roundf(soc),
+        };
+        // small jitter of the recording time
+        uint32_t time = 1600000000 + t + (noise() > 0.9F ? 1 : 0);
+        for (int i = 0; i < PROFILE_SERIES; i++) {
+            buf[num].time = time;
+            buf[num].key = 0x1000 + i;
+            buf[num].value = values[i];
+            num++;
+        }
+    }
+    return num;
+}
+
+static void assert_samples_equal(const HistSample *expected, const HistSample *actual)
+{
+    TEST_ASSERT_EQUAL(expected->time, actual->time);
+    TEST_ASSERT_EQUAL_HEX32(expected->key, actual->key);
+    // compare bits, so NaN and negative zero are also covered
+    TEST_ASSERT_EQUAL_MEMORY(&expected->value, &actual->value, sizeof(float));
+}
+
+void hist_codec_round_trip(void)
+{
+    static const float special[] = { 0.0F, -0.0F, NAN, INFINITY, -INFINITY, 1e-40F, 3.4e38F };
+    int num = 0;
+
+    hist_block_start(&block, &codec, 7);
+    uint32_t time = 1000;
+    for (int i = 0; i < 100; i++) {
+        // irregular intervals incl. negative delta-of-delta and gaps of all sizes
+        static const uint32_t deltas[] = { 1, 1, 0, 30, 2, 100, 3000, 1, 70000, 10 };
+        time += deltas[i % 10];
+        uint32_t key = i % 5;
+        float value = (i % 3 == 0) ? special[i % 7] : i * 0.37F;
+        if (i % 4 == 0 && i >= 5) {
+            // same value as the previous sample of the series
+            value = samples[i - 5].value;
+        }
+        samples[num] = (HistSample){ time, key, value };
+        TEST_ASSERT_EQUAL(0, hist_block_add(&block, &codec, time, key, value));
+        num++;
+    }
+
+    // table of series in the block is limited
+    for (uint32_t key = 5; key < HIST_BLOCK_SERIES_MAX; key++) {
+        samples[num] = (HistSample){ time, key, key };
+        TEST_ASSERT_EQUAL(0, hist_block_add(&block, &codec, time, key, key));
+        num++;
+    }
+    TEST_ASSERT_EQUAL(-1, hist_block_add(&block, &codec, time, 1000, 0));
+
+    // fill until the block is full
+    while (hist_block_add(&block, &codec, time + num, num % HIST_BLOCK_SERIES_MAX, num) == 0) {
+        samples[num] = (HistSample){ time + num, num % HIST_BLOCK_SERIES_MAX, num };
+        num++;
+    }
+    TEST_ASSERT_EQUAL(num, block.hdr.num);
+    TEST_ASSERT_EQUAL(7, block.hdr.seq);
+    TEST_ASSERT_EQUAL(1001, block.hdr.first_time);
+    TEST_ASSERT_EQUAL(samples[num - 1].time, block.hdr.last_time);
+    TEST_ASSERT_LESS_OR_EQUAL(HIST_BLOCK_SIZE, hist_block_len(&block));
+
+    HistSample sample;
+    hist_block_read_start(&reader, &block);
+    for (int i = 0; i < num; i++) {
+        TEST_ASSERT_EQUAL(1, hist_block_read(&reader, &sample));
+        assert_samples_equal(&samples[i], &sample);
+    }
+    TEST_ASSERT_EQUAL(0, hist_block_read(&reader, &sample));
+
+    // truncated data is detected
+    block.hdr.bits -= 10;
+    hist_block_read_start(&reader, &block);
+    int ret;
+    while ((ret = hist_block_read(&reader, &sample)) == 1) {}
+    TEST_ASSERT_EQUAL(-1, ret);
+}
+
+void hist_codec_benchmark(void)
+{
+    int num = solar_day_profile(samples);
+    int num_blocks = 0;
+    size_t encoded_size = 0;
+
+    clock_t start = clock();
+    hist_block_start(&encoded[0], &codec, 0);
+    for (int i = 0; i < num; i++) {
+        HistBlock *b = &encoded[num_blocks];
+        if (hist_block_add(b, &codec, samples[i].time, samples[i].key, samples[i].value) != 0) {
+            encoded_size += hist_block_len(b);
+            b = &encoded[++num_blocks];
+            hist_block_start(b, &codec, num_blocks);
+            TEST_ASSERT_EQUAL(0, hist_block_add(b, &codec, samples[i].time, samples[i].key,
+                samples[i].value));
+        }
+    }
+    encoded_size += hist_block_len(&encoded[num_blocks]);
+    num_blocks++;
+    clock_t encoded_time = clock();
+
+    HistSample sample;
+    int decoded = 0;
+    for (int i = 0; i < num_blocks; i++) {
+        hist_block_read_start(&reader, &encoded[i]);
+        while (hist_block_read(&reader, &sample) == 1) {
+            assert_samples_equal(&samples[decoded++], &sample);
+        }
+    }
+    clock_t decoded_time = clock();
+    TEST_ASSERT_EQUAL(num, decoded);
+
+    size_t raw_size = num * sizeof(HistSample);
+    float ratio = (float) raw_size / encoded_size;
+    printf("History codec: %d samples in %d blocks, %u bytes raw, %u bytes compressed "
+        "(ratio %.1f, %.2f bytes/sample), encoding %.0f ns/sample, decoding %.0f ns/sample\n",
+        num, num_blocks, (unsigned int) raw_size, (unsigned int) encoded_size, ratio,
+        (float) encoded_size / num,
+        (double) (encoded_time - start) * 1e9 / CLOCKS_PER_SEC / num,
+        (double) (decoded_time - encoded_time) * 1e9 / CLOCKS_PER_SEC / num);
+
+    TEST_ASSERT_GREATER_OR_EQUAL(4, (int) ratio);
+}
+
+void hist_codec_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(hist_codec_round_trip);
+    RUN_TEST(hist_codec_benchmark);
+    UNITY_END();
+}
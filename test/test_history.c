@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tests.h"
+#include "flash_fake.h"
+#include <history.h>
+#include <math.h>
+#include <string.h>
+#include <unity.h>
+
+#define NUM_SECTORS 4
+
+static uint8_t flash[NUM_SECTORS * FLASH_LOG_SECTOR_SIZE];
+static uint8_t tier_flash[NUM_SECTORS * FLASH_LOG_SECTOR_SIZE];
+static FlashFake fake;
+static FlashFake tier_fake;
+static FlashLog flog;
+static FlashLog tier_log;
+
+static HistBlock blocks[2];
+static HistStore hist;
+static HistBlock read_buf;
+
+static uint32_t times[4000];
+static float values[4000];
+static HistPoint points[4000];
+static int num_points;
+
+static int store_point(void *ctx, const HistPoint *point)
+{
+    if (num_points >= sizeof(times) / sizeof(times[0])) {
+        return -1;
+    }
+    times[num_points] = point->time;
+    values[num_points] = point->avg;
+    points[num_points] = *point;
+    num_points++;
+    return 0;
+}
+
+static int query(const char *name, uint32_t from, uint32_t to, uint32_t step)
+{
+    num_points = 0;
+    return hist_query(&hist, hist_key("dev", name), from, to, step, store_point, NULL,
+        &read_buf);
+}
+
+/* two series with one sample each per second */
+static void add_samples(uint32_t start, uint32_t num)
+{
+    for (uint32_t t = start; t < start + num; t++) {
+        TEST_ASSERT_EQUAL(0, hist_add(&hist, t, hist_key("dev", "Bat_V"), 12 + (t % 10) * 0.1F));
+        TEST_ASSERT_EQUAL(0, hist_add(&hist, t, hist_key("dev", "Bat_A"), t));
+    }
+}
+
+void history_downsampling(void)
+{
+    hist_init(&hist, blocks, 2, NULL);
+    add_samples(1000, 40);
+
+    // raw samples
+    TEST_ASSERT_EQUAL(11, query("Bat_A", 1010, 1020, 0));
+    TEST_ASSERT_EQUAL(1010, times[0]);
+    TEST_ASSERT_EQUAL_FLOAT(1020, values[10]);
+
+    // averages of 10 s intervals
+    TEST_ASSERT_EQUAL(4, query("Bat_V", 1000, 2000, 10));
+    TEST_ASSERT_EQUAL(1030, times[3]);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 12.45, values[3]);
+
+    // intervals start at from, the last one is incomplete
+    TEST_ASSERT_EQUAL(3, query("Bat_A", 1005, 1039, 15));
+    TEST_ASSERT_EQUAL(1035, times[2]);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 1037, values[2]);
+
+    TEST_ASSERT_EQUAL(0, query("Unknown", 0, 2000, 10));
+
+    // samples must be in chronological order
+    TEST_ASSERT_EQUAL(-1, hist_add(&hist, 1000, hist_key("dev", "Bat_V"), 0));
+    TEST_ASSERT_EQUAL(1, hist.rejected);
+}
+
+static int max_points;
+static uint32_t resume_time;
+
+/* aborts the query like the web server if its response buffer is full */
+static int store_point_limited(void *ctx, const HistPoint *point)
+{
+    if (num_points >= max_points) {
+        resume_time = point->time;
+        return -1;
+    }
+    return store_point(ctx, point);
+}
+
+void history_query_resumed(void)
+{
+    HistPoint expected[40];
+    hist_init(&hist, blocks, 2, NULL);
+    add_samples(1000, 40);
+
+    for (uint32_t step = 0; step <= 7; step += 7) {
+        int num = query("Bat_V", 1003, 1036, step);
+        memcpy(expected, points, num * sizeof(HistPoint));
+
+        // continued at the time of the first missing point
+        num_points = 0;
+        uint32_t from = 1003;
+        int ret;
+        do {
+            max_points = num_points + 3;
+            ret = hist_query(&hist, hist_key("dev", "Bat_V"), from, 1036, step,
+                store_point_limited, NULL, &read_buf);
+            from = resume_time;
+        } while (ret < 0);
+
+        TEST_ASSERT_EQUAL(num, num_points);
+        for (int i = 0; i < num; i++) {
+            TEST_ASSERT_EQUAL(expected[i].time, points[i].time);
+            TEST_ASSERT_EQUAL_FLOAT(expected[i].avg, points[i].avg);
+            TEST_ASSERT_EQUAL(expected[i].count, points[i].count);
+        }
+    }
+}
+
+void history_ram_ring(void)
+{
+    // number of samples per block depends on compression, oldest block is overwritten
+    hist_init(&hist, blocks, 2, NULL);
+    add_samples(0, 2000);
+    TEST_ASSERT_GREATER_THAN(2, hist.blocks[hist.head].hdr.seq);
+
+    uint32_t first = hist.blocks[(hist.head + 1) % 2].hdr.first_time;
+    TEST_ASSERT_EQUAL(2000 - first, query("Bat_A", 0, 10000, 0));
+    TEST_ASSERT_EQUAL(first, times[0]);
+    TEST_ASSERT_EQUAL(1999, times[num_points - 1]);
+}
+
+void history_flash_persistent(void)
+{
+    flash_fake_init(&fake, flash, sizeof(flash));
+    TEST_ASSERT_EQUAL(0, flash_log_mount(&flog, &fake.io));
+    hist_init(&hist, blocks, 2, &flog);
+    add_samples(0, 3000);
+
+    // all blocks except the head block are written to flash, only 2 of them are in RAM
+    uint32_t written = hist.blocks[hist.head].hdr.seq - 1;
+    TEST_ASSERT_GREATER_THAN(2, written);
+    TEST_ASSERT_EQUAL(written, flog.count);
+    TEST_ASSERT_EQUAL(0, flog.dropped);
+    TEST_ASSERT_EQUAL(3000, query("Bat_A", 0, 10000, 0));
+    for (int i = 0; i < 3000; i++) {
+        TEST_ASSERT_EQUAL(i, times[i]);
+        TEST_ASSERT_EQUAL_FLOAT(i, values[i]);
+    }
+
+    // after a reset, samples of the incomplete block are lost
+    uint32_t flushed = hist.blocks[(hist.head + 1) % 2].hdr.last_time;
+    TEST_ASSERT_EQUAL(0, flash_log_mount(&flog, &fake.io));
+    hist_init(&hist, blocks, 2, &flog);
+    TEST_ASSERT_EQUAL(written + 1, hist.blocks[0].hdr.seq);
+    TEST_ASSERT_EQUAL(flushed, hist.last_time);
+    add_samples(5000, 10);
+    TEST_ASSERT_EQUAL(flushed + 11, query("Bat_V", 0, 10000, 0));
+    TEST_ASSERT_EQUAL(flushed, times[flushed]);
+    TEST_ASSERT_EQUAL(5000, times[flushed + 1]);
+
+    // intervals without samples are skipped
+    TEST_ASSERT_EQUAL(flushed / 1000 + 2, query("Bat_A", 0, 10000, 1000));
+    TEST_ASSERT_EQUAL(1000, times[1]);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 1499.5, values[1]);
+    TEST_ASSERT_EQUAL(5000, times[num_points - 1]);
+
+    // aborted by the receiver
+    num_points = sizeof(times) / sizeof(times[0]);
+    TEST_ASSERT_EQUAL(-1, hist_query(&hist, hist_key("dev", "Bat_A"), 0, 10000, 0, store_point,
+        NULL, &read_buf));
+}
+
+void history_rollup_tiers(void)
+{
+    static HistTier tiers[2];
+
+    flash_fake_init(&tier_fake, tier_flash, sizeof(tier_flash));
+    TEST_ASSERT_EQUAL(0, flash_log_mount(&tier_log, &tier_fake.io));
+    hist_init(&hist, blocks, 2, NULL);
+    hist_tier_init(&tiers[0], 60, NULL);
+    hist_tier_init(&tiers[1], 600, &tier_log);
+    hist_set_tiers(&hist, tiers, 2);
+    add_samples(0, 3000);
+
+    // one record per closed period, the current period is only in RAM
+    TEST_ASSERT_EQUAL(4, tier_log.count);
+    TEST_ASSERT_EQUAL(5, query("Bat_A", 0, 10000, 600));
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_EQUAL(i * 600, points[i].time);
+        TEST_ASSERT_FLOAT_WITHIN(0.01, i * 600 + 299.5, points[i].avg);
+        TEST_ASSERT_EQUAL_FLOAT(i * 600, points[i].min);
+        TEST_ASSERT_EQUAL_FLOAT(i * 600 + 599, points[i].max);
+        TEST_ASSERT_EQUAL(600, points[i].count);
+    }
+
+    // rollups are combined for longer intervals and assigned by the start of their period
+    TEST_ASSERT_EQUAL(2, query("Bat_A", 650, 10000, 1200));
+    TEST_ASSERT_EQUAL(650, points[0].time);
+    TEST_ASSERT_EQUAL(1200, points[0].count);
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 1799.5, points[0].avg);
+    TEST_ASSERT_EQUAL(1850, points[1].time);
+    TEST_ASSERT_EQUAL_FLOAT(2999, points[1].max);
+
+    // tier without flash is not used, intervals are calculated from raw samples
+    TEST_ASSERT_EQUAL(1, query("Bat_A", 2700, 10000, 300));
+    TEST_ASSERT_EQUAL(300, points[0].count);
+    TEST_ASSERT_EQUAL_FLOAT(2700, points[0].min);
+    TEST_ASSERT_EQUAL_FLOAT(2999, points[0].max);
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 2849.5, points[0].avg);
+
+    // invalid values are not included in rollups
+    TEST_ASSERT_EQUAL(0, hist_add(&hist, 3000, hist_key("dev", "Bat_A"), NAN));
+    TEST_ASSERT_EQUAL(5, tier_log.count);
+    TEST_ASSERT_EQUAL(0, query("Bat_A", 3000, 10000, 600));
+
+    // series which do not fit into the table are counted
+    for (uint32_t key = 0; key < HIST_ROLLUP_KEYS; key++) {
+        hist_add(&hist, 3001, key, 1);
+    }
+    TEST_ASSERT_EQUAL(2, tiers[1].overflows);
+    TEST_ASSERT_EQUAL(0, tiers[1].flash_errors);
+}
+
+void history_rollup_tier_wrapped(void)
+{
+    static uint8_t small_flash[2 * FLASH_LOG_SECTOR_SIZE];
+    static FlashFake small_fake;
+    static HistTier tier;
+
+    flash_fake_init(&fake, flash, sizeof(flash));
+    TEST_ASSERT_EQUAL(0, flash_log_mount(&flog, &fake.io));
+    flash_fake_init(&small_fake, small_flash, sizeof(small_flash));
+    TEST_ASSERT_EQUAL(0, flash_log_mount(&tier_log, &small_fake.io));
+    hist_init(&hist, blocks, 2, &flog);
+    hist_tier_init(&tier, 60, &tier_log);
+    hist_set_tiers(&hist, &tier, 1);
+
+    // 20 series per minute for one hour, only the last 9 to 18 periods are kept by the tier
+    for (uint32_t t = 0; t < 3600; t += 60) {
+        TEST_ASSERT_EQUAL(0, hist_add(&hist, t, hist_key("dev", "Bat_A"), t));
+        for (uint32_t key = 1; key < 20; key++) {
+            TEST_ASSERT_EQUAL(0, hist_add(&hist, t, key, 0));
+        }
+    }
+    TEST_ASSERT_GREATER_THAN(0, tier_log.dropped);
+    TEST_ASSERT_EQUAL(0, hist.flash_errors);
+
+    // overwritten periods are calculated from the raw samples
+    TEST_ASSERT_EQUAL(12, query("Bat_A", 0, 3600, 300));
+    for (int i = 0; i < 12; i++) {
+        TEST_ASSERT_EQUAL(i * 300, points[i].time);
+        TEST_ASSERT_EQUAL(5, points[i].count);
+        TEST_ASSERT_EQUAL_FLOAT(i * 300 + 120, points[i].avg);
+    }
+
+    // recent periods are still available in the tier
+    TEST_ASSERT_EQUAL(2, query("Bat_A", 3000, 3600, 300));
+    TEST_ASSERT_EQUAL(3300, points[1].time);
+    TEST_ASSERT_EQUAL(5, points[1].count);
+    TEST_ASSERT_EQUAL_FLOAT(3420, points[1].avg);
+}
+
+void history_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(history_downsampling);
+    RUN_TEST(history_query_resumed);
+    RUN_TEST(history_ram_ring);
+    RUN_TEST(history_flash_persistent);
+    RUN_TEST(history_rollup_tiers);
+    RUN_TEST(history_rollup_tier_wrapped);
+    UNITY_END();
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tests.h"
+#include <http_client.h>
+#include <string.h>
+#include <unity.h>
+
+static HttpResponse resp;
+
+static size_t parse_str(const char *str)
+{
+    return http_response_parse(&resp, str, strlen(str));
+}
+
+void http_response_content_length(void)
+{
+    const char msg[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/html; charset=UTF-8\r\n"
+        "content-length: 2\r\n"
+        "\r\n"
+        "ok"
+        "HTTP/1.1 200 OK\r\n";
+
+    http_response_init(&resp);
+    TEST_ASSERT_EQUAL(strlen(msg) - 17, parse_str(msg));
+    TEST_ASSERT_EQUAL(HTTP_RESP_DONE, resp.state);
+    TEST_ASSERT_EQUAL(200, resp.status);
+    TEST_ASSERT_TRUE(resp.keep_alive);
+    TEST_ASSERT_EQUAL_STRING("ok", resp.body);
+
+    // byte by byte as received from a slow connection
+    http_response_init(&resp);
+    for (size_t i = 0; i < strlen(msg) - 17; i++) {
+        TEST_ASSERT_NOT_EQUAL(HTTP_RESP_DONE, resp.state);
+        TEST_ASSERT_EQUAL(1, http_response_parse(&resp, msg + i, 1));
+    }
+    TEST_ASSERT_EQUAL(HTTP_RESP_DONE, resp.state);
+    TEST_ASSERT_EQUAL_STRING("ok", resp.body);
+}
+
+void http_response_chunked(void)
+{
+    http_response_init(&resp);
+    parse_str("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+    TEST_ASSERT_EQUAL(HTTP_RESP_CHUNK_SIZE, resp.state);
+    parse_str("2\r\nok\r\n");
+    parse_str("A;ext=1\r\n, 12345678\r\n");
+    TEST_ASSERT_EQUAL(HTTP_RESP_CHUNK_SIZE, resp.state);
+    parse_str("0\r\nX-Trailer: 1\r\n\r\n");
+    TEST_ASSERT_EQUAL(HTTP_RESP_DONE, resp.state);
+    TEST_ASSERT_TRUE(resp.keep_alive);
+    TEST_ASSERT_EQUAL_STRING("ok, 12345678", resp.body);
+
+    http_response_init(&resp);
+    parse_str("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nxyz\r\n");
+    TEST_ASSERT_EQUAL(HTTP_RESP_ERROR, resp.state);
+}
+
+void http_response_connection_close(void)
+{
+    // explicitly closed by server
+    http_response_init(&resp);
+    parse_str("HTTP/1.1 401 Unauthorized\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+    TEST_ASSERT_EQUAL(HTTP_RESP_DONE, resp.state);
+    TEST_ASSERT_EQUAL(401, resp.status);
+    TEST_ASSERT_FALSE(resp.keep_alive);
+
+    // HTTP/1.0 without keep-alive
+    http_response_init(&resp);
+    parse_str("HTTP/1.0 200 OK\r\nContent-Length: 0\r\n\r\n");
+    TEST_ASSERT_FALSE(resp.keep_alive);
+
+    http_response_init(&resp);
+    parse_str("HTTP/1.0 200 OK\r\nConnection: Keep-Alive\r\nContent-Length: 0\r\n\r\n");
+    TEST_ASSERT_TRUE(resp.keep_alive);
+
+    // body without length ends with the connection
+    http_response_init(&resp);
+    parse_str("HTTP/1.1 200 OK\r\n\r\nok");
+    TEST_ASSERT_EQUAL(HTTP_RESP_BODY, resp.state);
+    TEST_ASSERT_FALSE(resp.keep_alive);
+    TEST_ASSERT_TRUE(http_response_eof(&resp));
+
+    // incomplete response
+    http_response_init(&resp);
+    parse_str("HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nok");
+    TEST_ASSERT_FALSE(http_response_eof(&resp));
+}
+
+void http_response_special_cases(void)
+{
+    // informational response before the actual response
+    http_response_init(&resp);
+    parse_str("HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 204 No Content\r\n\r\n");
+    TEST_ASSERT_EQUAL(HTTP_RESP_DONE, resp.state);
+    TEST_ASSERT_EQUAL(204, resp.status);
+
+    // long header lines are truncated
+    char line[300];
+    memset(line, 'x', sizeof(line));
+    http_response_init(&resp);
+    parse_str("HTTP/1.1 200 OK\r\nSet-Cookie: ");
+    http_response_parse(&resp, line, sizeof(line));
+    parse_str("\r\nContent-Length: 0\r\n\r\n");
+    TEST_ASSERT_EQUAL(HTTP_RESP_DONE, resp.state);
+
+    http_response_init(&resp);
+    parse_str("<html>\r\n");
+    TEST_ASSERT_EQUAL(HTTP_RESP_ERROR, resp.state);
+}
+
+void http_client_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(http_response_content_length);
+    RUN_TEST(http_response_chunked);
+    RUN_TEST(http_response_connection_close);
+    RUN_TEST(http_response_special_cases);
+    UNITY_END();
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tests.h"
+#include <http_stats.h>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+static HttpStats stats;
+
+void http_trace_status_and_bytes(void)
+{
+    HttpTrace trace;
+    http_trace_init(&trace, "ts");
+    const char hdr[] = "HTTP/1.1 404 Not Found\r\n";
+    http_trace_sent(&trace, hdr, strlen(hdr), 100);
+    http_trace_sent(&trace, "HTTP/1.1 200 OK\r\n", 17, 50);
+    http_trace_sent(&trace, "body", -1, 20);
+    TEST_ASSERT_EQUAL(404, trace.status);
+    TEST_ASSERT_EQUAL(strlen(hdr) + 17, trace.bytes_out);
+    TEST_ASSERT_EQUAL(170, trace.phase_us[HTTP_PHASE_SEND]);
+    TEST_ASSERT_EQUAL(1U << HTTP_PHASE_SEND, trace.phases);
+
+    // calls without trace are ignored
+    http_trace_sent(NULL, hdr, strlen(hdr), 100);
+    http_trace_bus_begin(NULL, 0);
+    http_trace_bus_end(NULL, 100);
+}
+
+void http_trace_bus_excludes_io(void)
+{
+    HttpTrace trace;
+    http_trace_init(&trace, "ts");
+    http_trace_add(&trace, HTTP_PHASE_SEND, 1000);
+    http_trace_bus_begin(&trace, 10000);
+    // response is forwarded to the client while it arrives from the device
+    http_trace_add(&trace, HTTP_PHASE_RECV, 2000);
+    http_trace_add(&trace, HTTP_PHASE_SEND, 3000);
+    http_trace_bus_end(&trace, 25000);
+    TEST_ASSERT_EQUAL(10000, trace.phase_us[HTTP_PHASE_BUS]);
+    TEST_ASSERT_EQUAL(7, trace.phases);
+}
+
+void http_stats_record_buckets(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    const uint32_t bus_us[] = { 500, 1000, 4999, 150000, 3000000 };
+    for (int i = 0; i < 5; i++) {
+        HttpTrace trace;
+        http_trace_init(&trace, "ts");
+        http_trace_source(&trace, "ABCD1234", "serial");
+        http_trace_add(&trace, HTTP_PHASE_BUS, bus_us[i]);
+        trace.bytes_out = 100;
+        trace.status = i == 4 ? 404 : 200;
+        http_stats_record(&stats, &trace);
+    }
+    TEST_ASSERT_EQUAL(1, stats.num_entries);
+    HttpStatsEntry *entry = &stats.entries[0];
+    TEST_ASSERT_EQUAL_STRING("ABCD1234", entry->device);
+    TEST_ASSERT_EQUAL_STRING("serial", entry->transport);
+    TEST_ASSERT_EQUAL(5, entry->requests);
+    TEST_ASSERT_EQUAL(1, entry->errors);
+    TEST_ASSERT_EQUAL(500, entry->bytes_out);
+    TEST_ASSERT_EQUAL(0, entry->phases[HTTP_PHASE_RECV].count);
+    HttpHistogram *bus = &entry->phases[HTTP_PHASE_BUS];
+    TEST_ASSERT_EQUAL(5, bus->count);
+    TEST_ASSERT_EQUAL(3000000, bus->max_us);
+    TEST_ASSERT_EQUAL(1, bus->buckets[0]);      // < 1 ms
+    TEST_ASSERT_EQUAL(1, bus->buckets[1]);      // < 2 ms
+    TEST_ASSERT_EQUAL(1, bus->buckets[2]);      // < 5 ms
+    TEST_ASSERT_EQUAL(1, bus->buckets[7]);      // < 200 ms
+    TEST_ASSERT_EQUAL(1, bus->buckets[HTTP_STATS_BUCKETS - 1]);
+}
+
+void http_stats_entries_full(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    for (int i = 0; i < HTTP_STATS_ENTRIES + 2; i++) {
+        char device[16];
+        snprintf(device, sizeof(device), "dev%d", i);
+        HttpTrace trace;
+        http_trace_init(&trace, "ts");
+        http_trace_source(&trace, device, "can");
+        http_stats_record(&stats, &trace);
+    }
+    TEST_ASSERT_EQUAL(HTTP_STATS_ENTRIES, stats.num_entries);
+    TEST_ASSERT_EQUAL(2, stats.dropped);
+
+    // existing entries are still updated
+    HttpTrace trace;
+    http_trace_init(&trace, "ts");
+    http_trace_source(&trace, "dev0", "can");
+    http_stats_record(&stats, &trace);
+    TEST_ASSERT_EQUAL(2, stats.entries[0].requests);
+    TEST_ASSERT_EQUAL(2, stats.dropped);
+}
+
+void http_stats_summary_per_transport(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    const char *transports[] = { "serial", "serial", "can", NULL };
+    const uint32_t bus_us[] = { 10000, 20000, 4000, 1000 };
+    for (int i = 0; i < 4; i++) {
+        HttpTrace trace;
+        http_trace_init(&trace, i < 3 ? "ts" : "files");
+        http_trace_source(&trace, NULL, transports[i]);
+        http_trace_add(&trace, HTTP_PHASE_BUS, bus_us[i]);
+        http_trace_add(&trace, HTTP_PHASE_SEND, 500);
+        trace.bytes_out = 1000;
+        trace.error = i == 2;
+        http_stats_record(&stats, &trace);
+    }
+    TEST_ASSERT_EQUAL(3, stats.num_entries);
+
+    HttpStatsSummary summary;
+    http_stats_summarize(&stats, &summary);
+    TEST_ASSERT_EQUAL(4, summary.requests);
+    TEST_ASSERT_EQUAL(1, summary.errors);
+    TEST_ASSERT_EQUAL(4000, summary.bytes_out);
+    TEST_ASSERT_EQUAL_FLOAT(0, summary.recv_avg_ms);
+    TEST_ASSERT_EQUAL_FLOAT(8.75, summary.bus_avg_ms);
+    TEST_ASSERT_EQUAL_FLOAT(0.5, summary.send_avg_ms);
+    TEST_ASSERT_EQUAL_FLOAT(20, summary.bus_max_ms);
+    TEST_ASSERT_EQUAL_FLOAT(15, summary.serial_bus_avg_ms);
+    TEST_ASSERT_EQUAL_FLOAT(4, summary.can_bus_avg_ms);
+    TEST_ASSERT_EQUAL_FLOAT(0, summary.spiffs_bus_avg_ms);
+}
+
+void http_stats_json(void)
+{
+    HttpStatsEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    strcpy(entry.endpoint, "files");
+    strcpy(entry.transport, "spiffs");
+    entry.requests = 2;
+    entry.bytes_out = 12345;
+    entry.phases[HTTP_PHASE_BUS].count = 2;
+    entry.phases[HTTP_PHASE_BUS].sum_us = 3000;
+    entry.phases[HTTP_PHASE_BUS].max_us = 2500;
+    entry.phases[HTTP_PHASE_BUS].buckets[0] = 1;
+    entry.phases[HTTP_PHASE_BUS].buckets[2] = 1;
+
+    char buf[512];
+    int len = http_stats_entry_json(&entry, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"endpoint\":\"files\",\"device\":\"\",\"transport\":\"spiffs\","
+        "\"requests\":2,\"errors\":0,\"bytes_out\":12345,"
+        "\"recv\":{\"count\":0,\"avg_ms\":0.00,\"max_ms\":0.00,\"hist\":[0,0,0,0,0,0,0,0,0,0,0,0]},"
+        "\"bus\":{\"count\":2,\"avg_ms\":1.50,\"max_ms\":2.50,\"hist\":[1,0,1,0,0,0,0,0,0,0,0,0]},"
+        "\"send\":{\"count\":0,\"avg_ms\":0.00,\"max_ms\":0.00,\"hist\":[0,0,0,0,0,0,0,0,0,0,0,0]}}",
+        buf);
+    TEST_ASSERT_EQUAL(strlen(buf), len);
+
+    TEST_ASSERT_EQUAL(-1, http_stats_entry_json(&entry, buf, 100));
+}
+
+void http_stats_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(http_trace_status_and_bytes);
+    RUN_TEST(http_trace_bus_excludes_io);
+    RUN_TEST(http_stats_record_buckets);
+    RUN_TEST(http_stats_entries_full);
+    RUN_TEST(http_stats_summary_per_transport);
+    RUN_TEST(http_stats_json);
+    UNITY_END();
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tests.h"
+#include <metrics.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+static char output[1024];
+static size_t output_len;
+static int num_chunks;
+
+static int collect_chunk(void *ctx, const char *buf, size_t len)
+{
+    if (output_len + len >= sizeof(output)) {
+        return -1;
+    }
+    memcpy(output + output_len, buf, len);
+    output_len += len;
+    output[output_len] = '\0';
+    num_chunks++;
+    return 0;
+}
+
+static int fail_chunk(void *ctx, const char *buf, size_t len)
+{
+    num_chunks++;
+    return -1;
+}
+
+static void reset_output(void)
+{
+    output[0] = '\0';
+    output_len = 0;
+    num_chunks = 0;
+}
+
+void metrics_single_value(void)
+{
+    char buf[128];
+    MetricsWriter w;
+    reset_output();
+    metrics_init(&w, buf, sizeof(buf), collect_chunk, NULL);
+    metrics_value(&w, "gateway_heap_free_bytes", "gauge", "Free heap memory", 123456);
+    TEST_ASSERT_EQUAL(0, num_chunks);
+    TEST_ASSERT_EQUAL(0, metrics_finish(&w));
+    TEST_ASSERT_EQUAL_STRING(
+        "# HELP gateway_heap_free_bytes Free heap memory\n"
+        "# TYPE gateway_heap_free_bytes gauge\n"
+        "gateway_heap_free_bytes 123456\n", output);
+}
+
+void metrics_labels_escaped(void)
+{
+    char buf[128];
+    MetricsWriter w;
+    reset_output();
+    metrics_init(&w, buf, sizeof(buf), collect_chunk, NULL);
+    metrics_sample(&w, "thingset_value", "device", "a\"b\\c\nd", "name", "Bat_V", 12.5);
+    metrics_sample(&w, "gateway_queue_messages", "queue", "ts_jobs", NULL, NULL, 0);
+    metrics_sample(&w, "thingset_value", "device", "x", "name", "Err", NAN);
+    metrics_sample(&w, "thingset_value", "device", "x", "name", "Max", -INFINITY);
+    TEST_ASSERT_EQUAL(0, metrics_finish(&w));
+    TEST_ASSERT_EQUAL_STRING(
+        "thingset_value{device=\"a\\\"b\\\\c\\nd\",name=\"Bat_V\"} 12.5\n"
+        "gateway_queue_messages{queue=\"ts_jobs\"} 0\n"
+        "thingset_value{device=\"x\",name=\"Err\"} NaN\n"
+        "thingset_value{device=\"x\",name=\"Max\"} -Inf\n", output);
+}
+
+void metrics_split_into_chunks(void)
+{
+    char buf[64];
+    MetricsWriter w;
+    reset_output();
+    metrics_init(&w, buf, sizeof(buf), collect_chunk, NULL);
+    for (int i = 0; i < 10; i++) {
+        metrics_sample(&w, "thingset_value", "name", "Bat_V", NULL, NULL, i);
+    }
+    TEST_ASSERT_EQUAL(0, metrics_finish(&w));
+
+    // only complete lines are flushed, so no line is split between two chunks
+    TEST_ASSERT_EQUAL(5, num_chunks);
+    char expected[512] = "";
+    for (int i = 0; i < 10; i++) {
+        char line[40];
+        snprintf(line, sizeof(line), "thingset_value{name=\"Bat_V\"} %d\n", i);
+        strcat(expected, line);
+    }
+    TEST_ASSERT_EQUAL_STRING(expected, output);
+}
+
+void metrics_line_too_long(void)
+{
+    char buf[24];
+    MetricsWriter w;
+    reset_output();
+    metrics_init(&w, buf, sizeof(buf), collect_chunk, NULL);
+    metrics_sample(&w, "short", NULL, NULL, NULL, NULL, 1);
+    metrics_sample(&w, "thingset_value", "device", "abcdefgh", NULL, NULL, 1);
+    metrics_sample(&w, "short", NULL, NULL, NULL, NULL, 2);
+    TEST_ASSERT_EQUAL(-1, metrics_finish(&w));
+    TEST_ASSERT_EQUAL_STRING("short 1\nshort 2\n", output);
+}
+
+void metrics_flush_failed(void)
+{
+    char buf[24];
+    MetricsWriter w;
+    reset_output();
+    metrics_init(&w, buf, sizeof(buf), fail_chunk, NULL);
+    for (int i = 0; i < 10; i++) {
+        metrics_sample(&w, "short", NULL, NULL, NULL, NULL, i);
+    }
+    TEST_ASSERT_EQUAL(-1, metrics_finish(&w));
+    // no further attempts to send after the first error
+    TEST_ASSERT_EQUAL(1, num_chunks);
+}
+
+void metrics_from_pubmsg(void)
+{
+    char buf[256];
+    MetricsWriter w;
+    reset_output();
+    metrics_init(&w, buf, sizeof(buf), collect_chunk, NULL);
+    int num = metrics_pubmsg(&w, "thingset_value", "ABCD1234",
+        "#serial {\"Bat_V\":14.2,\"Load\":{\"On\":true,\"A\":-0.5},\"Name\":\"MPPT\"}");
+    TEST_ASSERT_EQUAL(3, num);
+    TEST_ASSERT_EQUAL(0, metrics_finish(&w));
+    TEST_ASSERT_EQUAL_STRING(
+        "thingset_value{device=\"ABCD1234\",name=\"Bat_V\"} 14.2\n"
+        "thingset_value{device=\"ABCD1234\",name=\"Load/On\"} 1\n"
+        "thingset_value{device=\"ABCD1234\",name=\"Load/A\"} -0.5\n", output);
+}
+
+void metrics_from_invalid_pubmsg(void)
+{
+    char buf[64];
+    MetricsWriter w;
+    reset_output();
+    metrics_init(&w, buf, sizeof(buf), collect_chunk, NULL);
+    TEST_ASSERT_EQUAL(-1, metrics_pubmsg(&w, "thingset_value", "x", ":85 Content."));
+    TEST_ASSERT_EQUAL(-1, metrics_pubmsg(&w, "thingset_value", "x", "#serial"));
+    TEST_ASSERT_EQUAL(-1, metrics_pubmsg(&w, "thingset_value", "x", "#serial [1,2]"));
+    TEST_ASSERT_EQUAL(0, metrics_finish(&w));
+    TEST_ASSERT_EQUAL_STRING("", output);
+}
+
+void metrics_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(metrics_single_value);
+    RUN_TEST(metrics_labels_escaped);
+    RUN_TEST(metrics_split_into_chunks);
+    RUN_TEST(metrics_line_too_long);
+    RUN_TEST(metrics_flush_failed);
+    RUN_TEST(metrics_from_pubmsg);
+    RUN_TEST(metrics_from_invalid_pubmsg);
+    UNITY_END();
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tests.h"
+#include <pub_batch.h>
+#include <string.h>
+#include <unity.h>
+
+static PubBatch batch;
+static char buf[80];
+static PubWindow window;
+
+void pub_batch_aggregate(void)
+{
+    pub_batch_init(&batch, buf, sizeof(buf));
+    TEST_ASSERT_NULL(pub_batch_finish(&batch));
+    TEST_ASSERT_FALSE(pub_batch_due(&batch, 1000, 0));
+
+    TEST_ASSERT_EQUAL(0, pub_batch_add(&batch, "MPPT1/serial", "{\"Bat_V\":14.1}", 100));
+    TEST_ASSERT_EQUAL(0, pub_batch_add(&batch, "BMS1/can", "{\"Bat_V\":14}", 200));
+    TEST_ASSERT_EQUAL(2, batch.num);
+    TEST_ASSERT_EQUAL_STRING("[[\"MPPT1/serial\",{\"Bat_V\":14.1}],[\"BMS1/can\",{\"Bat_V\":14}]]",
+        pub_batch_finish(&batch));
+
+    // delay is measured from the first message
+    TEST_ASSERT_FALSE(pub_batch_due(&batch, 1099, 1000));
+    TEST_ASSERT_TRUE(pub_batch_due(&batch, 1100, 1000));
+
+    pub_batch_clear(&batch);
+    TEST_ASSERT_EQUAL(0, batch.num);
+    TEST_ASSERT_NULL(pub_batch_finish(&batch));
+}
+
+void pub_batch_full(void)
+{
+    pub_batch_init(&batch, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL(0, pub_batch_add(&batch, "MPPT1/serial", "{\"Bat_V\":14.1}", 0));
+
+    // several samples of the same device
+    TEST_ASSERT_EQUAL(0, pub_batch_add(&batch, "MPPT1/serial", "{\"Bat_V\":14.2}", 0));
+
+    // not enough space left
+    TEST_ASSERT_EQUAL(1, pub_batch_add(&batch, "BMS1/can", "{\"Bat_V\":14.1}", 0));
+    TEST_ASSERT_EQUAL_STRING(
+        "[[\"MPPT1/serial\",{\"Bat_V\":14.1}],[\"MPPT1/serial\",{\"Bat_V\":14.2}]]",
+        pub_batch_finish(&batch));
+
+    pub_batch_clear(&batch);
+    TEST_ASSERT_EQUAL(0, pub_batch_add(&batch, "BMS1/can", "{\"Bat_V\":14.1}", 0));
+
+    // exactly fits into the empty buffer including closing bracket and zero termination
+    char data[sizeof(buf) - 10];
+    memset(data, 'x', sizeof(data) - 1);
+    data[sizeof(data) - 1] = '\0';
+    pub_batch_clear(&batch);
+    TEST_ASSERT_EQUAL(-1, pub_batch_add(&batch, "a/bc", data, 0));
+    TEST_ASSERT_EQUAL(0, pub_batch_add(&batch, "a/b", data, 0));
+    TEST_ASSERT_EQUAL(sizeof(buf) - 1, strlen(pub_batch_finish(&batch)));
+}
+
+void pub_window_bounded(void)
+{
+    pub_window_init(&window, 2);
+    TEST_ASSERT_EQUAL(0, pub_window_add(&window, 1, 0));
+    TEST_ASSERT_EQUAL(0, pub_window_add(&window, 2, 10));
+    TEST_ASSERT_TRUE(pub_window_full(&window));
+    TEST_ASSERT_EQUAL(-1, pub_window_add(&window, 3, 20));
+
+    // acknowledgements may arrive out of order
+    TEST_ASSERT_EQUAL(40, pub_window_ack(&window, 2, 50));
+    TEST_ASSERT_FALSE(pub_window_full(&window));
+    TEST_ASSERT_EQUAL(-1, pub_window_ack(&window, 2, 60));
+    TEST_ASSERT_EQUAL(0, pub_window_add(&window, 3, 60));
+    TEST_ASSERT_EQUAL(70, pub_window_ack(&window, 1, 70));
+    TEST_ASSERT_EQUAL(1, window.num);
+
+    pub_window_init(&window, 100);
+    TEST_ASSERT_EQUAL(PUB_WINDOW_MAX, window.max);
+}
+
+void pub_window_early_ack(void)
+{
+    PubStats stats;
+
+    // acknowledgement received by the MQTT task before the publishing task added the message
+    pub_window_init(&window, 4);
+    TEST_ASSERT_EQUAL(-1, pub_window_ack(&window, 5, 100));
+    TEST_ASSERT_EQUAL(0, pub_window_add(&window, 5, 90));
+    TEST_ASSERT_EQUAL(0, window.num);
+    pub_window_stats(&window, &stats);
+    TEST_ASSERT_EQUAL(1, stats.acked);
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 10.0, stats.latency_max_ms);
+
+    // unmatched acknowledgements are removed after the timeout
+    pub_window_add(&window, 6, 200);
+    pub_window_ack(&window, 7, 300);
+    TEST_ASSERT_EQUAL(1, pub_window_expire(&window, 1299, 1000));
+    TEST_ASSERT_EQUAL(1, window.num_early_acks);
+    TEST_ASSERT_EQUAL(0, pub_window_expire(&window, 1300, 1000));
+    TEST_ASSERT_EQUAL(0, window.num_early_acks);
+    pub_window_add(&window, 7, 1310);
+    TEST_ASSERT_EQUAL(1, window.num);
+
+    // oldest acknowledgement is dropped if too many are unmatched
+    for (int i = 10; i < 10 + PUB_WINDOW_EARLY_ACKS + 1; i++) {
+        pub_window_ack(&window, i, 1400);
+    }
+    pub_window_add(&window, 10, 1390);
+    TEST_ASSERT_EQUAL(2, window.num);
+    pub_window_add(&window, 11, 1390);
+    TEST_ASSERT_EQUAL(2, window.num);
+    TEST_ASSERT_EQUAL(2, window.acked);
+}
+
+void pub_window_expire_and_stats(void)
+{
+    PubStats stats;
+
+    pub_window_init(&window, 4);
+    window.published = 5;
+    pub_window_add(&window, 1, 0);
+    pub_window_add(&window, 2, 100);
+    pub_window_add(&window, 3, 200);
+    pub_window_add(&window, 4, 300);
+    pub_window_ack(&window, 2, 110);
+    pub_window_ack(&window, 4, 330);
+
+    TEST_ASSERT_EQUAL(0, pub_window_expire(&window, 999, 1000));
+    TEST_ASSERT_EQUAL(1, pub_window_expire(&window, 1000, 1000));
+    TEST_ASSERT_EQUAL(-1, pub_window_ack(&window, 1, 1010));
+
+    pub_window_stats(&window, &stats);
+    TEST_ASSERT_EQUAL(5, stats.published);
+    TEST_ASSERT_EQUAL(2, stats.acked);
+    TEST_ASSERT_EQUAL(1, stats.expired);
+    TEST_ASSERT_EQUAL(1, stats.inflight);
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 66.7, stats.ack_rate_pct);
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 20.0, stats.latency_avg_ms);
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 30.0, stats.latency_max_ms);
+}
+
+void pub_batch_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(pub_batch_aggregate);
+    RUN_TEST(pub_batch_full);
+    RUN_TEST(pub_window_bounded);
+    RUN_TEST(pub_window_early_ack);
+    RUN_TEST(pub_window_expire_and_stats);
+    UNITY_END();
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tests.h"
+#include <pub_filter.h>
+#include <string.h>
+#include <unity.h>
+
+static PubFilter filter;
+static char out[256];
+
+void pub_filter_first_message_complete(void)
+{
+    pub_filter_init(&filter, 0, 0, 0);
+    const char msg[] = "{\"Bat_V\":14.1, \"Load\":{\"On\":true},\"Name\":\"MPPT\"}";
+    TEST_ASSERT_EQUAL(strlen(msg) - 1, pub_filter_apply(&filter, msg, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_STRING("{\"Bat_V\":14.1,\"Load\":{\"On\":true},\"Name\":\"MPPT\"}", out);
+
+    // nothing changed
+    TEST_ASSERT_EQUAL(0, pub_filter_apply(&filter, msg, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_STRING("", out);
+}
+
+void pub_filter_only_changed_values(void)
+{
+    pub_filter_init(&filter, 0, 0, 0);
+    pub_filter_apply(&filter, "{\"Bat_V\":14.1,\"Load\":{\"On\":true},\"Err\":0}", out,
+        sizeof(out));
+    pub_filter_apply(&filter, "{\"Bat_V\":14.2,\"Load\":{\"On\":true},\"Err\":0}", out,
+        sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("{\"Bat_V\":14.2}", out);
+    pub_filter_apply(&filter, "{\"Bat_V\":14.2,\"Load\":{\"On\":false},\"Err\":0}", out,
+        sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("{\"Load\":{\"On\":false}}", out);
+}
+
+void pub_filter_deadbands(void)
+{
+    pub_filter_init(&filter, 0.1, 5, 0);
+    pub_filter_apply(&filter, "{\"Bat_V\":12.0,\"Solar_W\":0}", out, sizeof(out));
+
+    // 5 % of 12 V is 0.6 V
+    TEST_ASSERT_EQUAL(0, pub_filter_apply(&filter, "{\"Bat_V\":12.5,\"Solar_W\":0.1}", out,
+        sizeof(out)));
+    // changes accumulate, as the comparison is against the last published value
+    pub_filter_apply(&filter, "{\"Bat_V\":12.7,\"Solar_W\":0.11}", out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("{\"Bat_V\":12.7,\"Solar_W\":0.11}", out);
+}
+
+void pub_filter_value_rules(void)
+{
+    pub_filter_init(&filter, 1, 0, 0);
+    TEST_ASSERT_EQUAL(2, pub_filter_set_rules(&filter, "Bat_V=0.05, Bat_A=10%,Bat_V=1%"));
+    TEST_ASSERT_EQUAL_FLOAT(0.05, filter.rules[0].abs);
+    TEST_ASSERT_EQUAL_FLOAT(1, filter.rules[0].rel);
+    TEST_ASSERT_EQUAL_FLOAT(0, filter.rules[1].abs);
+    TEST_ASSERT_EQUAL_FLOAT(10, filter.rules[1].rel);
+
+    pub_filter_apply(&filter, "{\"Bat_V\":10,\"Bat_A\":10,\"Temp\":20}", out, sizeof(out));
+    pub_filter_apply(&filter, "{\"Bat_V\":10.2,\"Bat_A\":10.5,\"Temp\":20.5}", out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("{\"Bat_V\":10.2}", out);
+    pub_filter_apply(&filter, "{\"Bat_V\":10.2,\"Bat_A\":11.5,\"Temp\":21.5}", out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("{\"Bat_A\":11.5,\"Temp\":21.5}", out);
+
+    TEST_ASSERT_EQUAL(0, pub_filter_set_rules(&filter, ""));
+    TEST_ASSERT_EQUAL(-1, pub_filter_set_rules(&filter, "Bat_V"));
+    TEST_ASSERT_EQUAL(-1, pub_filter_set_rules(&filter, "Bat_V=abc"));
+    TEST_ASSERT_EQUAL(-1, pub_filter_set_rules(&filter, "Bat_V=0.1,=2"));
+    TEST_ASSERT_EQUAL(0, filter.num_rules);
+}
+
+void pub_filter_full_refresh(void)
+{
+    const char msg[] = "{\"Bat_V\":14.1}";
+    pub_filter_init(&filter, 0, 0, 3);
+    TEST_ASSERT_EQUAL(14, pub_filter_apply(&filter, msg, out, sizeof(out)));
+    TEST_ASSERT_EQUAL(0, pub_filter_apply(&filter, msg, out, sizeof(out)));
+    TEST_ASSERT_EQUAL(0, pub_filter_apply(&filter, msg, out, sizeof(out)));
+    TEST_ASSERT_EQUAL(14, pub_filter_apply(&filter, msg, out, sizeof(out)));
+    TEST_ASSERT_EQUAL(0, pub_filter_apply(&filter, msg, out, sizeof(out)));
+
+    pub_filter_refresh(&filter);
+    TEST_ASSERT_EQUAL(14, pub_filter_apply(&filter, msg, out, sizeof(out)));
+}
+
+void pub_filter_invalid_json(void)
+{
+    pub_filter_init(&filter, 0, 0, 0);
+    TEST_ASSERT_EQUAL(-1, pub_filter_apply(&filter, "[1,2]", out, sizeof(out)));
+    TEST_ASSERT_EQUAL(-1, pub_filter_apply(&filter, "{\"a\":1,}", out, sizeof(out)));
+    TEST_ASSERT_EQUAL(-1, pub_filter_apply(&filter, "{\"a\":\"x}", out, sizeof(out)));
+    TEST_ASSERT_EQUAL(-1, pub_filter_apply(&filter, "{\"a\":{\"b\":1}", out, sizeof(out)));
+    TEST_ASSERT_EQUAL(-1, pub_filter_apply(&filter, "{\"a\":1} x", out, sizeof(out)));
+    TEST_ASSERT_EQUAL(-1, pub_filter_apply(&filter, "{\"a\":1}", out, 7));
+    // no state is changed by invalid messages
+    TEST_ASSERT_EQUAL(0, filter.num_values);
+    TEST_ASSERT_EQUAL(0, pub_filter_apply(&filter, " {} ", out, sizeof(out)));
+}
+
+void pub_filter_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(pub_filter_first_message_complete);
+    RUN_TEST(pub_filter_only_changed_values);
+    RUN_TEST(pub_filter_deadbands);
+    RUN_TEST(pub_filter_value_rules);
+    RUN_TEST(pub_filter_full_refresh);
+    RUN_TEST(pub_filter_invalid_json);
+    UNITY_END();
+}
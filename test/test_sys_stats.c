@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tests.h"
+#include <sys_stats.h>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+static char buf[128];
+
+void sys_stats_stack_list_truncated(void)
+{
+    SysTaskSample tasks[] = {
+        { .name = "IDLE0", .id = 1, .stack_free = 612 },
+        { .name = "ts_worker", .id = 7, .stack_free = 1880 },
+        { .name = "mqtt_pub", .id = 9, .stack_free = 96 },
+    };
+
+    TEST_ASSERT_EQUAL(3, sys_stats_stack_list(tasks, 3, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING("IDLE0=612,ts_worker=1880,mqtt_pub=96", buf);
+
+    // entries which do not fit completely are omitted
+    TEST_ASSERT_EQUAL(2, sys_stats_stack_list(tasks, 3, buf, 30));
+    TEST_ASSERT_EQUAL_STRING("IDLE0=612,ts_worker=1880", buf);
+
+    TEST_ASSERT_EQUAL(0, sys_stats_stack_list(tasks, 3, buf, 5));
+    TEST_ASSERT_EQUAL_STRING("", buf);
+}
+
+void sys_stats_cpu_share(void)
+{
+    SysTaskSample prev[] = {
+        { .name = "IDLE0", .id = 1, .runtime = 1000 },
+        { .name = "IDLE1", .id = 2, .runtime = 2000 },
+        { .name = "httpd", .id = 5, .runtime = 500 },
+        { .name = "boot_wifi", .id = 6, .runtime = 100 },
+    };
+    SysTaskSample cur[] = {
+        { .name = "IDLE0", .id = 1, .runtime = 6000 },
+        { .name = "IDLE1", .id = 2, .runtime = 4000 },
+        { .name = "httpd", .id = 5, .runtime = 2500 },
+        // started after the previous sample
+        { .name = "ts_worker", .id = 8, .runtime = 1000 },
+    };
+
+    // 10000 in total, the deleted task boot_wifi is not considered
+    TEST_ASSERT_EQUAL(4, sys_stats_cpu_list(prev, 4, cur, 4, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING("IDLE0=50.0,IDLE1=20.0,httpd=20.0,ts_worker=10.0", buf);
+}
+
+void sys_stats_cpu_share_rounding_and_wrap(void)
+{
+    SysTaskSample prev[] = {
+        { .name = "IDLE0", .id = 1, .runtime = UINT32_MAX - 99 },
+        { .name = "can_rx", .id = 3, .runtime = 0 },
+    };
+    SysTaskSample cur[] = {
+        { .name = "IDLE0", .id = 1, .runtime = 200 },
+        { .name = "can_rx", .id = 3, .runtime = 1 },
+    };
+
+    // counter of IDLE0 wrapped around, 300 of 301 in total
+    TEST_ASSERT_EQUAL(2, sys_stats_cpu_list(prev, 2, cur, 2, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING("IDLE0=99.7,can_rx=0.3", buf);
+
+    // no run time passed, e.g. run-time stats not enabled
+    TEST_ASSERT_EQUAL(0, sys_stats_cpu_list(cur, 2, cur, 2, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING("", buf);
+}
+
+void sys_stats_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(sys_stats_stack_list_truncated);
+    RUN_TEST(sys_stats_cpu_share);
+    RUN_TEST(sys_stats_cpu_share_rounding_and_wrap);
+    UNITY_END();
+}
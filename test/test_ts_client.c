@@ -9,6 +9,7 @@
 #include <ts_cbor.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unity.h>
 
 
@@ -185,6 +186,230 @@ void ts_build_query_payload(void)
     free(query);
 }
 
+void parse_uri_with_query(void)
+{
+    const char *uri = "someID/output?Bat_V,Bat_A";
+    TSUriElems params;
+    params.ts_payload = "";
+    ts_parse_uri(uri, &params);
+    TEST_ASSERT_EQUAL_INT(1, params.ts_list_subnodes);
+    TEST_ASSERT_EQUAL_STRING("output", params.ts_target_node);
+    TEST_ASSERT_EQUAL_STRING("someID", params.ts_device_id);
+}
+
+void ts_build_fetch_payload_names(void)
+{
+    char *payload = ts_build_fetch_payload("someID/output?Bat_V,Bat_A,,Bat_W");
+    TEST_ASSERT_EQUAL_STRING("[\"Bat_V\",\"Bat_A\",\"Bat_W\"]", payload);
+    free(payload);
+}
+
+void ts_build_fetch_payload_url_encoded(void)
+{
+    // encoded separators are part of the name, invalid sequences are kept
+    char *payload = ts_build_fetch_payload("someID/output?Bat%5FV,a%2cb,c%2,d%zz%");
+    TEST_ASSERT_EQUAL_STRING("[\"Bat_V\",\"a,b\",\"c%2\",\"d%zz%\"]", payload);
+    free(payload);
+}
+
+void ts_build_fetch_payload_escaped(void)
+{
+    char *payload = ts_build_fetch_payload("someID/output?a\"],\"b,c\\,%22%5C%0A");
+    TEST_ASSERT_EQUAL_STRING("[\"a\\\"]\",\"\\\"b\",\"c\\\\\",\"\\\"\\\\\\u000a\"]", payload);
+    free(payload);
+}
+
+void ts_build_fetch_payload_empty(void)
+{
+    TEST_ASSERT_EQUAL_STRING(NULL, ts_build_fetch_payload("someID/output"));
+    TEST_ASSERT_EQUAL_STRING(NULL, ts_build_fetch_payload("someID/output?"));
+    TEST_ASSERT_EQUAL_STRING(NULL, ts_build_fetch_payload("someID/output?,"));
+}
+
+void ts_build_query_fetch(void)
+{
+    TSUriElems params;
+    char *query;
+    uint32_t length;
+    params.ts_payload = "[\"Bat_V\",\"Bat_A\"]";
+    params.ts_target_node = "output";
+    params.ts_list_subnodes = 1;
+    query = ts_build_query_serial(TS_FETCH, &params, &length);
+    TEST_ASSERT_EQUAL_STRING("?output [\"Bat_V\",\"Bat_A\"]\n", query);
+    free(query);
+}
+
+void ts_build_query_fetch_no_names(void)
+{
+    TSUriElems params;
+    char *query;
+    uint32_t length;
+    params.ts_payload = NULL;
+    params.ts_target_node = "output";
+    params.ts_list_subnodes = 1;
+    query = ts_build_query_serial(TS_FETCH, &params, &length);
+    TEST_ASSERT_EQUAL_STRING("", query);
+    free(query);
+}
+
+void ts_build_query_header_patch(void)
+{
+    TSUriElems params;
+    char buf[20];
+    params.ts_payload = NULL;
+    params.ts_target_node = "conf";
+    params.ts_list_subnodes = 1;
+    int len = ts_build_query_header(buf, sizeof(buf), TS_PATCH, &params, true);
+    TEST_ASSERT_EQUAL_STRING("=conf ", buf);
+    TEST_ASSERT_EQUAL(6, len);
+}
+
+void ts_build_query_header_root(void)
+{
+    TSUriElems params;
+    char buf[20];
+    params.ts_payload = NULL;
+    params.ts_target_node = "";
+    params.ts_list_subnodes = 0;
+    int len = ts_build_query_header(buf, sizeof(buf), TS_GET, &params, false);
+    TEST_ASSERT_EQUAL_STRING("?/", buf);
+    TEST_ASSERT_EQUAL(2, len);
+}
+
+void ts_build_query_header_exec(void)
+{
+    TSUriElems params;
+    char buf[20];
+    params.ts_payload = NULL;
+    params.ts_target_node = "exec/reset";
+    params.ts_list_subnodes = 1;
+    ts_build_query_header(buf, sizeof(buf), TS_POST, &params, true);
+    TEST_ASSERT_EQUAL_STRING("!exec/reset ", buf);
+}
+
+void ts_build_query_header_too_small(void)
+{
+    TSUriElems params;
+    char buf[6];
+    params.ts_payload = NULL;
+    params.ts_target_node = "conf";
+    params.ts_list_subnodes = 1;
+    TEST_ASSERT_EQUAL(0, ts_build_query_header(buf, sizeof(buf), TS_PATCH, &params, true));
+    TEST_ASSERT_EQUAL(0, ts_build_query_header(buf, sizeof(buf), 0, &params, false));
+    TEST_ASSERT_EQUAL(0, ts_build_query_header(buf, sizeof(buf), TS_GET, NULL, false));
+}
+
+void ts_parse_mqtt_request_methods(void)
+{
+    const char topic[] = "ts/user/ABCD1234/rx/conf";
+    char *uri;
+    char *payload;
+
+    TEST_ASSERT_EQUAL(TS_PATCH, ts_parse_mqtt_request(topic, strlen(topic), "ts/user/",
+        "{\"Load_On\":true}", 16, &uri, &payload));
+    TEST_ASSERT_EQUAL_STRING("ABCD1234/conf", uri);
+    TEST_ASSERT_EQUAL_STRING("{\"Load_On\":true}", payload);
+    free(uri);
+    free(payload);
+
+    TEST_ASSERT_EQUAL(TS_GET, ts_parse_mqtt_request(topic, strlen(topic), "ts/user/", "", 0,
+        &uri, &payload));
+    TEST_ASSERT_EQUAL_STRING(NULL, payload);
+    free(uri);
+
+    TEST_ASSERT_EQUAL(TS_FETCH, ts_parse_mqtt_request(topic, strlen(topic), "ts/user/",
+        "? [\"Bat_V\"]", 11, &uri, &payload));
+    TEST_ASSERT_EQUAL_STRING("[\"Bat_V\"]", payload);
+    free(uri);
+    free(payload);
+
+    TEST_ASSERT_EQUAL(TS_POST, ts_parse_mqtt_request(topic, strlen(topic), "ts/user/", "!", 1,
+        &uri, &payload));
+    TEST_ASSERT_EQUAL_STRING(NULL, payload);
+    free(uri);
+
+    // topic is not zero-terminated in MQTT events
+    TEST_ASSERT_EQUAL(TS_GET, ts_parse_mqtt_request("ts/user/ABCD1234/rx/xyz", 19, "ts/user/",
+        NULL, 0, &uri, &payload));
+    TEST_ASSERT_EQUAL_STRING("ABCD1234/", uri);
+    free(uri);
+}
+
+void ts_parse_mqtt_request_invalid(void)
+{
+    char *uri;
+    char *payload;
+    const char *topics[] = { "ts/other/ABCD1234/rx/conf", "ts/user/ABCD1234/tx/conf",
+        "ts/user/ABCD1234/rxconf", "ts/user//rx/conf", "ts/user/ABCD1234" };
+    for (int i = 0; i < sizeof(topics) / sizeof(topics[0]); i++) {
+        TEST_ASSERT_EQUAL(0, ts_parse_mqtt_request(topics[i], strlen(topics[i]), "ts/user/",
+            "", 0, &uri, &payload));
+        TEST_ASSERT_EQUAL_STRING(NULL, uri);
+    }
+}
+
+static int stream_status;
+static char stream_data[128];
+static int stream_parts;
+
+static int stream_start(void *ctx, uint8_t ts_status)
+{
+    stream_status = ts_status;
+    return 0;
+}
+
+static int stream_collect(void *ctx, const char *buf, size_t len)
+{
+    strncat(stream_data, buf, len);
+    stream_parts++;
+    return 0;
+}
+
+static void stream_reset(TSResponseStream *resp)
+{
+    stream_status = -1;
+    stream_data[0] = '\0';
+    stream_parts = 0;
+    ts_resp_stream_init(resp, stream_start, stream_collect, NULL);
+}
+
+void ts_resp_stream_content(void)
+{
+    TSResponseStream resp;
+    stream_reset(&resp);
+    TEST_ASSERT_EQUAL(0, ts_resp_stream_feed(&resp, ":85 Cont", 8));
+    TEST_ASSERT_EQUAL(-1, stream_status);
+    // status section ends in the middle of the second part
+    TEST_ASSERT_EQUAL(0, ts_resp_stream_feed(&resp, "ent. {\"Bat_V\"", 13));
+    TEST_ASSERT_EQUAL(TS_STATUS_CONTENT, stream_status);
+    TEST_ASSERT_EQUAL(0, ts_resp_stream_feed(&resp, ":14.2}", 6));
+    TEST_ASSERT_EQUAL(0, ts_resp_stream_finish(&resp));
+    TEST_ASSERT_EQUAL_STRING("{\"Bat_V\":14.2}", stream_data);
+    TEST_ASSERT_EQUAL(2, stream_parts);
+}
+
+void ts_resp_stream_no_payload(void)
+{
+    TSResponseStream resp;
+    stream_reset(&resp);
+    TEST_ASSERT_EQUAL(0, ts_resp_stream_feed(&resp, ":84 Changed.", 12));
+    TEST_ASSERT_EQUAL(-1, stream_status);
+    TEST_ASSERT_EQUAL(0, ts_resp_stream_finish(&resp));
+    TEST_ASSERT_EQUAL(TS_STATUS_CHANGED, stream_status);
+    TEST_ASSERT_EQUAL(0, stream_parts);
+}
+
+void ts_resp_stream_invalid(void)
+{
+    TSResponseStream resp;
+    stream_reset(&resp);
+    // header exceeding the maximum length is truncated, status can't be parsed
+    TEST_ASSERT_EQUAL(0, ts_resp_stream_feed(&resp, "garbage without status section", 30));
+    TEST_ASSERT_EQUAL(0, ts_resp_stream_finish(&resp));
+    TEST_ASSERT_EQUAL(0xFF, stream_status);
+    TEST_ASSERT_EQUAL(0, stream_parts);
+}
+
 void ts_build_bin_query_post(void)
 {
     TSUriElems params;
@@ -253,6 +478,126 @@ void ts_build_bin_query_with_object(void)
     free(query);
 }
 
+void ts_build_bin_query_fetch(void)
+{
+    TSUriElems params;
+    uint8_t *query;
+    uint32_t length;
+    params.ts_payload = "[\"Bat_V\", \"Bat_A\"]";
+    params.ts_target_node = "output";
+    params.ts_list_subnodes = 1;
+    query = ts_build_query_bin(TS_FETCH, &params, &length);
+
+    uint8_t expected[] = {TS_FETCH,
+                          0x66, 0x6F, 0x75, 0x74, 0x70, 0x75, 0x74,
+                          0x82, 0x65, 0x42, 0x61, 0x74, 0x5F, 0x56,
+                          0x65, 0x42, 0x61, 0x74, 0x5F, 0x41};
+    TEST_ASSERT_EQUAL(sizeof(expected), length);
+    for (int i = 0; i < sizeof(expected); i++) {
+        TEST_ASSERT_EQUAL(expected[i], query[i]);
+    }
+
+    free(query);
+}
+
+/* values of the output path of json-server/test-device.json as published by the device */
+static const char pubmsg_output[] = "{\"LoadInfo\":1,\"UsbInfo\":1,\"SOC_%\":0.17,\"Bat_V\":12.78,"
+    "\"Solar_V\":31.4,\"Bat_A\":2.52,\"Load_A\":1.39,\"Bat_degC\":22.3,\"BatTempExt\":false,"
+    "\"Int_degC\":28.1,\"Mosfet_degC\":42.1,\"ChgState\":2,\"DCDCState\":1,\"Solar_A\":0.58,"
+    "\"BatTarget_V\":14.4,\"BatTarget_A\":2.0,\"Bat_W\":53,\"Solar_W\":94,\"Load_W\":15,"
+    "\"NumBatteries\":1,\"ErrorFlags\":0}";
+
+void ts_pubmsg_cbor_size(void)
+{
+    uint8_t buf[400];
+    TSIdMap ids;
+    ts_id_map_init(&ids);
+
+    size_t json_len = strlen(pubmsg_output);
+    size_t cbor_len = ts_pubmsg_json2cbor(pubmsg_output, buf, sizeof(buf), NULL);
+    size_t cbor_ids_len = ts_pubmsg_json2cbor(pubmsg_output, buf, sizeof(buf), &ids);
+    printf("Publication message size: JSON %u bytes, CBOR %u bytes, CBOR with IDs %u bytes\n",
+        (unsigned int) json_len, (unsigned int) cbor_len, (unsigned int) cbor_ids_len);
+
+    TEST_ASSERT_EQUAL(312, json_len);
+    TEST_ASSERT_EQUAL(251, cbor_len);
+    TEST_ASSERT_EQUAL(85, cbor_ids_len);
+    TEST_ASSERT_EQUAL(21, ids.num);
+
+    // IDs stay the same for further messages
+    ids.changed = false;
+    TEST_ASSERT_EQUAL(85, ts_pubmsg_json2cbor(pubmsg_output, buf, sizeof(buf), &ids));
+    TEST_ASSERT_EQUAL(false, ids.changed);
+}
+
+void ts_pubmsg_cbor_encoding(void)
+{
+    uint8_t buf[32];
+    TSIdMap ids;
+    ts_id_map_init(&ids);
+    TEST_ASSERT_EQUAL(0, ts_id_map_add(&ids, 0x70, "Bat_V"));
+
+    const char json[] = "{\"Bat_V\":12.5,\"Err\":-3,\"Load\":{\"On\":true}}";
+    uint8_t expected[] = {
+        0xA3,
+        0x18, 0x70, 0xFA, 0x41, 0x48, 0x00, 0x00,   // 0x70: 12.5
+        0x01, 0x22,                                 // 1: -3
+        0x02, 0xA1, 0x62, 0x4F, 0x6E, 0xF5          // 2: {"On":true}
+    };
+    TEST_ASSERT_EQUAL(sizeof(expected), ts_pubmsg_json2cbor(json, buf, sizeof(buf), &ids));
+    for (int i = 0; i < sizeof(expected); i++) {
+        TEST_ASSERT_EQUAL(expected[i], buf[i]);
+    }
+
+    char map_json[64];
+    ts_id_map_json(&ids, map_json, sizeof(map_json));
+    TEST_ASSERT_EQUAL_STRING("{\"112\":\"Bat_V\",\"1\":\"Err\",\"2\":\"Load\"}", map_json);
+    TEST_ASSERT_EQUAL(0, ts_id_map_json(&ids, map_json, 20));
+
+    TEST_ASSERT_EQUAL(0, ts_pubmsg_json2cbor(json, buf, 10, &ids));
+    TEST_ASSERT_EQUAL(0, ts_pubmsg_json2cbor("[1,2]", buf, sizeof(buf), NULL));
+
+    // numbers out of the range of integers are encoded as float
+    uint8_t expected_big[] = { 0xA1, 0x61, 0x42, 0xFA, 0x5F, 0x0A, 0xC7, 0x23 };
+    TEST_ASSERT_EQUAL(sizeof(expected_big), ts_pubmsg_json2cbor("{\"B\":1e19}", buf,
+        sizeof(buf), NULL));
+    for (int i = 0; i < sizeof(expected_big); i++) {
+        TEST_ASSERT_EQUAL(expected_big[i], buf[i]);
+    }
+}
+
+void ts_id_map_json_escaped(void)
+{
+    char map_json[64];
+    TSIdMap ids;
+    ts_id_map_init(&ids);
+    TEST_ASSERT_EQUAL(0, ts_id_map_add(&ids, 1, "a\"b"));
+    TEST_ASSERT_EQUAL(0, ts_id_map_add(&ids, 2, "c\\d"));
+    TEST_ASSERT_EQUAL(0, ts_id_map_add(&ids, 3, "e\nf"));
+
+    ts_id_map_json(&ids, map_json, sizeof(map_json));
+    TEST_ASSERT_EQUAL_STRING("{\"1\":\"a\\\"b\",\"2\":\"c\\\\d\",\"3\":\"e\\u000af\"}", map_json);
+    TEST_ASSERT_EQUAL(0, ts_id_map_json(&ids, map_json, 30));
+}
+
+void ts_id_map_full(void)
+{
+    TSIdMap ids;
+    char name[8];
+    ts_id_map_init(&ids);
+    TEST_ASSERT_EQUAL(0, ts_id_map_add(&ids, 1, "Bat_V"));
+    TEST_ASSERT_EQUAL(0, ts_id_map_add(&ids, 1, "Bat_V"));
+    TEST_ASSERT_EQUAL(-1, ts_id_map_add(&ids, 1, "Bat_A"));
+    TEST_ASSERT_EQUAL(2, ts_id_map_lookup(&ids, "Bat_A"));
+
+    for (int i = ids.num; i < TS_ID_MAP_SIZE; i++) {
+        snprintf(name, sizeof(name), "v%d", i);
+        TEST_ASSERT_EQUAL(i + 1, ts_id_map_lookup(&ids, name));
+    }
+    TEST_ASSERT_EQUAL(-1, ts_id_map_lookup(&ids, "Load_A"));
+    TEST_ASSERT_EQUAL(1, ts_id_map_lookup(&ids, "Bat_V"));
+}
+
 void ts_get_json_from_valid_cbor(void)
 {
     uint8_t node[] = {0x66, 0x63, 0x6F, 0x6E, 0x66, 0x69, 0x67};
@@ -272,6 +617,7 @@ void ts_client_tests()
     RUN_TEST(parse_uri_empty);
     RUN_TEST(parse_uri_null);
     RUN_TEST(parse_uri_with_payload);
+    RUN_TEST(parse_uri_with_query);
 
     RUN_TEST(ts_build_query_get);
     RUN_TEST(ts_build_query_get_subnodes);
@@ -281,9 +627,29 @@ void ts_client_tests()
     RUN_TEST(ts_build_query_null);
     RUN_TEST(ts_build_query_payload);
     RUN_TEST(ts_build_query_false_method);
+    RUN_TEST(ts_build_fetch_payload_names);
+    RUN_TEST(ts_build_fetch_payload_url_encoded);
+    RUN_TEST(ts_build_fetch_payload_escaped);
+    RUN_TEST(ts_build_fetch_payload_empty);
+    RUN_TEST(ts_build_query_fetch);
+    RUN_TEST(ts_build_query_fetch_no_names);
+    RUN_TEST(ts_build_query_header_patch);
+    RUN_TEST(ts_build_query_header_root);
+    RUN_TEST(ts_build_query_header_exec);
+    RUN_TEST(ts_build_query_header_too_small);
+    RUN_TEST(ts_parse_mqtt_request_methods);
+    RUN_TEST(ts_parse_mqtt_request_invalid);
+    RUN_TEST(ts_resp_stream_content);
+    RUN_TEST(ts_resp_stream_no_payload);
+    RUN_TEST(ts_resp_stream_invalid);
 
     RUN_TEST(ts_build_bin_query_post);
     RUN_TEST(ts_build_bin_query_with_object);
+    RUN_TEST(ts_build_bin_query_fetch);
     RUN_TEST(ts_get_json_from_valid_cbor);
+    RUN_TEST(ts_pubmsg_cbor_size);
+    RUN_TEST(ts_pubmsg_cbor_encoding);
+    RUN_TEST(ts_id_map_json_escaped);
+    RUN_TEST(ts_id_map_full);
     UNITY_END();
 }
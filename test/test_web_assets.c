@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tests.h"
+#include <web_assets.h>
+#include <unity.h>
+
+void web_assets_hashed_names(void)
+{
+    TEST_ASSERT_TRUE(web_assets_is_hashed_name("/www/js/chunk-vendors.3f9a0b.js.gz"));
+    TEST_ASSERT_TRUE(web_assets_is_hashed_name("app.ABCDEF.css"));
+
+    // hash must be a complete segment with the configured length
+    TEST_ASSERT_FALSE(web_assets_is_hashed_name("/www/index.html.gz"));
+    TEST_ASSERT_FALSE(web_assets_is_hashed_name("/www/js/app.3f9a0b1c.js.gz"));
+    TEST_ASSERT_FALSE(web_assets_is_hashed_name("/www/js/app.3f9a0g.js"));
+    TEST_ASSERT_FALSE(web_assets_is_hashed_name("/www/3f9a0b.js"));
+
+    // only the file name is checked
+    TEST_ASSERT_FALSE(web_assets_is_hashed_name("/www.3f9a0b.x/app.js"));
+}
+
+void web_assets_etag_list(void)
+{
+    const char *etag = "\"1a2b3c4d-1f0\"";
+
+    TEST_ASSERT_TRUE(web_assets_etag_match("\"1a2b3c4d-1f0\"", etag));
+    TEST_ASSERT_FALSE(web_assets_etag_match("\"1a2b3c4d-1f1\"", etag));
+    TEST_ASSERT_FALSE(web_assets_etag_match("", etag));
+
+    // lists with optional whitespace
+    TEST_ASSERT_TRUE(web_assets_etag_match("\"abc\", \"1a2b3c4d-1f0\"", etag));
+    TEST_ASSERT_TRUE(web_assets_etag_match("\"abc\",\"1a2b3c4d-1f0\",\"def\"", etag));
+    TEST_ASSERT_FALSE(web_assets_etag_match("\"abc\", \"1a2b3c4d-1f0x\"", etag));
+
+    // weak comparison and wildcard
+    TEST_ASSERT_TRUE(web_assets_etag_match("W/\"1a2b3c4d-1f0\"", etag));
+    TEST_ASSERT_TRUE(web_assets_etag_match("\"abc\", W/\"1a2b3c4d-1f0\"", etag));
+    TEST_ASSERT_TRUE(web_assets_etag_match("*", etag));
+
+    // malformed values don't match
+    TEST_ASSERT_FALSE(web_assets_etag_match("1a2b3c4d-1f0", etag));
+    TEST_ASSERT_FALSE(web_assets_etag_match("\"1a2b3c4d-1f0", etag));
+    TEST_ASSERT_FALSE(web_assets_etag_match("W/", etag));
+}
+
+void web_assets_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(web_assets_hashed_names);
+    RUN_TEST(web_assets_etag_list);
+    UNITY_END();
+}
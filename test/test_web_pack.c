@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tests.h"
+#include <web_pack.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+static const char index_html[] = "<html>test</html>";
+static const char app_js[] = "console.log(1);";
+
+static uint8_t image[512];
+
+/* packs two files in the same way as tools/pack_webapp.py */
+static size_t pack_test_image(void)
+{
+    const char *paths[] = { "/index.html.gz", "/app.1a2b3c4d.js.gz" };
+    const char *types[] = { "text/html", "application/javascript" };
+    const char *contents[] = { index_html, app_js };
+    const int num_files = 2;
+
+    memset(image, 0, sizeof(image));
+    WebPackHeader *hdr = (WebPackHeader *) image;
+    WebPackEntry *entries = (WebPackEntry *) (image + sizeof(WebPackHeader));
+
+    uint32_t offset = sizeof(WebPackHeader) + num_files * sizeof(WebPackEntry);
+    for (int i = 0; i < num_files; i++) {
+        offset = (offset + 3) & ~3U;
+        strcpy(entries[i].path, paths[i]);
+        strcpy(entries[i].content_type, types[i]);
+        entries[i].offset = offset;
+        entries[i].length = strlen(contents[i]);
+        entries[i].hash = web_pack_hash(WEB_PACK_HASH_INIT, (const uint8_t *) contents[i],
+            entries[i].length);
+        memcpy(image + offset, contents[i], entries[i].length);
+        offset += entries[i].length;
+    }
+
+    hdr->magic = WEB_PACK_MAGIC;
+    hdr->version = WEB_PACK_VERSION;
+    hdr->num_files = num_files;
+    hdr->image_size = offset;
+    hdr->index_hash = web_pack_hash(WEB_PACK_HASH_INIT, (const uint8_t *) entries,
+        num_files * sizeof(WebPackEntry));
+    return offset;
+}
+
+static void update_index_hash(void)
+{
+    WebPackHeader *hdr = (WebPackHeader *) image;
+    hdr->index_hash = web_pack_hash(WEB_PACK_HASH_INIT, image + sizeof(WebPackHeader),
+        hdr->num_files * sizeof(WebPackEntry));
+}
+
+void web_pack_format_size(void)
+{
+    // sizes are part of the image format and must match tools/pack_webapp.py
+    TEST_ASSERT_EQUAL(16, sizeof(WebPackHeader));
+    TEST_ASSERT_EQUAL(112, sizeof(WebPackEntry));
+}
+
+void web_pack_hash_reference(void)
+{
+    // reference values of 32-bit FNV-1a
+    TEST_ASSERT_EQUAL_UINT32(0x811C9DC5, web_pack_hash(WEB_PACK_HASH_INIT, NULL, 0));
+    TEST_ASSERT_EQUAL_UINT32(0xE40C292C, web_pack_hash(WEB_PACK_HASH_INIT,
+        (const uint8_t *) "a", 1));
+    TEST_ASSERT_EQUAL_UINT32(0xBF9CF968, web_pack_hash(WEB_PACK_HASH_INIT,
+        (const uint8_t *) "foobar", 6));
+}
+
+void web_pack_read_valid(void)
+{
+    size_t size = pack_test_image();
+    TEST_ASSERT_EQUAL(2, web_pack_validate(image, sizeof(image)));
+    TEST_ASSERT_EQUAL(2, web_pack_validate(image, size));
+
+    const WebPackEntry *entry = web_pack_find(image, "/app.1a2b3c4d.js.gz");
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL_STRING("application/javascript", entry->content_type);
+    TEST_ASSERT_EQUAL(strlen(app_js), entry->length);
+    TEST_ASSERT_EQUAL(0, entry->offset % 4);
+    TEST_ASSERT_EQUAL_MEMORY(app_js, image + entry->offset, entry->length);
+
+    entry = web_pack_find(image, "/index.html.gz");
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL_MEMORY(index_html, image + entry->offset, entry->length);
+    TEST_ASSERT_EQUAL_UINT32(web_pack_hash(WEB_PACK_HASH_INIT, image + entry->offset,
+        entry->length), entry->hash);
+
+    TEST_ASSERT_NULL(web_pack_find(image, "/missing.js"));
+    TEST_ASSERT_NULL(web_pack_entry(image, 2));
+}
+
+void web_pack_reject_invalid_header(void)
+{
+    size_t size = pack_test_image();
+    TEST_ASSERT_EQUAL(-1, web_pack_validate(image, size - 1));
+    TEST_ASSERT_EQUAL(-1, web_pack_validate(NULL, size));
+
+    // erased flash
+    memset(image, 0xFF, sizeof(image));
+    TEST_ASSERT_EQUAL(-1, web_pack_validate(image, sizeof(image)));
+
+    pack_test_image();
+    ((WebPackHeader *) image)->version = WEB_PACK_VERSION + 1;
+    TEST_ASSERT_EQUAL(-1, web_pack_validate(image, sizeof(image)));
+}
+
+void web_pack_reject_corrupt_index(void)
+{
+    pack_test_image();
+    WebPackEntry *entries = (WebPackEntry *) (image + sizeof(WebPackHeader));
+
+    // modified index without updated hash
+    entries[1].length++;
+    TEST_ASSERT_EQUAL(-1, web_pack_validate(image, sizeof(image)));
+
+    // file data beyond image size
+    update_index_hash();
+    entries[1].length += 100;
+    update_index_hash();
+    TEST_ASSERT_EQUAL(-1, web_pack_validate(image, sizeof(image)));
+
+    // file data overlapping index
+    pack_test_image();
+    entries[0].offset = 0;
+    update_index_hash();
+    TEST_ASSERT_EQUAL(-1, web_pack_validate(image, sizeof(image)));
+
+    // path not terminated
+    pack_test_image();
+    memset(entries[0].path, '/', sizeof(entries[0].path));
+    update_index_hash();
+    TEST_ASSERT_EQUAL(-1, web_pack_validate(image, sizeof(image)));
+}
+
+void web_pack_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(web_pack_format_size);
+    RUN_TEST(web_pack_hash_reference);
+    RUN_TEST(web_pack_read_valid);
+    RUN_TEST(web_pack_reject_invalid_header);
+    RUN_TEST(web_pack_reject_corrupt_index);
+    UNITY_END();
+}
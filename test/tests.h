@@ -8,6 +8,32 @@
 
 void ts_client_tests();
 
+void web_pack_tests();
+
+void web_assets_tests();
+
+void metrics_tests();
+
+void http_stats_tests();
+
+void pub_filter_tests();
+
+void flash_log_tests();
+
+void pub_batch_tests();
+
+void http_client_tests();
+
+void emon_bulk_tests();
+
+void history_tests();
+
+void hist_codec_tests();
+
+void config_store_tests();
+
+void sys_stats_tests();
+
 // activate this via build_flags in platformio.ini or custom.ini
 #ifdef CUSTOM_TESTS
 void custom_tests();
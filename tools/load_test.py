@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) The Libre Solar Project Contributors
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""
+Concurrent load test for the HTTP server of the gateway
+
+Requests static files of the webapp and ThingSet data in parallel and prints latency
+statistics per request type. Static files should not be slowed down by ThingSet requests
+waiting for the bus.
+
+Example:
+    tools/load_test.py 192.168.1.10 --device abcd1234 --concurrency 4 --requests 50
+
+To measure the effect of a change, run the same command against the same device and
+connected devices once with the previous and once with the new firmware, and compare the
+percentiles per request type.
+"""
+
+import argparse
+import statistics
+import threading
+import time
+import urllib.error
+import urllib.request
+from concurrent.futures import ThreadPoolExecutor
+
+
+def fetch(url, timeout):
+    start = time.monotonic()
+    try:
+        with urllib.request.urlopen(url, timeout=timeout) as resp:
+            size = len(resp.read())
+            status = resp.status
+    except urllib.error.HTTPError as err:
+        size = 0
+        status = err.code
+    except OSError:
+        size = 0
+        status = None
+    return time.monotonic() - start, status, size
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(round(p / 100 * (len(values) - 1))))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('host', help='IP address or host name of the gateway')
+    parser.add_argument('--device', help='ThingSet device ID (default: first device found)')
+    parser.add_argument('--path', default='meas', help='ThingSet path to request')
+    parser.add_argument('--concurrency', type=int, default=4, help='parallel clients per type')
+    parser.add_argument('--requests', type=int, default=40, help='requests per client')
+    parser.add_argument('--timeout', type=float, default=10.0)
+    args = parser.parse_args()
+
+    base = f'http://{args.host}'
+    device = args.device
+    if device is None:
+        import json
+        with urllib.request.urlopen(base + '/ts/', timeout=args.timeout) as resp:
+            devices = json.loads(resp.read())
+        device = next(v for k, v in devices.items() if k != 'self')
+
+    urls = {
+        'static': base + '/',
+        'thingset': f'{base}/ts/{device}/{args.path}',
+    }
+
+    results = {name: [] for name in urls}
+    lock = threading.Lock()
+
+    def client(name):
+        for _ in range(args.requests):
+            result = fetch(urls[name], args.timeout)
+            with lock:
+                results[name].append(result)
+
+    start = time.monotonic()
+    with ThreadPoolExecutor(max_workers=args.concurrency * len(urls)) as pool:
+        for name in urls:
+            for _ in range(args.concurrency):
+                pool.submit(client, name)
+    duration = time.monotonic() - start
+
+    print(f'{"type":10} {"ok":>5} {"err":>5} {"p50 ms":>8} {"p95 ms":>8} {"max ms":>8} {"kB":>8}')
+    for name, samples in results.items():
+        ok = [s for s in samples if s[1] is not None and s[1] < 400]
+        latencies = [s[0] * 1000 for s in ok] or [0]
+        print(f'{name:10} {len(ok):5} {len(samples) - len(ok):5} '
+              f'{statistics.median(latencies):8.0f} {percentile(latencies, 95):8.0f} '
+              f'{max(latencies):8.0f} {sum(s[2] for s in ok) / 1024:8.1f}')
+    total = sum(len(samples) for samples in results.values())
+    print(f'{total} requests in {duration:.1f} s ({total / duration:.1f} req/s)')
+
+
+if __name__ == '__main__':
+    main()
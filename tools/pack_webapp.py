@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) The Libre Solar Project Contributors
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""
+Pack the files of the webapp into a read-only image for the website partition
+
+The format is described in main/web_pack.h. After writing, the image is read back and
+checked against the source files.
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+MAGIC = 0x4B504157      # "WAPK"
+VERSION = 1
+
+HEADER = struct.Struct('<IHHII')
+ENTRY = struct.Struct('<64s32sIIII')
+
+PATH_LEN = 64
+TYPE_LEN = 32
+
+CONTENT_TYPES = {
+    '.html': 'text/html',
+    '.js': 'application/javascript',
+    '.css': 'text/css',
+    '.png': 'image/png',
+    '.ico': 'image/x-icon',
+    '.svg': 'text/xml',
+    '.json': 'application/json',
+}
+
+
+def fnv1a(data, hash=2166136261):
+    for byte in data:
+        hash ^= byte
+        hash = (hash * 16777619) & 0xFFFFFFFF
+    return hash
+
+
+def content_type(path):
+    # type of compressed files is determined by the original extension
+    if path.endswith('.gz'):
+        path = path[:-3]
+    return CONTENT_TYPES.get(os.path.splitext(path)[1].lower(), 'text/plain')
+
+
+def collect_files(src_dir):
+    files = []
+    for root, _, names in os.walk(src_dir):
+        for name in sorted(names):
+            full_path = os.path.join(root, name)
+            path = '/' + os.path.relpath(full_path, src_dir).replace(os.sep, '/')
+            if len(path.encode()) >= PATH_LEN:
+                raise ValueError(f'path too long: {path}')
+            with open(full_path, 'rb') as f:
+                files.append((path, f.read()))
+    return sorted(files)
+
+
+def pack(files):
+    offset = HEADER.size + len(files) * ENTRY.size
+    index = b''
+    data = b''
+    for path, content in files:
+        padding = -offset % 4
+        data += b'\0' * padding
+        offset += padding
+        index += ENTRY.pack(path.encode(), content_type(path).encode(), offset, len(content),
+                            fnv1a(content), 0)
+        data += content
+        offset += len(content)
+
+    header = HEADER.pack(MAGIC, VERSION, len(files), offset, fnv1a(index))
+    return header + index + data
+
+
+def unpack(image):
+    magic, version, num_files, image_size, index_hash = HEADER.unpack_from(image, 0)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('invalid header')
+    if image_size > len(image):
+        raise ValueError('image truncated')
+
+    index_end = HEADER.size + num_files * ENTRY.size
+    if fnv1a(image[HEADER.size:index_end]) != index_hash:
+        raise ValueError('index hash mismatch')
+
+    files = []
+    for i in range(num_files):
+        path, ctype, offset, length, hash, _ = ENTRY.unpack_from(image, HEADER.size + i * ENTRY.size)
+        if offset < index_end or offset + length > image_size:
+            raise ValueError('file data out of bounds')
+        content = image[offset:offset + length]
+        if fnv1a(content) != hash:
+            raise ValueError('file hash mismatch')
+        files.append((path.rstrip(b'\0').decode(), content))
+    return files
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('src_dir', help='directory with the built webapp (webapp/dist)')
+    parser.add_argument('image', help='output image file')
+    parser.add_argument('--max-size', type=lambda x: int(x, 0), help='size of the partition')
+    args = parser.parse_args()
+
+    files = collect_files(args.src_dir)
+    image = pack(files)
+    if args.max_size is not None and len(image) > args.max_size:
+        sys.exit(f'Image size {len(image)} exceeds partition size {args.max_size}')
+
+    if unpack(image) != files:
+        sys.exit('Verification of packed image failed')
+
+    with open(args.image, 'wb') as f:
+        f.write(image)
+
+    print(f'Packed {len(files)} files into {args.image} ({len(image)} bytes)')
+
+
+if __name__ == '__main__':
+    main()
@@ -57,10 +57,29 @@ export default new Vuex.Store({
     },
     updateChartData(state, newData) {
       state.chartDataKeys.forEach(key => {
+        // pub messages may contain only a subset of the keys, so keep the last known value
+        let last = state.chartData[key][state.chartData[key].length - 1]
         state.chartData[key].shift()
-        state.chartData[key].push(newData[key])
+        state.chartData[key].push(key in newData ? newData[key] : last)
       });
     },
+    fillChartData(state, { key, now, points }) {
+      // points are [time, value] pairs recorded by the gateway, one chart point per second
+      let data = Array(state.chartData[key].length)
+      points.forEach(([time, value]) => {
+        let i = data.length - 1 - (now - time)
+        if (i >= 0 && i < data.length) {
+          data[i] = value
+        }
+      })
+      // recorded values are held until the next one
+      for (let i = 1; i < data.length; i++) {
+        if (data[i] === undefined) {
+          data[i] = data[i - 1]
+        }
+      }
+      state.chartData[key] = data
+    },
     saveAuthStatus(state, status) {
       state.isAuthenticated = status;
     },
@@ -128,6 +147,21 @@ export default new Vuex.Store({
           console.log(error);
         })
     },
+    loadChartHistory({ commit }) {
+      const now = Math.floor(Date.now() / 1000)
+      // same number of points as in initChartData
+      const from = now - 180
+      return Promise.all(this.state.chartDataKeys.map(key =>
+        axios.get("hist/" + this.state.activeDeviceId + "/" + key + "?from=" + from + "&to=" + now)
+          .then(res => {
+            commit("fillChartData", { key: key, now: now, points: res.data.data });
+          })
+          .catch(error => {
+            // no history recorded, the chart starts empty
+            console.log(error);
+          })
+      ))
+    },
     updateChartData({ commit }) {
       return axios.get("ts/" + this.state.activeDeviceId + "/meas")
         .then(res => {
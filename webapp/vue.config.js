@@ -14,6 +14,10 @@ module.exports = {
         target: 'http://',
         changeOrigin: true,
         ws: true
+      },
+      '/events': {
+        target: 'http://',
+        changeOrigin: true
       }
     }
   },
@@ -24,16 +28,18 @@ module.exports = {
       .use('url-loader')
       .tap(options => Object.assign({}, options, { name: '[name].[ext]' }));
   },
+  // content hash in file names allows long-lived caching of the assets in the browser, it is
+  // kept short so that names like /js/chunk-vendors.<hash>.js.gz fit into SPIFFS (31 chars)
   css: {
     extract: {
-      filename: '[name].css',
-      chunkFilename: '[name].css',
+      filename: '[name].[contenthash:6].css',
+      chunkFilename: '[name].[contenthash:6].css',
     },
   },
   configureWebpack: {
     output: {
-      filename: '[name].js',
-      chunkFilename: '[name].js',
+      filename: '[name].[contenthash:6].js',
+      chunkFilename: '[name].[contenthash:6].js',
     },
     plugins: [new CompressionPlugin({
       filename: '[name][ext].gz',